@@ -0,0 +1,311 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "buff_pool.h"
+#include "file_reader.h"
+
+#include <assert.h>
+#include <string.h>
+
+using namespace TagLEET;
+
+#define BP_MAGIC 0x4C504254
+/* Class of the buffers that are not pooled */
+#define BP_DIRECT BP_CLASS_COUNT
+
+/* Header in front of every buffer, 16 bytes so the buffer keeps the
+ * alignment of the OS allocation. A free buffer is linked through its first
+ * bytes */
+struct BuffPool::BuffHdr
+{
+  uint32_t Magic;
+  uint16_t Class;
+  uint16_t Huge;
+  uint64_t RawSize;
+};
+
+#define BP_NEXT_FREE(Hdr) (*(BuffPool::BuffHdr **)((Hdr) + 1))
+
+/* Free buffers of one thread. They go to the shared lists when the thread
+ * exits */
+struct BuffPool::LocalCache
+{
+  LocalCache();
+  ~LocalCache();
+
+  BuffHdr *Head[BP_CLASS_COUNT];
+  uint32_t Count[BP_CLASS_COUNT];
+};
+
+static inline uint32_t class_size(uint32_t Class)
+{
+  return (uint32_t)1 << (Class + BP_MIN_CLASS_SHIFT);
+}
+
+static inline uint32_t size_to_class(uint32_t Size)
+{
+  uint32_t Class = 0;
+
+  while (Class < BP_CLASS_COUNT && class_size(Class) < Size)
+    Class++;
+  return Class;
+}
+
+BuffPool::LocalCache::LocalCache()
+{
+  ::memset(Head, 0, sizeof(Head));
+  ::memset(Count, 0, sizeof(Count));
+}
+
+BuffPool::LocalCache::~LocalCache()
+{
+  BuffPool *Pool = BuffPool::Global();
+  uint32_t Class;
+
+  for (Class = 0; Class < BP_CLASS_COUNT; Class++)
+  {
+    while (Head[Class] != NULL)
+    {
+      BuffHdr *Hdr = Head[Class];
+      Head[Class] = BP_NEXT_FREE(Hdr);
+      Pool->CachedBytes -= class_size(Class);
+      Pool->PutShared(Hdr);
+    }
+    Count[Class] = 0;
+  }
+}
+
+BuffPool::BuffPool():
+  Allocs(0),
+  Frees(0),
+  LocalHits(0),
+  SharedHits(0),
+  OsAllocs(0),
+  OsFrees(0),
+  HugeAllocs(0),
+  CachedBytes(0)
+{
+  ::memset(Shared, 0, sizeof(Shared));
+  ::memset(SharedCount, 0, sizeof(SharedCount));
+  SharedBytes = 0;
+  HugePages = false;
+}
+
+/* The pool is never destroyed, thread caches may be flushed into it at any
+ * time until the process exits */
+BuffPool *BuffPool::Global()
+{
+  static BuffPool *Pool = new BuffPool();
+  return Pool;
+}
+
+BuffPool::LocalCache *BuffPool::GetLocal()
+{
+  static thread_local LocalCache Local;
+  return &Local;
+}
+
+void *BuffPool::OsAlloc(uint32_t Class, uint32_t Size)
+{
+  BuffHdr *Hdr;
+  bool Huge;
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    Huge = HugePages && Class == BP_DIRECT && Size >= BP_HUGE_MIN_SIZE;
+  }
+
+  Hdr = (BuffHdr *)FileReader::AllocatePages(
+    (size_t)Size + sizeof(BuffHdr), &Huge);
+  if (Hdr == NULL)
+    return NULL;
+
+  OsAllocs.fetch_add(1, std::memory_order_relaxed);
+  if (Huge)
+    HugeAllocs.fetch_add(1, std::memory_order_relaxed);
+  Hdr->Magic = BP_MAGIC;
+  Hdr->Class = (uint16_t)Class;
+  Hdr->Huge = Huge ? 1 : 0;
+  Hdr->RawSize = (uint64_t)Size + sizeof(BuffHdr);
+  return Hdr + 1;
+}
+
+void BuffPool::OsFree(BuffHdr *Hdr)
+{
+  OsFrees.fetch_add(1, std::memory_order_relaxed);
+  Hdr->Magic = 0;
+  FileReader::FreePages(Hdr, (size_t)Hdr->RawSize, Hdr->Huge != 0);
+}
+
+void BuffPool::PutShared(BuffHdr *Hdr)
+{
+  uint32_t Size = class_size(Hdr->Class);
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if (SharedCount[Hdr->Class] < BP_SHARED_MAX &&
+      SharedBytes + Size <= BP_SHARED_MAX_BYTES)
+    {
+      BP_NEXT_FREE(Hdr) = Shared[Hdr->Class];
+      Shared[Hdr->Class] = Hdr;
+      SharedCount[Hdr->Class]++;
+      SharedBytes += Size;
+      CachedBytes += Size;
+      return;
+    }
+  }
+  OsFree(Hdr);
+}
+
+void *BuffPool::Alloc(uint32_t Size)
+{
+  LocalCache *Local;
+  BuffHdr *Hdr;
+  uint32_t Class;
+
+  Allocs.fetch_add(1, std::memory_order_relaxed);
+  Class = size_to_class(Size);
+  if (Class == BP_DIRECT)
+    return OsAlloc(BP_DIRECT, Size);
+
+  Local = GetLocal();
+  Hdr = Local->Head[Class];
+  if (Hdr != NULL)
+  {
+    Local->Head[Class] = BP_NEXT_FREE(Hdr);
+    Local->Count[Class]--;
+    LocalHits.fetch_add(1, std::memory_order_relaxed);
+    CachedBytes -= class_size(Class);
+    return Hdr + 1;
+  }
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    Hdr = Shared[Class];
+    if (Hdr != NULL)
+    {
+      Shared[Class] = BP_NEXT_FREE(Hdr);
+      SharedCount[Class]--;
+      SharedBytes -= class_size(Class);
+    }
+  }
+  if (Hdr != NULL)
+  {
+    SharedHits.fetch_add(1, std::memory_order_relaxed);
+    CachedBytes -= class_size(Class);
+    return Hdr + 1;
+  }
+
+  return OsAlloc(Class, class_size(Class));
+}
+
+void BuffPool::Free(void *Ptr)
+{
+  LocalCache *Local;
+  BuffHdr *Hdr;
+
+  if (Ptr == NULL)
+    return;
+
+  Hdr = (BuffHdr *)Ptr - 1;
+  assert(Hdr->Magic == BP_MAGIC);
+  Frees.fetch_add(1, std::memory_order_relaxed);
+  if (Hdr->Class == BP_DIRECT)
+  {
+    OsFree(Hdr);
+    return;
+  }
+
+  Local = GetLocal();
+  if (Local->Count[Hdr->Class] < BP_LOCAL_MAX)
+  {
+    BP_NEXT_FREE(Hdr) = Local->Head[Hdr->Class];
+    Local->Head[Hdr->Class] = Hdr;
+    Local->Count[Hdr->Class]++;
+    CachedBytes += class_size(Hdr->Class);
+    return;
+  }
+  PutShared(Hdr);
+}
+
+void BuffPool::Trim()
+{
+  LocalCache *Local = GetLocal();
+  BuffHdr *FreeList = NULL;
+  uint32_t Class;
+
+  for (Class = 0; Class < BP_CLASS_COUNT; Class++)
+  {
+    while (Local->Head[Class] != NULL)
+    {
+      BuffHdr *Hdr = Local->Head[Class];
+      Local->Head[Class] = BP_NEXT_FREE(Hdr);
+      CachedBytes -= class_size(Class);
+      OsFree(Hdr);
+    }
+    Local->Count[Class] = 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    for (Class = 0; Class < BP_CLASS_COUNT; Class++)
+    {
+      while (Shared[Class] != NULL)
+      {
+        BuffHdr *Hdr = Shared[Class];
+        Shared[Class] = BP_NEXT_FREE(Hdr);
+        BP_NEXT_FREE(Hdr) = FreeList;
+        FreeList = Hdr;
+        CachedBytes -= class_size(Class);
+      }
+      SharedCount[Class] = 0;
+    }
+    SharedBytes = 0;
+  }
+
+  while (FreeList != NULL)
+  {
+    BuffHdr *Hdr = FreeList;
+    FreeList = BP_NEXT_FREE(Hdr);
+    OsFree(Hdr);
+  }
+}
+
+/* Use huge pages for big direct allocations, if the OS allows it */
+void BuffPool::SetHugePages(bool Enable)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+  HugePages = Enable;
+}
+
+void BuffPool::GetStats(BuffPoolStats *Stats)
+{
+  Stats->Allocs = Allocs.load(std::memory_order_relaxed);
+  Stats->Frees = Frees.load(std::memory_order_relaxed);
+  Stats->LocalHits = LocalHits.load(std::memory_order_relaxed);
+  Stats->SharedHits = SharedHits.load(std::memory_order_relaxed);
+  Stats->OsAllocs = OsAllocs.load(std::memory_order_relaxed);
+  Stats->OsFrees = OsFrees.load(std::memory_order_relaxed);
+  Stats->HugeAllocs = HugeAllocs.load(std::memory_order_relaxed);
+  Stats->CachedBytes = CachedBytes.load(std::memory_order_relaxed);
+}
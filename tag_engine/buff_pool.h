@@ -0,0 +1,103 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _BUFF_POOL_H_
+#define _BUFF_POOL_H_
+
+#include "tl_types.h"
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+namespace TagLEET {
+
+/* Size classes are powers of 2 from 1KB to 1MB, bigger buffers are
+ * allocated directly from the OS */
+#define BP_MIN_CLASS_SHIFT 10
+#define BP_CLASS_COUNT 11
+/* Free buffers kept per class by each thread and by the shared lists */
+#define BP_LOCAL_MAX 4
+#define BP_SHARED_MAX 16
+#define BP_SHARED_MAX_BYTES (32*1024*1024)
+/* Direct allocations from this size may use huge pages */
+#define BP_HUGE_MIN_SIZE (2*1024*1024)
+
+struct BuffPoolStats
+{
+  uint64_t Allocs;
+  uint64_t Frees;
+  /* Allocations served by the free buffers of the calling thread */
+  uint64_t LocalHits;
+  /* Allocations served by the shared free lists */
+  uint64_t SharedHits;
+  /* Allocations and frees that reached the OS. Once the pool is warm they
+   * do not change */
+  uint64_t OsAllocs;
+  uint64_t OsFrees;
+  uint64_t HugeAllocs;
+  /* Bytes of free buffers held by the pool */
+  uint64_t CachedBytes;
+};
+
+/* Pool of the I/O buffers and allocator pages behind FileReader::AllocateMem.
+ * Freed buffers are kept in per thread lists, with a bounded shared list
+ * behind them, so steady state allocations do not reach the OS. */
+class BuffPool
+{
+public:
+  static BuffPool *Global();
+
+  void *Alloc(uint32_t Size);
+  void Free(void *Ptr);
+  /* Give the free buffers of the shared lists and of the calling thread
+   * back to the OS */
+  void Trim();
+  void SetHugePages(bool Enable);
+  void GetStats(BuffPoolStats *Stats);
+
+private:
+  struct BuffHdr;
+  struct LocalCache;
+
+  BuffPool();
+  static LocalCache *GetLocal();
+  void *OsAlloc(uint32_t Class, uint32_t Size);
+  void OsFree(BuffHdr *Hdr);
+  void PutShared(BuffHdr *Hdr);
+
+  std::mutex Lock;
+  BuffHdr *Shared[BP_CLASS_COUNT];
+  uint32_t SharedCount[BP_CLASS_COUNT];
+  uint64_t SharedBytes;
+  bool HugePages;
+
+  std::atomic<uint64_t> Allocs;
+  std::atomic<uint64_t> Frees;
+  std::atomic<uint64_t> LocalHits;
+  std::atomic<uint64_t> SharedHits;
+  std::atomic<uint64_t> OsAllocs;
+  std::atomic<uint64_t> OsFrees;
+  std::atomic<uint64_t> HugeAllocs;
+  std::atomic<uint64_t> CachedBytes;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _BUFF_POOL_H_ */
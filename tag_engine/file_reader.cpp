@@ -18,11 +18,173 @@
 */
 
 #include "file_reader.h"
+#include "buff_pool.h"
+#include "tl_simd.h"
 #include <stddef.h>
+#include <string.h>
 #include <assert.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 using namespace TagLEET;
 
+namespace TagLEET {
+
+/* A read of the next window of a sequential ReaderBuff */
+struct ReadAheadReq
+{
+  FileReader *fr;
+  tf_int_t Offset;
+  void *Buff;
+  uint32_t Size;
+  TL_ERR Err;
+  bool Pending;
+  ReadAheadReq *Next;
+};
+
+} /* namespace TagLEET */
+
+/* Background reader of the read ahead windows. One thread serves all the
+ * sequential ReaderBuffs, each has at most one pending read. It is never
+ * destroyed so it may outlive any ReaderBuff. Once its thread is stopped
+ * the reads are done in the foreground */
+class ReadAheadWorker
+{
+public:
+  static ReadAheadWorker *Get();
+  void Submit(ReadAheadReq *Req);
+  void Wait(ReadAheadReq *Req);
+  void Shutdown();
+
+private:
+  ReadAheadWorker();
+  void Run();
+
+  std::mutex Lock;
+  std::condition_variable WorkCond;
+  std::condition_variable DoneCond;
+  ReadAheadReq *Head;
+  ReadAheadReq *Tail;
+  std::thread Thread;
+  bool Started;
+  bool Stopping;
+};
+
+ReadAheadWorker::ReadAheadWorker()
+{
+  Head = Tail = NULL;
+  Started = false;
+  Stopping = false;
+}
+
+ReadAheadWorker *ReadAheadWorker::Get()
+{
+  static ReadAheadWorker *Worker = new ReadAheadWorker();
+  return Worker;
+}
+
+void ReadAheadWorker::Run()
+{
+  std::unique_lock<std::mutex> Guard(Lock);
+
+  for (;;)
+  {
+    ReadAheadReq *Req;
+
+    while (Head == NULL && !Stopping)
+      WorkCond.wait(Guard);
+    /* The pending reads are done before stopping, readers wait for them */
+    if (Head == NULL)
+      return;
+    Req = Head;
+    Head = Req->Next;
+    if (Head == NULL)
+      Tail = NULL;
+
+    Guard.unlock();
+    Req->Err = Req->fr->Read(Req->Offset, Req->Buff, Req->Size);
+    Guard.lock();
+    Req->Pending = false;
+    DoneCond.notify_all();
+  }
+}
+
+void ReadAheadWorker::Submit(ReadAheadReq *Req)
+{
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if (!Started && !Stopping)
+    {
+      try
+      {
+        Thread = std::thread(&ReadAheadWorker::Run, this);
+        Started = true;
+      }
+      catch (...)
+      {
+      }
+    }
+    if (Started)
+    {
+      Req->Pending = true;
+      Req->Next = NULL;
+      if (Tail != NULL)
+        Tail->Next = Req;
+      else
+        Head = Req;
+      Tail = Req;
+      WorkCond.notify_one();
+      return;
+    }
+  }
+
+  /* No thread, read in the foreground */
+  Req->Err = Req->fr->Read(Req->Offset, Req->Buff, Req->Size);
+  Req->Pending = false;
+}
+
+void ReadAheadWorker::Wait(ReadAheadReq *Req)
+{
+  std::unique_lock<std::mutex> Guard(Lock);
+
+  while (Req->Pending)
+    DoneCond.wait(Guard);
+}
+
+void ReadAheadWorker::Shutdown()
+{
+  std::thread Stopped;
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    Stopping = true;
+    Started = false;
+    Stopped.swap(Thread);
+    WorkCond.notify_one();
+  }
+
+  if (Stopped.joinable())
+    Stopped.join();
+}
+
+void FileReader::StopReadAhead()
+{
+  ReadAheadWorker::Get()->Shutdown();
+}
+
+void *FileReader::AllocateMem(uint32_t Size)
+{
+  return BuffPool::Global()->Alloc(Size);
+}
+
+void FileReader::FreeMem(void *ptr)
+{
+  BuffPool::Global()->Free(ptr);
+}
+
 ReaderBuff::ReaderBuff()
 {
   fr = NULL;
@@ -34,17 +196,20 @@ ReaderBuff::ReaderBuff()
   LineSize = 0;
   TagSize = 0;
   IsMapped = false;
+  SeqMem[0] = SeqMem[1] = NULL;
+  SeqFront[0] = SeqFront[1] = 0;
+  SeqCurr = 0;
+  WindowSize = 0;
+  NoGrow = false;
+  Ahead = NULL;
+  SavedAccess = FR_ACCESS_NORMAL;
+  HintEnd = 0;
 }
 
 ReaderBuff::~ReaderBuff()
 {
-  if ( Buff != NULL)
-  {
-    if (IsMapped)
-      fr->Unmap(Buff, Size);
-    else
-      fr->FreeMem(Buff);
-  }
+  Release();
+  delete Ahead;
 }
 
 TL_ERR ReaderBuff::Init(FileReader *in_fr, tf_int_t in_Offset, uint32_t in_Size)
@@ -56,11 +221,13 @@ TL_ERR ReaderBuff::Init(FileReader *in_fr, tf_int_t in_Offset, uint32_t in_Size)
 
   fr = in_fr;
   Offset = in_Offset;
+  WindowSize = in_Size;
   Size = in_Size;
   LineOffset = 0;
   NextLineOffset = 0;
   LineSize = 0;
   TagSize = 0;
+  HintEnd = 0;
 
   if (Offset + Size > fr->FileSize)
   {
@@ -89,8 +256,133 @@ TL_ERR ReaderBuff::Init(FileReader *in_fr, tf_int_t in_Offset, uint32_t in_Size)
   return err;
 }
 
+/* Init for a long sequential scan with FindNextFullLine(true). The next
+ * window is read in the background while the current one is scanned.
+ * The file is read with in_Access until Release */
+TL_ERR ReaderBuff::InitSequential(FileReader *in_fr, tf_int_t in_Offset,
+  uint32_t in_Size, FR_ACCESS in_Access)
+{
+  TL_ERR err;
+
+  Release();
+  if (Ahead == NULL)
+  {
+    Ahead = new ReadAheadReq;
+    if (Ahead == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Ahead->Pending = false;
+  }
+
+  fr = in_fr;
+  Offset = in_Offset;
+  LineOffset = 0;
+  NextLineOffset = 0;
+  LineSize = 0;
+  TagSize = 0;
+  IsMapped = false;
+  WindowSize = in_Size;
+  Size = in_Size;
+  if (Offset + Size > fr->FileSize)
+  {
+    Size = Offset >= fr->FileSize ? 0 : (uint32_t)(fr->FileSize - Offset);
+    if (Size == 0)
+      return TL_ERR_NO_MORE;
+  }
+
+  SeqMem[0] = (uint8_t *)fr->AllocateMem(2 * WindowSize);
+  SeqMem[1] = (uint8_t *)fr->AllocateMem(2 * WindowSize);
+  SavedAccess = fr->GetAccess();
+  fr->SetAccess(in_Access);
+  if (SeqMem[0] == NULL || SeqMem[1] == NULL)
+  {
+    Release();
+    return TL_ERR_MEM_ALLOC;
+  }
+
+  SeqFront[0] = SeqFront[1] = WindowSize;
+  SeqCurr = 0;
+  Buff = SeqMem[0] + SeqFront[0];
+  err = fr->Read(Offset, Buff, Size);
+  if (err)
+  {
+    Release();
+    return err;
+  }
+  StartReadAhead(Offset + Size);
+  return TL_ERR_OK;
+}
+
+/* Start reading the window at ReadOffset into the buffer not in use */
+void ReaderBuff::StartReadAhead(tf_int_t ReadOffset)
+{
+  Ahead->fr = fr;
+  Ahead->Offset = ReadOffset;
+  Ahead->Buff = SeqMem[SeqCurr ^ 1] + SeqFront[SeqCurr ^ 1];
+  Ahead->Size = ReadOffset >= fr->FileSize ? 0 :
+    (uint32_t)(fr->FileSize - ReadOffset < WindowSize ?
+    fr->FileSize - ReadOffset : WindowSize);
+  Ahead->Err = TL_ERR_OK;
+  Ahead->Pending = false;
+  if (Ahead->Size > 0)
+    ReadAheadWorker::Get()->Submit(Ahead);
+}
+
+/* Move to the window that was read ahead. The bytes from Drop to the end of
+ * the current window are copied in front of it */
+TL_ERR ReaderBuff::SlideSequential(uint32_t Drop)
+{
+  uint32_t Carry = Size - Drop;
+  uint32_t n = SeqCurr ^ 1;
+
+  ReadAheadWorker::Get()->Wait(Ahead);
+  if (Ahead->Err)
+    return Ahead->Err;
+  if (Ahead->Size == 0)
+    return TL_ERR_NO_MORE;
+
+  if (Carry > SeqFront[n])
+  {
+    /* The partial line does not fit in front of the next window. Move the
+     * window to a buffer with a larger front */
+    uint32_t NewFront = SeqFront[n];
+    uint8_t *NewMem;
+
+    while (NewFront < Carry)
+      NewFront *= 2;
+    NewMem = (uint8_t *)fr->AllocateMem(NewFront + WindowSize);
+    if (NewMem == NULL)
+      return TL_ERR_MEM_ALLOC;
+    ::memcpy(NewMem + NewFront, SeqMem[n] + SeqFront[n], Ahead->Size);
+    fr->FreeMem(SeqMem[n]);
+    SeqMem[n] = NewMem;
+    SeqFront[n] = NewFront;
+  }
+
+  ::memcpy(SeqMem[n] + SeqFront[n] - Carry, Buff + Drop, Carry);
+  Offset += Drop;
+  Buff = SeqMem[n] + SeqFront[n] - Carry;
+  Size = Carry + Ahead->Size;
+  SeqCurr = n;
+  StartReadAhead(Offset + Size);
+  return TL_ERR_OK;
+}
+
 void ReaderBuff::Release()
 {
+  if (SeqMem[0] != NULL || SeqMem[1] != NULL)
+  {
+    /* The background read may still be writing to our memory */
+    ReadAheadWorker::Get()->Wait(Ahead);
+    if (SeqMem[0] != NULL)
+      fr->FreeMem(SeqMem[0]);
+    if (SeqMem[1] != NULL)
+      fr->FreeMem(SeqMem[1]);
+    SeqMem[0] = SeqMem[1] = NULL;
+    Buff = NULL;
+    fr->SetAccess(SavedAccess);
+    return;
+  }
+
   if (Buff == NULL)
     return;
 
@@ -102,15 +394,117 @@ void ReaderBuff::Release()
   Buff = NULL;
 }
 
+/* Windows read ahead by a plain ReaderBuff that slides in a random access
+ * file */
+#define RB_SLIDE_HINT_WINDOWS 4
+
 static uint8_t TestEolArr[2] = {10,13};
 #define IS_EOL_CHAR(c) (TestEolArr[(uint8_t)(c) & 1] == (c))
 
+/* Find the 1st EOL char in Buff[Start, End), or End if there is none.
+ * Also return in TabOffset the offset of the 1st tab before the EOL, not
+ * counting a tab at Start, or 0 if there is none.
+ * With SSE2 16 bytes are tested at a time, the tail is scanned bytewise. */
+static uint32_t scan_line(const uint8_t *Buff, uint32_t Start, uint32_t End,
+  uint32_t *TabOffset)
+{
+  uint32_t i = Start;
+  uint32_t Tab = 0;
+
+#ifdef TL_USE_SSE2
+  const __m128i Lf = _mm_set1_epi8('\n');
+  const __m128i Cr = _mm_set1_epi8('\r');
+  const __m128i Ht = _mm_set1_epi8('\t');
+
+  while (End - i >= 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(Buff + i));
+    uint32_t EolMask = (uint32_t)_mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(v, Lf), _mm_cmpeq_epi8(v, Cr)));
+
+    if (Tab == 0)
+    {
+      uint32_t TabMask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, Ht));
+      if (i == Start)
+        TabMask &= ~1U;
+      /* Only tabs before the EOL */
+      if (EolMask != 0)
+        TabMask &= (EolMask & (0U - EolMask)) - 1;
+      if (TabMask != 0)
+        Tab = i + lowest_bit_index(TabMask);
+    }
+
+    if (EolMask != 0)
+    {
+      *TabOffset = Tab;
+      return i + lowest_bit_index(EolMask);
+    }
+    i += 16;
+  }
+#endif
+
+  for (; i < End && !IS_EOL_CHAR(Buff[i]); i++)
+  {
+    if (Buff[i] == '\t' && Tab == 0 && i > Start)
+      Tab = i;
+  }
+  *TabOffset = Tab;
+  return i;
+}
+
+/* With SSE2 the first and last bytes of Needle are tested at 16 positions at
+ * a time and memcmp only runs where both match */
+const char *TagLEET::memfind(const char *Hay, size_t HaySize,
+  const char *Needle, size_t NeedleSize)
+{
+  size_t i = 0;
+
+  if (NeedleSize == 0)
+    return Hay;
+  if (NeedleSize > HaySize)
+    return NULL;
+  if (NeedleSize == 1)
+    return (const char *)::memchr(Hay, Needle[0], HaySize);
+
+#ifdef TL_USE_SSE2
+  const __m128i First = _mm_set1_epi8(Needle[0]);
+  const __m128i Last = _mm_set1_epi8(Needle[NeedleSize - 1]);
+
+  for (; i + NeedleSize - 1 + 16 <= HaySize; i += 16)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(Hay + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(Hay + i + NeedleSize - 1));
+    uint32_t Mask = (uint32_t)_mm_movemask_epi8(
+      _mm_and_si128(_mm_cmpeq_epi8(a, First), _mm_cmpeq_epi8(b, Last)));
+
+    while (Mask != 0)
+    {
+      size_t j = i + lowest_bit_index(Mask);
+      if (::memcmp(Hay + j + 1, Needle + 1, NeedleSize - 2) == 0)
+        return Hay + j;
+      Mask &= Mask - 1;
+    }
+  }
+#endif
+
+  for (; i + NeedleSize <= HaySize; i++)
+  {
+    if (Hay[i] != Needle[0])
+      continue;
+    if (::memcmp(Hay + i, Needle, NeedleSize) == 0)
+      return Hay + i;
+  }
+  return NULL;
+}
+
 TL_ERR ReaderBuff::FindFirstFullLine(bool SlideBuffer)
 {
   TL_ERR err;
 
   NextLineOffset = 0;
+  NoGrow = true;
   err = FindNextFullLine(SlideBuffer);
+  NoGrow = false;
   if (!err || err == TL_ERR_LINE_TOO_BIG)
     err = FindNextFullLine(SlideBuffer);
   return err;
@@ -127,9 +521,11 @@ TL_ERR ReaderBuff::GetEolSize(uint32_t EolOffset, uint32_t *EolSize)
   }
   else if (Buff[EolOffset] == '\r')
   {
-    if (EolOffset + 1 == Size)
+    /* A '\r' at the end of the buffer may be followed by '\n', unless it is
+     * the end of the file */
+    if (EolOffset + 1 == Size && Offset + Size < fr->FileSize)
       return TL_ERR_NO_MORE;
-    if (Buff[EolOffset+1] == '\n')
+    if (EolOffset + 1 < Size && Buff[EolOffset+1] == '\n')
       n = 2;
     else
       n = 1;
@@ -152,17 +548,12 @@ TL_ERR ReaderBuff::FindNextFullLine(bool SlideBuffer)
     return TL_ERR_GENERAL;
   for (;;)
   {
-    uint32_t EolSize;
-    TagSize = 0;
+    uint32_t EolSize, TabOffset;
 
-    i = LineOffset = NextLineOffset;
+    LineOffset = NextLineOffset;
     /* Search for Next EOL */
-    while (i < Size && !IS_EOL_CHAR(Buff[i]))
-    {
-      if (Buff[i] == '\t' && TagSize == 0)
-        TagSize = i - LineOffset;
-      i++;
-    }
+    i = scan_line(Buff, LineOffset, Size, &TabOffset);
+    TagSize = TabOffset != 0 ? TabOffset - LineOffset : 0;
 
     if (i == Size)
     {
@@ -190,6 +581,12 @@ TL_ERR ReaderBuff::FindNextFullLine(bool SlideBuffer)
       {
         LineSize = i - LineOffset;
         NextLineOffset = i + EolSize;
+        if (TooBig)
+        {
+          /* This is the tail of a line that did not fit the window */
+          LineSize = 0;
+          return TL_ERR_LINE_TOO_BIG;
+        }
         return LineSize + EolSize > 0 ? TL_ERR_OK : TL_ERR_NO_MORE;
       }
     }
@@ -197,44 +594,137 @@ TL_ERR ReaderBuff::FindNextFullLine(bool SlideBuffer)
     if (SlideBuffer == false)
       return TL_ERR_NO_MORE;
 
-    if (LineOffset > 0)
-    {
-      Offset += LineOffset;
-    }
-    else
-    {
+    /* The line starts at the beginning of the buffer and still does not fit.
+     * Keep it and read more, unless it is too long or it is only skipped */
+    if (LineOffset == 0 && (NoGrow || Size >= RB_MAX_WINDOW_SIZE))
       TooBig = true;
-      Offset += i;
-    }
-
-    /* Slide the buffer further in the file to read the next lines */
-    if (Offset + Size > fr->FileSize)
-    {
-      Size = (uint32_t)(fr->FileSize - Offset);
-      if (Size == 0)
-        return TL_ERR_NO_MORE;
-    }
 
+    if (SeqMem[0] != NULL)
+      err = SlideSequential(TooBig ? i : LineOffset);
+    else
+      err = SlideWindow(TooBig ? i : LineOffset, LineOffset == 0 && !TooBig);
+    if (err)
+      return err;
     LineOffset = 0;
     NextLineOffset = 0;
     LineSize = 0;
     TagSize = 0;
+  }
+}
 
-    if (IsMapped)
-    {
-      fr->Unmap(Buff, Size);
-      err = fr->Map(Offset, Size, (void **)&Buff);
-    }
-    else
-    {
-      err = fr->Read(Offset, Buff, Size);
-    }
+/* Slide the window of a plain ReaderBuff further in the file. The bytes from
+ * Drop to the end of the window stay in the buffer and only the rest is
+ * read. With Grow the window size is doubled */
+TL_ERR ReaderBuff::SlideWindow(uint32_t Drop, bool Grow)
+{
+  TL_ERR err;
+  uint32_t Keep = Size - Drop;
+  uint32_t NewSize;
+
+  if (Grow)
+  {
+    WindowSize *= 2;
+    if (WindowSize > RB_MAX_WINDOW_SIZE)
+      WindowSize = RB_MAX_WINDOW_SIZE;
+  }
+
+  NewSize = WindowSize;
+  if (Offset + Drop + NewSize > fr->FileSize)
+    NewSize = (uint32_t)(fr->FileSize - Offset - Drop);
+  if (NewSize <= Keep)
+    return TL_ERR_NO_MORE;
+
+  /* Reads of a random access file get no OS read ahead. Once a scan
+   * slides, ask for the next few windows */
+  if (fr->GetAccess() == FR_ACCESS_RANDOM && Offset + Drop + NewSize > HintEnd)
+  {
+    HintEnd = Offset + Drop + (tf_int_t)NewSize * RB_SLIDE_HINT_WINDOWS;
+    fr->WillRead(Offset + Drop, HintEnd - Offset - Drop);
+  }
+
+  if (IsMapped)
+  {
+    fr->Unmap(Buff, Size);
+    Offset += Drop;
+    Size = NewSize;
+    err = fr->Map(Offset, Size, (void **)&Buff);
     if (err)
-    {
-      if (!IsMapped)
-        fr->FreeMem(Buff);
       Buff = NULL;
+    return err;
+  }
+
+  if (Grow)
+  {
+    uint8_t *NewBuff = (uint8_t *)fr->AllocateMem(WindowSize);
+    if (NewBuff == NULL)
+      return TL_ERR_MEM_ALLOC;
+    ::memcpy(NewBuff, Buff + Drop, Keep);
+    fr->FreeMem(Buff);
+    Buff = NewBuff;
+  }
+  else if (Keep > 0)
+  {
+    ::memmove(Buff, Buff + Drop, Keep);
+  }
+
+  Offset += Drop;
+  Size = NewSize;
+  err = fr->Read(Offset + Keep, Buff + Keep, Size - Keep);
+  if (err)
+  {
+    fr->FreeMem(Buff);
+    Buff = NULL;
+  }
+  return err;
+}
+
+FileWriter::FileWriter()
+{
+  Buff = NULL;
+  BuffUsed = 0;
+  BuffSize = 64*1024;
+}
+
+FileWriter::~FileWriter()
+{
+  if (Buff != NULL)
+    FileReader::FreeMem(Buff);
+}
+
+TL_ERR FileWriter::Write(const void *Data, uint32_t Size)
+{
+  TL_ERR err;
+
+  if (Buff == NULL)
+  {
+    Buff = (uint8_t *)FileReader::AllocateMem(BuffSize);
+    if (Buff == NULL)
+      return TL_ERR_MEM_ALLOC;
+  }
+
+  if (BuffUsed + Size > BuffSize)
+  {
+    err = Flush();
+    if (err)
       return err;
-    }
+    /* Big writes go directly to the file */
+    if (Size >= BuffSize)
+      return WriteRaw(Data, Size);
   }
+
+  ::memcpy(Buff + BuffUsed, Data, Size);
+  BuffUsed += Size;
+  return TL_ERR_OK;
+}
+
+TL_ERR FileWriter::Flush()
+{
+  TL_ERR err;
+
+  if (BuffUsed == 0)
+    return TL_ERR_OK;
+
+  err = WriteRaw(Buff, BuffUsed);
+  BuffUsed = 0;
+  return err;
 }
@@ -21,13 +21,25 @@
 #define _FILE_READER_H_
 
 #include "tl_types.h"
+#include <stddef.h>
 
 namespace TagLEET {
 
+/* How a file is about to be read, for the OS read ahead and page cache */
+typedef enum {
+  FR_ACCESS_NORMAL,
+  /* Binary search, read only what is asked for */
+  FR_ACCESS_RANDOM,
+  /* Forward scan, read ahead aggressively */
+  FR_ACCESS_SEQUENTIAL,
+  /* Forward scan of data that is not needed again, drop it once read */
+  FR_ACCESS_ONCE,
+} FR_ACCESS;
+
 class FileReader
 {
 public:
-  FileReader() {};
+  FileReader() : ReadCount(0), ReadBytes(0), Access(FR_ACCESS_NORMAL) {};
   virtual ~FileReader() {};
 
   virtual TL_ERR Open(const char *FileName, bool RandomAccess = false) = 0;
@@ -39,32 +51,118 @@ public:
   virtual void Unmap(void *Base, tf_int_t Size) = 0;
   virtual TL_ERR Unmodified() const = 0;
   virtual void AckNewTime() = 0;
+  /* Access hints. Readers that can not change the access pattern of an open
+   * file only remember it */
+  virtual void SetAccess(FR_ACCESS in_Access) { Access = in_Access; };
+  virtual void WillRead(tf_int_t /* Offset */, tf_int_t /* Size */) {}
+  FR_ACCESS GetAccess() const { return Access; }
 
   static bool MapSupported();
   static FileReader *FileReaderCreate();
-  /* Used for allocating full pages by the OS, may use faster implementation
-   * than regular malloc/free */
+  /* Used for allocating I/O buffers and allocator pages. Served by the
+   * buffer pool, which reuses freed buffers of the same size class */
   static void *AllocateMem(uint32_t Size);
   static void FreeMem(void *ptr);
+  /* Pages from the OS behind the buffer pool. Huge asks for huge pages and
+   * is cleared if they could not be used */
+  static void *AllocatePages(size_t Size, bool *Huge);
+  static void FreePages(void *Ptr, size_t Size, bool Huge);
   static uint32_t GetSystemPageSize();
   static uint32_t GetSystemAllocGranularity();
+  /* Size and ModTime of a file without opening it */
+  static TL_ERR GetFileInfo(const char *FileName, tf_int_t *Size,
+    uint64_t *ModTime);
+  /* Wait for the read ahead thread to exit, later read ahead windows are
+   * read in the foreground */
+  static void StopReadAhead();
 
   tf_int_t FileSize;
+  /* Last modification time of the file in OS specific units. Together with
+   * FileSize it identifies a version of the file */
+  uint64_t ModTime;
+  /* Number of Read calls and the bytes they read since creation */
+  uint64_t ReadCount;
+  uint64_t ReadBytes;
+
+protected:
+  FR_ACCESS Access;
+};
+
+/* Extension of the file a new file is written to before it is renamed over
+ * the old one */
+#define FW_TMP_EXT ".tmp"
+
+/* Sequential writer for new files. Writes are buffered and flushed to the OS
+ * in big chunks */
+class FileWriter
+{
+public:
+  FileWriter();
+  virtual ~FileWriter();
+
+  virtual TL_ERR Create(const char *FileName) = 0;
+  virtual void Close() = 0;
+  TL_ERR Write(const void *Data, uint32_t Size);
+  TL_ERR Flush();
+
+  static FileWriter *FileWriterCreate();
+  /* Rename a file, replacing NewName if it exists. The replace is atomic,
+   * readers see either the old file or the new one, and a reader that has
+   * the old file open goes on reading it until it reopens NewName */
+  static TL_ERR RenameFile(const char *OldName, const char *NewName);
+  static void RemoveFile(const char *FileName);
+
+protected:
+  virtual TL_ERR WriteRaw(const void *Data, uint32_t Size) = 0;
+
+private:
+  uint8_t *Buff;
+  uint32_t BuffUsed;
+  uint32_t BuffSize;
 };
 
 
+struct ReadAheadReq;
+
+/* A ReaderBuff window grows up to this size to hold a line that does not fit
+ * in it. Longer lines are skipped with TL_ERR_LINE_TOO_BIG */
+#define RB_MAX_WINDOW_SIZE (4*1024*1024)
+
 class ReaderBuff
 {
 public:
   ReaderBuff();
   virtual ~ReaderBuff();
   TL_ERR Init(FileReader *in_fr, tf_int_t in_Offset, uint32_t in_Size);
+  TL_ERR InitSequential(FileReader *in_fr, tf_int_t in_Offset,
+    uint32_t in_Size, FR_ACCESS in_Access = FR_ACCESS_SEQUENTIAL);
   void Release();
 
   TL_ERR FindFirstFullLine(bool SlideBuffer = false);
   TL_ERR FindNextFullLine(bool SlideBuffer = false);
 private:
   TL_ERR GetEolSize(uint32_t EolOffset, uint32_t *EolSize);
+  void StartReadAhead(tf_int_t ReadOffset);
+  TL_ERR SlideSequential(uint32_t Drop);
+  TL_ERR SlideWindow(uint32_t Drop, bool Grow);
+
+  /* Sequential mode: two buffers, each with SeqFront[n] bytes followed by
+   * a window. The next window is read after the front of one buffer while
+   * the other is scanned, and the partial line is copied in front of it.
+   * The front grows when a line does not fit in it */
+  uint8_t *SeqMem[2];
+  uint32_t SeqFront[2];
+  uint32_t SeqCurr;
+  /* Bytes read at a time. A plain window grows for a long line */
+  uint32_t WindowSize;
+  /* Set while FindFirstFullLine skips the partial first line, that line is
+   * never returned so the window does not grow for it */
+  bool NoGrow;
+  ReadAheadReq *Ahead;
+  /* Access of the file before the sequential scan, restored by Release */
+  FR_ACCESS SavedAccess;
+  /* End of the range the OS was asked to read ahead while sliding */
+  tf_int_t HintEnd;
 
 public:
   /* Buffer to file data. Either to mapped data or allocated buffer with data
@@ -87,6 +185,10 @@ public:
   FileReader *fr;
 };
 
+/* Find the 1st occurrence of Needle in Hay, NULL if there is none */
+const char *memfind(const char *Hay, size_t HaySize, const char *Needle,
+  size_t NeedleSize);
+
 } /* namespace TagLEET */
 
 #endif /* _FILE_READER_H_ */
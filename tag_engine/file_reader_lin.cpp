@@ -21,11 +21,26 @@
 #include "file_reader.h"
 #include <sys/types.h>
 #include <sys/stat.h>
-//#include <sys/mman.h>
-#include "../unistd.h"
+#include <sys/mman.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+
+using namespace TagLEET;
+
+/* How far the kernel is asked to read ahead of a sequential scan */
+#define FR_READ_AHEAD_SIZE (1024*1024)
+
+/* Modification time in nanoseconds, a file rewritten within the same second
+ * must still get a new time */
+static uint64_t stat_mod_time(const struct stat *buf)
+{
+  return (uint64_t)buf->st_mtim.tv_sec * 1000000000 +
+    (uint64_t)buf->st_mtim.tv_nsec;
+}
 
 class FileReaderLin : public FileReader
 {
@@ -34,6 +49,7 @@ public:
   virtual ~FileReaderLin();
 
   virtual TL_ERR Open(const char *FileName, bool RandomAccess);
+  virtual TL_ERR Open(const wchar_t *FileName, bool RandomAccess);
   virtual TL_ERR Reopen();
   virtual void Close();
   virtual TL_ERR Read(tf_int_t Offset, void *buff, uint32_t Size);
@@ -41,20 +57,29 @@ public:
   virtual void Unmap(void *Base, tf_int_t Size);
   virtual TL_ERR Unmodified() const;
   virtual void AckNewTime();
+  virtual void SetAccess(FR_ACCESS in_Access);
+  virtual void WillRead(tf_int_t Offset, tf_int_t Size);
 
 private:
+  void ApplyAccess();
+
   int fd;
   uint32_t PageSize;
   const char *FileName;
-  bool SaveRandomAccess;
   time_t OpenFileTime;
   time_t ReopenFileTime;
+  /* End of the range the kernel was asked to read ahead */
+  tf_int_t PrefetchEnd;
 };
 
 FileReaderLin::FileReaderLin():
   FileReader()
 {
   fd = -1;
+  FileName = NULL;
+  PrefetchEnd = 0;
+  FileSize = 0;
+  ModTime = 0;
   PageSize = GetSystemPageSize();
 }
 
@@ -88,7 +113,7 @@ TL_ERR FileReaderLin::Open(const char *in_FileName, bool RandomAccess)
   if (FileName == NULL)
     return TL_ERR_MEM_ALLOC;
 
-  SaveRandomAccess = RandomAccess;
+  Access = RandomAccess ? FR_ACCESS_RANDOM : FR_ACCESS_NORMAL;
   err = FileReaderLin::Reopen();
 
   if (!err)
@@ -102,6 +127,25 @@ TL_ERR FileReaderLin::Open(const char *in_FileName, bool RandomAccess)
   return TL_ERR_GENERAL;
 }
 
+/* File names are multibyte strings on Linux */
+TL_ERR FileReaderLin::Open(const wchar_t *in_FileName, bool RandomAccess)
+{
+  size_t Size;
+  char *FileNameA;
+  TL_ERR err;
+
+  Size = ::wcstombs(NULL, in_FileName, 0);
+  if (Size == (size_t)-1)
+    return TL_ERR_ENCODE_CONV;
+  FileNameA = (char *)malloc(Size + 1);
+  if (FileNameA == NULL)
+    return TL_ERR_MEM_ALLOC;
+  ::wcstombs(FileNameA, in_FileName, Size + 1);
+  err = Open(FileNameA, RandomAccess);
+  free(FileNameA);
+  return err;
+}
+
 TL_ERR FileReaderLin::Reopen()
 {
   struct stat buf;
@@ -124,9 +168,49 @@ TL_ERR FileReaderLin::Reopen()
 
   ReopenFileTime = buf.st_mtime;
   FileSize = buf.st_size;
+  ModTime = stat_mod_time(&buf);
+  ApplyAccess();
   return TL_ERR_OK;
 }
 
+void FileReaderLin::ApplyAccess()
+{
+  int Advice;
+
+  if (fd == -1)
+    return;
+
+  switch (Access)
+  {
+    case FR_ACCESS_RANDOM:
+      Advice = POSIX_FADV_RANDOM;
+      break;
+    case FR_ACCESS_SEQUENTIAL:
+    case FR_ACCESS_ONCE:
+      Advice = POSIX_FADV_SEQUENTIAL;
+      break;
+    default:
+      Advice = POSIX_FADV_NORMAL;
+      break;
+  }
+  ::posix_fadvise(fd, 0, 0, Advice);
+  PrefetchEnd = 0;
+}
+
+void FileReaderLin::SetAccess(FR_ACCESS in_Access)
+{
+  if (in_Access == Access)
+    return;
+  Access = in_Access;
+  ApplyAccess();
+}
+
+void FileReaderLin::WillRead(tf_int_t Offset, tf_int_t Size)
+{
+  if (fd != -1)
+    ::posix_fadvise(fd, (off_t)Offset, (off_t)Size, POSIX_FADV_WILLNEED);
+}
+
 bool FileReader::MapSupported()
 {
   return false;
@@ -146,6 +230,11 @@ TL_ERR FileReaderLin::Map(tf_int_t Offset, tf_int_t Size, void **BasePtr)
 
   if (Base != MAP_FAILED)
   {
+    if (Access != FR_ACCESS_NORMAL)
+    {
+      ::madvise(Base, (size_t)(GranPad + Size), Access == FR_ACCESS_RANDOM ?
+        MADV_RANDOM : MADV_SEQUENTIAL);
+    }
     *BasePtr = Base + GranPad;
     return TL_ERR_OK;
   }
@@ -161,22 +250,36 @@ void FileReaderLin::Unmap(void *Base, tf_int_t Size)
   ::munmap((uint8_t *)Base - GranPad, (size_t)(Size + GranPad));
 }
 
+/* Positional read, so read ahead may read the file from another thread */
 TL_ERR FileReaderLin::Read(tf_int_t Offset, void *buff, uint32_t Size)
 {
-  off_t seek_rc;
   ssize_t read_rc;
 
   if (fd == -1)
     return TL_ERR_GENERAL;
 
-  seek_rc = ::lseek(fd, Offset, SEEK_SET);
-  if (seek_rc == (off_t)-1)
+  read_rc = ::pread(fd, buff, Size, (off_t)Offset);
+  if ((uint32_t)read_rc != Size)
     return TL_ERR_GENERAL;
-  read_rc = ::read(fd, buff, Size);
-  if ((uint32_t)read_rc == Size)
-    return TL_ERR_OK;
 
-  return TL_ERR_GENERAL;
+  ReadCount++;
+  ReadBytes += Size;
+  if (Access == FR_ACCESS_SEQUENTIAL || Access == FR_ACCESS_ONCE)
+  {
+    /* Keep the kernel at least half a read ahead window ahead of us */
+    if (Offset + Size + FR_READ_AHEAD_SIZE / 2 > PrefetchEnd)
+    {
+      tf_int_t Start = Offset + Size > PrefetchEnd ? Offset + Size :
+        PrefetchEnd;
+      PrefetchEnd = Offset + Size + FR_READ_AHEAD_SIZE;
+      ::posix_fadvise(fd, (off_t)Start, (off_t)(PrefetchEnd - Start),
+        POSIX_FADV_WILLNEED);
+    }
+    /* Pages that were fully read are not needed any more */
+    if (Access == FR_ACCESS_ONCE)
+      ::posix_fadvise(fd, (off_t)Offset, (off_t)Size, POSIX_FADV_DONTNEED);
+  }
+  return TL_ERR_OK;
 }
 
 FileReader *FileReader::FileReaderCreate()
@@ -197,14 +300,32 @@ void FileReaderLin::AckNewTime()
   OpenFileTime = ReopenFileTime;
 }
 
-void *FileReader::AllocateMem(uint32_t Size)
+/* Huge pages are anonymous mappings advised for transparent huge pages */
+void *FileReader::AllocatePages(size_t Size, bool *Huge)
 {
+  if (*Huge)
+  {
+    void *Ptr = ::mmap(NULL, Size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (Ptr != MAP_FAILED)
+    {
+#ifdef MADV_HUGEPAGE
+      ::madvise(Ptr, Size, MADV_HUGEPAGE);
+#endif
+      return Ptr;
+    }
+    *Huge = false;
+  }
   return malloc(Size);
 }
 
-void FileReader::FreeMem(void *Ptr)
+void FileReader::FreePages(void *Ptr, size_t Size, bool Huge)
 {
-  free(Ptr);
+  if (Huge)
+    ::munmap(Ptr, Size);
+  else
+    free(Ptr);
 }
 
 uint32_t FileReader::GetSystemPageSize()
@@ -217,3 +338,95 @@ uint32_t FileReader::GetSystemAllocGranularity()
   return GetSystemPageSize();
 }
 
+TL_ERR FileReader::GetFileInfo(const char *FileName, tf_int_t *Size,
+  uint64_t *ModTime)
+{
+  struct stat buf;
+
+  if (stat(FileName, &buf) != 0)
+    return TL_ERR_FILE_NOT_EXIST;
+  *Size = buf.st_size;
+  *ModTime = stat_mod_time(&buf);
+  return TL_ERR_OK;
+}
+
+
+class FileWriterLin : public FileWriter
+{
+public:
+  FileWriterLin();
+  virtual ~FileWriterLin();
+
+  virtual TL_ERR Create(const char *FileName);
+  virtual void Close();
+
+protected:
+  virtual TL_ERR WriteRaw(const void *Data, uint32_t Size);
+
+private:
+  int fd;
+};
+
+FileWriterLin::FileWriterLin():
+  FileWriter()
+{
+  fd = -1;
+}
+
+FileWriterLin::~FileWriterLin()
+{
+  Close();
+}
+
+TL_ERR FileWriterLin::Create(const char *FileName)
+{
+  if (fd != -1)
+    return TL_ERR_GENERAL;
+
+  fd = ::open(FileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  return fd == -1 ? TL_ERR_GENERAL : TL_ERR_OK;
+}
+
+void FileWriterLin::Close()
+{
+  if (fd != -1)
+  {
+    Flush();
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+TL_ERR FileWriterLin::WriteRaw(const void *Data, uint32_t Size)
+{
+  const uint8_t *p = (const uint8_t *)Data;
+  ssize_t rc;
+
+  if (fd == -1)
+    return TL_ERR_GENERAL;
+
+  while (Size > 0)
+  {
+    rc = ::write(fd, p, Size);
+    if (rc <= 0)
+      return TL_ERR_GENERAL;
+    p += rc;
+    Size -= (uint32_t)rc;
+  }
+  return TL_ERR_OK;
+}
+
+FileWriter *FileWriter::FileWriterCreate()
+{
+  return new FileWriterLin;
+}
+
+TL_ERR FileWriter::RenameFile(const char *OldName, const char *NewName)
+{
+  return ::rename(OldName, NewName) == 0 ? TL_ERR_OK : TL_ERR_GENERAL;
+}
+
+void FileWriter::RemoveFile(const char *FileName)
+{
+  ::unlink(FileName);
+}
@@ -21,9 +21,14 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <string.h>
 
 using namespace TagLEET;
 
+/* Attempts to replace a file that is held open by a reader */
+#define FW_RENAME_RETRIES 20
+#define FW_RENAME_RETRY_MSEC 25
+
 class FileReaderWin : public FileReader
 {
 public:
@@ -98,6 +103,8 @@ FileReaderWin::FileReaderWin():
   FileHndl = INVALID_HANDLE_VALUE;
   MapHndl = NULL;
   FileNameW = NULL;
+  FileSize = 0;
+  ModTime = 0;
 
   ::GetSystemInfo(&SysInfo);
   AllocGranularity = SysInfo.dwAllocationGranularity;
@@ -134,6 +141,7 @@ TL_ERR FileReaderWin::DoOpen(bool RandomAccess)
   if (FileNameW == NULL)
     return TL_ERR_MEM_ALLOC;
   SaveRandomAccess = RandomAccess;
+  Access = RandomAccess ? FR_ACCESS_RANDOM : FR_ACCESS_SEQUENTIAL;
   err = FileReaderWin::Reopen();
   if (!err)
   {
@@ -174,8 +182,10 @@ TL_ERR FileReaderWin::Reopen()
 
   Flags = FILE_ATTRIBUTE_READONLY |
     (SaveRandomAccess ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN);
-  FileHndl = ::CreateFileW(FileNameW, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
-    Flags, NULL);
+  /* A new version of the file may be renamed over it while it is open, the
+   * reader goes on with the version it opened until it is reopened */
+  FileHndl = ::CreateFileW(FileNameW, GENERIC_READ,
+    FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, Flags, NULL);
   if (FileHndl == INVALID_HANDLE_VALUE)
     return TL_ERR_GENERAL;
 
@@ -187,6 +197,8 @@ TL_ERR FileReaderWin::Reopen()
     return TL_ERR_GENERAL;
   }
   FileSize = Size();
+  ModTime = ((uint64_t)ReopenFileTime.dwHighDateTime << 32) |
+    ReopenFileTime.dwLowDateTime;
   return TL_ERR_OK;
 }
 
@@ -233,22 +245,27 @@ void FileReaderWin::Unmap(void *Base, tf_int_t)
   UnmapViewOfFile((uint8_t *)Base - GranPad);
 }
 
+/* The offset is passed with the read and not by moving the file pointer, so
+ * read ahead may read the file from another thread */
 TL_ERR FileReaderWin::Read(tf_int_t Offset, void *buff, uint32_t Size)
 {
   BOOL rc;
   DWORD BytesRead;
-  LARGE_INTEGER i64;
+  OVERLAPPED Ov;
 
   if (FileHndl == INVALID_HANDLE_VALUE)
     return TL_ERR_GENERAL;
 
-  i64.QuadPart = Offset;
-  rc = ::SetFilePointerEx(FileHndl, i64, NULL, FILE_BEGIN);
-  if (rc == 0)
-    return TL_ERR_GENERAL;
-  rc = ::ReadFile(FileHndl, buff, Size, &BytesRead, NULL);
+  ::memset(&Ov, 0, sizeof(Ov));
+  Ov.Offset = (DWORD)Offset;
+  Ov.OffsetHigh = (DWORD)(Offset >> 32);
+  rc = ::ReadFile(FileHndl, buff, Size, &BytesRead, &Ov);
   if (rc != 0 && BytesRead == Size)
+  {
+    ReadCount++;
+    ReadBytes += Size;
     return TL_ERR_OK;
+  }
 
   return TL_ERR_GENERAL;
 }
@@ -289,14 +306,30 @@ void FileReaderWin::AckNewTime()
   OpenFileTime = ReopenFileTime;
 }
 
-void *FileReader::AllocateMem(uint32_t Size)
+/* Large pages need the "Lock pages in memory" privilege, without it the
+ * allocation fails and regular pages are used */
+void *FileReader::AllocatePages(size_t Size, bool *Huge)
 {
+  if (*Huge)
+  {
+    SIZE_T LargeSize = GetLargePageMinimum();
+    void *Ptr;
+
+    if (LargeSize != 0)
+    {
+      Ptr = VirtualAlloc(NULL, (Size + LargeSize - 1) & ~(LargeSize - 1),
+        MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (Ptr != NULL)
+        return Ptr;
+    }
+    *Huge = false;
+  }
   return VirtualAlloc(NULL, Size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 }
 
-void FileReader::FreeMem(void *ptr)
+void FileReader::FreePages(void *Ptr, size_t Size, bool Huge)
 {
-  VirtualFree(ptr, 0, MEM_RELEASE);
+  VirtualFree(Ptr, 0, MEM_RELEASE);
 }
 
 uint32_t FileReader::GetSystemPageSize()
@@ -313,3 +346,177 @@ uint32_t FileReader::GetSystemAllocGranularity()
   return (uint32_t)SysInfo.dwAllocationGranularity;
 }
 
+TL_ERR FileReader::GetFileInfo(const char *FileName, tf_int_t *Size,
+  uint64_t *ModTime)
+{
+  WIN32_FILE_ATTRIBUTE_DATA Attr;
+  wchar_t *FileNameW;
+  BOOL rc;
+
+  FileNameW = file_name_w_alloc(FileName);
+  if (FileNameW == NULL)
+    return TL_ERR_MEM_ALLOC;
+  rc = ::GetFileAttributesExW(FileNameW, GetFileExInfoStandard, &Attr);
+  file_name_w_free(FileNameW);
+  if (rc == 0)
+    return TL_ERR_FILE_NOT_EXIST;
+
+  *Size = ((tf_int_t)Attr.nFileSizeHigh << 32) | Attr.nFileSizeLow;
+  *ModTime = ((uint64_t)Attr.ftLastWriteTime.dwHighDateTime << 32) |
+    Attr.ftLastWriteTime.dwLowDateTime;
+  return TL_ERR_OK;
+}
+
+
+class FileWriterWin : public FileWriter
+{
+public:
+  FileWriterWin();
+  virtual ~FileWriterWin();
+
+  virtual TL_ERR Create(const char *FileName);
+  virtual void Close();
+
+protected:
+  virtual TL_ERR WriteRaw(const void *Data, uint32_t Size);
+
+private:
+  HANDLE FileHndl;
+};
+
+FileWriterWin::FileWriterWin():
+  FileWriter()
+{
+  FileHndl = INVALID_HANDLE_VALUE;
+}
+
+FileWriterWin::~FileWriterWin()
+{
+  Close();
+}
+
+TL_ERR FileWriterWin::Create(const char *FileName)
+{
+  wchar_t *FileNameW;
+
+  if (FileHndl != INVALID_HANDLE_VALUE)
+    return TL_ERR_GENERAL;
+
+  FileNameW = file_name_w_alloc(FileName);
+  if (FileNameW == NULL)
+    return TL_ERR_MEM_ALLOC;
+  FileHndl = ::CreateFileW(FileNameW, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+    FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  file_name_w_free(FileNameW);
+  return FileHndl == INVALID_HANDLE_VALUE ? TL_ERR_GENERAL : TL_ERR_OK;
+}
+
+void FileWriterWin::Close()
+{
+  if (FileHndl != INVALID_HANDLE_VALUE)
+  {
+    Flush();
+    ::CloseHandle(FileHndl);
+    FileHndl = INVALID_HANDLE_VALUE;
+  }
+}
+
+TL_ERR FileWriterWin::WriteRaw(const void *Data, uint32_t Size)
+{
+  BOOL rc;
+  DWORD BytesWritten;
+
+  if (FileHndl == INVALID_HANDLE_VALUE)
+    return TL_ERR_GENERAL;
+
+  rc = ::WriteFile(FileHndl, Data, Size, &BytesWritten, NULL);
+  if (rc != 0 && BytesWritten == Size)
+    return TL_ERR_OK;
+
+  return TL_ERR_GENERAL;
+}
+
+FileWriter *FileWriter::FileWriterCreate()
+{
+  return new FileWriterWin;
+}
+
+/* Replace NewNameW with POSIX semantics: the name is switched at once even
+ * while readers have the old file open, they keep reading the old file */
+static BOOL RenameOverOpenFile(const wchar_t *OldNameW,
+  const wchar_t *NewNameW)
+{
+  BOOL rc = 0;
+#ifdef FILE_RENAME_FLAG_POSIX_SEMANTICS
+  wchar_t FullName[MAX_PATH + 1];
+  FILE_RENAME_INFO *Info;
+  DWORD NameSize, InfoSize;
+  HANDLE Hndl;
+
+  NameSize = ::GetFullPathNameW(NewNameW, MAX_PATH + 1, FullName, NULL);
+  if (NameSize == 0 || NameSize > MAX_PATH)
+    return 0;
+  NameSize *= sizeof(wchar_t);
+  InfoSize = sizeof(FILE_RENAME_INFO) + NameSize;
+  Info = (FILE_RENAME_INFO *)::HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+    InfoSize);
+  if (Info == NULL)
+    return 0;
+  Info->Flags = FILE_RENAME_FLAG_REPLACE_IF_EXISTS |
+    FILE_RENAME_FLAG_POSIX_SEMANTICS;
+  Info->RootDirectory = NULL;
+  Info->FileNameLength = NameSize;
+  ::memcpy(Info->FileName, FullName, NameSize);
+
+  Hndl = ::CreateFileW(OldNameW, DELETE | SYNCHRONIZE,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (Hndl != INVALID_HANDLE_VALUE)
+  {
+    rc = ::SetFileInformationByHandle(Hndl, FileRenameInfoEx, Info, InfoSize);
+    ::CloseHandle(Hndl);
+  }
+  ::HeapFree(GetProcessHeap(), 0, Info);
+#else
+  (void)OldNameW;
+  (void)NewNameW;
+#endif
+  return rc;
+}
+
+TL_ERR FileWriter::RenameFile(const char *OldName, const char *NewName)
+{
+  wchar_t *OldNameW, *NewNameW;
+  BOOL rc = 0;
+  int i;
+
+  OldNameW = file_name_w_alloc(OldName);
+  NewNameW = file_name_w_alloc(NewName);
+  if (OldNameW != NULL && NewNameW != NULL)
+    rc = RenameOverOpenFile(OldNameW, NewNameW);
+  /* Before Windows 10 a file that is open can't be replaced. Readers keep
+   * the file open only for the length of a query, so try again a few times */
+  for (i = 0; rc == 0 && OldNameW != NULL && NewNameW != NULL &&
+    i < FW_RENAME_RETRIES; i++)
+  {
+    rc = ::MoveFileExW(OldNameW, NewNameW, MOVEFILE_REPLACE_EXISTING);
+    if (rc == 0)
+      ::Sleep(FW_RENAME_RETRY_MSEC);
+  }
+  if (OldNameW != NULL)
+    file_name_w_free(OldNameW);
+  if (NewNameW != NULL)
+    file_name_w_free(NewNameW);
+  return rc != 0 ? TL_ERR_OK : TL_ERR_GENERAL;
+}
+
+void FileWriter::RemoveFile(const char *FileName)
+{
+  wchar_t *FileNameW;
+
+  FileNameW = file_name_w_alloc(FileName);
+  if (FileNameW == NULL)
+    return;
+  ::DeleteFileW(FileNameW);
+  file_name_w_free(FileNameW);
+}
@@ -0,0 +1,238 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "file_watch.h"
+
+#include <malloc.h>
+#include <string.h>
+
+using namespace TagLEET;
+
+FileWatch::FileWatch():
+  Generation(0),
+  Active(true)
+{
+  FileName = NULL;
+  BaseName = NULL;
+  Dir = NULL;
+  NextInDir = NULL;
+  InfoValid = false;
+  InfoGen = 0;
+  InfoSize = 0;
+  InfoModTime = 0;
+}
+
+bool FileWatch::GetFileInfo(uint32_t Gen, tf_int_t *Size, uint64_t *ModTime)
+{
+  std::lock_guard<std::mutex> Guard(InfoLock);
+
+  if (!InfoValid || InfoGen != Gen || Generation.load() != Gen ||
+    !Active.load())
+  {
+    return false;
+  }
+  *Size = InfoSize;
+  *ModTime = InfoModTime;
+  return true;
+}
+
+void FileWatch::SetFileInfo(uint32_t Gen, tf_int_t Size, uint64_t ModTime)
+{
+  std::lock_guard<std::mutex> Guard(InfoLock);
+
+  if (Generation.load() != Gen)
+    return;
+  InfoValid = true;
+  InfoGen = Gen;
+  InfoSize = Size;
+  InfoModTime = ModTime;
+}
+
+FileWatcher::FileWatcher()
+{
+  Dirs = NULL;
+  FileCount = 0;
+  Started = false;
+  StartFailed = false;
+  OsHandle = -1;
+}
+
+/* Never destroyed, the watcher threads run until the process exits */
+FileWatcher *FileWatcher::Global()
+{
+  static FileWatcher *Watcher = new FileWatcher();
+  return Watcher;
+}
+
+/* Find or start the watch of a directory. Must be called with the lock
+ * held */
+FwDir *FileWatcher::GetDir(const char *DirPath)
+{
+  FwDir *Dir;
+
+  for (Dir = Dirs; Dir != NULL; Dir = Dir->Next)
+  {
+    if (::strcmp(Dir->Path, DirPath) == 0)
+      return Dir->Active ? Dir : NULL;
+  }
+
+  Dir = (FwDir *)malloc(sizeof(*Dir));
+  if (Dir == NULL)
+    return NULL;
+  Dir->Path = ::_strdup(DirPath);
+  Dir->Files = NULL;
+  Dir->OsHandle = -1;
+  Dir->Active = false;
+  if (Dir->Path == NULL)
+  {
+    free(Dir);
+    return NULL;
+  }
+
+  /* A directory that could not be watched is kept, so it is not retried on
+   * every query */
+  Dir->Active = OsWatchDir(Dir);
+  Dir->Next = Dirs;
+  Dirs = Dir;
+  return Dir->Active ? Dir : NULL;
+}
+
+/* Must be called with the lock held */
+FwDir *FileWatcher::FindDir(intptr_t in_OsHandle)
+{
+  FwDir *Dir;
+
+  for (Dir = Dirs; Dir != NULL; Dir = Dir->Next)
+  {
+    if (Dir->Active && Dir->OsHandle == in_OsHandle)
+      return Dir;
+  }
+  return NULL;
+}
+
+FileWatch *FileWatcher::Watch(const char *FileName)
+{
+  FileWatch *Watch;
+  FwDir *Dir;
+  const char *Sep, *s;
+  char *DirPath;
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  for (Dir = Dirs; Dir != NULL; Dir = Dir->Next)
+  {
+    for (Watch = Dir->Files; Watch != NULL; Watch = Watch->NextInDir)
+    {
+      if (::strcmp(Watch->FileName, FileName) == 0)
+        return Watch;
+    }
+  }
+
+  if (StartFailed || FileCount >= FW_MAX_FILES)
+    return NULL;
+  if (!Started)
+  {
+    Started = OsStart();
+    if (!Started)
+    {
+      StartFailed = true;
+      return NULL;
+    }
+  }
+
+  Sep = NULL;
+  for (s = FileName; *s != '\0'; s++)
+  {
+    if (*s == '/' || *s == '\\')
+      Sep = s;
+  }
+  if (Sep == NULL)
+  {
+    DirPath = ::_strdup(".");
+  }
+  else
+  {
+    DirPath = (char *)malloc(Sep - FileName + 2);
+    if (DirPath != NULL)
+    {
+      /* Keep the separator of a root directory */
+      size_t DirSize = Sep == FileName ? 1 : Sep - FileName;
+      ::memcpy(DirPath, FileName, DirSize);
+      DirPath[DirSize] = '\0';
+    }
+  }
+  if (DirPath == NULL)
+    return NULL;
+
+  Dir = GetDir(DirPath);
+  free(DirPath);
+  if (Dir == NULL)
+    return NULL;
+
+  Watch = new FileWatch();
+  Watch->FileName = ::_strdup(FileName);
+  if (Watch->FileName == NULL)
+  {
+    delete Watch;
+    return NULL;
+  }
+  Watch->BaseName = Watch->FileName + (Sep == NULL ? 0 : Sep - FileName + 1);
+  Watch->Dir = Dir;
+  Watch->NextInDir = Dir->Files;
+  Dir->Files = Watch;
+  FileCount++;
+  return Watch;
+}
+
+/* A file of the directory was changed. Name NULL means any file. Must be
+ * called with the lock held */
+void FileWatcher::OnChange(FwDir *Dir, const char *Name)
+{
+  FileWatch *Watch;
+
+  for (Watch = Dir->Files; Watch != NULL; Watch = Watch->NextInDir)
+  {
+    if (Name == NULL || OsNameEqual(Watch->BaseName, Name))
+      Watch->Generation++;
+  }
+}
+
+/* The directory can no longer be watched. Its files are reported changed
+ * and left to the usual checks. Must be called with the lock held */
+void FileWatcher::OnDirLost(FwDir *Dir)
+{
+  FileWatch *Watch;
+
+  Dir->Active = false;
+  for (Watch = Dir->Files; Watch != NULL; Watch = Watch->NextInDir)
+  {
+    Watch->Active = false;
+    Watch->Generation++;
+  }
+}
+
+/* Events were lost, any file may have changed. Must be called with the lock
+ * held */
+void FileWatcher::OnOverflow()
+{
+  FwDir *Dir;
+
+  for (Dir = Dirs; Dir != NULL; Dir = Dir->Next)
+    OnChange(Dir, NULL);
+}
@@ -0,0 +1,120 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _FILE_WATCH_H_
+#define _FILE_WATCH_H_
+
+#include "tl_types.h"
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+
+namespace TagLEET {
+
+#define FW_MAX_FILES 64
+
+struct FwDir;
+
+/* A watched file. Its generation is bumped by the watcher thread as soon as
+ * the OS reports a write, rename, replace or delete of the file, so a cache
+ * of the file is known to be current without any file system call.
+ * A watch that is not active (its directory is gone) tells nothing and the
+ * file must be checked the usual way. */
+class FileWatch
+{
+public:
+  const char *GetFileName() const { return FileName; }
+  uint32_t GetGeneration() const { return Generation.load(); }
+  bool IsActive() const { return Active.load(); }
+  /* Size and time of the file as recorded at generation Gen. False if the
+   * file changed since or nothing was recorded */
+  bool GetFileInfo(uint32_t Gen, tf_int_t *Size, uint64_t *ModTime);
+  /* Record the size and time of the file, that was opened after the
+   * generation was Gen. Ignored if the file changed meanwhile */
+  void SetFileInfo(uint32_t Gen, tf_int_t Size, uint64_t ModTime);
+
+private:
+  friend class FileWatcher;
+  FileWatch();
+
+  char *FileName;
+  /* Name of the file within its directory, points into FileName */
+  const char *BaseName;
+  FwDir *Dir;
+  FileWatch *NextInDir;
+  std::atomic<uint32_t> Generation;
+  std::atomic<bool> Active;
+
+  std::mutex InfoLock;
+  bool InfoValid;
+  uint32_t InfoGen;
+  tf_int_t InfoSize;
+  uint64_t InfoModTime;
+};
+
+/* A watched directory, files are watched through their directory so that a
+ * tags file that is replaced by a rename is still followed */
+struct FwDir
+{
+  char *Path;
+  FileWatch *Files;
+  FwDir *Next;
+  /* inotify watch descriptor, or directory handle on Windows */
+  intptr_t OsHandle;
+  bool Active;
+};
+
+/* Change notifications of files: inotify on Linux, ReadDirectoryChangesW on
+ * Windows. Watches are kept until the process exits */
+class FileWatcher
+{
+public:
+  static FileWatcher *Global();
+
+  /* Watch a file, or get its existing watch. NULL if the file can not be
+   * watched */
+  FileWatch *Watch(const char *FileName);
+
+private:
+  FileWatcher();
+  FwDir *GetDir(const char *DirPath);
+  FwDir *FindDir(intptr_t OsHandle);
+  void OnChange(FwDir *Dir, const char *Name);
+  void OnDirLost(FwDir *Dir);
+  void OnOverflow();
+
+  /* Implemented by the OS specific files */
+  bool OsStart();
+  bool OsWatchDir(FwDir *Dir);
+  static bool OsNameEqual(const char *Name1, const char *Name2);
+  static void OsThread(FileWatcher *Watcher, FwDir *Dir);
+
+  std::mutex Lock;
+  FwDir *Dirs;
+  uint32_t FileCount;
+  bool Started;
+  bool StartFailed;
+  /* inotify instance on Linux */
+  intptr_t OsHandle;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _FILE_WATCH_H_ */
@@ -0,0 +1,116 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "file_watch.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <thread>
+
+using namespace TagLEET;
+
+#define FW_DIR_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | \
+  IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* One inotify instance and one thread serve all the directories */
+bool FileWatcher::OsStart()
+{
+  int fd = ::inotify_init1(IN_CLOEXEC);
+
+  if (fd == -1)
+    return false;
+  OsHandle = fd;
+  try
+  {
+    std::thread(OsThread, this, (FwDir *)NULL).detach();
+  }
+  catch (...)
+  {
+    ::close(fd);
+    OsHandle = -1;
+    return false;
+  }
+  return true;
+}
+
+bool FileWatcher::OsWatchDir(FwDir *Dir)
+{
+  int wd = ::inotify_add_watch((int)OsHandle, Dir->Path, FW_DIR_EVENTS);
+
+  if (wd == -1)
+    return false;
+  Dir->OsHandle = wd;
+  return true;
+}
+
+bool FileWatcher::OsNameEqual(const char *Name1, const char *Name2)
+{
+  return ::strcmp(Name1, Name2) == 0;
+}
+
+void FileWatcher::OsThread(FileWatcher *Watcher, FwDir *)
+{
+  /* Aligned for struct inotify_event */
+  uint64_t Buff[4096 / sizeof(uint64_t)];
+
+  for (;;)
+  {
+    ssize_t Size = ::read((int)Watcher->OsHandle, Buff, sizeof(Buff));
+    const uint8_t *p = (const uint8_t *)Buff;
+
+    if (Size < 0 && errno == EINTR)
+      continue;
+
+    std::lock_guard<std::mutex> Guard(Watcher->Lock);
+    if (Size <= 0)
+    {
+      /* No more events, nothing can be trusted to be current */
+      FwDir *Dir;
+      for (Dir = Watcher->Dirs; Dir != NULL; Dir = Dir->Next)
+      {
+        if (Dir->Active)
+          Watcher->OnDirLost(Dir);
+      }
+      return;
+    }
+
+    while (p < (const uint8_t *)Buff + Size)
+    {
+      const struct inotify_event *Event = (const struct inotify_event *)p;
+      FwDir *Dir;
+
+      p += sizeof(*Event) + Event->len;
+      if (Event->mask & IN_Q_OVERFLOW)
+      {
+        Watcher->OnOverflow();
+        continue;
+      }
+
+      Dir = Watcher->FindDir(Event->wd);
+      if (Dir == NULL)
+        continue;
+      if (Event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        Watcher->OnDirLost(Dir);
+      else if (Event->len > 0)
+        Watcher->OnChange(Dir, Event->name);
+    }
+  }
+}
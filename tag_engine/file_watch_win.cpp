@@ -0,0 +1,132 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "file_watch.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <string.h>
+#include <thread>
+
+using namespace TagLEET;
+
+#define FW_NOTIFY_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | \
+  FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | \
+  FILE_NOTIFY_CHANGE_CREATION)
+
+/* Each directory has its own thread blocked in ReadDirectoryChangesW */
+bool FileWatcher::OsStart()
+{
+  return true;
+}
+
+bool FileWatcher::OsWatchDir(FwDir *Dir)
+{
+  HANDLE DirHndl;
+  wchar_t *PathW;
+  int Size;
+
+  Size = ::MultiByteToWideChar(CP_UTF8, 0, Dir->Path, -1, NULL, 0);
+  if (Size == 0)
+    return false;
+  PathW = (wchar_t *)::HeapAlloc(GetProcessHeap(), 0, Size * sizeof(wchar_t));
+  if (PathW == NULL)
+    return false;
+  ::MultiByteToWideChar(CP_UTF8, 0, Dir->Path, -1, PathW, Size);
+
+  /* Sharing everything, the watch must not stop ctags from replacing the
+   * files of the directory */
+  DirHndl = ::CreateFileW(PathW, FILE_LIST_DIRECTORY,
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+    OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  ::HeapFree(GetProcessHeap(), 0, PathW);
+  if (DirHndl == INVALID_HANDLE_VALUE)
+    return false;
+
+  Dir->OsHandle = (intptr_t)DirHndl;
+  try
+  {
+    std::thread(OsThread, this, Dir).detach();
+  }
+  catch (...)
+  {
+    ::CloseHandle(DirHndl);
+    Dir->OsHandle = -1;
+    return false;
+  }
+  return true;
+}
+
+bool FileWatcher::OsNameEqual(const char *Name1, const char *Name2)
+{
+  return ::_stricmp(Name1, Name2) == 0;
+}
+
+void FileWatcher::OsThread(FileWatcher *Watcher, FwDir *Dir)
+{
+  /* DWORD aligned for FILE_NOTIFY_INFORMATION */
+  DWORD Buff[16*1024 / sizeof(DWORD)];
+  char Name[MAX_PATH * 3];
+  HANDLE DirHndl = (HANDLE)Dir->OsHandle;
+
+  for (;;)
+  {
+    DWORD Size = 0;
+    BOOL rc;
+    const uint8_t *p = (const uint8_t *)Buff;
+
+    rc = ::ReadDirectoryChangesW(DirHndl, Buff, sizeof(Buff), FALSE,
+      FW_NOTIFY_FILTER, &Size, NULL, NULL);
+
+    std::lock_guard<std::mutex> Guard(Watcher->Lock);
+    if (!rc)
+    {
+      /* The directory was deleted or renamed */
+      Watcher->OnDirLost(Dir);
+      ::CloseHandle(DirHndl);
+      return;
+    }
+    if (Size == 0)
+    {
+      /* The buffer overflowed, events were lost */
+      Watcher->OnChange(Dir, NULL);
+      continue;
+    }
+
+    for (;;)
+    {
+      const FILE_NOTIFY_INFORMATION *Info =
+        (const FILE_NOTIFY_INFORMATION *)p;
+      int NameSize;
+
+      NameSize = ::WideCharToMultiByte(CP_UTF8, 0, Info->FileName,
+        Info->FileNameLength / sizeof(wchar_t), Name, sizeof(Name) - 1,
+        NULL, NULL);
+      if (NameSize > 0)
+      {
+        Name[NameSize] = '\0';
+        Watcher->OnChange(Dir, Name);
+      }
+      if (Info->NextEntryOffset == 0)
+        break;
+      p += Info->NextEntryOffset;
+    }
+  }
+}
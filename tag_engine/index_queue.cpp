@@ -0,0 +1,309 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "index_queue.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace TagLEET;
+
+namespace TagLEET {
+
+struct IqProject
+{
+  std::string TagsFilePath;
+  /* Changed files that no job took yet */
+  std::vector<std::string> Pending;
+  /* When the project is indexed if nothing else changes */
+  uint64_t DueMsec;
+  IQ_JOB_FN JobFn;
+  void *Ctx;
+  IndexJob *Running;
+  IqProject *Next;
+};
+
+struct IqTask
+{
+  std::string TagsFilePath;
+  IQ_JOB_FN TaskFn;
+  void *Ctx;
+  IndexJob *Running;
+  IqTask *Next;
+};
+
+} /* namespace TagLEET */
+
+IndexJob::IndexJob():
+  Canceled(false)
+{
+  Done = 0;
+}
+
+IndexQueue::IndexQueue()
+{
+  Projects = NULL;
+  Tasks = NULL;
+  Started = false;
+  Stopping = false;
+}
+
+IndexQueue *IndexQueue::Global()
+{
+  static IndexQueue *Queue = new IndexQueue();
+  return Queue;
+}
+
+uint64_t IndexQueue::NowMsec()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Must be called with the lock held */
+IqProject *IndexQueue::GetProject(const char *TagsFilePath)
+{
+  IqProject *Project;
+
+  for (Project = Projects; Project != NULL; Project = Project->Next)
+  {
+    if (Project->TagsFilePath == TagsFilePath)
+      return Project;
+  }
+
+  Project = new IqProject;
+  Project->TagsFilePath = TagsFilePath;
+  Project->DueMsec = 0;
+  Project->JobFn = NULL;
+  Project->Ctx = NULL;
+  Project->Running = NULL;
+  Project->Next = Projects;
+  Projects = Project;
+  return Project;
+}
+
+void IndexQueue::AddFile(IqProject *Project, const std::string &FileName)
+{
+  size_t i;
+
+  for (i = 0; i < Project->Pending.size(); i++)
+  {
+    if (Project->Pending[i] == FileName)
+      return;
+  }
+  Project->Pending.push_back(FileName);
+}
+
+/* Start the indexing thread unless it runs. Must be called with the lock
+ * held */
+bool IndexQueue::Start()
+{
+  if (!Started)
+  {
+    try
+    {
+      Thread = std::thread(&IndexQueue::Run, this);
+      Started = true;
+    }
+    catch (...)
+    {
+    }
+  }
+  return Started;
+}
+
+/* Run the first task, if there is one. Must be called with the lock held,
+ * it is released while the task runs */
+bool IndexQueue::RunTask(std::unique_lock<std::mutex> *Guard)
+{
+  IqTask *Task = Tasks;
+  IndexJob *Job;
+
+  if (Task == NULL)
+    return false;
+
+  Job = new IndexJob();
+  Job->TagsFilePath = Task->TagsFilePath;
+  Task->Running = Job;
+  Guard->unlock();
+  Task->TaskFn(Task->Ctx, Job);
+  Guard->lock();
+
+  /* Tasks are posted at the end, it is still the first */
+  Tasks = Task->Next;
+  delete Task;
+  delete Job;
+  return true;
+}
+
+void IndexQueue::Run()
+{
+  std::unique_lock<std::mutex> Guard(Lock);
+
+  for (;;)
+  {
+    IqProject *Project, *Next = NULL;
+    IndexJob *Job;
+    IQ_JOB_FN JobFn;
+    void *Ctx;
+    uint64_t Now;
+    TL_ERR err;
+    uint32_t i;
+
+    if (Stopping)
+      return;
+    if (RunTask(&Guard))
+      continue;
+
+    /* The project that is due first, and has no job running */
+    for (Project = Projects; Project != NULL; Project = Project->Next)
+    {
+      if (Project->Pending.empty() || Project->Running != NULL)
+        continue;
+      if (Next == NULL || Project->DueMsec < Next->DueMsec)
+        Next = Project;
+    }
+    if (Next == NULL)
+    {
+      WorkCond.wait(Guard);
+      continue;
+    }
+    Now = NowMsec();
+    if (Next->DueMsec > Now)
+    {
+      WorkCond.wait_for(Guard, std::chrono::milliseconds(Next->DueMsec - Now));
+      continue;
+    }
+
+    Job = new IndexJob();
+    Job->TagsFilePath = Next->TagsFilePath;
+    Job->Files.swap(Next->Pending);
+    Next->Running = Job;
+    JobFn = Next->JobFn;
+    Ctx = Next->Ctx;
+
+    Guard.unlock();
+    err = JobFn(Ctx, Job);
+    Guard.lock();
+
+    Next->Running = NULL;
+    if (err == TL_ERR_CANCELED)
+    {
+      for (i = Job->Done; i < Job->Files.size(); i++)
+        AddFile(Next, Job->Files[i]);
+    }
+    delete Job;
+  }
+}
+
+void IndexQueue::Submit(const char *TagsFilePath, const char *SrcFileName,
+  uint32_t DebounceMsec, IQ_JOB_FN JobFn, void *Ctx)
+{
+  IndexJob *Job;
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    IqProject *Project;
+
+    if (Stopping)
+      return;
+    if (Start())
+    {
+      Project = GetProject(TagsFilePath);
+      AddFile(Project, SrcFileName);
+      Project->DueMsec = NowMsec() + DebounceMsec;
+      Project->JobFn = JobFn;
+      Project->Ctx = Ctx;
+      if (Project->Running != NULL)
+        Project->Running->Canceled = true;
+      WorkCond.notify_one();
+      return;
+    }
+  }
+
+  /* No thread, index in the foreground */
+  Job = new IndexJob();
+  Job->TagsFilePath = TagsFilePath;
+  Job->Files.push_back(SrcFileName);
+  JobFn(Ctx, Job);
+  delete Job;
+}
+
+bool IndexQueue::Post(const char *TagsFilePath, IQ_JOB_FN TaskFn, void *Ctx)
+{
+  IndexJob *Job;
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    IqTask **Last, *Task;
+
+    if (Stopping)
+      return false;
+    for (Last = &Tasks; *Last != NULL; Last = &(*Last)->Next)
+    {
+      if ((*Last)->TaskFn == TaskFn && (*Last)->TagsFilePath == TagsFilePath)
+        return false;
+    }
+
+    if (Start())
+    {
+      Task = new IqTask;
+      Task->TagsFilePath = TagsFilePath;
+      Task->TaskFn = TaskFn;
+      Task->Ctx = Ctx;
+      Task->Running = NULL;
+      Task->Next = NULL;
+      *Last = Task;
+      WorkCond.notify_one();
+      return true;
+    }
+  }
+
+  /* No thread, run it in the foreground */
+  Job = new IndexJob();
+  Job->TagsFilePath = TagsFilePath;
+  TaskFn(Ctx, Job);
+  delete Job;
+  return true;
+}
+
+void IndexQueue::Shutdown()
+{
+  std::thread Stopped;
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+    IqProject *Project;
+
+    Stopping = true;
+    for (Project = Projects; Project != NULL; Project = Project->Next)
+    {
+      if (Project->Running != NULL)
+        Project->Running->Canceled = true;
+    }
+    if (Tasks != NULL && Tasks->Running != NULL)
+      Tasks->Running->Canceled = true;
+    Stopped.swap(Thread);
+    WorkCond.notify_one();
+  }
+
+  if (Stopped.joinable())
+    Stopped.join();
+}
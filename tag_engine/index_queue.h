@@ -0,0 +1,112 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _INDEX_QUEUE_H_
+#define _INDEX_QUEUE_H_
+
+#include "tl_types.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace TagLEET {
+
+struct IqProject;
+struct IqTask;
+
+/* The changed source files of one project, taken by one run of indexing */
+class IndexJob
+{
+public:
+  const char *GetTagsFilePath() const { return TagsFilePath.c_str(); }
+  uint32_t GetFileCount() const { return (uint32_t)Files.size(); }
+  const char *GetFileName(uint32_t i) const { return Files[i].c_str(); }
+  /* Set once a newer change of the project is queued. The job should stop
+   * and return TL_ERR_CANCELED */
+  bool IsCanceled() const { return Canceled.load(); }
+  /* Files [0, Count) are indexed, a cancelled job queues only the rest
+   * again */
+  void SetDone(uint32_t Count) { Done = Count; }
+
+private:
+  friend class IndexQueue;
+  IndexJob();
+
+  std::string TagsFilePath;
+  std::vector<std::string> Files;
+  std::atomic<bool> Canceled;
+  uint32_t Done;
+};
+
+/* Indexes a job on the indexing thread */
+typedef TL_ERR (*IQ_JOB_FN)(void *Ctx, IndexJob *Job);
+
+/* Indexing of changed source files, off the thread that reports the
+ * changes. Changes are kept per project, that is per tags file, and a
+ * project is indexed once none of its files changed for the debounce time,
+ * with all the files that changed meanwhile. A file is queued once however
+ * many times it changed. A change of a project that is being indexed
+ * cancels the running job, its files that were not indexed yet are indexed
+ * again along with the new ones.
+ * Tasks of a project that are not about changed files, like building an
+ * index next to its tags file, are posted to run on the same thread ahead
+ * of the changed files. Their job has no files.
+ * One thread runs all the jobs, one at a time, until Shutdown */
+class IndexQueue
+{
+public:
+  static IndexQueue *Global();
+
+  /* Queue a changed file. JobFn with Ctx indexes the project, the last
+   * ones given for a project are used */
+  void Submit(const char *TagsFilePath, const char *SrcFileName,
+    uint32_t DebounceMsec, IQ_JOB_FN JobFn, void *Ctx);
+  /* Queue a task of a project. A task that is queued or running with the
+   * same TaskFn for the project is not queued again, then false is returned
+   * and Ctx is not used */
+  bool Post(const char *TagsFilePath, IQ_JOB_FN TaskFn, void *Ctx);
+  /* Cancel the running job and wait for the thread to exit. Changes queued
+   * later are dropped */
+  void Shutdown();
+
+private:
+  IndexQueue();
+  void Run();
+  IqProject *GetProject(const char *TagsFilePath);
+  static void AddFile(IqProject *Project, const std::string &FileName);
+  static uint64_t NowMsec();
+  bool Start();
+  bool RunTask(std::unique_lock<std::mutex> *Guard);
+
+  std::mutex Lock;
+  std::condition_variable WorkCond;
+  IqProject *Projects;
+  /* In the order they were posted, the first one may be running */
+  IqTask *Tasks;
+  std::thread Thread;
+  bool Started;
+  bool Stopping;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _INDEX_QUEUE_H_ */
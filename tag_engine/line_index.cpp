@@ -0,0 +1,366 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "line_index.h"
+#include "tl_simd.h"
+
+#include <malloc.h>
+#include <string.h>
+
+using namespace TagLEET;
+
+/* Bytes read at a time while building an index */
+#define LI_READ_SIZE (1024*1024)
+
+LineIndex::LineIndex()
+{
+  FileSize = 0;
+  ModTime = 0;
+  FileName = NULL;
+  LineStarts = NULL;
+  LineCount = 0;
+  AllocCount = 0;
+  RefCount = 0;
+  Cached = false;
+  Prev = NULL;
+  Next = NULL;
+}
+
+LineIndex::~LineIndex()
+{
+  if (FileName != NULL)
+    ::free(FileName);
+  if (LineStarts != NULL)
+    ::free(LineStarts);
+}
+
+TL_ERR LineIndex::GetLineRange(uint32_t Line, tf_int_t *Offset,
+  uint32_t *Size) const
+{
+  if (Line >= LineCount)
+    return TL_ERR_NOT_EXIST;
+  *Offset = LineStarts[Line];
+  *Size = (uint32_t)(LineStarts[Line + 1] - LineStarts[Line]);
+  return TL_ERR_OK;
+}
+
+/* While building, LineCount is the number of entries in LineStarts */
+TL_ERR LineIndex::AddLine(tf_int_t Offset)
+{
+  if (LineCount == AllocCount)
+  {
+    uint32_t NewCount = AllocCount > 0 ? AllocCount * 2 : 4096;
+    tf_int_t *NewStarts = (tf_int_t *)::realloc(LineStarts,
+      NewCount * sizeof(tf_int_t));
+    if (NewStarts == NULL)
+      return TL_ERR_MEM_ALLOC;
+    LineStarts = NewStarts;
+    AllocCount = NewCount;
+  }
+  LineStarts[LineCount++] = Offset;
+  return TL_ERR_OK;
+}
+
+/* Add the lines that start in Buff, which holds the file bytes from Offset.
+ * A line starts after '\n' and after '\r' that is not followed by '\n'.
+ * PendingCr carries a '\r' at the end of Buff to the next block */
+TL_ERR LineIndex::AddBlock(const uint8_t *Buff, uint32_t Size,
+  tf_int_t Offset, bool *PendingCr)
+{
+  TL_ERR err = TL_ERR_OK;
+  uint32_t i = 0;
+
+  if (*PendingCr)
+  {
+    *PendingCr = false;
+    if (Buff[0] != '\n')
+      err = AddLine(Offset);
+  }
+
+#ifdef TL_USE_SSE2
+  const __m128i Lf = _mm_set1_epi8('\n');
+  const __m128i Cr = _mm_set1_epi8('\r');
+
+  for (; !err && Size - i >= 16; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(Buff + i));
+    uint32_t Mask = (uint32_t)_mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(v, Lf), _mm_cmpeq_epi8(v, Cr)));
+
+    while (Mask != 0 && !err)
+    {
+      uint32_t j = i + lowest_bit_index(Mask);
+      Mask &= Mask - 1;
+      if (Buff[j] == '\r')
+      {
+        if (j + 1 == Size)
+        {
+          *PendingCr = true;
+          continue;
+        }
+        if (Buff[j + 1] == '\n')
+          continue;
+      }
+      err = AddLine(Offset + j + 1);
+    }
+  }
+#endif
+
+  for (; !err && i < Size; i++)
+  {
+    if (Buff[i] == '\r')
+    {
+      if (i + 1 == Size)
+      {
+        *PendingCr = true;
+        continue;
+      }
+      if (Buff[i + 1] == '\n')
+        continue;
+    }
+    else if (Buff[i] != '\n')
+    {
+      continue;
+    }
+    err = AddLine(Offset + i + 1);
+  }
+  return err;
+}
+
+TL_ERR LineIndex::Build(FileReader *fr)
+{
+  TL_ERR err;
+  uint8_t *Buff;
+  uint32_t Size;
+  tf_int_t Offset;
+  bool PendingCr = false;
+  FR_ACCESS SavedAccess = fr->GetAccess();
+
+  FileSize = fr->FileSize;
+  ModTime = fr->ModTime;
+  Buff = (uint8_t *)fr->AllocateMem(LI_READ_SIZE);
+  if (Buff == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  fr->SetAccess(FR_ACCESS_SEQUENTIAL);
+  err = AddLine(0);
+  for (Offset = 0; !err && Offset < FileSize; Offset += Size)
+  {
+    Size = FileSize - Offset < LI_READ_SIZE ? (uint32_t)(FileSize - Offset) :
+      LI_READ_SIZE;
+    err = fr->Read(Offset, Buff, Size);
+    if (!err)
+      err = AddBlock(Buff, Size, Offset, &PendingCr);
+  }
+  fr->SetAccess(SavedAccess);
+  fr->FreeMem(Buff);
+
+  /* A '\r' at the end of the file ends the last line. Then add the end of
+   * the last line, unless the file ended with an EOL that added it */
+  if (!err && PendingCr)
+    err = AddLine(FileSize);
+  if (!err && LineStarts[LineCount - 1] != FileSize)
+    err = AddLine(FileSize);
+  if (err)
+    return err;
+
+  LineCount--;
+  if (AllocCount > LineCount + 1)
+  {
+    tf_int_t *NewStarts = (tf_int_t *)::realloc(LineStarts,
+      (LineCount + 1) * sizeof(tf_int_t));
+    if (NewStarts != NULL)
+    {
+      LineStarts = NewStarts;
+      AllocCount = LineCount + 1;
+    }
+  }
+  return TL_ERR_OK;
+}
+
+LineIndexCache::LineIndexCache()
+{
+  Head = NULL;
+  Tail = NULL;
+  Count = 0;
+  Bytes = 0;
+}
+
+/* Never destroyed, like the other process wide caches */
+LineIndexCache *LineIndexCache::Global()
+{
+  static LineIndexCache *Cache = new LineIndexCache();
+  return Cache;
+}
+
+LineIndex *LineIndexCache::Find(const char *FileName)
+{
+  LineIndex *Index;
+
+  for (Index = Head; Index != NULL; Index = Index->Next)
+  {
+    if (::strcmp(Index->FileName, FileName) == 0)
+      return Index;
+  }
+  return NULL;
+}
+
+/* Remove an index from the cache. It is freed once it is released by all
+ * its users */
+void LineIndexCache::Unlink(LineIndex *Index)
+{
+  if (Index->Prev != NULL)
+    Index->Prev->Next = Index->Next;
+  else
+    Head = Index->Next;
+  if (Index->Next != NULL)
+    Index->Next->Prev = Index->Prev;
+  else
+    Tail = Index->Prev;
+  Index->Prev = NULL;
+  Index->Next = NULL;
+  Index->Cached = false;
+  Count--;
+  Bytes -= Index->AllocCount * sizeof(tf_int_t);
+  if (Index->RefCount == 0)
+    delete Index;
+}
+
+void LineIndexCache::Trim()
+{
+  while (Count > 1 && (Count > LI_MAX_ENTRIES || Bytes > LI_MAX_BYTES))
+    Unlink(Tail);
+}
+
+TL_ERR LineIndexCache::Get(const char *FileName, FileReader *fr,
+  LineIndex **out_Index)
+{
+  TL_ERR err;
+  LineIndex *Index;
+  FileReader *OwnFr = NULL;
+
+  if (FileName != NULL)
+  {
+    tf_int_t Size;
+    uint64_t ModTime;
+
+    if (fr != NULL)
+    {
+      Size = fr->FileSize;
+      ModTime = fr->ModTime;
+    }
+    else
+    {
+      err = FileReader::GetFileInfo(FileName, &Size, &ModTime);
+      if (err)
+        return err;
+    }
+
+    std::lock_guard<std::mutex> Guard(Lock);
+    Index = Find(FileName);
+    if (Index != NULL && Index->FileSize == Size && Index->ModTime == ModTime)
+    {
+      if (Index != Head)
+      {
+        Index->Prev->Next = Index->Next;
+        if (Index->Next != NULL)
+          Index->Next->Prev = Index->Prev;
+        else
+          Tail = Index->Prev;
+        Index->Prev = NULL;
+        Index->Next = Head;
+        Head->Prev = Index;
+        Head = Index;
+      }
+      Index->RefCount++;
+      *out_Index = Index;
+      return TL_ERR_OK;
+    }
+    if (Index != NULL)
+      Unlink(Index);
+  }
+  else if (fr == NULL)
+  {
+    return TL_ERR_INVALID;
+  }
+
+  /* Build without the lock, a file may take a while */
+  if (fr == NULL)
+  {
+    OwnFr = FileReader::FileReaderCreate();
+    if (OwnFr == NULL)
+      return TL_ERR_MEM_ALLOC;
+    err = OwnFr->Open(FileName);
+    if (err)
+    {
+      delete OwnFr;
+      return err;
+    }
+    fr = OwnFr;
+  }
+
+  Index = new LineIndex();
+  err = Index == NULL ? TL_ERR_MEM_ALLOC : Index->Build(fr);
+  if (OwnFr != NULL)
+    delete OwnFr;
+  if (!err && FileName != NULL)
+  {
+    Index->FileName = ::_strdup(FileName);
+    if (Index->FileName == NULL)
+      err = TL_ERR_MEM_ALLOC;
+  }
+  if (err)
+  {
+    delete Index;
+    return err;
+  }
+
+  Index->RefCount = 1;
+  *out_Index = Index;
+  if (FileName == NULL)
+    return TL_ERR_OK;
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  /* Another thread may have built it meanwhile */
+  LineIndex *Old = Find(FileName);
+  if (Old != NULL)
+    Unlink(Old);
+  Index->Next = Head;
+  if (Head != NULL)
+    Head->Prev = Index;
+  else
+    Tail = Index;
+  Head = Index;
+  Index->Cached = true;
+  Count++;
+  Bytes += Index->AllocCount * sizeof(tf_int_t);
+  Trim();
+  return TL_ERR_OK;
+}
+
+void LineIndexCache::Release(LineIndex *Index)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  Index->RefCount--;
+  if (Index->RefCount == 0 && !Index->Cached)
+    delete Index;
+}
@@ -0,0 +1,96 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _LINE_INDEX_H_
+#define _LINE_INDEX_H_
+
+#include "file_reader.h"
+#include <mutex>
+
+namespace TagLEET {
+
+/* Indexes kept by the cache, the least recently used are dropped first */
+#define LI_MAX_ENTRIES 32
+#define LI_MAX_BYTES (32*1024*1024)
+
+/* Start offsets of all the lines of a file. The first line is number 0 */
+class LineIndex
+{
+public:
+  const char *GetFileName() const { return FileName; }
+  uint32_t GetLineCount() const { return LineCount; }
+  /* Byte range of a line, including its EOL */
+  TL_ERR GetLineRange(uint32_t Line, tf_int_t *Offset, uint32_t *Size) const;
+
+  /* The version of the file that was indexed */
+  tf_int_t FileSize;
+  uint64_t ModTime;
+
+private:
+  friend class LineIndexCache;
+  LineIndex();
+  ~LineIndex();
+  TL_ERR Build(FileReader *fr);
+  TL_ERR AddLine(tf_int_t Offset);
+  TL_ERR AddBlock(const uint8_t *Buff, uint32_t Size, tf_int_t Offset,
+    bool *PendingCr);
+
+  char *FileName;
+  /* LineCount + 1 entries, the last is the end of the last line */
+  tf_int_t *LineStarts;
+  uint32_t LineCount;
+  uint32_t AllocCount;
+  uint32_t RefCount;
+  bool Cached;
+  LineIndex *Prev;
+  LineIndex *Next;
+};
+
+/* LRU cache of line indexes of source files. A cached index is used while
+ * the size and modification time of its file did not change */
+class LineIndexCache
+{
+public:
+  static LineIndexCache *Global();
+
+  /* Get the index of a file, building it if needed. fr may be an open
+   * reader of the file, otherwise the file is opened here. Without a
+   * FileName the index is built for fr and not cached. Every index that was
+   * returned must be released */
+  TL_ERR Get(const char *FileName, FileReader *fr, LineIndex **out_Index);
+  void Release(LineIndex *Index);
+
+private:
+  LineIndexCache();
+  LineIndex *Find(const char *FileName);
+  void Unlink(LineIndex *Index);
+  void Trim();
+
+  std::mutex Lock;
+  /* Most recently used first */
+  LineIndex *Head;
+  LineIndex *Tail;
+  uint32_t Count;
+  size_t Bytes;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _LINE_INDEX_H_ */
@@ -0,0 +1,107 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "process_runner.h"
+
+#include <malloc.h>
+#include <stdlib.h>
+
+using namespace TagLEET;
+
+#define PR_INIT_BUFF_SIZE (64*1024)
+
+TL_ERR ProcessRunner::ReadAll(uint32_t MaxSize, PR_PROGRESS_CB Progress,
+  void *Ctx, char **out_Data, uint32_t *out_Size)
+{
+  TL_ERR err = TL_ERR_OK;
+  char *Data = NULL;
+  uint32_t Size = 0;
+  uint32_t Capacity = 0;
+  uint32_t ReadSize;
+  int ExitCode = 1;
+
+  for (;;)
+  {
+    /* One more byte for the terminating '\0' */
+    if (Size + 1 >= Capacity)
+    {
+      uint32_t NewCapacity = Capacity == 0 ? PR_INIT_BUFF_SIZE : Capacity * 2;
+      char *NewData;
+
+      if (Capacity > MaxSize)
+      {
+        err = TL_ERR_TOO_BIG;
+        break;
+      }
+      NewData = (char *)::realloc(Data, NewCapacity);
+      if (NewData == NULL)
+      {
+        err = TL_ERR_MEM_ALLOC;
+        break;
+      }
+      Data = NewData;
+      Capacity = NewCapacity;
+    }
+
+    err = Read(Data + Size, Capacity - Size - 1, &ReadSize);
+    if (err)
+      break;
+    Size += ReadSize;
+    if (Size > MaxSize)
+    {
+      err = TL_ERR_TOO_BIG;
+      break;
+    }
+    if (Progress != NULL && !Progress(Ctx, Size))
+    {
+      err = TL_ERR_CANCELED;
+      break;
+    }
+  }
+
+  if (err == TL_ERR_NO_MORE)
+  {
+    err = Wait(&ExitCode);
+    if (!err && ExitCode != 0)
+      err = TL_ERR_GENERAL;
+  }
+  else
+  {
+    Kill();
+    Wait(&ExitCode);
+  }
+  if (err)
+  {
+    ::free(Data);
+    return err;
+  }
+
+  /* A process without output still gets a buffer */
+  if (Data == NULL)
+  {
+    Data = (char *)::malloc(1);
+    if (Data == NULL)
+      return TL_ERR_MEM_ALLOC;
+  }
+  Data[Size] = '\0';
+  *out_Data = Data;
+  *out_Size = Size;
+  return TL_ERR_OK;
+}
@@ -0,0 +1,69 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _PROCESS_RUNNER_H_
+#define _PROCESS_RUNNER_H_
+
+#include "tl_types.h"
+
+namespace TagLEET {
+
+/* Longest wait of a Read for output, so a caller can report progress and
+ * cancel while the process is silent */
+#define PR_POLL_MSEC 100
+
+/* Called by ReadAll after each read with the number of bytes read so far,
+ * at least every PR_POLL_MSEC. Returning false cancels the run */
+typedef bool (*PR_PROGRESS_CB)(void *Ctx, uint32_t Size);
+
+/* Runs a program with its standard output to a pipe, so the output is read
+ * as it is written instead of from a file once the program is done.
+ * posix_spawn on Linux, CreateProcess on Windows */
+class ProcessRunner
+{
+public:
+  virtual ~ProcessRunner() {}
+
+  /* Run Args[0] with the arguments that follow it, Args ends with NULL.
+   * Dir is the working directory of the process, NULL for the current one.
+   * Its standard input and error are not used. A LowPriority process runs
+   * only when the machine is otherwise idle */
+  virtual TL_ERR Start(const char *const *Args, const char *Dir,
+    bool LowPriority = false) = 0;
+  /* Read output, waiting at most PR_POLL_MSEC. *out_Size is 0 if nothing
+   * came. TL_ERR_NO_MORE once the process closed its output */
+  virtual TL_ERR Read(void *Buff, uint32_t Size, uint32_t *out_Size) = 0;
+  virtual void Kill() = 0;
+  /* Wait for the process to exit */
+  virtual TL_ERR Wait(int *out_ExitCode) = 0;
+
+  /* Read all the output to a buffer allocated with malloc, and wait for the
+   * process. Output longer than MaxSize fails with TL_ERR_TOO_BIG, a
+   * process that did not exit with 0 fails with TL_ERR_GENERAL and a run
+   * cancelled by Progress fails with TL_ERR_CANCELED. The process is killed
+   * on failure. The data is followed by '\0' that is not counted */
+  TL_ERR ReadAll(uint32_t MaxSize, PR_PROGRESS_CB Progress, void *Ctx,
+    char **out_Data, uint32_t *out_Size);
+
+  static ProcessRunner *ProcessRunnerCreate();
+};
+
+} /* namespace TagLEET */
+
+#endif /* _PROCESS_RUNNER_H_ */
@@ -0,0 +1,181 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "process_runner.h"
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+
+using namespace TagLEET;
+
+extern char **environ;
+
+class ProcessRunnerLin : public ProcessRunner
+{
+public:
+  ProcessRunnerLin();
+  virtual ~ProcessRunnerLin();
+
+  virtual TL_ERR Start(const char *const *Args, const char *Dir,
+    bool LowPriority);
+  virtual TL_ERR Read(void *Buff, uint32_t Size, uint32_t *out_Size);
+  virtual void Kill();
+  virtual TL_ERR Wait(int *out_ExitCode);
+
+private:
+  pid_t Pid;
+  int OutFd;
+  bool Exited;
+  int ExitCode;
+};
+
+ProcessRunnerLin::ProcessRunnerLin()
+{
+  Pid = -1;
+  OutFd = -1;
+  Exited = false;
+  ExitCode = -1;
+}
+
+/* A process that is still running is killed, it is never left a zombie */
+ProcessRunnerLin::~ProcessRunnerLin()
+{
+  if (OutFd != -1)
+    ::close(OutFd);
+  if (Pid != -1 && !Exited)
+  {
+    Kill();
+    Wait(&ExitCode);
+  }
+}
+
+TL_ERR ProcessRunnerLin::Start(const char *const *Args, const char *Dir,
+  bool LowPriority)
+{
+  posix_spawn_file_actions_t Actions;
+  posix_spawnattr_t Attr;
+  int Fds[2];
+  int res;
+
+  if (Pid != -1 || Args == NULL || Args[0] == NULL)
+    return TL_ERR_BAD_STATE;
+  if (::pipe2(Fds, O_CLOEXEC) != 0)
+    return TL_ERR_GENERAL;
+
+  /* The child gets only the write end, as its standard output */
+  ::posix_spawn_file_actions_init(&Actions);
+  ::posix_spawn_file_actions_addopen(&Actions, 0, "/dev/null", O_RDONLY, 0);
+  ::posix_spawn_file_actions_adddup2(&Actions, Fds[1], 1);
+  ::posix_spawn_file_actions_addopen(&Actions, 2, "/dev/null", O_WRONLY, 0);
+  if (Dir != NULL)
+    ::posix_spawn_file_actions_addchdir_np(&Actions, Dir);
+  ::posix_spawnattr_init(&Attr);
+#ifdef SCHED_IDLE
+  if (LowPriority)
+  {
+    struct sched_param Param;
+
+    Param.sched_priority = 0;
+    ::posix_spawnattr_setschedpolicy(&Attr, SCHED_IDLE);
+    ::posix_spawnattr_setschedparam(&Attr, &Param);
+    ::posix_spawnattr_setflags(&Attr, POSIX_SPAWN_SETSCHEDULER);
+  }
+#endif
+  res = ::posix_spawnp(&Pid, Args[0], &Actions, &Attr, (char *const *)Args,
+    environ);
+  ::posix_spawnattr_destroy(&Attr);
+  ::posix_spawn_file_actions_destroy(&Actions);
+  ::close(Fds[1]);
+
+  if (res != 0)
+  {
+    ::close(Fds[0]);
+    Pid = -1;
+    return res == ENOENT ? TL_ERR_FILE_NOT_EXIST : TL_ERR_GENERAL;
+  }
+  OutFd = Fds[0];
+  return TL_ERR_OK;
+}
+
+TL_ERR ProcessRunnerLin::Read(void *Buff, uint32_t Size, uint32_t *out_Size)
+{
+  struct pollfd Poll;
+  ssize_t res;
+
+  *out_Size = 0;
+  if (OutFd == -1)
+    return TL_ERR_BAD_STATE;
+
+  Poll.fd = OutFd;
+  Poll.events = POLLIN;
+  Poll.revents = 0;
+  res = ::poll(&Poll, 1, PR_POLL_MSEC);
+  if (res == 0 || (res < 0 && errno == EINTR))
+    return TL_ERR_OK;
+  if (res < 0)
+    return TL_ERR_GENERAL;
+
+  res = ::read(OutFd, Buff, Size);
+  if (res < 0)
+    return errno == EINTR || errno == EAGAIN ? TL_ERR_OK : TL_ERR_GENERAL;
+  if (res == 0)
+    return TL_ERR_NO_MORE;
+  *out_Size = (uint32_t)res;
+  return TL_ERR_OK;
+}
+
+void ProcessRunnerLin::Kill()
+{
+  if (Pid != -1 && !Exited)
+    ::kill(Pid, SIGKILL);
+}
+
+TL_ERR ProcessRunnerLin::Wait(int *out_ExitCode)
+{
+  int Status;
+  pid_t res;
+
+  if (Pid == -1)
+    return TL_ERR_BAD_STATE;
+  if (!Exited)
+  {
+    do
+    {
+      res = ::waitpid(Pid, &Status, 0);
+    } while (res == -1 && errno == EINTR);
+    if (res == -1)
+      return TL_ERR_GENERAL;
+    Exited = true;
+    ExitCode = WIFEXITED(Status) ? WEXITSTATUS(Status) : -1;
+  }
+  *out_ExitCode = ExitCode;
+  return TL_ERR_OK;
+}
+
+ProcessRunner *ProcessRunner::ProcessRunnerCreate()
+{
+  return new ProcessRunnerLin;
+}
@@ -0,0 +1,244 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "process_runner.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <malloc.h>
+#include <string.h>
+#include <string>
+
+using namespace TagLEET;
+
+class ProcessRunnerWin : public ProcessRunner
+{
+public:
+  ProcessRunnerWin();
+  virtual ~ProcessRunnerWin();
+
+  virtual TL_ERR Start(const char *const *Args, const char *Dir,
+    bool LowPriority);
+  virtual TL_ERR Read(void *Buff, uint32_t Size, uint32_t *out_Size);
+  virtual void Kill();
+  virtual TL_ERR Wait(int *out_ExitCode);
+
+private:
+  HANDLE hProcess;
+  HANDLE hOutRead;
+};
+
+ProcessRunnerWin::ProcessRunnerWin()
+{
+  hProcess = NULL;
+  hOutRead = NULL;
+}
+
+ProcessRunnerWin::~ProcessRunnerWin()
+{
+  if (hOutRead != NULL)
+    ::CloseHandle(hOutRead);
+  if (hProcess != NULL)
+  {
+    if (::WaitForSingleObject(hProcess, 0) != WAIT_OBJECT_0)
+      ::TerminateProcess(hProcess, 1);
+    ::CloseHandle(hProcess);
+  }
+}
+
+/* Quote an argument so the C runtime of the process splits it back. Only
+ * backslashes that precede a quote are doubled */
+static void AppendArg(std::string *CmdLine, const char *Arg)
+{
+  uint32_t Slashes = 0;
+
+  if (!CmdLine->empty())
+    *CmdLine += ' ';
+  *CmdLine += '"';
+  for (; *Arg != '\0'; Arg++)
+  {
+    if (*Arg == '\\')
+    {
+      Slashes++;
+      continue;
+    }
+    if (*Arg == '"')
+      CmdLine->append(Slashes * 2 + 1, '\\');
+    else
+      CmdLine->append(Slashes, '\\');
+    Slashes = 0;
+    *CmdLine += *Arg;
+  }
+  CmdLine->append(Slashes * 2, '\\');
+  *CmdLine += '"';
+}
+
+/* The child gets the NUL device as its input and error output and the
+ * write end of the pipe as its output. These are the only handles it
+ * inherits: they are listed in the handle list attribute, and they are
+ * inheritable only during CreateProcess, so a process that another thread
+ * starts meanwhile does not get them */
+TL_ERR ProcessRunnerWin::Start(const char *const *Args, const char *Dir,
+  bool LowPriority)
+{
+  STARTUPINFOEXA Si;
+  PROCESS_INFORMATION Pi;
+  HANDLE hOutWrite, hNul;
+  HANDLE Handles[2];
+  SIZE_T AttrSize = 0;
+  std::string CmdLine;
+  DWORD err = ERROR_SUCCESS;
+  BOOL res;
+
+  if (hProcess != NULL || Args == NULL || Args[0] == NULL)
+    return TL_ERR_BAD_STATE;
+  for (; *Args != NULL; Args++)
+    AppendArg(&CmdLine, *Args);
+
+  if (!::CreatePipe(&hOutRead, &hOutWrite, NULL, 0))
+  {
+    hOutRead = NULL;
+    return TL_ERR_GENERAL;
+  }
+  hNul = ::CreateFileA("NUL", GENERIC_READ | GENERIC_WRITE,
+    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, 0, NULL);
+  if (hNul == INVALID_HANDLE_VALUE)
+  {
+    ::CloseHandle(hOutWrite);
+    ::CloseHandle(hOutRead);
+    hOutRead = NULL;
+    return TL_ERR_GENERAL;
+  }
+
+  ::memset(&Si, 0, sizeof(Si));
+  Si.StartupInfo.cb = sizeof(Si);
+  Si.StartupInfo.dwFlags = STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
+  Si.StartupInfo.wShowWindow = SW_HIDE;
+  Si.StartupInfo.hStdInput = hNul;
+  Si.StartupInfo.hStdOutput = hOutWrite;
+  Si.StartupInfo.hStdError = hNul;
+  Handles[0] = hNul;
+  Handles[1] = hOutWrite;
+
+  ::InitializeProcThreadAttributeList(NULL, 1, 0, &AttrSize);
+  Si.lpAttributeList = (LPPROC_THREAD_ATTRIBUTE_LIST)::malloc(AttrSize);
+  res = Si.lpAttributeList != NULL &&
+    ::InitializeProcThreadAttributeList(Si.lpAttributeList, 1, 0, &AttrSize);
+  if (!res)
+  {
+    ::free(Si.lpAttributeList);
+    Si.lpAttributeList = NULL;
+  }
+  else
+  {
+    res = ::UpdateProcThreadAttribute(Si.lpAttributeList, 0,
+      PROC_THREAD_ATTRIBUTE_HANDLE_LIST, Handles, sizeof(Handles), NULL,
+      NULL);
+  }
+  if (res)
+  {
+    ::SetHandleInformation(hNul, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT);
+    ::SetHandleInformation(hOutWrite, HANDLE_FLAG_INHERIT,
+      HANDLE_FLAG_INHERIT);
+    res = ::CreateProcessA(NULL, &CmdLine[0], NULL, NULL, TRUE,
+      EXTENDED_STARTUPINFO_PRESENT | CREATE_NO_WINDOW |
+      (LowPriority ? BELOW_NORMAL_PRIORITY_CLASS : 0), NULL, Dir,
+      &Si.StartupInfo, &Pi);
+    if (!res)
+      err = ::GetLastError();
+    ::SetHandleInformation(hNul, HANDLE_FLAG_INHERIT, 0);
+    ::SetHandleInformation(hOutWrite, HANDLE_FLAG_INHERIT, 0);
+  }
+  if (Si.lpAttributeList != NULL)
+  {
+    ::DeleteProcThreadAttributeList(Si.lpAttributeList);
+    ::free(Si.lpAttributeList);
+  }
+
+  /* Once the child exits the pipe is closed and Read ends */
+  ::CloseHandle(hNul);
+  ::CloseHandle(hOutWrite);
+  if (!res)
+  {
+    ::CloseHandle(hOutRead);
+    hOutRead = NULL;
+    return err == ERROR_FILE_NOT_FOUND ? TL_ERR_FILE_NOT_EXIST :
+      TL_ERR_GENERAL;
+  }
+  ::CloseHandle(Pi.hThread);
+  hProcess = Pi.hProcess;
+  return TL_ERR_OK;
+}
+
+/* Anonymous pipes can not be waited on, the pipe is peeked and the process
+ * is waited on for a while when it is empty */
+TL_ERR ProcessRunnerWin::Read(void *Buff, uint32_t Size, uint32_t *out_Size)
+{
+  DWORD Avail = 0;
+  DWORD ReadSize;
+
+  *out_Size = 0;
+  if (hOutRead == NULL)
+    return TL_ERR_BAD_STATE;
+
+  if (!::PeekNamedPipe(hOutRead, NULL, 0, NULL, &Avail, NULL))
+    return ::GetLastError() == ERROR_BROKEN_PIPE ? TL_ERR_NO_MORE :
+      TL_ERR_GENERAL;
+  if (Avail == 0)
+  {
+    ::WaitForSingleObject(hProcess, PR_POLL_MSEC);
+    return TL_ERR_OK;
+  }
+
+  if (!::ReadFile(hOutRead, Buff, Avail < Size ? Avail : Size, &ReadSize,
+    NULL))
+  {
+    return ::GetLastError() == ERROR_BROKEN_PIPE ? TL_ERR_NO_MORE :
+      TL_ERR_GENERAL;
+  }
+  *out_Size = ReadSize;
+  return TL_ERR_OK;
+}
+
+void ProcessRunnerWin::Kill()
+{
+  if (hProcess != NULL)
+    ::TerminateProcess(hProcess, 1);
+}
+
+TL_ERR ProcessRunnerWin::Wait(int *out_ExitCode)
+{
+  DWORD ExitCode;
+
+  if (hProcess == NULL)
+    return TL_ERR_BAD_STATE;
+  if (::WaitForSingleObject(hProcess, INFINITE) != WAIT_OBJECT_0 ||
+    !::GetExitCodeProcess(hProcess, &ExitCode))
+  {
+    return TL_ERR_GENERAL;
+  }
+  *out_ExitCode = (int)ExitCode;
+  return TL_ERR_OK;
+}
+
+ProcessRunner *ProcessRunner::ProcessRunnerCreate()
+{
+  return new ProcessRunnerWin;
+}
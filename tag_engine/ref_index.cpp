@@ -0,0 +1,781 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "ref_index.h"
+#include "file_reader.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace TagLEET;
+
+/* Header of a saved reference index. It is followed by the file offsets,
+ * the names, the references, the file pool and the name pool */
+struct RiFileHeader
+{
+  char Magic[4];
+  uint32_t Version;
+  uint64_t TagsFileSize;
+  uint64_t TagsModTime;
+  uint32_t FileCount;
+  uint32_t FilePoolSize;
+  uint32_t NameCount;
+  uint32_t NamePoolSize;
+  uint32_t RefCount;
+  uint32_t Reserved;
+};
+
+static const char RiMagic[4] = {'T', 'L', 'R', 'I'};
+#define RI_VERSION 1
+
+/* Files with a NUL byte in their start are not text */
+#define RI_BINARY_CHECK_SIZE 8192
+/* Each tokenizing thread asks if the update was cancelled once per this
+ * number of files */
+#define RI_CANCEL_CHECK_FILES 16
+
+static bool IsNameStart(uint8_t c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static bool IsNameChar(uint8_t c)
+{
+  return IsNameStart(c) || (c >= '0' && c <= '9');
+}
+
+/* A growing set of distinct names, each gets the next id */
+class RiNameTable
+{
+public:
+  RiNameTable() : HashSize(0) {}
+
+  uint32_t Add(const char *Name, uint32_t Size);
+  uint32_t GetCount() const { return (uint32_t)Offsets.size(); }
+  const char *GetName(uint32_t Id) const { return &Pool[Offsets[Id]]; }
+  uint32_t GetSize(uint32_t Id) const { return Sizes[Id]; }
+
+private:
+  static uint32_t NameHash(const char *Name, uint32_t Size);
+  void Grow();
+
+  std::vector<char> Pool;
+  std::vector<uint32_t> Offsets;
+  std::vector<uint32_t> Sizes;
+  /* Open addressing table of id + 1, HashSize is a power of 2 */
+  std::vector<uint32_t> Table;
+  uint32_t HashSize;
+};
+
+/* FNV-1a */
+uint32_t RiNameTable::NameHash(const char *Name, uint32_t Size)
+{
+  uint32_t Hash = 2166136261U;
+  uint32_t i;
+
+  for (i = 0; i < Size; i++)
+  {
+    Hash ^= (uint8_t)Name[i];
+    Hash *= 16777619U;
+  }
+  return Hash;
+}
+
+void RiNameTable::Grow()
+{
+  uint32_t Mask, i, j;
+
+  HashSize = HashSize == 0 ? 1024 : HashSize * 2;
+  Table.assign(HashSize, 0);
+  Mask = HashSize - 1;
+  for (i = 0; i < Offsets.size(); i++)
+  {
+    j = NameHash(&Pool[Offsets[i]], Sizes[i]) & Mask;
+    while (Table[j] != 0)
+      j = (j + 1) & Mask;
+    Table[j] = i + 1;
+  }
+}
+
+/* Id of a name, a new name is added. Throws when out of memory */
+uint32_t RiNameTable::Add(const char *Name, uint32_t Size)
+{
+  uint32_t Mask, i, Id;
+
+  /* Keep the table at most half full */
+  if (2 * (Offsets.size() + 1) > HashSize)
+    Grow();
+
+  Mask = HashSize - 1;
+  for (i = NameHash(Name, Size) & Mask; Table[i] != 0; i = (i + 1) & Mask)
+  {
+    Id = Table[i] - 1;
+    if (Sizes[Id] == Size && ::memcmp(&Pool[Offsets[Id]], Name, Size) == 0)
+      return Id;
+  }
+
+  Id = (uint32_t)Offsets.size();
+  Offsets.push_back((uint32_t)Pool.size());
+  Sizes.push_back(Size);
+  Pool.insert(Pool.end(), Name, Name + Size);
+  Pool.push_back('\0');
+  Table[i] = Id + 1;
+  return Id;
+}
+
+/* The identifiers of one file. Each reference has the id of its name in
+ * Names and its line, in the order of the file with no repeats in a line */
+struct RiFileRefs
+{
+  RiNameTable Names;
+  std::vector<uint32_t> RefNames;
+  std::vector<uint32_t> RefLines;
+};
+
+static void TokenizeData(const char *Data, uint32_t Size, RiFileRefs *FRefs)
+{
+  std::vector<uint32_t> LastLine;
+  uint32_t Line = 1;
+  uint32_t i = 0, Start, Id;
+
+  while (i < Size)
+  {
+    uint8_t c = (uint8_t)Data[i];
+
+    if (c == '\n')
+    {
+      Line++;
+      i++;
+      continue;
+    }
+    if (!IsNameChar(c))
+    {
+      i++;
+      continue;
+    }
+
+    /* A word that starts with a digit is a number */
+    for (Start = i++; i < Size && IsNameChar((uint8_t)Data[i]); i++);
+    if (!IsNameStart(c) || i - Start > REF_INDEX_MAX_NAME_SIZE)
+      continue;
+
+    Id = FRefs->Names.Add(Data + Start, i - Start);
+    if (Id == LastLine.size())
+      LastLine.push_back(0);
+    if (LastLine[Id] == Line)
+      continue;
+    LastLine[Id] = Line;
+    FRefs->RefNames.push_back(Id);
+    FRefs->RefLines.push_back(Line);
+  }
+}
+
+static TL_ERR TokenizeFile(const char *Path, RiFileRefs *FRefs)
+{
+  TL_ERR err;
+  FileReader *fr;
+  char *Data = NULL;
+  uint32_t Size = 0;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(Path);
+  if (!err && fr->FileSize > REF_INDEX_MAX_FILE_SIZE)
+    err = TL_ERR_FILE_TOO_BIG;
+  if (!err)
+  {
+    fr->SetAccess(FR_ACCESS_ONCE);
+    Size = (uint32_t)fr->FileSize;
+    Data = (char *)::malloc(Size + 1);
+    if (Data == NULL)
+      err = TL_ERR_MEM_ALLOC;
+  }
+  if (!err && Size > 0)
+    err = fr->Read(0, Data, Size);
+  delete fr;
+
+  if (!err && ::memchr(Data, '\0', Size < RI_BINARY_CHECK_SIZE ? Size :
+    RI_BINARY_CHECK_SIZE) != NULL)
+  {
+    err = TL_ERR_INVALID;
+  }
+  if (!err)
+  {
+    try
+    {
+      TokenizeData(Data, Size, FRefs);
+    }
+    catch (...)
+    {
+      err = TL_ERR_MEM_ALLOC;
+    }
+  }
+  ::free(Data);
+  return err;
+}
+
+struct RiCancel
+{
+  TL_CANCEL_CB IsCanceled;
+  void *Ctx;
+  std::atomic<bool> Canceled;
+};
+
+/* Take files to tokenize until there are none left or the update is
+ * cancelled. A file that fails has no references */
+static void TokenizeWorker(const char *const *Paths, uint32_t Count,
+  std::atomic<uint32_t> *Next, RiCancel *Cancel, RiFileRefs *out_FileRefs,
+  TL_ERR *out_Errs)
+{
+  uint32_t i, n;
+
+  for (i = Next->fetch_add(1), n = 0; i < Count; i = Next->fetch_add(1), n++)
+  {
+    if (Cancel->IsCanceled != NULL && n % RI_CANCEL_CHECK_FILES == 0 &&
+      Cancel->IsCanceled(Cancel->Ctx))
+    {
+      Cancel->Canceled = true;
+    }
+    if (Cancel->Canceled)
+      break;
+    out_Errs[i] = TokenizeFile(Paths[i], &out_FileRefs[i]);
+    if (out_Errs[i] != TL_ERR_OK)
+    {
+      out_FileRefs[i].RefNames.clear();
+      out_FileRefs[i].RefLines.clear();
+    }
+  }
+}
+
+static TL_ERR TokenizeFiles(const char *const *Paths, uint32_t Count,
+  uint32_t ThreadCount, RiCancel *Cancel, RiFileRefs *out_FileRefs,
+  TL_ERR *out_Errs)
+{
+  std::vector<std::thread> Threads;
+  std::atomic<uint32_t> Next(0);
+  uint32_t i;
+
+  if (ThreadCount > Count)
+    ThreadCount = Count;
+  /* The calling thread is one of the workers */
+  for (i = 1; i < ThreadCount; i++)
+  {
+    try
+    {
+      Threads.push_back(std::thread(TokenizeWorker, Paths, Count, &Next,
+        Cancel, out_FileRefs, out_Errs));
+    }
+    catch (...)
+    {
+      break;
+    }
+  }
+  TokenizeWorker(Paths, Count, &Next, Cancel, out_FileRefs, out_Errs);
+  for (i = 0; i < Threads.size(); i++)
+    Threads[i].join();
+  return Cancel->Canceled ? TL_ERR_CANCELED : TL_ERR_OK;
+}
+
+ReferenceIndex::ReferenceIndex()
+{
+  FileOffsets = NULL;
+  FilePool = NULL;
+  FileCount = FilePoolSize = 0;
+  Names = NULL;
+  NamePool = NULL;
+  NameCount = NamePoolSize = 0;
+  Refs = NULL;
+  RefCount = 0;
+  TagsFilePath = NULL;
+  TagsFileSize = 0;
+  TagsModTime = 0;
+}
+
+ReferenceIndex::~ReferenceIndex()
+{
+  Reset();
+}
+
+void ReferenceIndex::Reset()
+{
+  ::free(FileOffsets);
+  ::free(FilePool);
+  ::free(Names);
+  ::free(NamePool);
+  ::free(Refs);
+  ::free(TagsFilePath);
+  FileOffsets = NULL;
+  FilePool = NULL;
+  FileCount = FilePoolSize = 0;
+  Names = NULL;
+  NamePool = NULL;
+  NameCount = NamePoolSize = 0;
+  Refs = NULL;
+  RefCount = 0;
+  TagsFilePath = NULL;
+  TagsFileSize = 0;
+  TagsModTime = 0;
+}
+
+TL_ERR ReferenceIndex::SetStamp(const char *in_TagsFilePath)
+{
+  TL_ERR err;
+  tf_int_t Size;
+  uint64_t ModTime;
+  char *Path;
+
+  err = FileReader::GetFileInfo(in_TagsFilePath, &Size, &ModTime);
+  if (err)
+    return err;
+  Path = ::_strdup(in_TagsFilePath);
+  if (Path == NULL)
+    return TL_ERR_MEM_ALLOC;
+  ::free(TagsFilePath);
+  TagsFilePath = Path;
+  TagsFileSize = Size;
+  TagsModTime = ModTime;
+  return TL_ERR_OK;
+}
+
+bool ReferenceIndex::IsValidFor(const char *in_TagsFilePath) const
+{
+  tf_int_t Size;
+  uint64_t ModTime;
+
+  if (TagsFilePath == NULL || ::strcmp(TagsFilePath, in_TagsFilePath) != 0)
+    return false;
+  if (FileReader::GetFileInfo(in_TagsFilePath, &Size, &ModTime) != TL_ERR_OK)
+    return false;
+  return Size == TagsFileSize && ModTime == TagsModTime;
+}
+
+bool ReferenceIndex::Find(const char *Name, uint32_t *out_First,
+  uint32_t *out_Count) const
+{
+  uint32_t Lo = 0, Hi = NameCount, Mid;
+  int Cmp;
+
+  while (Lo < Hi)
+  {
+    Mid = Lo + (Hi - Lo) / 2;
+    Cmp = ::strcmp(NamePool + Names[Mid].NameOffset, Name);
+    if (Cmp == 0)
+    {
+      *out_First = Names[Mid].FirstRef;
+      *out_Count = Names[Mid].RefCount;
+      return true;
+    }
+    if (Cmp < 0)
+      Lo = Mid + 1;
+    else
+      Hi = Mid;
+  }
+  return false;
+}
+
+TL_ERR ReferenceIndex::Update(const char *const *UpdNames,
+  const char *const *Paths, uint32_t Count, uint32_t ThreadCount,
+  TL_CANCEL_CB IsCanceled, void *CancelCtx)
+{
+  TL_ERR err = TL_ERR_OK;
+  std::vector<RiFileRefs> FileRefs;
+  std::vector<TL_ERR> Errs;
+  RiCancel Cancel;
+  uint32_t *NewFileOffsets = NULL;
+  char *NewFilePool = NULL;
+  Name *NewNames = NULL;
+  char *NewNamePool = NULL;
+  Ref *NewRefs = NULL;
+  uint32_t NewNameCount = 0, NewNamePoolSize = 0, NewRefCount = 0;
+  uint32_t FilePoolNeeded = 0;
+  uint32_t i, j, n, Id;
+
+  if (Count == 0)
+    return TL_ERR_OK;
+
+  try
+  {
+    FileRefs.resize(Count);
+    Errs.resize(Count);
+  }
+  catch (...)
+  {
+    return TL_ERR_MEM_ALLOC;
+  }
+  Cancel.IsCanceled = IsCanceled;
+  Cancel.Ctx = CancelCtx;
+  Cancel.Canceled = false;
+  if (TokenizeFiles(Paths, Count, ThreadCount, &Cancel, &FileRefs[0],
+    &Errs[0]) != TL_ERR_OK)
+  {
+    return TL_ERR_CANCELED;
+  }
+
+  try
+  {
+    RiNameTable Files, AllNames;
+    std::vector<uint32_t> FileOf(Count);
+    std::vector<std::vector<uint32_t> > NameOf(Count);
+    std::vector<bool> Replaced, Touched;
+    std::vector<uint32_t> Counts, Order, Pos;
+
+    /* The files and names of the index keep their ids */
+    for (i = 0; i < FileCount; i++)
+      Files.Add(GetFileName(i), (uint32_t)::strlen(GetFileName(i)));
+    for (i = 0; i < Count; i++)
+      FileOf[i] = Files.Add(UpdNames[i], (uint32_t)::strlen(UpdNames[i]));
+    Replaced.assign(Files.GetCount(), false);
+    for (i = 0; i < Count; i++)
+      Replaced[FileOf[i]] = true;
+
+    for (i = 0; i < NameCount; i++)
+    {
+      const char *Str = NamePool + Names[i].NameOffset;
+      AllNames.Add(Str, (uint32_t)::strlen(Str));
+    }
+    for (i = 0; i < Count; i++)
+    {
+      const RiNameTable &Local = FileRefs[i].Names;
+
+      NameOf[i].resize(Local.GetCount());
+      for (j = 0; j < Local.GetCount(); j++)
+        NameOf[i][j] = AllNames.Add(Local.GetName(j), Local.GetSize(j));
+    }
+
+    /* Count the references of each name: those of the files that are not
+     * replaced and the new ones */
+    Counts.assign(AllNames.GetCount(), 0);
+    for (i = 0; i < NameCount; i++)
+    {
+      for (j = 0; j < Names[i].RefCount; j++)
+      {
+        if (!Replaced[Refs[Names[i].FirstRef + j].File])
+          Counts[i]++;
+      }
+    }
+    Touched.assign(AllNames.GetCount(), false);
+    for (i = 0; i < Count; i++)
+    {
+      for (j = 0; j < FileRefs[i].RefNames.size(); j++)
+      {
+        Id = NameOf[i][FileRefs[i].RefNames[j]];
+        Counts[Id]++;
+        Touched[Id] = true;
+      }
+    }
+
+    /* Names with no references are dropped, the others are sorted */
+    for (Id = 0; Id < AllNames.GetCount(); Id++)
+    {
+      if (Counts[Id] == 0)
+        continue;
+      Order.push_back(Id);
+      NewNamePoolSize += AllNames.GetSize(Id) + 1;
+    }
+    std::sort(Order.begin(), Order.end(),
+      [&AllNames](uint32_t a, uint32_t b)
+      { return ::strcmp(AllNames.GetName(a), AllNames.GetName(b)) < 0; });
+    NewNameCount = (uint32_t)Order.size();
+
+    for (i = 0; i < Files.GetCount(); i++)
+      FilePoolNeeded += Files.GetSize(i) + 1;
+    NewFileOffsets = (uint32_t *)::malloc(
+      (Files.GetCount() + 1) * sizeof(uint32_t));
+    NewFilePool = (char *)::malloc(FilePoolNeeded + 1);
+    NewNames = (Name *)::malloc((NewNameCount + 1) * sizeof(Name));
+    NewNamePool = (char *)::malloc(NewNamePoolSize + 1);
+    if (NewFileOffsets == NULL || NewFilePool == NULL || NewNames == NULL ||
+      NewNamePool == NULL)
+    {
+      err = TL_ERR_MEM_ALLOC;
+    }
+
+    /* Place the references of each name in the order of the names */
+    Pos.assign(AllNames.GetCount(), 0);
+    for (i = 0, n = 0; !err && i < NewNameCount; i++)
+    {
+      Id = Order[i];
+      NewNames[i].NameOffset = n;
+      NewNames[i].FirstRef = NewRefCount;
+      NewNames[i].RefCount = Counts[Id];
+      ::memcpy(NewNamePool + n, AllNames.GetName(Id),
+        AllNames.GetSize(Id) + 1);
+      n += AllNames.GetSize(Id) + 1;
+      Pos[Id] = NewRefCount;
+      NewRefCount += Counts[Id];
+    }
+    if (!err)
+    {
+      NewRefs = (Ref *)::malloc((NewRefCount + 1) * sizeof(Ref));
+      if (NewRefs == NULL)
+        err = TL_ERR_MEM_ALLOC;
+    }
+
+    for (i = 0; !err && i < NameCount; i++)
+    {
+      for (j = 0; j < Names[i].RefCount; j++)
+      {
+        const Ref *r = &Refs[Names[i].FirstRef + j];
+        if (!Replaced[r->File])
+          NewRefs[Pos[i]++] = *r;
+      }
+    }
+    for (i = 0; !err && i < Count; i++)
+    {
+      for (j = 0; j < FileRefs[i].RefNames.size(); j++)
+      {
+        Ref *r = &NewRefs[Pos[NameOf[i][FileRefs[i].RefNames[j]]]++];
+        r->File = FileOf[i];
+        r->Line = FileRefs[i].RefLines[j];
+      }
+    }
+    /* The kept references are in order, the new ones need their place */
+    for (i = 0; !err && i < NewNameCount; i++)
+    {
+      if (!Touched[Order[i]])
+        continue;
+      std::sort(NewRefs + NewNames[i].FirstRef,
+        NewRefs + NewNames[i].FirstRef + NewNames[i].RefCount,
+        [](const Ref &a, const Ref &b)
+        { return a.File != b.File ? a.File < b.File : a.Line < b.Line; });
+    }
+
+    for (i = 0, n = 0; !err && i < Files.GetCount(); i++)
+    {
+      NewFileOffsets[i] = n;
+      ::memcpy(NewFilePool + n, Files.GetName(i), Files.GetSize(i) + 1);
+      n += Files.GetSize(i) + 1;
+    }
+    if (!err)
+      FileCount = Files.GetCount();
+  }
+  catch (...)
+  {
+    err = TL_ERR_MEM_ALLOC;
+  }
+
+  if (err)
+  {
+    ::free(NewFileOffsets);
+    ::free(NewFilePool);
+    ::free(NewNames);
+    ::free(NewNamePool);
+    ::free(NewRefs);
+    return err;
+  }
+
+  ::free(FileOffsets);
+  ::free(FilePool);
+  ::free(Names);
+  ::free(NamePool);
+  ::free(Refs);
+  FileOffsets = NewFileOffsets;
+  FilePool = NewFilePool;
+  FilePoolSize = FilePoolNeeded;
+  Names = NewNames;
+  NamePool = NewNamePool;
+  NameCount = NewNameCount;
+  NamePoolSize = NewNamePoolSize;
+  Refs = NewRefs;
+  RefCount = NewRefCount;
+  return TL_ERR_OK;
+}
+
+TL_ERR ReferenceIndex::Save(const char *FileName,
+  const char *in_TagsFilePath)
+{
+  TL_ERR err;
+  FileWriter *fw;
+  std::string TmpPath(FileName);
+  RiFileHeader Hdr;
+
+  err = SetStamp(in_TagsFilePath);
+  if (err)
+    return err;
+
+  ::memset(&Hdr, 0, sizeof(Hdr));
+  ::memcpy(Hdr.Magic, RiMagic, sizeof(Hdr.Magic));
+  Hdr.Version = RI_VERSION;
+  Hdr.TagsFileSize = TagsFileSize;
+  Hdr.TagsModTime = TagsModTime;
+  Hdr.FileCount = FileCount;
+  Hdr.FilePoolSize = FilePoolSize;
+  Hdr.NameCount = NameCount;
+  Hdr.NamePoolSize = NamePoolSize;
+  Hdr.RefCount = RefCount;
+
+  fw = FileWriter::FileWriterCreate();
+  if (fw == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  TmpPath += FW_TMP_EXT;
+  err = fw->Create(TmpPath.c_str());
+  if (!err)
+    err = fw->Write(&Hdr, sizeof(Hdr));
+  if (!err && FileCount > 0)
+    err = fw->Write(FileOffsets, FileCount * sizeof(uint32_t));
+  if (!err && NameCount > 0)
+    err = fw->Write(Names, NameCount * sizeof(Name));
+  if (!err && RefCount > 0)
+    err = fw->Write(Refs, RefCount * sizeof(Ref));
+  if (!err && FilePoolSize > 0)
+    err = fw->Write(FilePool, FilePoolSize);
+  if (!err && NamePoolSize > 0)
+    err = fw->Write(NamePool, NamePoolSize);
+  if (!err)
+    err = fw->Flush();
+  fw->Close();
+  delete fw;
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), FileName);
+  if (err)
+    FileWriter::RemoveFile(TmpPath.c_str());
+  return err;
+}
+
+/* Each string must start in the pool and the pool must end with '\0' so
+ * none of them runs over it */
+static bool ValidStrings(const uint32_t *Offsets, size_t Stride,
+  uint32_t Count, const char *Pool, uint32_t PoolSize)
+{
+  uint32_t i;
+
+  if (Count == 0)
+    return true;
+  if (PoolSize == 0 || Pool[PoolSize - 1] != '\0')
+    return false;
+  for (i = 0; i < Count; i++)
+  {
+    if (*(const uint32_t *)((const char *)Offsets + i * Stride) >= PoolSize)
+      return false;
+  }
+  return true;
+}
+
+TL_ERR ReferenceIndex::Load(const char *FileName,
+  const char *in_TagsFilePath)
+{
+  TL_ERR err;
+  FileReader *fr;
+  RiFileHeader Hdr;
+  tf_int_t Offset;
+  uint32_t i;
+
+  Reset();
+  err = SetStamp(in_TagsFilePath);
+  if (err)
+    return err;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(FileName);
+  if (!err && fr->FileSize < sizeof(Hdr))
+    err = TL_ERR_INVALID;
+  if (!err)
+    err = fr->Read(0, &Hdr, sizeof(Hdr));
+  if (!err && (::memcmp(Hdr.Magic, RiMagic, sizeof(Hdr.Magic)) != 0 ||
+    Hdr.Version != RI_VERSION || fr->FileSize != sizeof(Hdr) +
+    (tf_int_t)Hdr.FileCount * sizeof(uint32_t) +
+    (tf_int_t)Hdr.NameCount * sizeof(Name) +
+    (tf_int_t)Hdr.RefCount * sizeof(Ref) +
+    Hdr.FilePoolSize + Hdr.NamePoolSize))
+  {
+    err = TL_ERR_INVALID;
+  }
+  if (!err && ((tf_int_t)Hdr.TagsFileSize != TagsFileSize ||
+    Hdr.TagsModTime != TagsModTime))
+  {
+    err = TL_ERR_MODIFIED;
+  }
+
+  if (!err)
+  {
+    fr->SetAccess(FR_ACCESS_ONCE);
+    FileOffsets = (uint32_t *)::malloc(
+      (Hdr.FileCount + 1) * sizeof(uint32_t));
+    Names = (Name *)::malloc((Hdr.NameCount + 1) * sizeof(Name));
+    Refs = (Ref *)::malloc((Hdr.RefCount + 1) * sizeof(Ref));
+    FilePool = (char *)::malloc(Hdr.FilePoolSize + 1);
+    NamePool = (char *)::malloc(Hdr.NamePoolSize + 1);
+    if (FileOffsets == NULL || Names == NULL || Refs == NULL ||
+      FilePool == NULL || NamePool == NULL)
+    {
+      err = TL_ERR_MEM_ALLOC;
+    }
+  }
+  Offset = sizeof(Hdr);
+  if (!err && Hdr.FileCount > 0)
+    err = fr->Read(Offset, FileOffsets, Hdr.FileCount * sizeof(uint32_t));
+  Offset += (tf_int_t)Hdr.FileCount * sizeof(uint32_t);
+  if (!err && Hdr.NameCount > 0)
+    err = fr->Read(Offset, Names, Hdr.NameCount * sizeof(Name));
+  Offset += (tf_int_t)Hdr.NameCount * sizeof(Name);
+  if (!err && Hdr.RefCount > 0)
+    err = fr->Read(Offset, Refs, Hdr.RefCount * sizeof(Ref));
+  Offset += (tf_int_t)Hdr.RefCount * sizeof(Ref);
+  if (!err && Hdr.FilePoolSize > 0)
+    err = fr->Read(Offset, FilePool, Hdr.FilePoolSize);
+  Offset += Hdr.FilePoolSize;
+  if (!err && Hdr.NamePoolSize > 0)
+    err = fr->Read(Offset, NamePool, Hdr.NamePoolSize);
+  delete fr;
+
+  if (!err && (!ValidStrings(FileOffsets, sizeof(uint32_t), Hdr.FileCount,
+    FilePool, Hdr.FilePoolSize) || !ValidStrings(&Names[0].NameOffset,
+    sizeof(Name), Hdr.NameCount, NamePool, Hdr.NamePoolSize)))
+  {
+    err = TL_ERR_INVALID;
+  }
+  for (i = 0; !err && i < Hdr.NameCount; i++)
+  {
+    if ((uint64_t)Names[i].FirstRef + Names[i].RefCount > Hdr.RefCount)
+      err = TL_ERR_INVALID;
+  }
+  for (i = 0; !err && i < Hdr.RefCount; i++)
+  {
+    if (Refs[i].File >= Hdr.FileCount)
+      err = TL_ERR_INVALID;
+  }
+
+  if (!err)
+  {
+    FileCount = Hdr.FileCount;
+    FilePoolSize = Hdr.FilePoolSize;
+    NameCount = Hdr.NameCount;
+    NamePoolSize = Hdr.NamePoolSize;
+    RefCount = Hdr.RefCount;
+  }
+  else
+  {
+    Reset();
+  }
+  return err;
+}
@@ -0,0 +1,118 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _REF_INDEX_H_
+#define _REF_INDEX_H_
+
+#include "tl_types.h"
+
+namespace TagLEET {
+
+/* Extension of the reference index, next to the tags file */
+#define REF_INDEX_EXT ".tlr"
+/* Bigger files are left out of the index */
+#define REF_INDEX_MAX_FILE_SIZE (16*1024*1024)
+/* Longer identifiers are left out of the index */
+#define REF_INDEX_MAX_NAME_SIZE 255
+
+/* Inverted index of the identifiers in the source files of a tags file.
+ * Every word that can be an identifier - a letter or '_' and then letters,
+ * digits and '_' - has the sorted list of the files and lines where it is,
+ * one reference per line. So it finds what a whole word Find in Files
+ * finds, comments and strings included, with one binary search.
+ * The identifiers are sorted in a single string pool and their references
+ * are in one array, grouped by identifier and sorted by file and line. The
+ * files are tokenized in parallel. Updating some of the files keeps the
+ * references of the others. The index may be saved next to the tags file,
+ * a saved index is valid only for the version of the tags file it was saved
+ * with. */
+class ReferenceIndex
+{
+public:
+  ReferenceIndex();
+  ~ReferenceIndex();
+
+  /* Replace the references of the named files with what is in them now.
+   * Names are the names of the files as in the tags file, Paths are where
+   * they are read from. A file that cannot be read is left with no
+   * references. The files are tokenized on up to ThreadCount threads.
+   * If IsCanceled returns true the index is left as it was and the update
+   * fails with TL_ERR_CANCELED */
+  TL_ERR Update(const char *const *Names, const char *const *Paths,
+    uint32_t Count, uint32_t ThreadCount, TL_CANCEL_CB IsCanceled = NULL,
+    void *CancelCtx = NULL);
+
+  /* Stamp the index with the tags file as it is now */
+  TL_ERR Save(const char *FileName, const char *in_TagsFilePath);
+  /* Fails with TL_ERR_MODIFIED if the tags file changed since it was saved */
+  TL_ERR Load(const char *FileName, const char *in_TagsFilePath);
+  void Reset();
+  bool IsValidFor(const char *in_TagsFilePath) const;
+  const char *GetTagsFilePath() const { return TagsFilePath; }
+
+  /* Find the references of an identifier, they are at [out_First,
+   * out_First + out_Count) */
+  bool Find(const char *Name, uint32_t *out_First,
+    uint32_t *out_Count) const;
+  uint32_t GetRefFile(uint32_t Ref) const { return Refs[Ref].File; }
+  uint32_t GetRefLine(uint32_t Ref) const { return Refs[Ref].Line; }
+
+  uint32_t GetFileCount() const { return FileCount; }
+  const char *GetFileName(uint32_t File) const
+    { return FilePool + FileOffsets[File]; }
+  uint32_t GetNameCount() const { return NameCount; }
+  uint32_t GetRefCount() const { return RefCount; }
+
+private:
+  struct Ref
+  {
+    uint32_t File;
+    uint32_t Line;
+  };
+
+  struct Name
+  {
+    uint32_t NameOffset;
+    uint32_t FirstRef;
+    uint32_t RefCount;
+  };
+
+  TL_ERR SetStamp(const char *in_TagsFilePath);
+
+  uint32_t *FileOffsets;
+  char *FilePool;
+  uint32_t FileCount;
+  uint32_t FilePoolSize;
+  /* Sorted by name */
+  Name *Names;
+  char *NamePool;
+  uint32_t NameCount;
+  uint32_t NamePoolSize;
+  Ref *Refs;
+  uint32_t RefCount;
+  /* Identity of the tags file the index was saved or loaded with */
+  char *TagsFilePath;
+  tf_int_t TagsFileSize;
+  uint64_t TagsModTime;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _REF_INDEX_H_ */
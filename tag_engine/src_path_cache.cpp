@@ -0,0 +1,250 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "src_path_cache.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <chrono>
+
+using namespace TagLEET;
+
+
+SrcPathCache::SrcPathCache()
+{
+  ::memset(Tables, 0, sizeof(Tables));
+  UseClock = 0;
+}
+
+/* Never destroyed, it may be used by other threads while the process exits */
+SrcPathCache *SrcPathCache::Global()
+{
+  static SrcPathCache *Cache = new SrcPathCache();
+  return Cache;
+}
+
+uint64_t SrcPathCache::NowMsec()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* FNV-1a */
+uint32_t SrcPathCache::NameHash(const char *FileName)
+{
+  uint32_t Hash = 2166136261U;
+
+  for (; *FileName != '\0'; FileName++)
+  {
+    Hash ^= (uint8_t)*FileName;
+    Hash *= 16777619U;
+  }
+  return Hash;
+}
+
+void SrcPathCache::ClearTable(PathTable *Table)
+{
+  uint32_t i;
+
+  for (i = 0; i < SP_HASH_SIZE; i++)
+  {
+    while (Table->Hash[i] != NULL)
+    {
+      PathEntry *Entry = Table->Hash[i];
+      Table->Hash[i] = Entry->Next;
+      ::free(Entry);
+    }
+  }
+  Table->Count = 0;
+}
+
+/* Find the table of a tags file. With Create the least recently used table
+ * is taken over when there is none. Must be called with the lock held */
+SrcPathCache::PathTable *SrcPathCache::GetTable(const char *TagsFilePath,
+  bool Create)
+{
+  PathTable *Victim = NULL;
+  int i;
+
+  for (i = 0; i < SP_MAX_TABLES; i++)
+  {
+    PathTable *Table = Tables[i];
+
+    if (Table == NULL)
+      continue;
+    if (::strcmp(Table->TagsFilePath, TagsFilePath) == 0)
+    {
+      Table->LastUse = ++UseClock;
+      return Table;
+    }
+    if (Victim == NULL || Table->LastUse < Victim->LastUse)
+      Victim = Table;
+  }
+
+  if (!Create)
+    return NULL;
+
+  for (i = 0; i < SP_MAX_TABLES && Tables[i] != NULL; i++);
+  if (i < SP_MAX_TABLES)
+  {
+    Victim = (PathTable *)::malloc(sizeof(PathTable));
+    if (Victim == NULL)
+      return NULL;
+    ::memset(Victim, 0, sizeof(PathTable));
+    Tables[i] = Victim;
+  }
+  else
+  {
+    ClearTable(Victim);
+    ::free(Victim->TagsFilePath);
+  }
+
+  Victim->TagsFilePath = ::_strdup(TagsFilePath);
+  if (Victim->TagsFilePath == NULL)
+  {
+    for (i = 0; Tables[i] != Victim; i++);
+    Tables[i] = NULL;
+    ::free(Victim);
+    return NULL;
+  }
+  Victim->LastUse = ++UseClock;
+  return Victim;
+}
+
+SrcPathCache::PathEntry **SrcPathCache::FindEntry(PathTable *Table,
+  const char *FileName, uint32_t Hash)
+{
+  PathEntry **Link = &Table->Hash[Hash % SP_HASH_SIZE];
+
+  for (; *Link != NULL; Link = &(*Link)->Next)
+  {
+    if ((*Link)->Hash == Hash && ::strcmp((*Link)->FileName, FileName) == 0)
+      break;
+  }
+  return Link;
+}
+
+bool SrcPathCache::Lookup(const char *TagsFilePath, const char *FileName,
+  char *Buff, uint32_t BuffSize, TL_ERR *out_Err)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+  PathTable *Table = GetTable(TagsFilePath, false);
+  PathEntry **Link, *Entry;
+  uint32_t Size;
+
+  if (Table == NULL)
+    return false;
+
+  Link = FindEntry(Table, FileName, NameHash(FileName));
+  Entry = *Link;
+  if (Entry == NULL)
+    return false;
+
+  if (Entry->Path == NULL)
+  {
+    if (NowMsec() < Entry->ExpireMsec)
+    {
+      *out_Err = Entry->Err;
+      return true;
+    }
+    *Link = Entry->Next;
+    ::free(Entry);
+    Table->Count--;
+    return false;
+  }
+
+  Size = (uint32_t)::strlen(Entry->Path) + 1;
+  if (Size > BuffSize)
+    return false;
+  ::memcpy(Buff, Entry->Path, Size);
+  *out_Err = TL_ERR_OK;
+  return true;
+}
+
+void SrcPathCache::Insert(const char *TagsFilePath, const char *FileName,
+  const char *Path, TL_ERR err)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+  PathTable *Table = GetTable(TagsFilePath, true);
+  uint32_t Hash = NameHash(FileName);
+  uint32_t NameSize = (uint32_t)::strlen(FileName) + 1;
+  uint32_t PathSize = Path != NULL ? (uint32_t)::strlen(Path) + 1 : 0;
+  PathEntry **Link, *Entry;
+
+  if (Table == NULL)
+    return;
+
+  Link = FindEntry(Table, FileName, Hash);
+  if (*Link != NULL)
+  {
+    Entry = *Link;
+    *Link = Entry->Next;
+    ::free(Entry);
+    Table->Count--;
+  }
+
+  if (Table->Count >= SP_MAX_PATHS)
+    ClearTable(Table);
+
+  Entry = (PathEntry *)::malloc(sizeof(PathEntry) + NameSize + PathSize);
+  if (Entry == NULL)
+    return;
+
+  Entry->Hash = Hash;
+  Entry->Err = err;
+  Entry->ExpireMsec = Path == NULL ? NowMsec() + SP_NEGATIVE_MSEC : 0;
+  ::memcpy(Entry->FileName, FileName, NameSize);
+  Entry->Path = NULL;
+  if (Path != NULL)
+  {
+    Entry->Path = Entry->FileName + NameSize;
+    ::memcpy(Entry->Path, Path, PathSize);
+  }
+  Entry->Next = Table->Hash[Hash % SP_HASH_SIZE];
+  Table->Hash[Hash % SP_HASH_SIZE] = Entry;
+  Table->Count++;
+}
+
+void SrcPathCache::Forget(const char *TagsFilePath, const char *FileName)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+  PathTable *Table = GetTable(TagsFilePath, false);
+  PathEntry **Link, *Entry;
+
+  if (Table == NULL)
+    return;
+
+  Link = FindEntry(Table, FileName, NameHash(FileName));
+  Entry = *Link;
+  if (Entry == NULL)
+    return;
+  *Link = Entry->Next;
+  ::free(Entry);
+  Table->Count--;
+}
+
+void SrcPathCache::Invalidate(const char *TagsFilePath)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+  PathTable *Table = GetTable(TagsFilePath, false);
+
+  if (Table != NULL)
+    ClearTable(Table);
+}
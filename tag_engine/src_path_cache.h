@@ -0,0 +1,94 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _SRC_PATH_CACHE_H_
+#define _SRC_PATH_CACHE_H_
+
+#include "tl_types.h"
+#include <mutex>
+
+namespace TagLEET {
+
+/* Tags files that have a path table, the least recently used is dropped */
+#define SP_MAX_TABLES 4
+/* Paths kept per tags file, a full table is emptied */
+#define SP_MAX_PATHS 8192
+#define SP_HASH_SIZE 1024
+/* A source file that was not found is tried again after this time */
+#define SP_NEGATIVE_MSEC 5000
+
+/* Resolved paths of the source files named in tags files. A file name of a
+ * tag is resolved once, relative to the tags file directory or by converting
+ * Cygwin and MinGW absolute paths, later lookups give the path that could
+ * be opened. A file name that could not be opened is remembered for a short
+ * while, with the error it got */
+class SrcPathCache
+{
+public:
+  static SrcPathCache *Global();
+
+  /* False when the file name was not resolved yet. Otherwise out_Err is
+   * TL_ERR_OK with the path in Buff, or the error of the failed open */
+  bool Lookup(const char *TagsFilePath, const char *FileName, char *Buff,
+    uint32_t BuffSize, TL_ERR *out_Err);
+  /* Path is NULL for a file name that could not be opened */
+  void Insert(const char *TagsFilePath, const char *FileName,
+    const char *Path, TL_ERR err);
+  /* Drop a file name whose path can no longer be opened */
+  void Forget(const char *TagsFilePath, const char *FileName);
+  void Invalidate(const char *TagsFilePath);
+
+private:
+  SrcPathCache();
+
+  struct PathEntry
+  {
+    PathEntry *Next;
+    uint32_t Hash;
+    TL_ERR Err;
+    uint64_t ExpireMsec;
+    /* FileName is followed by the path in the same allocation */
+    char *Path;
+    char FileName[1];
+  };
+
+  struct PathTable
+  {
+    char *TagsFilePath;
+    uint32_t LastUse;
+    uint32_t Count;
+    PathEntry *Hash[SP_HASH_SIZE];
+  };
+
+  PathTable *GetTable(const char *TagsFilePath, bool Create);
+  PathEntry **FindEntry(PathTable *Table, const char *FileName,
+    uint32_t Hash);
+  static void ClearTable(PathTable *Table);
+  static uint32_t NameHash(const char *FileName);
+  static uint64_t NowMsec();
+
+  std::mutex Lock;
+  PathTable *Tables[SP_MAX_TABLES];
+  uint32_t UseClock;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _SRC_PATH_CACHE_H_ */
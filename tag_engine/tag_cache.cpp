@@ -0,0 +1,273 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_cache.h"
+
+#include <malloc.h>
+#include <string.h>
+
+using namespace TagLEET;
+
+TagListResult::TagListResult():
+  Mem(16*1024, sizeof(void *)),
+  RefCount(1)
+{
+  List = NULL;
+  Count = 0;
+  TagsCaseInsensitive = false;
+}
+
+TagListResult::~TagListResult()
+{
+}
+
+void TagListResult::AddRef()
+{
+  RefCount++;
+}
+
+void TagListResult::Release()
+{
+  if (--RefCount == 0)
+    delete this;
+}
+
+uint32_t TagListResult::GetMemSize() const
+{
+  return Mem.GetAllocatedSize() + (uint32_t)sizeof(*this);
+}
+
+TagResultCache::TagResultCache(uint32_t in_MaxEntries, uint64_t in_MaxBytes)
+{
+  Head = Tail = NULL;
+  MaxEntries = in_MaxEntries;
+  MaxBytes = in_MaxBytes;
+  ::memset(&Stats, 0, sizeof(Stats));
+}
+
+TagResultCache::~TagResultCache()
+{
+  Clear();
+}
+
+/* The cache shared by all the TagLists of the process */
+TagResultCache *TagResultCache::Global()
+{
+  static TagResultCache Cache;
+  return &Cache;
+}
+
+uint32_t TagResultCache::KeyHash(const TagResultKey *Key)
+{
+  const char *s;
+  uint32_t h = 2166136261u;
+
+  for (s = Key->TagsFilePath; *s != '\0'; s++)
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  for (s = Key->Tag; *s != '\0'; s++)
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  return h ^ (Key->PrefixMatch ? 1 : 0);
+}
+
+void TagResultCache::Unlink(CacheEntry *Entry)
+{
+  if (Entry->Prev != NULL)
+    Entry->Prev->Next = Entry->Next;
+  else
+    Head = Entry->Next;
+  if (Entry->Next != NULL)
+    Entry->Next->Prev = Entry->Prev;
+  else
+    Tail = Entry->Prev;
+}
+
+void TagResultCache::LinkFirst(CacheEntry *Entry)
+{
+  Entry->Prev = NULL;
+  Entry->Next = Head;
+  if (Head != NULL)
+    Head->Prev = Entry;
+  else
+    Tail = Entry;
+  Head = Entry;
+}
+
+void TagResultCache::RemoveEntry(CacheEntry *Entry)
+{
+  Unlink(Entry);
+  Stats.EntryCount--;
+  Stats.MemBytes -= Entry->MemSize;
+  Entry->Result->Release();
+  free(Entry->TagsFilePath);
+  free(Entry->Tag);
+  free(Entry);
+}
+
+/* Evict the least recently used entries until there is room for NewEntries
+ * more entries of NewBytes */
+void TagResultCache::Shrink(uint32_t NewEntries, uint64_t NewBytes)
+{
+  while (Tail != NULL && (Stats.EntryCount + NewEntries > MaxEntries ||
+    Stats.MemBytes + NewBytes > MaxBytes))
+  {
+    RemoveEntry(Tail);
+    Stats.Evictions++;
+  }
+}
+
+/* Get the result of a query. The returned result has a reference that the
+ * caller must release. Return NULL on a miss */
+TagListResult *TagResultCache::Lookup(const TagResultKey *Key)
+{
+  CacheEntry *Entry, *Next;
+  TagListResult *Result = NULL;
+  uint32_t Hash = KeyHash(Key);
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  for (Entry = Head; Entry != NULL; Entry = Next)
+  {
+    Next = Entry->Next;
+    if (::strcmp(Entry->TagsFilePath, Key->TagsFilePath) != 0)
+      continue;
+
+    if (Entry->FileSize != Key->FileSize || Entry->ModTime != Key->ModTime ||
+      Entry->WatchGen != Key->WatchGen)
+    {
+      /* The tags file was modified since this result was created */
+      RemoveEntry(Entry);
+      Stats.Invalidations++;
+      continue;
+    }
+
+    if (Result == NULL && Entry->Hash == Hash &&
+      Entry->PrefixMatch == Key->PrefixMatch &&
+      Entry->MaxItemCount == Key->MaxItemCount &&
+      ::strcmp(Entry->Tag, Key->Tag) == 0)
+    {
+      Result = Entry->Result;
+      Result->AddRef();
+      Unlink(Entry);
+      LinkFirst(Entry);
+    }
+  }
+
+  if (Result != NULL)
+    Stats.Hits++;
+  else
+    Stats.Misses++;
+  return Result;
+}
+
+/* Publish a result. The cache takes its own reference so the caller keeps
+ * its reference */
+void TagResultCache::Insert(const TagResultKey *Key, TagListResult *Result)
+{
+  CacheEntry *Entry;
+  uint32_t Hash = KeyHash(Key);
+  uint32_t MemSize = Result->GetMemSize();
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  if (MaxEntries == 0 || MemSize > MaxBytes)
+    return;
+
+  /* Another list may have published the same query meanwhile */
+  for (Entry = Head; Entry != NULL; Entry = Entry->Next)
+  {
+    if (Entry->Hash == Hash && Entry->FileSize == Key->FileSize &&
+      Entry->ModTime == Key->ModTime && Entry->WatchGen == Key->WatchGen &&
+      Entry->PrefixMatch == Key->PrefixMatch &&
+      Entry->MaxItemCount == Key->MaxItemCount &&
+      ::strcmp(Entry->Tag, Key->Tag) == 0 &&
+      ::strcmp(Entry->TagsFilePath, Key->TagsFilePath) == 0)
+    {
+      return;
+    }
+  }
+
+  Entry = (CacheEntry *)malloc(sizeof(*Entry));
+  if (Entry == NULL)
+    return;
+  Entry->TagsFilePath = ::_strdup(Key->TagsFilePath);
+  Entry->Tag = ::_strdup(Key->Tag);
+  if (Entry->TagsFilePath == NULL || Entry->Tag == NULL)
+  {
+    free(Entry->TagsFilePath);
+    free(Entry->Tag);
+    free(Entry);
+    return;
+  }
+
+  Shrink(1, MemSize);
+  Entry->FileSize = Key->FileSize;
+  Entry->ModTime = Key->ModTime;
+  Entry->WatchGen = Key->WatchGen;
+  Entry->Hash = Hash;
+  Entry->MaxItemCount = Key->MaxItemCount;
+  Entry->PrefixMatch = Key->PrefixMatch;
+  Entry->MemSize = MemSize;
+  Entry->Result = Result;
+  Result->AddRef();
+  LinkFirst(Entry);
+  Stats.EntryCount++;
+  Stats.MemBytes += MemSize;
+  Stats.Insertions++;
+}
+
+void TagResultCache::InvalidateFile(const char *TagsFilePath)
+{
+  CacheEntry *Entry, *Next;
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  for (Entry = Head; Entry != NULL; Entry = Next)
+  {
+    Next = Entry->Next;
+    if (::strcmp(Entry->TagsFilePath, TagsFilePath) == 0)
+    {
+      RemoveEntry(Entry);
+      Stats.Invalidations++;
+    }
+  }
+}
+
+void TagResultCache::Clear()
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  while (Head != NULL)
+    RemoveEntry(Head);
+}
+
+void TagResultCache::SetLimits(uint32_t in_MaxEntries, uint64_t in_MaxBytes)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  MaxEntries = in_MaxEntries;
+  MaxBytes = in_MaxBytes;
+  Shrink(0, 0);
+}
+
+void TagResultCache::GetStats(TagResultCacheStats *out_Stats)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  *out_Stats = Stats;
+  out_Stats->MaxEntries = MaxEntries;
+  out_Stats->MaxBytes = MaxBytes;
+}
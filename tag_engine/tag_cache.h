@@ -0,0 +1,131 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TAG_CACHE_H_
+#define _TAG_CACHE_H_
+
+#include "tag_list.h"
+#include <atomic>
+#include <mutex>
+
+namespace TagLEET {
+
+/* Immutable result of a tags query: the items of a TagList.
+ * A result is shared, with a reference count, between the TagLists that show
+ * it and the result cache. It must not be modified once it was published */
+class TagListResult
+{
+public:
+  TagListResult();
+  void AddRef();
+  void Release();
+  uint32_t GetMemSize() const;
+
+  TagList::TagListItem *List;
+  uint32_t Count;
+  bool TagsCaseInsensitive;
+  TfAllocator Mem;
+
+private:
+  ~TagListResult();
+  std::atomic<uint32_t> RefCount;
+};
+
+/* Identity of a query. FileSize, ModTime and WatchGen are the generation of
+ * the tags file, a query on a rewritten file never matches an older result.
+ * WatchGen is the FileWatch generation of the file, 0 if not watched, it
+ * tells apart versions written within the same second */
+struct TagResultKey
+{
+  const char *TagsFilePath;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+  uint32_t WatchGen;
+  const char *Tag;
+  bool PrefixMatch;
+  uint32_t MaxItemCount;
+};
+
+struct TagResultCacheStats
+{
+  uint64_t Hits;
+  uint64_t Misses;
+  uint64_t Insertions;
+  uint64_t Evictions;
+  uint64_t Invalidations;
+  uint32_t EntryCount;
+  uint32_t MaxEntries;
+  uint64_t MemBytes;
+  uint64_t MaxBytes;
+};
+
+/* Bounded LRU cache of query results.
+ * Entries of a tags file are dropped as soon as a query sees a different
+ * generation of that file, or when the file is explicitly invalidated. */
+class TagResultCache
+{
+public:
+  TagResultCache(uint32_t in_MaxEntries = 64,
+    uint64_t in_MaxBytes = 16*1024*1024);
+  ~TagResultCache();
+
+  static TagResultCache *Global();
+
+  TagListResult *Lookup(const TagResultKey *Key);
+  void Insert(const TagResultKey *Key, TagListResult *Result);
+  void InvalidateFile(const char *TagsFilePath);
+  void Clear();
+  void SetLimits(uint32_t in_MaxEntries, uint64_t in_MaxBytes);
+  void GetStats(TagResultCacheStats *Stats);
+
+private:
+  struct CacheEntry
+  {
+    CacheEntry *Prev;
+    CacheEntry *Next;
+    char *TagsFilePath;
+    char *Tag;
+    tf_int_t FileSize;
+    uint64_t ModTime;
+    uint32_t WatchGen;
+    uint32_t Hash;
+    uint32_t MaxItemCount;
+    bool PrefixMatch;
+    uint32_t MemSize;
+    TagListResult *Result;
+  };
+
+  static uint32_t KeyHash(const TagResultKey *Key);
+  void Unlink(CacheEntry *Entry);
+  void LinkFirst(CacheEntry *Entry);
+  void RemoveEntry(CacheEntry *Entry);
+  void Shrink(uint32_t NewEntries, uint64_t NewBytes);
+
+  std::mutex Lock;
+  CacheEntry *Head;
+  CacheEntry *Tail;
+  uint32_t MaxEntries;
+  uint64_t MaxBytes;
+  TagResultCacheStats Stats;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_CACHE_H_ */
@@ -0,0 +1,529 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_complete.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <string>
+
+using namespace TagLEET;
+
+/* Header of a saved completion index file */
+struct TcFileHeader
+{
+  char Magic[4];
+  uint32_t Version;
+  uint64_t FileSize;
+  uint64_t ModTime;
+  uint32_t Count;
+  uint32_t PoolSize;
+  uint32_t CaseInsensitive;
+  uint32_t Reserved;
+};
+
+static const char TcMagic[4] = {'T', 'L', 'C', 'I'};
+#define TC_VERSION 2
+
+/* A build asks if it was cancelled once per this number of tag lines */
+#define TC_CANCEL_CHECK_LINES 8192
+
+TagCompletionIndex::TagCompletionIndex()
+{
+  NameOffsets = NULL;
+  Weights = NULL;
+  MaxTree = NULL;
+  Pool = NULL;
+  TagsFilePath = NULL;
+  Count = Capacity = 0;
+  PoolSize = PoolCapacity = 0;
+  FileSize = 0;
+  ModTime = 0;
+  CaseInsensitive = false;
+}
+
+TagCompletionIndex::~TagCompletionIndex()
+{
+  Reset();
+}
+
+void TagCompletionIndex::Reset()
+{
+  ::free(NameOffsets);
+  ::free(Weights);
+  ::free(MaxTree);
+  ::free(Pool);
+  ::free(TagsFilePath);
+  NameOffsets = NULL;
+  Weights = NULL;
+  MaxTree = NULL;
+  Pool = NULL;
+  TagsFilePath = NULL;
+  Count = Capacity = 0;
+  PoolSize = PoolCapacity = 0;
+}
+
+TL_ERR TagCompletionIndex::SetStamp(const char *in_TagsFilePath,
+  const TagFile *tf)
+{
+  FileReader *fr = tf->GetFileReader();
+
+  ::free(TagsFilePath);
+  TagsFilePath = ::_strdup(in_TagsFilePath);
+  if (TagsFilePath == NULL)
+    return TL_ERR_MEM_ALLOC;
+  FileSize = fr->FileSize;
+  ModTime = fr->ModTime;
+  CaseInsensitive = tf->IsCaseInsensitive();
+  return TL_ERR_OK;
+}
+
+bool TagCompletionIndex::IsValidFor(const char *in_TagsFilePath,
+  const TagFile *tf) const
+{
+  FileReader *fr = tf->GetFileReader();
+
+  if (TagsFilePath == NULL || fr == NULL)
+    return false;
+  return ::strcmp(TagsFilePath, in_TagsFilePath) == 0 &&
+    FileSize == fr->FileSize && ModTime == fr->ModTime;
+}
+
+TL_ERR TagCompletionIndex::AddTag(const char *Tag, uint32_t TagSize)
+{
+  if (Count == Capacity)
+  {
+    uint32_t NewCapacity = Capacity == 0 ? 4*1024 : Capacity * 2;
+    uint32_t *NewOffsets, *NewWeights;
+
+    NewOffsets = (uint32_t *)::realloc(NameOffsets,
+      NewCapacity * sizeof(uint32_t));
+    if (NewOffsets == NULL)
+      return TL_ERR_MEM_ALLOC;
+    NameOffsets = NewOffsets;
+    NewWeights = (uint32_t *)::realloc(Weights, NewCapacity * sizeof(uint32_t));
+    if (NewWeights == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Weights = NewWeights;
+    Capacity = NewCapacity;
+  }
+
+  if (PoolSize + TagSize + 1 > PoolCapacity)
+  {
+    uint32_t NewCapacity = PoolCapacity == 0 ? 64*1024 : PoolCapacity * 2;
+    char *NewPool;
+
+    while (PoolSize + TagSize + 1 > NewCapacity)
+      NewCapacity *= 2;
+    NewPool = (char *)::realloc(Pool, NewCapacity);
+    if (NewPool == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Pool = NewPool;
+    PoolCapacity = NewCapacity;
+  }
+
+  NameOffsets[Count] = PoolSize;
+  Weights[Count] = 1;
+  ::memcpy(Pool + PoolSize, Tag, TagSize);
+  Pool[PoolSize + TagSize] = '\0';
+  PoolSize += TagSize + 1;
+  Count++;
+  return TL_ERR_OK;
+}
+
+/* Build the tree used to find the heaviest tag in a range. Node i holds the
+ * index of the max weight of nodes 2i and 2i+1 */
+TL_ERR TagCompletionIndex::BuildMaxTree()
+{
+  uint32_t i;
+
+  ::free(MaxTree);
+  MaxTree = NULL;
+  if (Count == 0)
+    return TL_ERR_OK;
+
+  MaxTree = (uint32_t *)::malloc(2 * Count * sizeof(uint32_t));
+  if (MaxTree == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  for (i = 0; i < Count; i++)
+    MaxTree[Count + i] = i;
+  for (i = Count - 1; i > 0; i--)
+  {
+    uint32_t l = MaxTree[2*i];
+    uint32_t r = MaxTree[2*i + 1];
+    MaxTree[i] = Weights[r] > Weights[l] ? r : l;
+  }
+  return TL_ERR_OK;
+}
+
+TL_ERR TagCompletionIndex::Build(TagFile *tf, const char *in_TagsFilePath,
+  TL_CANCEL_CB IsCanceled, void *CancelCtx)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  const char *Line;
+  const char *PrevTag = NULL;
+  uint32_t PrevTagSize = 0;
+  uint32_t RunStart = 0, i, LineCount = 0;
+  int (*StrnCmp)(const char *s1, const char *s2, size_t n);
+
+  Reset();
+  StrnCmp = tf->IsCaseInsensitive() ? TagLEET::strnicmp : ::strncmp;
+  if (tf->GetFileReader() == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+
+  err = Rb.InitSequential(tf->GetFileReader(), 0, 128*1024, FR_ACCESS_ONCE);
+  if (err)
+    return err == TL_ERR_NO_MORE ? SetStamp(in_TagsFilePath, tf) : err;
+
+  for (;;)
+  {
+    if (IsCanceled != NULL && ++LineCount % TC_CANCEL_CHECK_LINES == 0 &&
+      IsCanceled(CancelCtx))
+    {
+      Reset();
+      return TL_ERR_CANCELED;
+    }
+    err = Rb.FindNextFullLine(true);
+    if (err == TL_ERR_LINE_TOO_BIG)
+      continue;
+    if (err)
+      break;
+
+    Line = (char *)Rb.Buff + Rb.LineOffset;
+    /* Skip pseudo tags and lines that are not tags */
+    if (Rb.TagSize == 0 || (Line[0] == '!' && Rb.TagSize > 1 && Line[1] == '_'))
+      continue;
+
+    /* The file is sorted, so all lines of a tag are in one run of lines
+     * that are equal by the case rule of the file. In a foldcase file the
+     * case variants of a tag may interleave in the run */
+    if (PrevTag != NULL && PrevTagSize == Rb.TagSize &&
+      StrnCmp(PrevTag, Line, Rb.TagSize) == 0)
+    {
+      for (i = RunStart; i < Count; i++)
+      {
+        if (::memcmp(Pool + NameOffsets[i], Line, Rb.TagSize) == 0)
+          break;
+      }
+      if (i < Count)
+      {
+        Weights[i]++;
+        continue;
+      }
+    }
+    else
+    {
+      RunStart = Count;
+    }
+
+    err = AddTag(Line, Rb.TagSize);
+    if (err)
+    {
+      Reset();
+      return err;
+    }
+    PrevTag = Pool + NameOffsets[Count - 1];
+    PrevTagSize = Rb.TagSize;
+  }
+
+  if (err != TL_ERR_NO_MORE)
+  {
+    Reset();
+    return err;
+  }
+
+  err = BuildMaxTree();
+  if (!err)
+    err = SetStamp(in_TagsFilePath, tf);
+  if (err)
+    Reset();
+  return err;
+}
+
+TL_ERR TagCompletionIndex::Save(const char *FileName) const
+{
+  TL_ERR err;
+  FileWriter *fw;
+  std::string TmpPath(FileName);
+  TcFileHeader Hdr;
+
+  if (TagsFilePath == NULL)
+    return TL_ERR_BAD_STATE;
+
+  ::memset(&Hdr, 0, sizeof(Hdr));
+  ::memcpy(Hdr.Magic, TcMagic, sizeof(Hdr.Magic));
+  Hdr.Version = TC_VERSION;
+  Hdr.FileSize = FileSize;
+  Hdr.ModTime = ModTime;
+  Hdr.Count = Count;
+  Hdr.PoolSize = PoolSize;
+  Hdr.CaseInsensitive = CaseInsensitive ? 1 : 0;
+
+  fw = FileWriter::FileWriterCreate();
+  if (fw == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  TmpPath += FW_TMP_EXT;
+  err = fw->Create(TmpPath.c_str());
+  if (!err)
+    err = fw->Write(&Hdr, sizeof(Hdr));
+  if (!err && Count > 0)
+    err = fw->Write(NameOffsets, Count * sizeof(uint32_t));
+  if (!err && Count > 0)
+    err = fw->Write(Weights, Count * sizeof(uint32_t));
+  if (!err && PoolSize > 0)
+    err = fw->Write(Pool, PoolSize);
+  if (!err)
+    err = fw->Flush();
+  fw->Close();
+  delete fw;
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), FileName);
+  if (err)
+    FileWriter::RemoveFile(TmpPath.c_str());
+  return err;
+}
+
+/* Load a saved index. Fails with TL_ERR_MODIFIED if it was not saved for the
+ * current version of the tags file */
+TL_ERR TagCompletionIndex::Load(const char *FileName, TagFile *tf,
+  const char *in_TagsFilePath)
+{
+  TL_ERR err;
+  FileReader *fr, *TagsFr = tf->GetFileReader();
+  TcFileHeader Hdr;
+  uint32_t i;
+
+  Reset();
+  if (TagsFr == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(FileName);
+  if (!err && fr->FileSize < sizeof(Hdr))
+    err = TL_ERR_INVALID;
+  if (!err)
+    err = fr->Read(0, &Hdr, sizeof(Hdr));
+  if (!err && (::memcmp(Hdr.Magic, TcMagic, sizeof(Hdr.Magic)) != 0 ||
+    Hdr.Version != TC_VERSION ||
+    fr->FileSize != sizeof(Hdr) + 2 * (tf_int_t)Hdr.Count * sizeof(uint32_t) +
+    Hdr.PoolSize))
+  {
+    err = TL_ERR_INVALID;
+  }
+  if (!err && (Hdr.FileSize != TagsFr->FileSize ||
+    Hdr.ModTime != TagsFr->ModTime ||
+    (Hdr.CaseInsensitive != 0) != tf->IsCaseInsensitive()))
+  {
+    err = TL_ERR_MODIFIED;
+  }
+
+  if (!err && Hdr.Count > 0)
+  {
+    NameOffsets = (uint32_t *)::malloc(Hdr.Count * sizeof(uint32_t));
+    Weights = (uint32_t *)::malloc(Hdr.Count * sizeof(uint32_t));
+    Pool = (char *)::malloc(Hdr.PoolSize);
+    if (NameOffsets == NULL || Weights == NULL || Pool == NULL)
+      err = TL_ERR_MEM_ALLOC;
+    if (!err)
+      err = fr->Read(sizeof(Hdr), NameOffsets, Hdr.Count * sizeof(uint32_t));
+    if (!err)
+      err = fr->Read(sizeof(Hdr) + Hdr.Count * sizeof(uint32_t), Weights,
+        Hdr.Count * sizeof(uint32_t));
+    if (!err)
+      err = fr->Read(sizeof(Hdr) + 2 * Hdr.Count * sizeof(uint32_t), Pool,
+        Hdr.PoolSize);
+    Count = Capacity = Hdr.Count;
+    PoolSize = PoolCapacity = Hdr.PoolSize;
+  }
+  delete fr;
+
+  /* Every name must start in the pool, and the pool must end with '\0' so
+   * none of them runs over it */
+  if (!err && Count > 0 && (PoolSize == 0 || Pool[PoolSize - 1] != '\0'))
+    err = TL_ERR_INVALID;
+  for (i = 0; !err && i < Count; i++)
+  {
+    if (NameOffsets[i] >= PoolSize)
+      err = TL_ERR_INVALID;
+  }
+
+  if (!err)
+    err = BuildMaxTree();
+  if (!err)
+    err = SetStamp(in_TagsFilePath, tf);
+  if (err)
+    Reset();
+  return err;
+}
+
+/* Get the range [Lo, Hi) of the tags that start with Prefix */
+void TagCompletionIndex::GetPrefixRange(const char *Prefix, uint32_t *Lo,
+  uint32_t *Hi) const
+{
+  int (*StrCmp)(const char *s1, const char *s2);
+  int (*StrnCmp)(const char *s1, const char *s2, size_t n);
+  size_t PrefixSize = ::strlen(Prefix);
+  uint32_t l, h, m;
+
+  StrCmp = CaseInsensitive ? TagLEET::stricmp : ::strcmp;
+  StrnCmp = CaseInsensitive ? TagLEET::strnicmp : ::strncmp;
+
+  /* 1st tag >= Prefix */
+  l = 0;
+  h = Count;
+  while (l < h)
+  {
+    m = l + (h - l) / 2;
+    if (StrCmp(Pool + NameOffsets[m], Prefix) < 0)
+      l = m + 1;
+    else
+      h = m;
+  }
+  *Lo = l;
+
+  /* 1st tag that is after all tags with Prefix */
+  h = Count;
+  while (l < h)
+  {
+    m = l + (h - l) / 2;
+    if (StrnCmp(Pool + NameOffsets[m], Prefix, PrefixSize) <= 0)
+      l = m + 1;
+    else
+      h = m;
+  }
+  *Hi = l;
+}
+
+/* Get the index of the heaviest tag in [Lo, Hi). Range must not be empty */
+uint32_t TagCompletionIndex::GetMaxInRange(uint32_t Lo, uint32_t Hi) const
+{
+  uint32_t Best = Lo;
+
+  for (Lo += Count, Hi += Count; Lo < Hi; Lo /= 2, Hi /= 2)
+  {
+    if (Lo & 1)
+    {
+      if (Weights[MaxTree[Lo]] > Weights[Best])
+        Best = MaxTree[Lo];
+      Lo++;
+    }
+    if (Hi & 1)
+    {
+      Hi--;
+      if (Weights[MaxTree[Hi]] > Weights[Best])
+        Best = MaxTree[Hi];
+    }
+  }
+  return Best;
+}
+
+/* Range of tags waiting in the heap of GetTopCompletions */
+struct TcRange
+{
+  uint32_t Lo;
+  uint32_t Hi;
+  uint32_t MaxIdx;
+};
+
+/* Get up to MaxCount completions of Prefix ordered by decreasing weight.
+ * Names point into the index and are valid until it is reset */
+uint32_t TagCompletionIndex::GetTopCompletions(const char *Prefix,
+  uint32_t MaxCount, const char **Names, uint32_t *OutWeights) const
+{
+  TcRange *Heap;
+  uint32_t HeapSize, n, Lo, Hi;
+
+  if (Count == 0 || MaxCount == 0)
+    return 0;
+
+  GetPrefixRange(Prefix, &Lo, &Hi);
+  if (Lo >= Hi)
+    return 0;
+
+  /* Every popped range pushes at most 2 sub ranges */
+  Heap = (TcRange *)::malloc((2 * MaxCount + 1) * sizeof(TcRange));
+  if (Heap == NULL)
+    return 0;
+
+  Heap[0].Lo = Lo;
+  Heap[0].Hi = Hi;
+  Heap[0].MaxIdx = GetMaxInRange(Lo, Hi);
+  HeapSize = 1;
+
+  for (n = 0; n < MaxCount && HeapSize > 0; n++)
+  {
+    TcRange Top = Heap[0];
+    TcRange Sub[2];
+    uint32_t i, j, k;
+
+    Names[n] = Pool + NameOffsets[Top.MaxIdx];
+    if (OutWeights != NULL)
+      OutWeights[n] = Weights[Top.MaxIdx];
+
+    /* Pop the top */
+    Heap[0] = Heap[--HeapSize];
+    for (i = 0; ; i = j)
+    {
+      j = 2 * i + 1;
+      if (j >= HeapSize)
+        break;
+      if (j + 1 < HeapSize &&
+        Weights[Heap[j + 1].MaxIdx] > Weights[Heap[j].MaxIdx])
+      {
+        j++;
+      }
+      if (Weights[Heap[j].MaxIdx] <= Weights[Heap[i].MaxIdx])
+        break;
+      TcRange Tmp = Heap[i];
+      Heap[i] = Heap[j];
+      Heap[j] = Tmp;
+    }
+
+    /* Push the ranges on both sides of the popped tag */
+    Sub[0].Lo = Top.Lo;
+    Sub[0].Hi = Top.MaxIdx;
+    Sub[1].Lo = Top.MaxIdx + 1;
+    Sub[1].Hi = Top.Hi;
+    for (k = 0; k < 2; k++)
+    {
+      if (Sub[k].Lo >= Sub[k].Hi)
+        continue;
+      Sub[k].MaxIdx = GetMaxInRange(Sub[k].Lo, Sub[k].Hi);
+      for (i = HeapSize++; i > 0; i = j)
+      {
+        j = (i - 1) / 2;
+        if (Weights[Heap[j].MaxIdx] >= Weights[Sub[k].MaxIdx])
+          break;
+        Heap[i] = Heap[j];
+      }
+      Heap[i] = Sub[k];
+    }
+  }
+
+  ::free(Heap);
+  return n;
+}
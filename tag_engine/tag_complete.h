@@ -0,0 +1,81 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TAG_COMPLETE_H_
+#define _TAG_COMPLETE_H_
+
+#include "tag_file.h"
+
+namespace TagLEET {
+
+/* Completion index over the distinct tags of a tags file.
+ * The distinct tags are kept sorted, in the order of the tags file, in a
+ * single string pool. Each tag has a weight - the number of lines of the tag
+ * in the tags file. A max-tree over the weights allows getting the K heaviest
+ * completions of a prefix in O(K*log(n)) regardless of the number of tags
+ * with that prefix.
+ * The index is built with one sequential read of the tags file and may be
+ * saved next to it so it would not be rebuilt until the tags file changes. */
+class TagCompletionIndex
+{
+public:
+  TagCompletionIndex();
+  ~TagCompletionIndex();
+
+  /* If IsCanceled returns true the index is left empty and the build fails
+   * with TL_ERR_CANCELED */
+  TL_ERR Build(TagFile *tf, const char *in_TagsFilePath,
+    TL_CANCEL_CB IsCanceled = NULL, void *CancelCtx = NULL);
+  TL_ERR Save(const char *FileName) const;
+  TL_ERR Load(const char *FileName, TagFile *tf, const char *in_TagsFilePath);
+  void Reset();
+  bool IsValidFor(const char *in_TagsFilePath, const TagFile *tf) const;
+  uint32_t GetTopCompletions(const char *Prefix, uint32_t MaxCount,
+    const char **Names, uint32_t *Weights = NULL) const;
+  uint32_t GetCount() const { return Count; }
+  const char *GetTagsFilePath() const { return TagsFilePath; }
+
+private:
+  TL_ERR AddTag(const char *Tag, uint32_t TagSize);
+  TL_ERR BuildMaxTree();
+  void GetPrefixRange(const char *Prefix, uint32_t *Lo, uint32_t *Hi) const;
+  uint32_t GetMaxInRange(uint32_t Lo, uint32_t Hi) const;
+  TL_ERR SetStamp(const char *in_TagsFilePath, const TagFile *tf);
+
+  /* Offset in Pool of each tag */
+  uint32_t *NameOffsets;
+  uint32_t *Weights;
+  /* Tree of indexes of the max weight. Leaves are at [Count, 2*Count) */
+  uint32_t *MaxTree;
+  char *Pool;
+  uint32_t Count;
+  uint32_t Capacity;
+  uint32_t PoolSize;
+  uint32_t PoolCapacity;
+  /* Identity of the tags file the index was built from */
+  char *TagsFilePath;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+  bool CaseInsensitive;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_COMPLETE_H_ */
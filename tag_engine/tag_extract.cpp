@@ -0,0 +1,1448 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_extract.h"
+#include "file_reader.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace TagLEET;
+
+/* ctags cuts patterns at this many characters */
+#define TX_PATTERN_LENGTH_LIMIT 96
+
+/* Marks in a statement of a body that was skipped, with the scope of an
+ * aggregate body added to it */
+#define TX_INIT_MARK 0xFFFFFFFFU
+#define TX_AGG_MARK 0x80000000U
+/* Tokens of the longest operator name, as in operator const char * */
+#define TX_MAX_OPERATOR_TOKENS 6
+
+enum TxTokenType {
+  TX_IDENT,
+  TX_PUNCT,
+  TX_OTHER      /* Number or literal */
+};
+
+struct TxToken
+{
+  uint8_t Type;
+  /* For TX_PUNCT, "::" is ':' with Size 2 */
+  char Punct;
+  uint32_t Offset;
+  uint32_t Size;
+  uint32_t Line;
+};
+
+struct TxScope
+{
+  const char *Kind;
+  std::string Name;
+  int Parent;
+};
+
+struct TxTag
+{
+  std::string Name;
+  const char *Kind;
+  uint32_t Line;
+  int Scope;
+  /* Class of a definition out of its class, as in A::f */
+  std::string Qualifier;
+  bool FileScope;
+};
+
+/* #if state of the lexer */
+struct TxCond
+{
+  bool Skip;
+  bool Dead;
+  bool Taken;
+};
+
+/* Words that are never the name of a tag */
+static const char *const TxKeywords[] = {
+  "alignas", "alignof", "and", "asm", "auto", "bool", "break", "case",
+  "catch", "char", "char16_t", "char32_t", "char8_t", "class", "co_await",
+  "co_return", "co_yield", "concept", "const", "consteval", "constexpr",
+  "constinit", "const_cast", "continue", "decltype", "default", "delete",
+  "do", "double", "dynamic_cast", "else", "enum", "explicit", "export",
+  "extern", "false", "final", "float", "for", "friend", "goto", "if",
+  "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not",
+  "nullptr", "operator", "or", "override", "private", "protected", "public",
+  "register", "reinterpret_cast", "requires", "restrict", "return", "short",
+  "signed", "sizeof", "static", "static_assert", "static_cast", "struct",
+  "switch", "template", "this", "thread_local", "throw", "true", "try",
+  "typedef", "typeid", "typename", "typeof", "union", "unsigned", "using",
+  "virtual", "void", "volatile", "wchar_t", "while", "_Bool", "__asm",
+  "__asm__", "__forceinline", "__inline", "__restrict", "__typeof__", NULL
+};
+
+/* Words that are followed by a (group) that is not part of a declaration */
+static const char *const TxAttributes[] = {
+  "__attribute__", "__attribute", "__declspec", "alignas", "_Alignas",
+  NULL
+};
+
+static const char *const TxAccessWords[] = {
+  "public", "protected", "private", "signals", "slots", "Q_SIGNALS",
+  "Q_SLOTS", NULL
+};
+
+static bool InWordList(const char *const *List, const char *Word,
+  uint32_t Size)
+{
+  for (; *List != NULL; List++)
+  {
+    if (::strncmp(*List, Word, Size) == 0 && (*List)[Size] == '\0')
+      return true;
+  }
+  return false;
+}
+
+static bool IsIdentStart(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+    c == '$' || (uint8_t)c >= 0x80;
+}
+
+static bool IsIdentChar(char c)
+{
+  return IsIdentStart(c) || (c >= '0' && c <= '9');
+}
+
+/* Extension of a file name, without the '.' */
+static const char *GetExtension(const char *FileName)
+{
+  const char *Ext = NULL;
+
+  for (; *FileName != '\0'; FileName++)
+  {
+    if (*FileName == '.')
+      Ext = FileName + 1;
+    else if (*FileName == '/' || *FileName == '\\')
+      Ext = NULL;
+  }
+  return Ext != NULL ? Ext : "";
+}
+
+static bool SameExtension(const char *Ext, const char *Name)
+{
+  for (; *Ext != '\0' && *Name != '\0'; Ext++, Name++)
+  {
+    char c = *Ext >= 'A' && *Ext <= 'Z' ? *Ext - 'A' + 'a' : *Ext;
+    if (c != *Name)
+      return false;
+  }
+  return *Ext == '\0' && *Name == '\0';
+}
+
+static const char *const TxSourceExts[] = {
+  "c", "cc", "cpp", "cxx", "c++", "inl", NULL
+};
+
+static const char *const TxHeaderExts[] = {
+  "h", "hh", "hpp", "hxx", "h++", NULL
+};
+
+static bool IsExtIn(const char *const *List, const char *Ext)
+{
+  for (; *List != NULL; List++)
+  {
+    if (SameExtension(Ext, *List))
+      return true;
+  }
+  return false;
+}
+
+bool TagLEET::IsExtractSupported(const char *FileName)
+{
+  const char *Ext = GetExtension(FileName);
+  return IsExtIn(TxSourceExts, Ext) || IsExtIn(TxHeaderExts, Ext);
+}
+
+/* One pass over the source makes the tokens, with comments, literals and
+ * preprocessor lines taken out, and the tags of the macros. The tokens are
+ * then parsed by scopes: the bodies of functions and initializers are
+ * skipped, namespaces, classes and enums are parsed for their tags */
+class TagExtractor
+{
+public:
+  TagExtractor(const char *in_Data, uint32_t in_Size, bool in_Cpp,
+    bool in_Header);
+  void Run();
+  void Write(const char *SrcFileName, std::string *Out) const;
+
+private:
+  void Lex();
+  void NewLine(uint32_t Offset);
+  uint32_t SkipLiteral(uint32_t i);
+  uint32_t SkipBlockComment(uint32_t i);
+  uint32_t Directive(uint32_t i);
+  bool IsSkipping() const;
+  bool IsDead() const;
+  void AddToken(uint8_t Type, uint32_t Offset, uint32_t Size);
+
+  bool IsWord(uint32_t t, const char *Word) const;
+  bool IsPunct(uint32_t t, char c) const;
+  bool IsKeyword(uint32_t t) const;
+  std::string TokenStr(uint32_t t) const;
+  int AddScope(const char *Kind, const std::string &Name, int Parent);
+  void AddTag(const std::string &Name, const char *Kind, uint32_t Line,
+    int Scope, bool FileScope, const std::string &Qualifier = "");
+
+  void ParseBlock(int Scope);
+  void ParseEnum(int Scope);
+  void SkipBraces();
+  void SkipGroup();
+  void OpenBrace(std::vector<uint32_t> *Stmt, int Scope);
+  void EndStatement(const std::vector<uint32_t> &Stmt, int Scope);
+  size_t SkipTemplate(const std::vector<uint32_t> &Stmt) const;
+  int FindAggregate(const std::vector<uint32_t> &Stmt, size_t Begin) const;
+  bool FindFunction(const std::vector<uint32_t> &Stmt, size_t Begin,
+    size_t *out_NameTok, std::string *out_Name, std::string *out_Qualifier,
+    bool *out_CtorInit) const;
+  bool FindDeclarator(const std::vector<uint32_t> &Stmt, size_t a, size_t b,
+    bool NeedType, size_t *out_Name) const;
+  bool IsClassScope(int Scope) const;
+  bool HasWord(const std::vector<uint32_t> &Stmt, size_t a, size_t b,
+    const char *Word) const;
+  std::string GetScopeName(int Scope) const;
+  void WritePattern(uint32_t Line, std::string *Out) const;
+
+  const char *Data;
+  uint32_t Size;
+  bool Cpp;
+  bool Header;
+  uint32_t Line;
+  std::vector<uint32_t> LineStarts;
+  std::vector<TxCond> Conds;
+  std::vector<TxToken> Tokens;
+  std::vector<TxScope> Scopes;
+  std::vector<TxTag> Tags;
+  size_t Pos;
+};
+
+TagExtractor::TagExtractor(const char *in_Data, uint32_t in_Size,
+  bool in_Cpp, bool in_Header)
+{
+  Data = in_Data;
+  Size = in_Size;
+  Cpp = in_Cpp;
+  Header = in_Header;
+  Line = 1;
+  Pos = 0;
+}
+
+void TagExtractor::NewLine(uint32_t Offset)
+{
+  Line++;
+  LineStarts.push_back(Offset);
+}
+
+bool TagExtractor::IsSkipping() const
+{
+  size_t i;
+
+  for (i = 0; i < Conds.size(); i++)
+  {
+    if (Conds[i].Skip)
+      return true;
+  }
+  return false;
+}
+
+bool TagExtractor::IsDead() const
+{
+  size_t i;
+
+  for (i = 0; i < Conds.size(); i++)
+  {
+    if (Conds[i].Dead)
+      return true;
+  }
+  return false;
+}
+
+void TagExtractor::AddToken(uint8_t Type, uint32_t Offset, uint32_t in_Size)
+{
+  TxToken t;
+
+  if (IsSkipping())
+    return;
+  t.Type = Type;
+  t.Punct = Type == TX_PUNCT ? Data[Offset] : 0;
+  t.Offset = Offset;
+  t.Size = in_Size;
+  t.Line = Line;
+  Tokens.push_back(t);
+}
+
+/* Skip a string or char literal starting at i, return the offset after it.
+ * A literal is not continued on the next line */
+uint32_t TagExtractor::SkipLiteral(uint32_t i)
+{
+  char Quote = Data[i++];
+
+  while (i < Size && Data[i] != Quote && Data[i] != '\n')
+  {
+    if (Data[i] == '\\' && i + 1 < Size)
+    {
+      if (Data[i + 1] == '\n')
+        NewLine(i + 2);
+      i++;
+    }
+    i++;
+  }
+  return i < Size && Data[i] == Quote ? i + 1 : i;
+}
+
+uint32_t TagExtractor::SkipBlockComment(uint32_t i)
+{
+  for (i += 2; i < Size; i++)
+  {
+    if (Data[i] == '*' && i + 1 < Size && Data[i + 1] == '/')
+      return i + 2;
+    if (Data[i] == '\n')
+      NewLine(i + 1);
+  }
+  return i;
+}
+
+/* A preprocessor line starting at the '#' in i. #define is a macro tag and
+ * #if, #else and #endif select the code that is parsed: the first branch
+ * that is not #if 0. Return the offset of the end of the line */
+uint32_t TagExtractor::Directive(uint32_t i)
+{
+  uint32_t Start, WordSize, End;
+  const char *Word;
+
+  for (i++; i < Size && (Data[i] == ' ' || Data[i] == '\t'); i++);
+  for (Start = i; i < Size && IsIdentChar(Data[i]); i++);
+  Word = Data + Start;
+  WordSize = i - Start;
+  for (; i < Size && (Data[i] == ' ' || Data[i] == '\t'); i++);
+
+  if (WordSize == 6 && ::memcmp(Word, "define", 6) == 0)
+  {
+    for (Start = i; i < Size && IsIdentChar(Data[i]); i++);
+    if (i > Start && IsIdentStart(Data[Start]) && !IsDead())
+    {
+      AddTag(std::string(Data + Start, i - Start), "macro", Line, -1,
+        !Header);
+    }
+  }
+  else if ((WordSize == 2 && ::memcmp(Word, "if", 2) == 0) ||
+    (WordSize == 5 && ::memcmp(Word, "ifdef", 5) == 0) ||
+    (WordSize == 6 && ::memcmp(Word, "ifndef", 6) == 0))
+  {
+    TxCond Cond;
+    bool Zero = WordSize == 2 && i < Size && Data[i] == '0' &&
+      (i + 1 >= Size || !IsIdentChar(Data[i + 1]));
+
+    Cond.Skip = Zero;
+    Cond.Dead = Zero;
+    Cond.Taken = !Zero;
+    Conds.push_back(Cond);
+  }
+  else if ((WordSize == 4 && ::memcmp(Word, "elif", 4) == 0) ||
+    (WordSize == 4 && ::memcmp(Word, "else", 4) == 0))
+  {
+    bool Zero = Word[2] == 'i' && i < Size && Data[i] == '0' &&
+      (i + 1 >= Size || !IsIdentChar(Data[i + 1]));
+
+    if (!Conds.empty())
+    {
+      TxCond *Cond = &Conds.back();
+      if (Cond->Taken)
+      {
+        Cond->Skip = true;
+        Cond->Dead = false;
+      }
+      else if (!Zero)
+      {
+        Cond->Skip = false;
+        Cond->Dead = false;
+        Cond->Taken = true;
+      }
+    }
+  }
+  else if (WordSize == 5 && ::memcmp(Word, "endif", 5) == 0)
+  {
+    if (!Conds.empty())
+      Conds.pop_back();
+  }
+
+  /* The rest of the line, with its continuation lines and comments */
+  for (End = i; End < Size && Data[End] != '\n'; End++)
+  {
+    if (Data[End] == '\\' && End + 1 < Size &&
+      (Data[End + 1] == '\n' || Data[End + 1] == '\r'))
+    {
+      if (Data[End + 1] == '\r')
+        End++;
+      if (End + 1 < Size && Data[End + 1] == '\n')
+      {
+        End++;
+        NewLine(End + 1);
+      }
+    }
+    else if (Data[End] == '/' && End + 1 < Size && Data[End + 1] == '*')
+    {
+      End = SkipBlockComment(End) - 1;
+    }
+    else if (Data[End] == '/' && End + 1 < Size && Data[End + 1] == '/')
+    {
+      for (; End + 1 < Size && Data[End + 1] != '\n'; End++);
+    }
+  }
+  return End;
+}
+
+void TagExtractor::Lex()
+{
+  uint32_t i = 0;
+  uint32_t Start;
+  bool LineStart = true;
+
+  LineStarts.push_back(0);
+  while (i < Size)
+  {
+    char c = Data[i];
+    char Next = i + 1 < Size ? Data[i + 1] : '\0';
+
+    if (c == '\n')
+    {
+      NewLine(++i);
+      LineStart = true;
+      continue;
+    }
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v' ||
+      (c == '\\' && (Next == '\n' || Next == '\r')))
+    {
+      i++;
+      continue;
+    }
+    if (c == '/' && Next == '/')
+    {
+      for (; i < Size && Data[i] != '\n'; i++);
+      continue;
+    }
+    if (c == '/' && Next == '*')
+    {
+      i = SkipBlockComment(i);
+      continue;
+    }
+    if (c == '#' && LineStart)
+    {
+      i = Directive(i);
+      continue;
+    }
+    LineStart = false;
+
+    if (IsIdentStart(c))
+    {
+      for (Start = i; i < Size && IsIdentChar(Data[i]); i++);
+      /* Prefix of a literal */
+      if (i < Size && (Data[i] == '"' || Data[i] == '\'') && i - Start <= 3 &&
+        (Data[i - 1] == 'R' || Data[i - 1] == 'L' || Data[i - 1] == 'u' ||
+        Data[i - 1] == 'U' || Data[i - 1] == '8'))
+      {
+        if (Cpp && Data[i - 1] == 'R' && Data[i] == '"')
+        {
+          /* Raw string R"delim( ... )delim" */
+          uint32_t DelimStart = i + 1;
+          uint32_t DelimEnd;
+          for (DelimEnd = DelimStart; DelimEnd < Size &&
+            Data[DelimEnd] != '(' && DelimEnd - DelimStart < 16; DelimEnd++);
+          for (i = DelimEnd + 1; i < Size; i++)
+          {
+            if (Data[i] == '\n')
+              NewLine(i + 1);
+            else if (Data[i] == ')' &&
+              i + 1 + (DelimEnd - DelimStart) < Size &&
+              ::memcmp(Data + i + 1, Data + DelimStart,
+              DelimEnd - DelimStart) == 0 &&
+              Data[i + 1 + DelimEnd - DelimStart] == '"')
+            {
+              i += DelimEnd - DelimStart + 2;
+              break;
+            }
+          }
+          AddToken(TX_OTHER, Start, 1);
+        }
+        continue;
+      }
+      AddToken(TX_IDENT, Start, i - Start);
+      continue;
+    }
+    if ((c >= '0' && c <= '9') || (c == '.' && Next >= '0' && Next <= '9'))
+    {
+      for (Start = i++; i < Size; i++)
+      {
+        if ((Data[i] == '+' || Data[i] == '-') && (Data[i - 1] == 'e' ||
+          Data[i - 1] == 'E' || Data[i - 1] == 'p' || Data[i - 1] == 'P'))
+        {
+          continue;
+        }
+        if (!IsIdentChar(Data[i]) && Data[i] != '.' && Data[i] != '\'')
+          break;
+      }
+      AddToken(TX_OTHER, Start, i - Start);
+      continue;
+    }
+    if (c == '"' || c == '\'')
+    {
+      Start = i;
+      i = SkipLiteral(i);
+      AddToken(TX_OTHER, Start, i - Start);
+      continue;
+    }
+    if (c == ':' && Next == ':')
+    {
+      AddToken(TX_PUNCT, i, 2);
+      i += 2;
+      continue;
+    }
+    AddToken(TX_PUNCT, i, 1);
+    i++;
+  }
+}
+
+bool TagExtractor::IsWord(uint32_t t, const char *Word) const
+{
+  return t < Tokens.size() && Tokens[t].Type == TX_IDENT &&
+    ::strncmp(Data + Tokens[t].Offset, Word, Tokens[t].Size) == 0 &&
+    Word[Tokens[t].Size] == '\0';
+}
+
+bool TagExtractor::IsPunct(uint32_t t, char c) const
+{
+  return t < Tokens.size() && Tokens[t].Type == TX_PUNCT &&
+    Tokens[t].Punct == c && Tokens[t].Size == 1;
+}
+
+bool TagExtractor::IsKeyword(uint32_t t) const
+{
+  return Tokens[t].Type == TX_IDENT &&
+    InWordList(TxKeywords, Data + Tokens[t].Offset, Tokens[t].Size);
+}
+
+std::string TagExtractor::TokenStr(uint32_t t) const
+{
+  return std::string(Data + Tokens[t].Offset, Tokens[t].Size);
+}
+
+int TagExtractor::AddScope(const char *Kind, const std::string &Name,
+  int Parent)
+{
+  TxScope Scope;
+
+  Scope.Kind = Kind;
+  Scope.Name = Name;
+  Scope.Parent = Parent;
+  Scopes.push_back(Scope);
+  return (int)Scopes.size() - 1;
+}
+
+void TagExtractor::AddTag(const std::string &Name, const char *Kind,
+  uint32_t TagLine, int Scope, bool FileScope, const std::string &Qualifier)
+{
+  TxTag Tag;
+
+  Tag.Name = Name;
+  Tag.Kind = Kind;
+  Tag.Line = TagLine;
+  Tag.Scope = Scope;
+  Tag.Qualifier = Qualifier;
+  Tag.FileScope = FileScope;
+  Tags.push_back(Tag);
+}
+
+bool TagExtractor::IsClassScope(int Scope) const
+{
+  return Scope >= 0 && ::strcmp(Scopes[Scope].Kind, "namespace") != 0;
+}
+
+bool TagExtractor::HasWord(const std::vector<uint32_t> &Stmt, size_t a,
+  size_t b, const char *Word) const
+{
+  for (; a < b; a++)
+  {
+    if (Stmt[a] < TX_AGG_MARK && IsWord(Stmt[a], Word))
+      return true;
+  }
+  return false;
+}
+
+/* Skip to after the '}' that matches the '{' before Pos */
+void TagExtractor::SkipBraces()
+{
+  uint32_t Depth = 1;
+
+  for (; Pos < Tokens.size(); Pos++)
+  {
+    if (IsPunct((uint32_t)Pos, '{'))
+    {
+      Depth++;
+    }
+    else if (IsPunct((uint32_t)Pos, '}') && --Depth == 0)
+    {
+      Pos++;
+      return;
+    }
+  }
+}
+
+/* Skip a (group) that starts at Pos */
+void TagExtractor::SkipGroup()
+{
+  uint32_t Depth = 0;
+
+  for (; Pos < Tokens.size(); Pos++)
+  {
+    if (IsPunct((uint32_t)Pos, '('))
+    {
+      Depth++;
+    }
+    else if (IsPunct((uint32_t)Pos, ')') && --Depth == 0)
+    {
+      Pos++;
+      return;
+    }
+  }
+}
+
+/* Statements of a file, namespace or class body, up to its '}' */
+void TagExtractor::ParseBlock(int Scope)
+{
+  std::vector<uint32_t> Stmt;
+  uint32_t Parens = 0;
+  size_t i;
+
+  while (Pos < Tokens.size())
+  {
+    uint32_t t = (uint32_t)Pos;
+
+    if (Tokens[t].Type == TX_PUNCT && Tokens[t].Size == 1)
+    {
+      char c = Tokens[t].Punct;
+
+      if (c == '}' || c == ';')
+      {
+        /* Unbalanced parens are given up at the end of a statement */
+        Parens = 0;
+        Pos++;
+        if (c == '}')
+          return;
+        EndStatement(Stmt, Scope);
+        Stmt.clear();
+        continue;
+      }
+      if (c == '{')
+      {
+        Pos++;
+        if (Parens > 0)
+        {
+          SkipBraces();
+          Stmt.push_back(TX_INIT_MARK);
+        }
+        else
+        {
+          OpenBrace(&Stmt, Scope);
+        }
+        continue;
+      }
+      if (c == '(' || c == '[')
+        Parens++;
+      else if ((c == ')' || c == ']') && Parens > 0)
+        Parens--;
+
+      /* An access label ends with ':' */
+      if (c == ':' && Parens == 0 && !Stmt.empty())
+      {
+        for (i = 0; i < Stmt.size(); i++)
+        {
+          if (Stmt[i] >= TX_AGG_MARK || Tokens[Stmt[i]].Type != TX_IDENT ||
+            !InWordList(TxAccessWords, Data + Tokens[Stmt[i]].Offset,
+            Tokens[Stmt[i]].Size))
+          {
+            break;
+          }
+        }
+        if (i == Stmt.size())
+        {
+          Stmt.clear();
+          Pos++;
+          continue;
+        }
+      }
+    }
+    else if (Tokens[t].Type == TX_IDENT && IsPunct(t + 1, '(') &&
+      InWordList(TxAttributes, Data + Tokens[t].Offset, Tokens[t].Size))
+    {
+      Pos++;
+      SkipGroup();
+      continue;
+    }
+    Stmt.push_back(t);
+    Pos++;
+  }
+}
+
+/* The values of an enum, up to its '}' */
+void TagExtractor::ParseEnum(int Scope)
+{
+  uint32_t Depth = 0;
+  bool Expect = true;
+
+  for (; Pos < Tokens.size(); Pos++)
+  {
+    uint32_t t = (uint32_t)Pos;
+
+    if (IsPunct(t, '{') || IsPunct(t, '(') || IsPunct(t, '['))
+    {
+      Depth++;
+    }
+    else if (IsPunct(t, '}') || IsPunct(t, ')') || IsPunct(t, ']'))
+    {
+      if (Depth == 0 && IsPunct(t, '}'))
+      {
+        Pos++;
+        return;
+      }
+      if (Depth > 0)
+        Depth--;
+    }
+    else if (Depth == 0 && IsPunct(t, ','))
+    {
+      Expect = true;
+      continue;
+    }
+    else if (Expect && Depth == 0 && Tokens[t].Type == TX_IDENT)
+    {
+      AddTag(TokenStr(t), "enumerator", Tokens[t].Line, Scope, false);
+    }
+    Expect = false;
+  }
+}
+
+/* Start of the statement after a template<...> prefix */
+size_t TagExtractor::SkipTemplate(const std::vector<uint32_t> &Stmt) const
+{
+  size_t i = 0;
+  uint32_t Depth = 0;
+
+  while (i + 1 < Stmt.size() && Stmt[i] < TX_AGG_MARK &&
+    IsWord(Stmt[i], "template") && Stmt[i + 1] < TX_AGG_MARK &&
+    IsPunct(Stmt[i + 1], '<'))
+  {
+    for (i++; i < Stmt.size(); i++)
+    {
+      if (Stmt[i] >= TX_AGG_MARK)
+        continue;
+      if (IsPunct(Stmt[i], '<'))
+        Depth++;
+      else if (IsPunct(Stmt[i], '>') && --Depth == 0)
+        break;
+    }
+    i++;
+  }
+  return i < Stmt.size() ? i : Stmt.size();
+}
+
+/* The class, struct, union or enum keyword of an aggregate definition. It
+ * is not after '=' and no '(' follows it */
+int TagExtractor::FindAggregate(const std::vector<uint32_t> &Stmt,
+  size_t Begin) const
+{
+  int Found = -1;
+  size_t i;
+
+  for (i = Begin; i < Stmt.size(); i++)
+  {
+    uint32_t t = Stmt[i];
+
+    if (t >= TX_AGG_MARK)
+      continue;
+    if (IsPunct(t, '=') || IsPunct(t, '('))
+      return -1;
+    if (Found < 0 && (IsWord(t, "class") || IsWord(t, "struct") ||
+      IsWord(t, "union") || IsWord(t, "enum")))
+    {
+      Found = (int)i;
+    }
+  }
+  return Found;
+}
+
+/* A function definition has a (parameter list) before any '=', with the
+ * name of the function before it. The name may be qualified by its class,
+ * be a destructor or an operator */
+bool TagExtractor::FindFunction(const std::vector<uint32_t> &Stmt,
+  size_t Begin, size_t *out_NameTok, std::string *out_Name,
+  std::string *out_Qualifier, bool *out_CtorInit) const
+{
+  size_t i, j, Close;
+  uint32_t Depth;
+
+  for (i = Begin; i < Stmt.size(); i++)
+  {
+    if (Stmt[i] >= TX_AGG_MARK)
+      continue;
+    if (IsPunct(Stmt[i], '='))
+      return false;
+    if (IsPunct(Stmt[i], '('))
+      break;
+    /* The name of an operator may have '=' and "()" in it */
+    if (IsWord(Stmt[i], "operator"))
+    {
+      if (i + 2 < Stmt.size() && IsPunct(Stmt[i + 1], '(') &&
+        IsPunct(Stmt[i + 2], ')'))
+      {
+        i += 2;
+      }
+      for (i++; i < Stmt.size() && !IsPunct(Stmt[i], '('); i++);
+      break;
+    }
+  }
+  if (i == Stmt.size() || i == Begin || Stmt[i - 1] >= TX_AGG_MARK)
+    return false;
+
+  /* The rest of the statement, is there a constructor initializer list */
+  *out_CtorInit = false;
+  for (Close = i, Depth = 0; Close < Stmt.size(); Close++)
+  {
+    if (Stmt[Close] >= TX_AGG_MARK)
+      continue;
+    if (IsPunct(Stmt[Close], '('))
+      Depth++;
+    else if (IsPunct(Stmt[Close], ')') && --Depth == 0)
+      break;
+  }
+  for (j = Close + 1; j < Stmt.size(); j++)
+  {
+    if (Stmt[j] < TX_AGG_MARK && IsPunct(Stmt[j], ':'))
+    {
+      *out_CtorInit = true;
+      break;
+    }
+  }
+
+  j = i - 1;
+  /* operator==, operator() and the other operators */
+  for (size_t k = j + 1; k-- > Begin && k + TX_MAX_OPERATOR_TOKENS > i;)
+  {
+    if (IsWord(Stmt[k], "operator"))
+    {
+      std::string Name = "operator ";
+      size_t n;
+
+      for (n = k + 1; n <= j; n++)
+      {
+        if (Stmt[n] < TX_AGG_MARK)
+          Name += TokenStr(Stmt[n]);
+      }
+      *out_NameTok = k;
+      *out_Name = Name;
+      j = k;
+      break;
+    }
+  }
+  if (out_Name->empty())
+  {
+    if (Tokens[Stmt[j]].Type != TX_IDENT || IsKeyword(Stmt[j]))
+      return false;
+    /* (*Name)() is a pointer to a function */
+    if (i + 1 < Stmt.size() && Stmt[i + 1] < TX_AGG_MARK &&
+      (IsPunct(Stmt[i + 1], '*') || IsPunct(Stmt[i + 1], '^')))
+    {
+      return false;
+    }
+    *out_NameTok = j;
+    *out_Name = TokenStr(Stmt[j]);
+    if (j > Begin && Stmt[j - 1] < TX_AGG_MARK && IsPunct(Stmt[j - 1], '~'))
+    {
+      *out_Name = "~" + *out_Name;
+      j--;
+    }
+  }
+
+  /* A::B:: before the name */
+  while (j >= Begin + 2 && Stmt[j - 1] < TX_AGG_MARK &&
+    Tokens[Stmt[j - 1]].Type == TX_PUNCT && Tokens[Stmt[j - 1]].Size == 2)
+  {
+    size_t q = j - 2;
+
+    /* Template arguments of the class */
+    if (Stmt[q] < TX_AGG_MARK && IsPunct(Stmt[q], '>'))
+    {
+      for (Depth = 0; q > Begin; q--)
+      {
+        if (Stmt[q] >= TX_AGG_MARK)
+          continue;
+        if (IsPunct(Stmt[q], '>'))
+          Depth++;
+        else if (IsPunct(Stmt[q], '<') && --Depth == 0)
+          break;
+      }
+      if (q == Begin)
+        break;
+      q--;
+    }
+    if (Stmt[q] >= TX_AGG_MARK || Tokens[Stmt[q]].Type != TX_IDENT)
+      break;
+    *out_Qualifier = out_Qualifier->empty() ? TokenStr(Stmt[q]) :
+      TokenStr(Stmt[q]) + "::" + *out_Qualifier;
+    if (q == 0)
+      break;
+    j = q;
+  }
+  return true;
+}
+
+void TagExtractor::OpenBrace(std::vector<uint32_t> *Stmt, int Scope)
+{
+  size_t Begin = SkipTemplate(*Stmt);
+  size_t NameTok = 0;
+  std::string Name, Qualifier;
+  bool CtorInit;
+  int Agg;
+  size_t i;
+
+  if (Begin < Stmt->size() && IsWord((*Stmt)[Begin], "namespace"))
+  {
+    uint32_t Line = 0;
+
+    for (i = Begin + 1; i < Stmt->size(); i++)
+    {
+      if ((*Stmt)[i] >= TX_AGG_MARK)
+        continue;
+      Name += TokenStr((*Stmt)[i]);
+      Line = Tokens[(*Stmt)[i]].Line;
+    }
+    Stmt->clear();
+    /* An anonymous namespace is parsed as part of its parent */
+    if (Name.empty())
+    {
+      ParseBlock(Scope);
+      return;
+    }
+    AddTag(Name, "namespace", Line, Scope, false);
+    ParseBlock(AddScope("namespace", Name, Scope));
+    return;
+  }
+  if (Begin < Stmt->size() && IsWord((*Stmt)[Begin], "extern") &&
+    Stmt->size() - Begin <= 2)
+  {
+    Stmt->clear();
+    ParseBlock(Scope);
+    return;
+  }
+
+  Agg = FindAggregate(*Stmt, Begin);
+  if (Agg >= 0)
+  {
+    uint32_t Keyword = (*Stmt)[Agg];
+    const char *Kind = IsWord(Keyword, "class") ? "class" :
+      IsWord(Keyword, "struct") ? "struct" :
+      IsWord(Keyword, "union") ? "union" : "enum";
+    uint32_t NameToken = 0;
+    int NewScope;
+
+    /* The last name before the base list or template arguments */
+    for (i = Agg + 1; i < Stmt->size(); i++)
+    {
+      uint32_t t = (*Stmt)[i];
+
+      if (t >= TX_AGG_MARK)
+        continue;
+      if (IsPunct(t, ':') || IsPunct(t, '<'))
+        break;
+      if (Tokens[t].Type == TX_IDENT && !IsKeyword(t) &&
+        !IsWord(t, "sealed"))
+      {
+        NameToken = t;
+        Name = TokenStr(t);
+      }
+    }
+    NewScope = AddScope(Kind, Name, Scope);
+    if (!Name.empty())
+      AddTag(Name, Kind, Tokens[NameToken].Line, Scope, false);
+    if (::strcmp(Kind, "enum") == 0)
+      ParseEnum(NewScope);
+    else
+      ParseBlock(NewScope);
+    Stmt->push_back(TX_AGG_MARK + NewScope);
+    return;
+  }
+
+  if (FindFunction(*Stmt, Begin, &NameTok, &Name, &Qualifier, &CtorInit))
+  {
+    /* In an initializer list a '{' after a member name initializes it, the
+     * body comes after the last initializer */
+    uint32_t Last = Stmt->back();
+    if (CtorInit && Last < TX_AGG_MARK &&
+      (Tokens[Last].Type == TX_IDENT || IsPunct(Last, '>')))
+    {
+      SkipBraces();
+      Stmt->push_back(TX_INIT_MARK);
+      return;
+    }
+    AddTag(Name, "function", Tokens[(*Stmt)[NameTok]].Line, Scope,
+      !IsClassScope(Scope) && Qualifier.empty() &&
+      HasWord(*Stmt, Begin, NameTok, "static"), Qualifier);
+    Stmt->clear();
+    SkipBraces();
+    return;
+  }
+
+  SkipBraces();
+  Stmt->push_back(TX_INIT_MARK);
+}
+
+/* The name declared by the tokens [a, b) of a declaration. With NeedType the
+ * name must follow a type */
+bool TagExtractor::FindDeclarator(const std::vector<uint32_t> &Stmt,
+  size_t a, size_t b, bool NeedType, size_t *out_Name) const
+{
+  uint32_t Depth = 0;
+  size_t i, End = b;
+  bool Found = false;
+
+  /* The initializer or bit field width is not part of it */
+  for (i = a; i < b; i++)
+  {
+    uint32_t t = Stmt[i];
+
+    if (t >= TX_AGG_MARK)
+    {
+      if (Depth == 0 && t == TX_INIT_MARK)
+      {
+        End = i;
+        break;
+      }
+      continue;
+    }
+    if (IsPunct(t, '(') || IsPunct(t, '['))
+      Depth++;
+    else if ((IsPunct(t, ')') || IsPunct(t, ']')) && Depth > 0)
+      Depth--;
+    else if (Depth == 0 && (IsPunct(t, '=') || IsPunct(t, ':')))
+    {
+      End = i;
+      break;
+    }
+  }
+
+  for (i = a, Depth = 0; i < End; i++)
+  {
+    uint32_t t = Stmt[i];
+
+    if (t >= TX_AGG_MARK)
+      continue;
+    if (IsPunct(t, '(') || IsPunct(t, '['))
+    {
+      /* (*Name)(...) is a pointer to a function */
+      if (Depth == 0 && IsPunct(t, '(') && i + 1 < End &&
+        Stmt[i + 1] < TX_AGG_MARK && (IsPunct(Stmt[i + 1], '*') ||
+        IsPunct(Stmt[i + 1], '^') || IsPunct(Stmt[i + 1], '&') ||
+        (i + 2 < End && Tokens[Stmt[i + 1]].Type == TX_IDENT &&
+        Stmt[i + 2] < TX_AGG_MARK && IsPunct(Stmt[i + 2], '*'))))
+      {
+        size_t k;
+
+        for (k = i + 1; k < End && Stmt[k] < TX_AGG_MARK &&
+          !IsPunct(Stmt[k], ')') && !IsPunct(Stmt[k], '['); k++)
+        {
+          if (Tokens[Stmt[k]].Type == TX_IDENT && !IsKeyword(Stmt[k]))
+          {
+            *out_Name = k;
+            Found = true;
+          }
+        }
+        return Found;
+      }
+      /* A function that is declared, not a variable */
+      if (Depth == 0 && IsPunct(t, '('))
+        return false;
+      Depth++;
+      continue;
+    }
+    if ((IsPunct(t, ')') || IsPunct(t, ']')) && Depth > 0)
+    {
+      Depth--;
+      continue;
+    }
+    if (Depth == 0 && Tokens[t].Type == TX_IDENT && !IsKeyword(t))
+    {
+      *out_Name = i;
+      Found = true;
+    }
+  }
+  if (!Found)
+    return false;
+
+  i = *out_Name;
+  /* struct X; declares no name, A::x defines a member of A */
+  if (i > a && Stmt[i - 1] < TX_AGG_MARK &&
+    (IsWord(Stmt[i - 1], "struct") || IsWord(Stmt[i - 1], "class") ||
+    IsWord(Stmt[i - 1], "union") || IsWord(Stmt[i - 1], "enum") ||
+    (Tokens[Stmt[i - 1]].Type == TX_PUNCT && Tokens[Stmt[i - 1]].Size == 2)))
+  {
+    return false;
+  }
+  return !NeedType || i > a;
+}
+
+/* A declaration at the ';' that ends it: typedefs, members and variables.
+ * Declarations of functions are not tagged */
+void TagExtractor::EndStatement(const std::vector<uint32_t> &Stmt, int Scope)
+{
+  size_t Begin = SkipTemplate(Stmt);
+  size_t i, Start, PartStart, NameTok;
+  uint32_t Depth, Angles;
+  int LastAgg = -1;
+  bool Typedef = false;
+  bool Static;
+  bool Assigned;
+  const char *Kind;
+
+  if (Begin >= Stmt.size())
+    return;
+  if (IsWord(Stmt[Begin], "using"))
+  {
+    /* using Name = Type; */
+    if (Begin + 2 < Stmt.size() && Stmt[Begin + 1] < TX_AGG_MARK &&
+      Tokens[Stmt[Begin + 1]].Type == TX_IDENT &&
+      Stmt[Begin + 2] < TX_AGG_MARK && IsPunct(Stmt[Begin + 2], '='))
+    {
+      AddTag(TokenStr(Stmt[Begin + 1]), "typedef",
+        Tokens[Stmt[Begin + 1]].Line, Scope, false);
+    }
+    return;
+  }
+  else if (IsWord(Stmt[Begin], "friend") || IsWord(Stmt[Begin], "extern") ||
+    IsWord(Stmt[Begin], "namespace") || IsWord(Stmt[Begin], "return") ||
+    IsWord(Stmt[Begin], "static_assert"))
+  {
+    return;
+  }
+  else if (IsWord(Stmt[Begin], "typedef"))
+  {
+    Typedef = true;
+    Begin++;
+  }
+
+  for (i = Begin; i < Stmt.size(); i++)
+  {
+    if (Stmt[i] >= TX_AGG_MARK && Stmt[i] != TX_INIT_MARK)
+      LastAgg = (int)i;
+  }
+
+  /* A function that is declared or a macro that is called */
+  if (LastAgg < 0 && !Typedef)
+  {
+    for (i = Begin; i < Stmt.size(); i++)
+    {
+      uint32_t t = Stmt[i];
+
+      if (t >= TX_AGG_MARK || IsPunct(t, '='))
+        break;
+      if (IsPunct(t, '('))
+      {
+        if (i > Begin && Stmt[i - 1] < TX_AGG_MARK &&
+          ((Tokens[Stmt[i - 1]].Type == TX_IDENT && !IsKeyword(Stmt[i - 1]))
+          || IsWord(Stmt[i - 1], "operator")) &&
+          !(i + 1 < Stmt.size() && Stmt[i + 1] < TX_AGG_MARK &&
+          (IsPunct(Stmt[i + 1], '*') || IsPunct(Stmt[i + 1], '^'))))
+        {
+          return;
+        }
+        break;
+      }
+    }
+  }
+
+  Static = HasWord(Stmt, Begin, LastAgg >= 0 ? LastAgg : Stmt.size(),
+    "static");
+  Kind = Typedef ? "typedef" : IsClassScope(Scope) ? "member" : "variable";
+  Start = LastAgg >= 0 ? LastAgg + 1 : Begin;
+
+  /* The declarators are separated by ',', not inside (), [] or the <> of
+   * template arguments in the type */
+  for (i = PartStart = Start, Depth = Angles = 0, Assigned = false;
+    i <= Stmt.size(); i++)
+  {
+    uint32_t t = i < Stmt.size() ? Stmt[i] : TX_INIT_MARK;
+
+    if (i < Stmt.size())
+    {
+      if (t >= TX_AGG_MARK)
+        continue;
+      if (IsPunct(t, '(') || IsPunct(t, '['))
+        Depth++;
+      else if ((IsPunct(t, ')') || IsPunct(t, ']')) && Depth > 0)
+        Depth--;
+      else if (IsPunct(t, '=') && Depth == 0)
+        Assigned = true;
+      else if (IsPunct(t, '<') && !Assigned && i > PartStart &&
+        Stmt[i - 1] < TX_AGG_MARK && Tokens[Stmt[i - 1]].Type == TX_IDENT)
+      {
+        Angles++;
+      }
+      else if (IsPunct(t, '>') && Angles > 0)
+        Angles--;
+      if (!IsPunct(t, ',') || Depth > 0 || Angles > 0)
+        continue;
+    }
+
+    if (FindDeclarator(Stmt, PartStart, i, PartStart == Begin, &NameTok))
+    {
+      uint32_t NameToken = Stmt[NameTok];
+
+      /* typedef struct { ... } Name; names the struct */
+      if (Typedef && LastAgg >= 0 &&
+        Scopes[Stmt[LastAgg] - TX_AGG_MARK].Name.empty())
+      {
+        Scopes[Stmt[LastAgg] - TX_AGG_MARK].Name = TokenStr(NameToken);
+      }
+      AddTag(TokenStr(NameToken), Kind, Tokens[NameToken].Line, Scope,
+        Static && !Typedef && !IsClassScope(Scope));
+    }
+    PartStart = i + 1;
+    Assigned = false;
+  }
+}
+
+void TagExtractor::Run()
+{
+  Lex();
+  while (Pos < Tokens.size())
+    ParseBlock(-1);
+}
+
+/* Full name of a scope, empty if it or one of its parents has no name */
+std::string TagExtractor::GetScopeName(int Scope) const
+{
+  std::string Name;
+
+  for (; Scope >= 0; Scope = Scopes[Scope].Parent)
+  {
+    if (Scopes[Scope].Name.empty())
+      return "";
+    Name = Name.empty() ? Scopes[Scope].Name :
+      Scopes[Scope].Name + "::" + Name;
+  }
+  return Name;
+}
+
+/* The search pattern of a line, cut like ctags cuts it */
+void TagExtractor::WritePattern(uint32_t TagLine, std::string *Out) const
+{
+  uint32_t i = TagLine - 1 < LineStarts.size() ? LineStarts[TagLine - 1] :
+    Size;
+  uint32_t End, Chars = 0;
+
+  for (End = i; End < Size && Data[End] != '\n'; End++);
+  if (End > i && Data[End - 1] == '\r')
+    End--;
+
+  *Out += "/^";
+  for (; i < End; i++)
+  {
+    char c = Data[i];
+
+    if (((uint8_t)c & 0xC0) != 0x80 && ++Chars > TX_PATTERN_LENGTH_LIMIT)
+      break;
+    if (c == '\\' || c == '/')
+      *Out += '\\';
+    *Out += c;
+  }
+  if (i == End)
+    *Out += '$';
+  *Out += "/;\"";
+}
+
+void TagExtractor::Write(const char *SrcFileName, std::string *Out) const
+{
+  const char *BaseName = SrcFileName;
+  const char *p;
+  size_t i;
+
+  for (p = SrcFileName; *p != '\0'; p++)
+  {
+    if (*p == '/' || *p == '\\')
+      BaseName = p + 1;
+  }
+  *Out += BaseName;
+  *Out += '\t';
+  *Out += SrcFileName;
+  *Out += "\t1;\"\tfile\tline:1\n";
+
+  for (i = 0; i < Tags.size(); i++)
+  {
+    const TxTag *Tag = &Tags[i];
+    std::string ScopeName = Tag->Scope >= 0 ? GetScopeName(Tag->Scope) : "";
+    const char *ScopeKind = Tag->Scope >= 0 ? Scopes[Tag->Scope].Kind : "";
+    std::string Fields;
+    char LineStr[32];
+
+    if (!Tag->Qualifier.empty())
+    {
+      ScopeName = ScopeName.empty() ? Tag->Qualifier :
+        ScopeName + "::" + Tag->Qualifier;
+      ScopeKind = "class";
+    }
+
+    ::sprintf(LineStr, "\tline:%u", Tag->Line);
+    Fields = std::string("\t") + SrcFileName + "\t";
+    WritePattern(Tag->Line, &Fields);
+    Fields += '\t';
+    Fields += Tag->Kind;
+    Fields += LineStr;
+    if (!ScopeName.empty())
+    {
+      Fields += '\t';
+      Fields += ScopeKind;
+      Fields += ':';
+      Fields += ScopeName;
+    }
+    if (Tag->FileScope)
+      Fields += "\tfile:";
+    Fields += '\n';
+
+    *Out += Tag->Name;
+    *Out += Fields;
+    if (Cpp && !ScopeName.empty())
+    {
+      *Out += ScopeName;
+      *Out += "::";
+      *Out += Tag->Name;
+      *Out += Fields;
+    }
+  }
+}
+
+TL_ERR TagLEET::ExtractTags(const char *Data, uint32_t Size,
+  const char *SrcFileName, std::string *out_Tags)
+{
+  const char *Ext = GetExtension(SrcFileName);
+  bool Header = IsExtIn(TxHeaderExts, Ext);
+
+  if (!Header && !IsExtIn(TxSourceExts, Ext))
+    return TL_ERR_INVALID;
+
+  /* Like ctags, .h files are C++ */
+  TagExtractor Extractor(Data, Size, !SameExtension(Ext, "c"), Header);
+  Extractor.Run();
+  out_Tags->clear();
+  Extractor.Write(SrcFileName, out_Tags);
+  return TL_ERR_OK;
+}
+
+TL_ERR TagLEET::ExtractTagsOfFile(const char *Path, const char *SrcFileName,
+  std::string *out_Tags)
+{
+  TL_ERR err;
+  FileReader *fr;
+  char *Data = NULL;
+  uint32_t Size = 0;
+
+  if (!IsExtractSupported(SrcFileName))
+    return TL_ERR_INVALID;
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(Path);
+  if (!err && fr->FileSize > TAG_EXTRACT_MAX_SIZE)
+    err = TL_ERR_FILE_TOO_BIG;
+  if (!err)
+  {
+    fr->SetAccess(FR_ACCESS_ONCE);
+    Size = (uint32_t)fr->FileSize;
+    Data = (char *)::malloc(Size + 1);
+    if (Data == NULL)
+      err = TL_ERR_MEM_ALLOC;
+  }
+  if (!err && Size > 0)
+    err = fr->Read(0, Data, Size);
+  delete fr;
+
+  if (!err)
+    err = ExtractTags(Data, Size, SrcFileName, out_Tags);
+  ::free(Data);
+  return err;
+}
+
+/* Take files to extract until there are none left */
+static void ExtractWorker(const char *const *Paths,
+  const char *const *SrcFileNames, uint32_t Count,
+  std::atomic<uint32_t> *Next, std::string *out_Tags, TL_ERR *out_Errs)
+{
+  uint32_t i;
+
+  for (i = Next->fetch_add(1); i < Count; i = Next->fetch_add(1))
+  {
+    try
+    {
+      out_Errs[i] = ExtractTagsOfFile(Paths[i], SrcFileNames[i],
+        &out_Tags[i]);
+    }
+    catch (...)
+    {
+      out_Errs[i] = TL_ERR_MEM_ALLOC;
+    }
+  }
+}
+
+void TagLEET::ExtractTagsOfFiles(const char *const *Paths,
+  const char *const *SrcFileNames, uint32_t Count, uint32_t ThreadCount,
+  std::string *out_Tags, TL_ERR *out_Errs)
+{
+  std::vector<std::thread> Threads;
+  std::atomic<uint32_t> Next(0);
+  uint32_t i;
+
+  if (ThreadCount > Count)
+    ThreadCount = Count;
+  /* The calling thread is one of the workers */
+  for (i = 1; i < ThreadCount; i++)
+  {
+    try
+    {
+      Threads.push_back(std::thread(ExtractWorker, Paths, SrcFileNames,
+        Count, &Next, out_Tags, out_Errs));
+    }
+    catch (...)
+    {
+      break;
+    }
+  }
+  ExtractWorker(Paths, SrcFileNames, Count, &Next, out_Tags, out_Errs);
+  for (i = 0; i < Threads.size(); i++)
+    Threads[i].join();
+}
@@ -0,0 +1,60 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TAG_EXTRACT_H_
+#define _TAG_EXTRACT_H_
+
+#include "tl_types.h"
+#include <string>
+
+namespace TagLEET {
+
+/* Bigger source files are left to ctags */
+#define TAG_EXTRACT_MAX_SIZE (16*1024*1024)
+
+/* Built-in tag extractor for C and C++ sources, for updating the tags of a
+ * saved file without starting ctags. It finds functions, macros, classes,
+ * structs, unions, enums with their values, typedefs, namespaces, members
+ * and variables, and writes them as ctags lines the way ctags writes them
+ * with --extras=+Ffq --fields=+Kn: the long kind name, line: field, scope
+ * and file: fields and the qualified Scope::Name tags of C++. It does not
+ * expand macros, code in #else branches and in #if 0 is skipped, and it
+ * leaves out the typeref field. The lines are not sorted. */
+
+/* Tell if the extractor knows the language of a file by its extension */
+bool IsExtractSupported(const char *FileName);
+
+/* Extract the tags of a source in memory. SrcFileName is the name of the
+ * source as written in the tags file, its extension tells C from C++ */
+TL_ERR ExtractTags(const char *Data, uint32_t Size, const char *SrcFileName,
+  std::string *out_Tags);
+
+/* The same with the source read from Path */
+TL_ERR ExtractTagsOfFile(const char *Path, const char *SrcFileName,
+  std::string *out_Tags);
+
+/* Extract the tags of files on up to ThreadCount threads. A file that is
+ * not supported or can't be read gets an error in out_Errs */
+void ExtractTagsOfFiles(const char *const *Paths,
+  const char *const *SrcFileNames, uint32_t Count, uint32_t ThreadCount,
+  std::string *out_Tags, TL_ERR *out_Errs);
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_EXTRACT_H_ */
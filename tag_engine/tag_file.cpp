@@ -41,12 +41,16 @@ struct TagLEET::TagStrRef
  * TagOffsetInDesc - the offset within the descriptor where the 1st full line
  * starts and also the tag that represents this descriptor.
  * TagStr - The tag that represents the descriptor.
+ * LastPageOffset - offset of the last page that was merged into the end of
+ * the descriptor. All lines before the 1st full line of that page have the
+ * same tag as TagStr so a scan for a bigger tag may start there.
  * Node - Used to hold the descriptor in an AVL tree sorted by tags.
  */
 struct TagLEET::TfPageDesc
 {
   tf_int_t Offset;
   tf_int_t Size;
+  tf_int_t LastPageOffset;
   uint32_t TagOffsetInDesc;
   const char *TagStr;
   avl_node_t Node;
@@ -159,6 +163,11 @@ TL_ERR TagFile::TestCaseSensitivity()
   uint32_t LineCount;
   int res;
 
+  /* The same TagFile may be used for another file or a rewritten file */
+  CaseInsensitive = false;
+  StrCmp = ::strcmp;
+  StrnCmp = ::strncmp;
+
   err = Rb.Init(fr, 0, 1024);
   if (err)
     return err;
@@ -241,7 +250,9 @@ void TagFile::CloseFile()
     fr->Close();
 }
 
-TL_ERR TagFile::ReopenFile()
+/* Reopen a closed file. The page tree is dropped if the file was modified,
+ * Modified tells that it is known to be, even if its time did not change */
+TL_ERR TagFile::ReopenFile(bool Modified)
 {
   TL_ERR err;
   if (fr == NULL)
@@ -251,10 +262,16 @@ TL_ERR TagFile::ReopenFile()
   if (err)
     return err;
   err = fr->Unmodified();
-  if (err)
+  if (err || Modified)
   {
     Reset();
     fr->AckNewTime();
+    err = TestCaseSensitivity();
+    if (err)
+    {
+      fr->Close();
+      return err;
+    }
   }
   return TL_ERR_OK;
 }
@@ -319,6 +336,7 @@ TfPageDesc *TagFile::AddNewPageToTree(tf_int_t Offset)
   TfPageDesc *Desc;
   uint32_t ReadSize = PageSize;
   uint32_t NewDescSize;
+  uint32_t TagOffsetInDesc;
   ReaderBuff Rb;
 
   if (Offset + ReadSize > fr->FileSize)
@@ -326,7 +344,7 @@ TfPageDesc *TagFile::AddNewPageToTree(tf_int_t Offset)
 
   NewDescSize = ReadSize;
   /* Usually we will perform one iteration. The loop is for the case where the
-   * page does not contain a single full line due to very long lines. In that
+   * page does not contain the start of a line due to very long lines. In that
    * case we grow it backward until we find a page that does */
   for(;;)
   {
@@ -335,15 +353,23 @@ TfPageDesc *TagFile::AddNewPageToTree(tf_int_t Offset)
       return NULL;
 
     err = Offset > 0 ? Rb.FindFirstFullLine(): Rb.FindNextFullLine();
+    /* A line that starts in the page but ends after it is read in full */
+    if (err == TL_ERR_NO_MORE && (Offset == 0 || Rb.LineOffset > 0) &&
+      Rb.LineOffset < Rb.Size)
+    {
+      err = Rb.FindNextFullLine(true);
+    }
     if (!err)
       break;
-    if (err != TL_ERR_NO_MORE || Offset == 0)
+    if ((err != TL_ERR_NO_MORE && err != TL_ERR_LINE_TOO_BIG) || Offset == 0)
       return NULL;
     ReadSize = PageSize;
     Offset -= PageSize;
     NewDescSize += PageSize;
   }
 
+  /* The buffer may have slid forward to hold the whole line */
+  TagOffsetInDesc = (uint32_t)(Rb.Offset + Rb.LineOffset - Offset);
   TagStrRef Tag = {(char *)Rb.Buff + Rb.LineOffset, Rb.TagSize};
   node = avl_lookup(&LookupTree, &Tag, &loc);
   /* Test if the same Tag is already in the tree - unlikely */
@@ -354,13 +380,14 @@ TfPageDesc *TagFile::AddNewPageToTree(tf_int_t Offset)
     if (Desc->Offset < Offset)
     {
       Desc->Size = Offset + NewDescSize - Desc->Offset;
+      Desc->LastPageOffset = Offset;
       return Desc;
     }
-    Desc->Offset = Offset;
     Desc->Size = Desc->Offset + Desc->Size - Offset;
+    Desc->Offset = Offset;
     if (Desc->Size < NewDescSize)
       Desc->Size = NewDescSize;
-    Desc->TagOffsetInDesc = Rb.LineOffset;
+    Desc->TagOffsetInDesc = TagOffsetInDesc;
     return Desc;
   }
 
@@ -376,7 +403,8 @@ TfPageDesc *TagFile::AddNewPageToTree(tf_int_t Offset)
   }
   Desc->Offset = Offset;
   Desc->Size = NewDescSize;
-  Desc->TagOffsetInDesc = Rb.LineOffset;
+  Desc->LastPageOffset = Offset;
+  Desc->TagOffsetInDesc = TagOffsetInDesc;
   avl_insert(&LookupTree, &loc, &Desc->Node);
   return Desc;
 }
@@ -424,15 +452,40 @@ TL_ERR TagFile::GrowDescBackward(TfPageDesc **DescPtr)
 }
 
 
-TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
-  tf_int_t *RangeSize)
+/* Test if a tag (not necessarily NULL terminated) is "before" the searched
+ * tag according to Mode. In prefix mode tags that start with the searched tag
+ * are considered equal to it. */
+bool TagFile::IsBefore(const char *Str, uint32_t StrSize, const TagStrRef *Tag,
+  SearchMode Mode) const
+{
+  uint32_t n = StrSize < Tag->Size ? StrSize : Tag->Size;
+  int res;
+
+  res = StrnCmp(Str, Tag->Str, n);
+  if (res == 0)
+  {
+    if (StrSize < Tag->Size)
+      res = -1;
+    else if (StrSize > Tag->Size && Mode != SEARCH_PREFIX_LE)
+      res = 1;
+  }
+  return Mode == SEARCH_LT ? res < 0 : res <= 0;
+}
+
+/* Binary search the tags file, adding pages to the LookupTree, until the
+ * descriptor of the last page that is before the tag is found. "Before" is
+ * defined by Mode, see IsBefore.
+ * Return in D1Ptr that descriptor or NULL if the tag is before the 1st line
+ * in the file. Return in GapBasePtr the end offset of that descriptor. The
+ * next descriptor in the tree starts at that offset and its tag is not
+ * "before" the tag. */
+TL_ERR TagFile::SearchDesc(const TagStrRef *Tag, SearchMode Mode,
+  TfPageDesc **D1Ptr, tf_int_t *GapBasePtr)
 {
-  TL_ERR err;
   tf_int_t GapBase, GapSize;
   TfPageDesc *D1, *D2;
   avl_node_t *node;
   avl_loc_t loc;
-  TagStrRef Tag = {TagStr, (uint32_t)strlen(TagStr)};
 
   if (fr == NULL)
     return TL_ERR_FILE_NOT_OPEN;
@@ -446,16 +499,34 @@ TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
    * Note that D2 need not actually be maintained during the search */
 
   /* Find intial D1 */
-  node = avl_lookup(&LookupTree, &Tag, &loc);
-  if (node != NULL)
+  node = avl_lookup(&LookupTree, const_cast<TagStrRef *>(Tag), &loc);
+  if (node != NULL && Mode != SEARCH_LT)
   {
     D1 = AVL_CONTREC(node, TfPageDesc, Node);
   }
   else
   {
-    avl_node_t *prev_node = avl_get_prev_node(&LookupTree, &loc);
+    avl_node_t *prev_node = node != NULL ? avl_prev(&LookupTree, node) :
+      avl_get_prev_node(&LookupTree, &loc);
     D1 = prev_node == NULL ? NULL : AVL_CONTREC(prev_node, TfPageDesc, Node);
   }
+  /* For prefix search, descriptors that start with the tag are also before
+   * it */
+  if (Mode == SEARCH_PREFIX_LE)
+  {
+    node = D1 != NULL ? D1->Node.next : LookupTree.list;
+    while (node != NULL)
+    {
+      TfPageDesc *Next = AVL_CONTREC(node, TfPageDesc, Node);
+      if (!IsBefore(Next->TagStr, (uint32_t)::strlen(Next->TagStr), Tag,
+        Mode))
+      {
+        break;
+      }
+      D1 = Next;
+      node = node->next;
+    }
+  }
   /* Set GapBase to after D1 and select initial 'node' for D2 */
   if (D1 != NULL)
   {
@@ -476,7 +547,6 @@ TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
   {
     TfPageDesc *NewDesc;
     tf_int_t GapPageCount, NewPageOffset;
-    int res;
 
     /* Select a page between D1 and D2 */
     GapPageCount = (GapSize + PageSize - 1) / PageSize;
@@ -486,8 +556,8 @@ TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
     NewDesc = AddNewPageToTree(NewPageOffset);
     if (NewDesc == NULL)
       return TL_ERR_GENERAL;
-    res = StrCmp(NewDesc->TagStr, Tag.Str);
-    if (res <= 0)
+    if (IsBefore(NewDesc->TagStr, (uint32_t)::strlen(NewDesc->TagStr), Tag,
+      Mode))
     {
       /* Tag is in the range [NewDesc]-[D2]. Move [D1] to [NewDesc] */
       tf_int_t OldBase = GapBase;
@@ -502,6 +572,23 @@ TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
     }
   }
 
+  *D1Ptr = D1;
+  *GapBasePtr = GapBase;
+  return TL_ERR_OK;
+}
+
+TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
+  tf_int_t *RangeSize)
+{
+  TL_ERR err;
+  tf_int_t GapBase;
+  TfPageDesc *D1;
+  TagStrRef Tag = {TagStr, (uint32_t)strlen(TagStr)};
+
+  err = SearchDesc(&Tag, SEARCH_LE, &D1, &GapBase);
+  if (err)
+    return err;
+
   if (D1 == NULL)
   {
     /* Tag is smaller than 1st tag in the file */
@@ -527,11 +614,282 @@ TL_ERR TagFile::Lookup(const char *TagStr, tf_int_t *RangeStart,
   return TL_ERR_OK;
 }
 
+/* Following SearchDesc, move Rb to the 1st line in the file which is not
+ * "before" the tag. Lines at the start of Desc that share its tag are skipped
+ * without being read, so a long run of identical tags costs a single page */
+TL_ERR TagFile::ScanFromDesc(const TfPageDesc *Desc, const TagStrRef *Tag,
+  SearchMode Mode, ReaderBuff *Rb)
+{
+  TL_ERR err;
+  tf_int_t Offset = Desc == NULL ? 0 : Desc->LastPageOffset;
+
+  err = Rb->Init(fr, Offset, PageSize);
+  if (err)
+    return err;
+
+  err = Offset > 0 ? Rb->FindFirstFullLine(true) : Rb->FindNextFullLine(true);
+  for (;;)
+  {
+    if (err)
+    {
+      if (err != TL_ERR_LINE_TOO_BIG)
+        return err;
+    }
+    else if (Rb->TagSize > 0 &&
+      !IsBefore((char *)Rb->Buff + Rb->LineOffset, Rb->TagSize, Tag, Mode))
+    {
+      return TL_ERR_OK;
+    }
+    err = Rb->FindNextFullLine(true);
+  }
+}
+
+/* Get the 1st tag in the file that is bigger than 'After' (or equal to it if
+ * 'Inclusive' is set). Lines of the same tag are skipped using the page tree
+ * so enumerating the distinct tags of a big file only reads a page per tag.
+ * Pseudo tags (!_TAG_XXX) are never returned. */
+TL_ERR TagFile::NextDistinctTag(const char *After, char *TagBuff,
+  uint32_t BuffSize, bool Inclusive)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  tf_int_t GapBase;
+  TfPageDesc *D1;
+  SearchMode Mode = Inclusive ? SEARCH_LT : SEARCH_LE;
+  TagStrRef Tag = {After, (uint32_t)strlen(After)};
+  const char *Line;
+
+  err = SearchDesc(&Tag, Mode, &D1, &GapBase);
+  if (!err)
+    err = ScanFromDesc(D1, &Tag, Mode, &Rb);
+
+  for (;;)
+  {
+    if (err)
+    {
+      if (err != TL_ERR_LINE_TOO_BIG)
+        return err;
+    }
+    else
+    {
+      Line = (char *)Rb.Buff + Rb.LineOffset;
+      if (Rb.TagSize > 0 && (Rb.TagSize < 2 || Line[0] != '!' ||
+        Line[1] != '_'))
+      {
+        break;
+      }
+    }
+    err = Rb.FindNextFullLine(true);
+  }
+
+  if (Rb.TagSize + 1 > BuffSize)
+    return TL_ERR_BUFF_TOO_SHORT;
+  ::memcpy(TagBuff, Line, Rb.TagSize);
+  TagBuff[Rb.TagSize] = '\0';
+  return TL_ERR_OK;
+}
+
+/* Count the lines between Start and End. Both must be at start of lines */
+TL_ERR TagFile::CountLines(tf_int_t Start, tf_int_t End, uint32_t *Count)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  const uint8_t *p, *BuffEnd;
+  uint32_t n = 0;
+  uint8_t LastChar = '\n';
+
+  while (Start < End)
+  {
+    uint32_t ReadSize = End - Start > 128*1024 ? 128*1024 :
+      (uint32_t)(End - Start);
+
+    err = Rb.Init(fr, Start, ReadSize);
+    if (err)
+      return err;
+
+    p = Rb.Buff;
+    BuffEnd = p + Rb.Size;
+    while ((p = (const uint8_t *)::memchr(p, '\n', BuffEnd - p)) != NULL)
+    {
+      n++;
+      p++;
+    }
+    LastChar = Rb.Buff[Rb.Size - 1];
+    Start += Rb.Size;
+  }
+  /* Last line of the file without EOL */
+  if (LastChar != '\n')
+    n++;
+
+  *Count = n;
+  return TL_ERR_OK;
+}
+
+/* Get the range [Start, End) of the lines whose tag starts with 'Prefix'.
+ * If there are no such lines Start == End */
+TL_ERR TagFile::GetPrefixRange(const char *Prefix, tf_int_t *Start,
+  tf_int_t *End)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  tf_int_t GapBase;
+  TfPageDesc *D1;
+  TagStrRef Tag = {Prefix, (uint32_t)strlen(Prefix)};
+
+  /* Find the 1st line with the prefix */
+  err = SearchDesc(&Tag, SEARCH_LT, &D1, &GapBase);
+  if (!err)
+    err = ScanFromDesc(D1, &Tag, SEARCH_LT, &Rb);
+  if (err == TL_ERR_NO_MORE)
+  {
+    *Start = *End = fr->FileSize;
+    return TL_ERR_OK;
+  }
+  if (err)
+    return err;
+  *Start = *End = Rb.Offset + Rb.LineOffset;
+  if (Rb.TagSize < Tag.Size ||
+    StrnCmp((char *)Rb.Buff + Rb.LineOffset, Prefix, Tag.Size) != 0)
+  {
+    return TL_ERR_OK;
+  }
+
+  /* Find the 1st line after the prefix */
+  err = SearchDesc(&Tag, SEARCH_PREFIX_LE, &D1, &GapBase);
+  if (!err)
+    err = ScanFromDesc(D1, &Tag, SEARCH_PREFIX_LE, &Rb);
+  if (err == TL_ERR_NO_MORE)
+    *End = fr->FileSize;
+  else if (!err)
+    *End = Rb.Offset + Rb.LineOffset;
+  else
+    return err;
+  return TL_ERR_OK;
+}
+
+/* Find the 1st line within [Lo, Hi) that is not "before" the tag, or Hi if
+ * there is none. Lo and Hi must be at start of lines.
+ * The range is binary searched by probing the 1st full line after its middle
+ * so the cost depends on the size of the range and not of the file */
+TL_ERR TagFile::FindLineInRange(const TagStrRef *Tag, SearchMode Mode,
+  tf_int_t Lo, tf_int_t Hi, tf_int_t *LineStart)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  tf_int_t Mid, Probe;
+
+  while (Hi - Lo > PageSize)
+  {
+    Mid = Lo + (Hi - Lo) / 2;
+    err = Rb.Init(fr, Mid, 1024);
+    if (!err)
+      err = Rb.FindFirstFullLine(true);
+    while (err == TL_ERR_LINE_TOO_BIG)
+      err = Rb.FindNextFullLine(true);
+    if (err && err != TL_ERR_NO_MORE)
+      return err;
+
+    Probe = err ? Hi : Rb.Offset + Rb.LineOffset;
+    /* A single line covers the 2nd half of the range, scan the 1st half */
+    if (Probe >= Hi)
+      break;
+
+    if (IsBefore((char *)Rb.Buff + Rb.LineOffset, Rb.TagSize, Tag, Mode))
+      Lo = Probe;
+    else
+      Hi = Probe;
+  }
+
+  /* Scan the remaining lines */
+  err = Rb.Init(fr, Lo, PageSize);
+  if (!err)
+    err = Rb.FindNextFullLine(true);
+  for (;;)
+  {
+    if (err == TL_ERR_NO_MORE)
+      break;
+    if (!err)
+    {
+      if (Rb.Offset + Rb.LineOffset >= Hi)
+        break;
+      if (!IsBefore((char *)Rb.Buff + Rb.LineOffset, Rb.TagSize, Tag, Mode))
+      {
+        *LineStart = Rb.Offset + Rb.LineOffset;
+        return TL_ERR_OK;
+      }
+    }
+    else if (err != TL_ERR_LINE_TOO_BIG)
+    {
+      return err;
+    }
+    err = Rb.FindNextFullLine(true);
+  }
+  *LineStart = Hi;
+  return TL_ERR_OK;
+}
+
+/* Same as GetPrefixRange but search only within [RangeStart, RangeEnd). This
+ * is used to narrow the range of a prefix when it is extended */
+TL_ERR TagFile::GetPrefixRangeIn(const char *Prefix, tf_int_t RangeStart,
+  tf_int_t RangeEnd, tf_int_t *Start, tf_int_t *End)
+{
+  TL_ERR err;
+  TagStrRef Tag = {Prefix, (uint32_t)strlen(Prefix)};
+
+  if (fr == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+
+  err = FindLineInRange(&Tag, SEARCH_LT, RangeStart, RangeEnd, Start);
+  if (!err)
+    err = FindLineInRange(&Tag, SEARCH_PREFIX_LE, *Start, RangeEnd, End);
+  return err;
+}
+
+/* Count the lines whose tag starts with 'Prefix' without parsing them.
+ * Pseudo tags (!_TAG_XXX) are not counted, they sort together so the lines
+ * of the range that are pseudo tags are a range of their own */
+TL_ERR TagFile::CountMatches(const char *Prefix, uint32_t *Count)
+{
+  TL_ERR err;
+  tf_int_t Start, End;
+  tf_int_t PseudoStart = 0, PseudoEnd = 0;
+  uint32_t PseudoCount = 0;
+
+  *Count = 0;
+  err = GetPrefixRange(Prefix, &Start, &End);
+  if (!err && Start < End)
+    err = GetPrefixRange("!_", &PseudoStart, &PseudoEnd);
+  if (err)
+    return err;
+
+  if (PseudoStart < Start)
+    PseudoStart = Start;
+  if (PseudoEnd > End)
+    PseudoEnd = End;
+  if (Start < End && PseudoStart < PseudoEnd)
+  {
+    err = CountLines(PseudoStart, PseudoEnd, &PseudoCount);
+    if (err)
+      return err;
+  }
+
+  err = CountLines(Start, End, Count);
+  if (!err)
+    *Count -= PseudoCount;
+  return err;
+}
+
+bool TagFile::HasPrefix(const char *TagStr, const char *Prefix) const
+{
+  return StrnCmp(TagStr, Prefix, ::strlen(Prefix)) == 0;
+}
+
 TfAllocator::TfAllocator(uint32_t in_AllocPageSize, uint32_t in_AllocAlign)
 {
   uint32_t AllocGranularity = FileReader::GetSystemAllocGranularity();
 
   CurrPage = NULL;
+  AllocatedSize = 0;
   AllocPageSize = in_AllocPageSize;
   AllocAlign = in_AllocAlign;
   assert((AllocAlign & (AllocAlign - 1)) == 0);
@@ -556,6 +914,7 @@ void TfAllocator::Reset()
     CurrPage = *(uint8_t **)CurrPage;
     FileReader::FreeMem(TmpPage);
   }
+  AllocatedSize = 0;
 }
 
 void *TfAllocator::Alloc(uint32_t Size)
@@ -573,6 +932,7 @@ void *TfAllocator::Alloc(uint32_t Size)
     *(uint8_t **)NewPage = CurrPage;
     CurrPage = NewPage;
     AllocOffset = HeaderSize;
+    AllocatedSize += AllocPageSize;
   }
 
   Ptr = CurrPage + AllocOffset;
@@ -711,6 +1071,36 @@ TL_ERR TagIterator::Init(TagFile *tf, const char *in_TagStr, uint32_t ReadSize)
   return TL_ERR_OK;
 }
 
+/* Start iterating from a known start of line, usually the start of a range
+ * found by GetPrefixRange, without looking up the tag */
+TL_ERR TagIterator::InitAt(TagFile *tf, const char *in_TagStr,
+  tf_int_t LineStart, uint32_t ReadSize)
+{
+  TL_ERR err;
+
+  if (tf->IsCaseInsensitive())
+    MemCmp = TagLEET::memicmp;
+  TagStr = ::_strdup(in_TagStr);
+  err = TagStr == NULL ? TL_ERR_MEM_ALLOC : TL_ERR_OK;
+  if (!err)
+  {
+    if (ReadSize == 0)
+      ReadSize = 16*1024;
+    err = rb.Init(tf->GetFileReader(), LineStart, ReadSize);
+  }
+
+  if (err)
+  {
+    Release();
+    return err;
+  }
+
+  IsFirstLine = false;
+  TagSize = (uint32_t)strlen(TagStr);
+  LineCount = 0;
+  return TL_ERR_OK;
+}
+
 void TagIterator::Release()
 {
   rb.Release();
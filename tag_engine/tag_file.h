@@ -41,9 +41,11 @@ public:
   void *Alloc(uint32_t Size);
   char *StrDup(const char *Str, int32_t StrSize = 0);
   void UndoAlloc(uint32_t Size);
+  uint32_t GetAllocatedSize() const { return AllocatedSize; }
 
   private:
   uint8_t *CurrPage;
+  uint32_t AllocatedSize;
   uint32_t AllocOffset;
   uint32_t AllocPageSize;
   uint32_t AllocAlign;
@@ -63,12 +65,26 @@ public:
   void Reset();
   TL_ERR Lookup(const char *TagStr, tf_int_t *RangeStart,
     tf_int_t *RangeSize);
+  TL_ERR NextDistinctTag(const char *After, char *TagBuff, uint32_t BuffSize,
+    bool Inclusive = false);
+  TL_ERR CountMatches(const char *Prefix, uint32_t *Count);
+  TL_ERR GetPrefixRange(const char *Prefix, tf_int_t *Start, tf_int_t *End);
+  TL_ERR GetPrefixRangeIn(const char *Prefix, tf_int_t RangeStart,
+    tf_int_t RangeEnd, tf_int_t *Start, tf_int_t *End);
+  bool HasPrefix(const char *TagStr, const char *Prefix) const;
   void CloseFile();
-  TL_ERR ReopenFile();
+  TL_ERR ReopenFile(bool Modified = false);
   FileReader *GetFileReader() const { return fr; }
   bool IsCaseInsensitive() const { return CaseInsensitive; }
 
 private:
+  /* How SearchDesc compares the page tags with the searched tag */
+  enum SearchMode {
+    SEARCH_LE,        /* Last page with tag <= searched tag */
+    SEARCH_LT,        /* Last page with tag < searched tag */
+    SEARCH_PREFIX_LE  /* Last page with tag prefix <= searched tag */
+  };
+
   TL_ERR CommonInit(const wchar_t *FileNameW, const char *FileNameA);
   TL_ERR TestCaseSensitivity();
   TL_ERR Process_FILE_SORTED_flag(ReaderBuff *Rb);
@@ -76,6 +92,15 @@ private:
   TfPageDesc *AllocDesc(const TagStrRef *Tag);
   TL_ERR GrowDescBackward(TfPageDesc **Desc);
   TL_ERR TestSort(tf_int_t Offset, avl_loc_t *loc) const;
+  TL_ERR SearchDesc(const TagStrRef *Tag, SearchMode Mode, TfPageDesc **D1Ptr,
+    tf_int_t *GapBasePtr);
+  bool IsBefore(const char *Str, uint32_t StrSize, const TagStrRef *Tag,
+    SearchMode Mode) const;
+  TL_ERR ScanFromDesc(const TfPageDesc *Desc, const TagStrRef *Tag,
+    SearchMode Mode, ReaderBuff *Rb);
+  TL_ERR CountLines(tf_int_t Start, tf_int_t End, uint32_t *Count);
+  TL_ERR FindLineInRange(const TagStrRef *Tag, SearchMode Mode, tf_int_t Lo,
+    tf_int_t Hi, tf_int_t *LineStart);
   static int tag_tree_comp_func(void *ctx, avl_node_t *node, void *key);
 
 private:
@@ -132,6 +157,8 @@ public:
   virtual ~TagIterator();
 
   TL_ERR Init(TagFile *tf, const char *in_TagStr, uint32_t ReadSize=0);
+  TL_ERR InitAt(TagFile *tf, const char *in_TagStr, tf_int_t LineStart,
+    uint32_t ReadSize=0);
   void Release();
   TL_ERR GetNextTagLine(const char **Line, uint32_t *LineSize);
   TL_ERR GetTagLineProps(TagLineProperties *Props) const;
@@ -0,0 +1,561 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_file_index.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <string>
+
+using namespace TagLEET;
+
+/* Header of a saved file index */
+struct TiFileHeader
+{
+  char Magic[4];
+  uint32_t Version;
+  uint64_t FileSize;
+  uint64_t ModTime;
+  uint32_t FileCount;
+  uint32_t LineCount;
+  uint32_t PoolSize;
+  uint32_t Reserved;
+};
+
+static const char TiMagic[4] = {'T', 'L', 'F', 'I'};
+#define TI_VERSION 1
+
+TagFileIndex::TagFileIndex()
+{
+  NameOffsets = NULL;
+  FirstLine = NULL;
+  LineOffsets = NULL;
+  LineFiles = NULL;
+  HashTable = NULL;
+  Pool = NULL;
+  TagsFilePath = NULL;
+  HashSize = 0;
+  FileCount = FileCapacity = 0;
+  LineCount = LineCapacity = 0;
+  PoolSize = PoolCapacity = 0;
+  FileSize = 0;
+  ModTime = 0;
+}
+
+TagFileIndex::~TagFileIndex()
+{
+  Reset();
+}
+
+void TagFileIndex::Reset()
+{
+  ::free(NameOffsets);
+  ::free(FirstLine);
+  ::free(LineOffsets);
+  ::free(LineFiles);
+  ::free(HashTable);
+  ::free(Pool);
+  ::free(TagsFilePath);
+  NameOffsets = NULL;
+  FirstLine = NULL;
+  LineOffsets = NULL;
+  LineFiles = NULL;
+  HashTable = NULL;
+  Pool = NULL;
+  TagsFilePath = NULL;
+  HashSize = 0;
+  FileCount = FileCapacity = 0;
+  LineCount = LineCapacity = 0;
+  PoolSize = PoolCapacity = 0;
+}
+
+void TagFileIndex::MoveFrom(TagFileIndex *Other)
+{
+  Reset();
+  NameOffsets = Other->NameOffsets;
+  FirstLine = Other->FirstLine;
+  LineOffsets = Other->LineOffsets;
+  LineFiles = Other->LineFiles;
+  HashTable = Other->HashTable;
+  HashSize = Other->HashSize;
+  Pool = Other->Pool;
+  FileCount = Other->FileCount;
+  FileCapacity = Other->FileCapacity;
+  LineCount = Other->LineCount;
+  LineCapacity = Other->LineCapacity;
+  PoolSize = Other->PoolSize;
+  PoolCapacity = Other->PoolCapacity;
+  TagsFilePath = Other->TagsFilePath;
+  FileSize = Other->FileSize;
+  ModTime = Other->ModTime;
+
+  /* Other gave away its memory, it must not free it */
+  Other->NameOffsets = NULL;
+  Other->FirstLine = NULL;
+  Other->LineOffsets = NULL;
+  Other->LineFiles = NULL;
+  Other->HashTable = NULL;
+  Other->Pool = NULL;
+  Other->TagsFilePath = NULL;
+  Other->Reset();
+}
+
+bool TagFileIndex::IsValidFor(const char *in_TagsFilePath,
+  tf_int_t in_FileSize, uint64_t in_ModTime) const
+{
+  /* Lines are being added */
+  if (TagsFilePath == NULL || FirstLine == NULL)
+    return false;
+  return ::strcmp(TagsFilePath, in_TagsFilePath) == 0 &&
+    FileSize == in_FileSize && ModTime == in_ModTime;
+}
+
+bool TagFileIndex::IsValidFor(const char *in_TagsFilePath,
+  const TagFile *tf) const
+{
+  FileReader *fr = tf->GetFileReader();
+
+  if (fr == NULL)
+    return false;
+  return IsValidFor(in_TagsFilePath, fr->FileSize, fr->ModTime);
+}
+
+/* FNV-1a, with '/' hashed as '\\' */
+uint32_t TagFileIndex::NameHash(const char *Name, uint32_t Size)
+{
+  uint32_t Hash = 2166136261U;
+  uint32_t i;
+
+  for (i = 0; i < Size; i++)
+  {
+    Hash ^= Name[i] == '/' ? (uint8_t)'\\' : (uint8_t)Name[i];
+    Hash *= 16777619U;
+  }
+  return Hash;
+}
+
+bool TagFileIndex::SameName(const char *Name1, const char *Name2,
+  uint32_t Size)
+{
+  uint32_t i;
+
+  for (i = 0; i < Size; i++)
+  {
+    if (Name1[i] == Name2[i])
+      continue;
+    if ((Name1[i] == '/' || Name1[i] == '\\') &&
+      (Name2[i] == '/' || Name2[i] == '\\'))
+    {
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+/* Slot of a name, or the empty slot where it would be */
+uint32_t *TagFileIndex::FindSlot(const char *Name, uint32_t Size,
+  uint32_t Hash) const
+{
+  uint32_t Mask = HashSize - 1;
+  uint32_t i;
+
+  for (i = Hash & Mask; HashTable[i] != 0; i = (i + 1) & Mask)
+  {
+    const char *FileName = Pool + NameOffsets[HashTable[i] - 1];
+    if (FileName[Size] == '\0' && SameName(FileName, Name, Size))
+      break;
+  }
+  return HashTable + i;
+}
+
+TL_ERR TagFileIndex::BuildHash(uint32_t NewHashSize)
+{
+  uint32_t i;
+
+  ::free(HashTable);
+  HashTable = (uint32_t *)::calloc(NewHashSize, sizeof(uint32_t));
+  if (HashTable == NULL)
+  {
+    HashSize = 0;
+    return TL_ERR_MEM_ALLOC;
+  }
+  HashSize = NewHashSize;
+
+  for (i = 0; i < FileCount; i++)
+  {
+    const char *Name = Pool + NameOffsets[i];
+    uint32_t Size = (uint32_t)::strlen(Name);
+    *FindSlot(Name, Size, NameHash(Name, Size)) = i + 1;
+  }
+  return TL_ERR_OK;
+}
+
+TL_ERR TagFileIndex::InternName(const char *Name, uint32_t Size,
+  uint32_t *out_File)
+{
+  TL_ERR err;
+  uint32_t Hash = NameHash(Name, Size);
+  uint32_t *Slot;
+
+  /* Keep the table at most half full */
+  if (2 * (FileCount + 1) > HashSize)
+  {
+    err = BuildHash(HashSize == 0 ? 1024 : HashSize * 2);
+    if (err)
+      return err;
+  }
+
+  Slot = FindSlot(Name, Size, Hash);
+  if (*Slot != 0)
+  {
+    *out_File = *Slot - 1;
+    return TL_ERR_OK;
+  }
+
+  if (FileCount == FileCapacity)
+  {
+    uint32_t NewCapacity = FileCapacity == 0 ? 1024 : FileCapacity * 2;
+    uint32_t *NewOffsets;
+
+    NewOffsets = (uint32_t *)::realloc(NameOffsets,
+      NewCapacity * sizeof(uint32_t));
+    if (NewOffsets == NULL)
+      return TL_ERR_MEM_ALLOC;
+    NameOffsets = NewOffsets;
+    FileCapacity = NewCapacity;
+  }
+
+  if (PoolSize + Size + 1 > PoolCapacity)
+  {
+    uint32_t NewCapacity = PoolCapacity == 0 ? 64*1024 : PoolCapacity * 2;
+    char *NewPool;
+
+    while (PoolSize + Size + 1 > NewCapacity)
+      NewCapacity *= 2;
+    NewPool = (char *)::realloc(Pool, NewCapacity);
+    if (NewPool == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Pool = NewPool;
+    PoolCapacity = NewCapacity;
+  }
+
+  NameOffsets[FileCount] = PoolSize;
+  ::memcpy(Pool + PoolSize, Name, Size);
+  Pool[PoolSize + Size] = '\0';
+  PoolSize += Size + 1;
+  *Slot = ++FileCount;
+  *out_File = FileCount - 1;
+  return TL_ERR_OK;
+}
+
+TL_ERR TagFileIndex::AddLine(const char *Line, uint32_t LineSize,
+  tf_int_t Offset)
+{
+  TL_ERR err;
+  const char *Name, *End;
+  uint32_t File;
+
+  if (FirstLine != NULL)
+    return TL_ERR_BAD_STATE;
+  if (LineSize == 0 || (LineSize > 1 && Line[0] == '!' && Line[1] == '_'))
+    return TL_ERR_OK;
+
+  /* The file name is the 2nd field */
+  Name = (const char *)::memchr(Line, '\t', LineSize);
+  if (Name == NULL || Name == Line)
+    return TL_ERR_OK;
+  Name++;
+  End = (const char *)::memchr(Name, '\t', LineSize - (Name - Line));
+  if (End == NULL)
+    End = Line + LineSize;
+
+  err = InternName(Name, (uint32_t)(End - Name), &File);
+  if (err)
+    return err;
+
+  if (LineCount == LineCapacity)
+  {
+    uint32_t NewCapacity = LineCapacity == 0 ? 16*1024 : LineCapacity * 2;
+    tf_int_t *NewOffsets;
+    uint32_t *NewFiles;
+
+    NewOffsets = (tf_int_t *)::realloc(LineOffsets,
+      NewCapacity * sizeof(tf_int_t));
+    if (NewOffsets == NULL)
+      return TL_ERR_MEM_ALLOC;
+    LineOffsets = NewOffsets;
+    NewFiles = (uint32_t *)::realloc(LineFiles, NewCapacity * sizeof(uint32_t));
+    if (NewFiles == NULL)
+      return TL_ERR_MEM_ALLOC;
+    LineFiles = NewFiles;
+    LineCapacity = NewCapacity;
+  }
+  LineOffsets[LineCount] = Offset;
+  LineFiles[LineCount] = File;
+  LineCount++;
+  return TL_ERR_OK;
+}
+
+/* Group the lines by file, keeping the file order of the lines of each */
+TL_ERR TagFileIndex::Finish(const char *in_TagsFilePath,
+  tf_int_t in_FileSize, uint64_t in_ModTime)
+{
+  tf_int_t *Grouped = NULL;
+  uint32_t i;
+
+  if (FirstLine != NULL)
+    return TL_ERR_BAD_STATE;
+
+  FirstLine = (uint32_t *)::calloc(FileCount + 1, sizeof(uint32_t));
+  if (LineCount > 0)
+    Grouped = (tf_int_t *)::malloc(LineCount * sizeof(tf_int_t));
+  TagsFilePath = ::_strdup(in_TagsFilePath);
+  if (FirstLine == NULL || (LineCount > 0 && Grouped == NULL) ||
+    TagsFilePath == NULL)
+  {
+    ::free(Grouped);
+    Reset();
+    return TL_ERR_MEM_ALLOC;
+  }
+
+  for (i = 0; i < LineCount; i++)
+    FirstLine[LineFiles[i] + 1]++;
+  for (i = 0; i < FileCount; i++)
+    FirstLine[i + 1] += FirstLine[i];
+  /* FirstLine[f] is used as the next place of file f, then restored */
+  for (i = 0; i < LineCount; i++)
+    Grouped[FirstLine[LineFiles[i]]++] = LineOffsets[i];
+  for (i = FileCount; i > 0; i--)
+    FirstLine[i] = FirstLine[i - 1];
+  FirstLine[0] = 0;
+
+  ::free(LineOffsets);
+  ::free(LineFiles);
+  LineOffsets = Grouped;
+  LineFiles = NULL;
+  LineCapacity = LineCount;
+  FileSize = in_FileSize;
+  ModTime = in_ModTime;
+  return TL_ERR_OK;
+}
+
+TL_ERR TagFileIndex::Build(TagFile *tf, const char *in_TagsFilePath)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  FileReader *fr = tf->GetFileReader();
+
+  Reset();
+  if (fr == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+
+  err = Rb.InitSequential(fr, 0, 128*1024, FR_ACCESS_ONCE);
+  if (!err)
+    err = Rb.FindNextFullLine(true);
+  for (; !err || err == TL_ERR_LINE_TOO_BIG; err = Rb.FindNextFullLine(true))
+  {
+    if (err)
+      continue;
+    err = AddLine((const char *)Rb.Buff + Rb.LineOffset, Rb.LineSize,
+      Rb.Offset + Rb.LineOffset);
+    if (err)
+      break;
+  }
+
+  if (err != TL_ERR_NO_MORE)
+  {
+    Reset();
+    return err;
+  }
+  return Finish(in_TagsFilePath, fr->FileSize, fr->ModTime);
+}
+
+bool TagFileIndex::FindFile(const char *SrcFileName, uint32_t *out_File) const
+{
+  uint32_t Size = (uint32_t)::strlen(SrcFileName);
+  uint32_t *Slot;
+
+  if (FirstLine == NULL || HashSize == 0)
+    return false;
+  Slot = FindSlot(SrcFileName, Size, NameHash(SrcFileName, Size));
+  if (*Slot == 0)
+    return false;
+  *out_File = *Slot - 1;
+  return true;
+}
+
+uint32_t TagFileIndex::GetFileTags(uint32_t File,
+  const tf_int_t **out_Offsets) const
+{
+  if (FirstLine == NULL || File >= FileCount)
+    return 0;
+  *out_Offsets = LineOffsets + FirstLine[File];
+  return FirstLine[File + 1] - FirstLine[File];
+}
+
+TL_ERR TagFileIndex::Save(const char *FileName) const
+{
+  TL_ERR err;
+  FileWriter *fw;
+  std::string TmpPath(FileName);
+  TiFileHeader Hdr;
+
+  if (TagsFilePath == NULL || FirstLine == NULL)
+    return TL_ERR_BAD_STATE;
+
+  ::memset(&Hdr, 0, sizeof(Hdr));
+  ::memcpy(Hdr.Magic, TiMagic, sizeof(Hdr.Magic));
+  Hdr.Version = TI_VERSION;
+  Hdr.FileSize = FileSize;
+  Hdr.ModTime = ModTime;
+  Hdr.FileCount = FileCount;
+  Hdr.LineCount = LineCount;
+  Hdr.PoolSize = PoolSize;
+
+  fw = FileWriter::FileWriterCreate();
+  if (fw == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  TmpPath += FW_TMP_EXT;
+  err = fw->Create(TmpPath.c_str());
+  if (!err)
+    err = fw->Write(&Hdr, sizeof(Hdr));
+  if (!err && FileCount > 0)
+    err = fw->Write(NameOffsets, FileCount * sizeof(uint32_t));
+  if (!err)
+    err = fw->Write(FirstLine, (FileCount + 1) * sizeof(uint32_t));
+  if (!err && LineCount > 0)
+    err = fw->Write(LineOffsets, LineCount * sizeof(tf_int_t));
+  if (!err && PoolSize > 0)
+    err = fw->Write(Pool, PoolSize);
+  if (!err)
+    err = fw->Flush();
+  fw->Close();
+  delete fw;
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), FileName);
+  if (err)
+    FileWriter::RemoveFile(TmpPath.c_str());
+  return err;
+}
+
+TL_ERR TagFileIndex::Load(const char *FileName, const char *in_TagsFilePath)
+{
+  TL_ERR err;
+  FileReader *fr;
+  TiFileHeader Hdr;
+  tf_int_t TagsFileSize, Offset;
+  uint64_t TagsModTime;
+  uint32_t i;
+
+  Reset();
+  err = FileReader::GetFileInfo(in_TagsFilePath, &TagsFileSize, &TagsModTime);
+  if (err)
+    return err;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(FileName);
+  if (!err && fr->FileSize < sizeof(Hdr))
+    err = TL_ERR_INVALID;
+  if (!err)
+    err = fr->Read(0, &Hdr, sizeof(Hdr));
+  if (!err && (::memcmp(Hdr.Magic, TiMagic, sizeof(Hdr.Magic)) != 0 ||
+    Hdr.Version != TI_VERSION ||
+    fr->FileSize != sizeof(Hdr) + (2 * (tf_int_t)Hdr.FileCount + 1) *
+    sizeof(uint32_t) + (tf_int_t)Hdr.LineCount * sizeof(tf_int_t) +
+    Hdr.PoolSize))
+  {
+    err = TL_ERR_INVALID;
+  }
+  if (!err && (Hdr.FileSize != TagsFileSize || Hdr.ModTime != TagsModTime))
+    err = TL_ERR_MODIFIED;
+
+  if (!err)
+  {
+    FirstLine = (uint32_t *)::malloc((Hdr.FileCount + 1) * sizeof(uint32_t));
+    if (Hdr.FileCount > 0)
+      NameOffsets = (uint32_t *)::malloc(Hdr.FileCount * sizeof(uint32_t));
+    if (Hdr.LineCount > 0)
+      LineOffsets = (tf_int_t *)::malloc(Hdr.LineCount * sizeof(tf_int_t));
+    if (Hdr.PoolSize > 0)
+      Pool = (char *)::malloc(Hdr.PoolSize);
+    if (FirstLine == NULL || (Hdr.FileCount > 0 && NameOffsets == NULL) ||
+      (Hdr.LineCount > 0 && LineOffsets == NULL) ||
+      (Hdr.PoolSize > 0 && Pool == NULL))
+    {
+      err = TL_ERR_MEM_ALLOC;
+    }
+  }
+  Offset = sizeof(Hdr);
+  if (!err && Hdr.FileCount > 0)
+    err = fr->Read(Offset, NameOffsets, Hdr.FileCount * sizeof(uint32_t));
+  Offset += Hdr.FileCount * sizeof(uint32_t);
+  if (!err)
+    err = fr->Read(Offset, FirstLine, (Hdr.FileCount + 1) * sizeof(uint32_t));
+  Offset += (Hdr.FileCount + 1) * sizeof(uint32_t);
+  if (!err && Hdr.LineCount > 0)
+    err = fr->Read(Offset, LineOffsets, Hdr.LineCount * sizeof(tf_int_t));
+  Offset += Hdr.LineCount * sizeof(tf_int_t);
+  if (!err && Hdr.PoolSize > 0)
+    err = fr->Read(Offset, Pool, Hdr.PoolSize);
+  delete fr;
+
+  if (!err)
+  {
+    FileCount = FileCapacity = Hdr.FileCount;
+    LineCount = LineCapacity = Hdr.LineCount;
+    PoolSize = PoolCapacity = Hdr.PoolSize;
+    if (FirstLine[0] != 0 || FirstLine[FileCount] != LineCount ||
+      (PoolSize > 0 && Pool[PoolSize - 1] != '\0'))
+    {
+      err = TL_ERR_INVALID;
+    }
+  }
+  for (i = 0; !err && i < FileCount; i++)
+  {
+    if (NameOffsets[i] >= PoolSize || FirstLine[i] > FirstLine[i + 1])
+      err = TL_ERR_INVALID;
+  }
+  if (!err)
+  {
+    uint32_t NewHashSize = 1024;
+    while (NewHashSize < 2 * FileCount)
+      NewHashSize *= 2;
+    err = BuildHash(NewHashSize);
+  }
+  if (!err)
+  {
+    TagsFilePath = ::_strdup(in_TagsFilePath);
+    err = TagsFilePath == NULL ? TL_ERR_MEM_ALLOC : TL_ERR_OK;
+  }
+  if (!err)
+  {
+    FileSize = TagsFileSize;
+    ModTime = TagsModTime;
+  }
+  if (err)
+    Reset();
+  return err;
+}
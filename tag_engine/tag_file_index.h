@@ -0,0 +1,105 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TAG_FILE_INDEX_H_
+#define _TAG_FILE_INDEX_H_
+
+#include "tag_file.h"
+
+namespace TagLEET {
+
+/* Extension of the saved index, next to the tags file */
+#define TAG_FILE_INDEX_EXT ".tlf"
+
+/* Index of the tags file lines of each source file.
+ * The tags file is sorted by tag name, this index gives the offsets of all
+ * the lines of one source file without scanning the tags file. The file
+ * names are kept once each in a string pool with a hash table over them and
+ * the line offsets of a file are consecutive, so the k lines of a file are
+ * found in O(k).
+ * The index is built with one sequential read of the tags file, or line by
+ * line while a tags file is written, and may be saved next to it. */
+class TagFileIndex
+{
+public:
+  TagFileIndex();
+  ~TagFileIndex();
+
+  TL_ERR Build(TagFile *tf, const char *in_TagsFilePath);
+  TL_ERR Save(const char *FileName) const;
+  /* Fails with TL_ERR_MODIFIED if the tags file changed since it was saved */
+  TL_ERR Load(const char *FileName, const char *in_TagsFilePath);
+  void Reset();
+  /* Take the index of Other, that is left empty */
+  void MoveFrom(TagFileIndex *Other);
+  bool IsValidFor(const char *in_TagsFilePath, const TagFile *tf) const;
+  bool IsValidFor(const char *in_TagsFilePath, tf_int_t in_FileSize,
+    uint64_t in_ModTime) const;
+
+  /* Build line by line. Lines must be added in the order of the tags file,
+   * pseudo tags are ignored. Finish stamps the index with the tags file it
+   * describes */
+  TL_ERR AddLine(const char *Line, uint32_t LineSize, tf_int_t Offset);
+  TL_ERR Finish(const char *in_TagsFilePath, tf_int_t in_FileSize,
+    uint64_t in_ModTime);
+
+  uint32_t GetFileCount() const { return FileCount; }
+  const char *GetFileName(uint32_t File) const
+    { return Pool + NameOffsets[File]; }
+  /* '/' and '\\' in SrcFileName match either one */
+  bool FindFile(const char *SrcFileName, uint32_t *out_File) const;
+  /* Offsets in the tags file of the lines of a file, in file order */
+  uint32_t GetFileTags(uint32_t File, const tf_int_t **out_Offsets) const;
+  uint32_t GetLineCount() const { return LineCount; }
+  const char *GetTagsFilePath() const { return TagsFilePath; }
+
+private:
+  static uint32_t NameHash(const char *Name, uint32_t Size);
+  static bool SameName(const char *Name1, const char *Name2, uint32_t Size);
+  uint32_t *FindSlot(const char *Name, uint32_t Size, uint32_t Hash) const;
+  TL_ERR InternName(const char *Name, uint32_t Size, uint32_t *out_File);
+  TL_ERR BuildHash(uint32_t NewHashSize);
+
+  /* Offset in Pool of each file name */
+  uint32_t *NameOffsets;
+  /* The lines of file i are LineOffsets[FirstLine[i]..FirstLine[i+1]) */
+  uint32_t *FirstLine;
+  tf_int_t *LineOffsets;
+  /* While building, the file of each line of LineOffsets */
+  uint32_t *LineFiles;
+  /* Open addressing table of file index + 1, HashSize is a power of 2 */
+  uint32_t *HashTable;
+  uint32_t HashSize;
+  char *Pool;
+  uint32_t FileCount;
+  uint32_t FileCapacity;
+  uint32_t LineCount;
+  uint32_t LineCapacity;
+  uint32_t PoolSize;
+  uint32_t PoolCapacity;
+  /* Identity of the tags file the index was built from */
+  char *TagsFilePath;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_FILE_INDEX_H_ */
@@ -0,0 +1,571 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_filter.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+using namespace TagLEET;
+
+/* Header of a saved filter file */
+struct TbFileHeader
+{
+  char Magic[4];
+  uint32_t Version;
+  uint64_t FileSize;
+  uint64_t ModTime;
+  uint32_t BlockCount;
+  uint32_t CaseInsensitive;
+};
+
+static const char TbMagic[4] = {'T', 'L', 'B', 'F'};
+#define TB_VERSION 1
+#define TB_BLOCK_WORDS 8
+#define TB_BITS_PER_TAG 16
+
+/* Odd constants that spread the 8 bits of a tag over the 8 words of its
+ * block */
+static const uint32_t TbSalt[TB_BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+TagBloomFilter::TagBloomFilter()
+{
+  Blocks = NULL;
+  BlockCount = 0;
+  FileSize = 0;
+  ModTime = 0;
+  CaseInsensitive = false;
+}
+
+TagBloomFilter::~TagBloomFilter()
+{
+  Reset();
+}
+
+void TagBloomFilter::Reset()
+{
+  ::free(Blocks);
+  Blocks = NULL;
+  BlockCount = 0;
+}
+
+uint64_t TagBloomFilter::TagHash(const char *Tag, uint32_t TagSize,
+  bool CaseInsensitive)
+{
+  uint64_t h = 14695981039346656037ULL;
+  uint32_t i;
+
+  for (i = 0; i < TagSize; i++)
+  {
+    uint8_t ch = (uint8_t)Tag[i];
+    if (CaseInsensitive && ch >= 'a' && ch <= 'z')
+      ch -= 'a' - 'A';
+    h = (h ^ ch) * 1099511628211ULL;
+  }
+
+  /* FNV alone is weak in the high bits that select the block */
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+void TagBloomFilter::Insert(uint64_t Hash)
+{
+  uint32_t *Block;
+  uint32_t Key = (uint32_t)Hash;
+  int i;
+
+  Block = Blocks + ((Hash >> 32) * BlockCount >> 32) * TB_BLOCK_WORDS;
+  for (i = 0; i < TB_BLOCK_WORDS; i++)
+    Block[i] |= 1U << ((Key * TbSalt[i]) >> 27);
+}
+
+bool TagBloomFilter::MayContain(const char *Tag, uint32_t TagSize) const
+{
+  const uint32_t *Block;
+  uint64_t Hash;
+  uint32_t Key;
+  int i;
+
+  if (Blocks == NULL)
+    return true;
+
+  Hash = TagHash(Tag, TagSize, CaseInsensitive);
+  Key = (uint32_t)Hash;
+  Block = Blocks + ((Hash >> 32) * BlockCount >> 32) * TB_BLOCK_WORDS;
+  for (i = 0; i < TB_BLOCK_WORDS; i++)
+  {
+    if ((Block[i] & (1U << ((Key * TbSalt[i]) >> 27))) == 0)
+      return false;
+  }
+  return true;
+}
+
+bool TagBloomFilter::IsValidFor(tf_int_t in_FileSize, uint64_t in_ModTime) const
+{
+  return Blocks != NULL && FileSize == in_FileSize && ModTime == in_ModTime;
+}
+
+/* Build the filter with one sequential read of the tags file. The hashes of
+ * the distinct tags are collected first so the filter is sized exactly */
+TL_ERR TagBloomFilter::Build(TagFile *tf)
+{
+  TL_ERR err;
+  ReaderBuff Rb;
+  FileReader *fr = tf->GetFileReader();
+  const char *Line;
+  uint64_t *Hashes = NULL;
+  uint64_t PrevHash = 0;
+  uint32_t HashCount = 0, HashCapacity = 0;
+  uint32_t i;
+
+  Reset();
+  if (fr == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+
+  CaseInsensitive = tf->IsCaseInsensitive();
+  err = Rb.InitSequential(fr, 0, 128*1024, FR_ACCESS_ONCE);
+  while (!err)
+  {
+    uint64_t Hash;
+
+    err = Rb.FindNextFullLine(true);
+    if (err == TL_ERR_LINE_TOO_BIG)
+    {
+      err = TL_ERR_OK;
+      continue;
+    }
+    if (err)
+      break;
+
+    Line = (char *)Rb.Buff + Rb.LineOffset;
+    if (Rb.TagSize == 0 || (Line[0] == '!' && Rb.TagSize > 1 && Line[1] == '_'))
+      continue;
+
+    /* The file is sorted, so all lines of a tag are consecutive */
+    Hash = TagHash(Line, Rb.TagSize, CaseInsensitive);
+    if (HashCount > 0 && Hash == PrevHash)
+      continue;
+
+    if (HashCount == HashCapacity)
+    {
+      uint32_t NewCapacity = HashCapacity == 0 ? 16*1024 : HashCapacity * 2;
+      uint64_t *NewHashes;
+
+      NewHashes = (uint64_t *)::realloc(Hashes, NewCapacity * sizeof(uint64_t));
+      if (NewHashes == NULL)
+      {
+        err = TL_ERR_MEM_ALLOC;
+        break;
+      }
+      Hashes = NewHashes;
+      HashCapacity = NewCapacity;
+    }
+    Hashes[HashCount++] = PrevHash = Hash;
+  }
+
+  if (err == TL_ERR_NO_MORE)
+  {
+    BlockCount = (HashCount * TB_BITS_PER_TAG + TB_BLOCK_WORDS * 32 - 1) /
+      (TB_BLOCK_WORDS * 32);
+    if (BlockCount == 0)
+      BlockCount = 1;
+    Blocks = (uint32_t *)::calloc(BlockCount, TB_BLOCK_WORDS * sizeof(uint32_t));
+    err = Blocks == NULL ? TL_ERR_MEM_ALLOC : TL_ERR_OK;
+  }
+  if (!err)
+  {
+    for (i = 0; i < HashCount; i++)
+      Insert(Hashes[i]);
+    FileSize = fr->FileSize;
+    ModTime = fr->ModTime;
+  }
+
+  ::free(Hashes);
+  if (err)
+    Reset();
+  return err;
+}
+
+TL_ERR TagBloomFilter::Save(const char *FileName) const
+{
+  TL_ERR err;
+  FileWriter *fw;
+  std::string TmpPath(FileName);
+  TbFileHeader Hdr;
+
+  if (Blocks == NULL)
+    return TL_ERR_BAD_STATE;
+
+  ::memset(&Hdr, 0, sizeof(Hdr));
+  ::memcpy(Hdr.Magic, TbMagic, sizeof(Hdr.Magic));
+  Hdr.Version = TB_VERSION;
+  Hdr.FileSize = FileSize;
+  Hdr.ModTime = ModTime;
+  Hdr.BlockCount = BlockCount;
+  Hdr.CaseInsensitive = CaseInsensitive ? 1 : 0;
+
+  fw = FileWriter::FileWriterCreate();
+  if (fw == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  TmpPath += FW_TMP_EXT;
+  err = fw->Create(TmpPath.c_str());
+  if (!err)
+    err = fw->Write(&Hdr, sizeof(Hdr));
+  if (!err)
+    err = fw->Write(Blocks, BlockCount * TB_BLOCK_WORDS * sizeof(uint32_t));
+  if (!err)
+    err = fw->Flush();
+  fw->Close();
+  delete fw;
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), FileName);
+  if (err)
+    FileWriter::RemoveFile(TmpPath.c_str());
+  return err;
+}
+
+/* Load a saved filter. Fails with TL_ERR_MODIFIED if it was not saved for the
+ * current version of the tags file */
+TL_ERR TagBloomFilter::Load(const char *FileName, TagFile *tf)
+{
+  TL_ERR err;
+  FileReader *fr, *TagsFr = tf->GetFileReader();
+  TbFileHeader Hdr;
+
+  Reset();
+  if (TagsFr == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(FileName);
+  if (!err && fr->FileSize < sizeof(Hdr))
+    err = TL_ERR_INVALID;
+  if (!err)
+    err = fr->Read(0, &Hdr, sizeof(Hdr));
+  if (!err && (::memcmp(Hdr.Magic, TbMagic, sizeof(Hdr.Magic)) != 0 ||
+    Hdr.Version != TB_VERSION || Hdr.BlockCount == 0 ||
+    fr->FileSize != sizeof(Hdr) +
+    (tf_int_t)Hdr.BlockCount * TB_BLOCK_WORDS * sizeof(uint32_t)))
+  {
+    err = TL_ERR_INVALID;
+  }
+  if (!err && (Hdr.FileSize != TagsFr->FileSize ||
+    Hdr.ModTime != TagsFr->ModTime ||
+    (Hdr.CaseInsensitive != 0) != tf->IsCaseInsensitive()))
+  {
+    err = TL_ERR_MODIFIED;
+  }
+
+  if (!err)
+  {
+    Blocks = (uint32_t *)::malloc(Hdr.BlockCount * TB_BLOCK_WORDS *
+      sizeof(uint32_t));
+    err = Blocks == NULL ? TL_ERR_MEM_ALLOC : TL_ERR_OK;
+  }
+  if (!err)
+    err = fr->Read(sizeof(Hdr), Blocks,
+      Hdr.BlockCount * TB_BLOCK_WORDS * sizeof(uint32_t));
+  delete fr;
+
+  if (err)
+  {
+    Reset();
+    return err;
+  }
+  BlockCount = Hdr.BlockCount;
+  FileSize = Hdr.FileSize;
+  ModTime = Hdr.ModTime;
+  CaseInsensitive = Hdr.CaseInsensitive != 0;
+  return TL_ERR_OK;
+}
+
+TagFilterRegistry::TagFilterRegistry()
+{
+  ::memset(Entries, 0, sizeof(Entries));
+  UseClock = 0;
+  Stopping = false;
+}
+
+/* Never destroyed, Shutdown waits for its build threads */
+TagFilterRegistry *TagFilterRegistry::Global()
+{
+  static TagFilterRegistry *Registry = new TagFilterRegistry();
+  return Registry;
+}
+
+uint64_t TagFilterRegistry::NowMsec()
+{
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Find the entry of a tags file, or take over the least recently used entry.
+ * Must be called with the lock held */
+TagFilterRegistry::FilterEntry *TagFilterRegistry::GetEntry(
+  const char *TagsFilePath)
+{
+  FilterEntry *Victim = NULL;
+  int i;
+
+  for (i = 0; i < TF_MAX_FILTERS; i++)
+  {
+    FilterEntry *Entry = &Entries[i];
+
+    if (Entry->TagsFilePath != NULL &&
+      ::strcmp(Entry->TagsFilePath, TagsFilePath) == 0)
+    {
+      return Entry;
+    }
+    if (Entry->Building)
+      continue;
+    if (Victim == NULL || Entry->TagsFilePath == NULL ||
+      (Victim->TagsFilePath != NULL && Entry->LastUse < Victim->LastUse))
+    {
+      Victim = Entry;
+    }
+  }
+
+  if (Victim == NULL)
+    return NULL;
+
+  DropEntry(Victim);
+  Victim->TagsFilePath = ::_strdup(TagsFilePath);
+  if (Victim->TagsFilePath == NULL)
+    return NULL;
+  Victim->Watch = FileWatcher::Global()->Watch(TagsFilePath);
+  StartBuild(Victim);
+  return Victim;
+}
+
+void TagFilterRegistry::DropEntry(FilterEntry *Entry)
+{
+  delete Entry->Filter;
+  ::free(Entry->TagsFilePath);
+  Entry->Filter = NULL;
+  Entry->TagsFilePath = NULL;
+  Entry->FileSize = 0;
+  Entry->ModTime = 0;
+  Entry->Watch = NULL;
+  Entry->WatchGen = 0;
+}
+
+/* Rebuild skips the sidecar file, that may have the same size and time as
+ * a tags file that was rewritten within the same second */
+void TagFilterRegistry::StartBuild(FilterEntry *Entry, bool Rebuild)
+{
+  char *PathCopy;
+  std::thread *Build = &Builds[Entry - Entries];
+
+  if (Entry->Building || Stopping)
+    return;
+
+  PathCopy = ::_strdup(Entry->TagsFilePath);
+  if (PathCopy == NULL)
+    return;
+
+  Entry->Building = true;
+  Entry->BuildId++;
+  Entry->LastCheckMsec = NowMsec();
+  /* The previous build of the entry is done with the lock, it is about to
+   * exit */
+  if (Build->joinable())
+    Build->join();
+  try
+  {
+    *Build = std::thread(BuildThread, this, PathCopy, Entry->BuildId, Rebuild);
+  }
+  catch (...)
+  {
+    Entry->Building = false;
+    ::free(PathCopy);
+  }
+}
+
+void TagFilterRegistry::BuildThread(TagFilterRegistry *Reg,
+  char *TagsFilePath, uint32_t BuildId, bool Rebuild)
+{
+  TL_ERR err;
+  TagFile tf;
+  TagBloomFilter *Filter = new TagBloomFilter();
+  std::string SidecarPath(TagsFilePath);
+  FileWatch *Watch = FileWatcher::Global()->Watch(TagsFilePath);
+  uint32_t WatchGen = Watch != NULL ? Watch->GetGeneration() : 0;
+  int i;
+
+  SidecarPath += TAG_FILTER_EXT;
+  err = tf.Init(TagsFilePath);
+  if (!err && (Rebuild || Filter->Load(SidecarPath.c_str(), &tf) != TL_ERR_OK))
+  {
+    err = Filter->Build(&tf);
+    if (!err)
+      Filter->Save(SidecarPath.c_str());
+  }
+
+  {
+    std::lock_guard<std::mutex> Guard(Reg->Lock);
+
+    for (i = 0; i < TF_MAX_FILTERS; i++)
+    {
+      FilterEntry *Entry = &Reg->Entries[i];
+
+      if (!Entry->Building ||
+        ::strcmp(Entry->TagsFilePath, TagsFilePath) != 0)
+      {
+        continue;
+      }
+      Entry->Building = false;
+      /* The file was invalidated while building, don't use this filter */
+      if (Entry->BuildId != BuildId)
+        break;
+      if (tf.GetFileReader() != NULL)
+      {
+        Entry->FileSize = tf.GetFileReader()->FileSize;
+        Entry->ModTime = tf.GetFileReader()->ModTime;
+      }
+      else
+      {
+        /* No file, wait for it to be created */
+        Entry->FileSize = 0;
+        Entry->ModTime = 0;
+      }
+      Entry->WatchGen = WatchGen;
+      if (!err)
+      {
+        Entry->Filter = Filter;
+        Filter = NULL;
+      }
+      break;
+    }
+  }
+
+  delete Filter;
+  ::free(TagsFilePath);
+}
+
+/* Return true only if the tag is surely not in the tags file. Any doubt, a
+ * filter that is not ready or a tags file that changed, answers false */
+bool TagFilterRegistry::DefinitelyAbsent(const char *TagsFilePath,
+  const char *Tag)
+{
+  FilterEntry *Entry;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+  std::lock_guard<std::mutex> Guard(Lock);
+
+  Entry = GetEntry(TagsFilePath);
+  if (Entry == NULL || Entry->Building)
+    return false;
+
+  Entry->LastUse = ++UseClock;
+  if (Entry->Watch != NULL && Entry->Watch->IsActive())
+  {
+    /* The watcher reports any change of the file, nothing to check */
+    if (Entry->Watch->GetGeneration() != Entry->WatchGen ||
+      Entry->FileSize == (tf_int_t)-1)
+    {
+      delete Entry->Filter;
+      Entry->Filter = NULL;
+      StartBuild(Entry, true);
+      return false;
+    }
+  }
+  else if (NowMsec() - Entry->LastCheckMsec >= TF_RECHECK_MSEC)
+  {
+    Entry->LastCheckMsec = NowMsec();
+    if (FileReader::GetFileInfo(TagsFilePath, &FileSize, &ModTime) != TL_ERR_OK)
+    {
+      delete Entry->Filter;
+      Entry->Filter = NULL;
+      Entry->FileSize = (tf_int_t)-1;
+      return false;
+    }
+    if (FileSize != Entry->FileSize || ModTime != Entry->ModTime)
+    {
+      delete Entry->Filter;
+      Entry->Filter = NULL;
+      StartBuild(Entry);
+      return false;
+    }
+  }
+
+  if (Entry->Filter == NULL)
+    return false;
+  return !Entry->Filter->MayContain(Tag, (uint32_t)::strlen(Tag));
+}
+
+/* Called when the tags file is known to be rewritten */
+void TagFilterRegistry::Invalidate(const char *TagsFilePath)
+{
+  std::lock_guard<std::mutex> Guard(Lock);
+  int i;
+
+  for (i = 0; i < TF_MAX_FILTERS; i++)
+  {
+    FilterEntry *Entry = &Entries[i];
+
+    if (Entry->TagsFilePath == NULL ||
+      ::strcmp(Entry->TagsFilePath, TagsFilePath) != 0)
+    {
+      continue;
+    }
+    delete Entry->Filter;
+    Entry->Filter = NULL;
+    /* Ignore a build in progress and force a check of the file on the next
+     * query */
+    Entry->BuildId++;
+    Entry->FileSize = (tf_int_t)-1;
+    Entry->LastCheckMsec = 0;
+  }
+}
+
+void TagFilterRegistry::Shutdown()
+{
+  std::thread Stopped[TF_MAX_FILTERS];
+  int i;
+
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    Stopping = true;
+    for (i = 0; i < TF_MAX_FILTERS; i++)
+      Stopped[i].swap(Builds[i]);
+  }
+
+  for (i = 0; i < TF_MAX_FILTERS; i++)
+  {
+    if (Stopped[i].joinable())
+      Stopped[i].join();
+  }
+}
@@ -0,0 +1,117 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TAG_FILTER_H_
+#define _TAG_FILTER_H_
+
+#include "tag_file.h"
+#include "file_watch.h"
+#include <mutex>
+#include <thread>
+
+namespace TagLEET {
+
+#define TAG_FILTER_EXT ".tlb"
+#define TF_MAX_FILTERS 4
+/* How often a filter is checked against the tags file on disk, if the file
+ * is not watched */
+#define TF_RECHECK_MSEC 1000
+
+/* Blocked Bloom filter over the distinct tag names of a tags file.
+ * All the bits of a tag are in one 32 byte block, so a query touches a
+ * single cache line. With 16 bits per tag about 1 in 1000 absent tags is
+ * reported as "may contain". */
+class TagBloomFilter
+{
+public:
+  TagBloomFilter();
+  ~TagBloomFilter();
+
+  void Reset();
+  TL_ERR Build(TagFile *tf);
+  TL_ERR Save(const char *FileName) const;
+  TL_ERR Load(const char *FileName, TagFile *tf);
+  bool MayContain(const char *Tag, uint32_t TagSize) const;
+  bool IsValidFor(tf_int_t in_FileSize, uint64_t in_ModTime) const;
+
+  tf_int_t GetFileSize() const { return FileSize; }
+  uint64_t GetModTime() const { return ModTime; }
+
+private:
+  static uint64_t TagHash(const char *Tag, uint32_t TagSize,
+    bool CaseInsensitive);
+  void Insert(uint64_t Hash);
+
+  uint32_t *Blocks;
+  uint32_t BlockCount;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+  bool CaseInsensitive;
+};
+
+/* Filters of the recently used tags files. A filter is loaded from its
+ * sidecar file or built on a background thread the first time a tags file
+ * is queried, queries never wait for it. */
+class TagFilterRegistry
+{
+public:
+  static TagFilterRegistry *Global();
+
+  bool DefinitelyAbsent(const char *TagsFilePath, const char *Tag);
+  void Invalidate(const char *TagsFilePath);
+  /* Wait for the builds in progress, no build starts after it */
+  void Shutdown();
+
+private:
+  TagFilterRegistry();
+
+  struct FilterEntry
+  {
+    char *TagsFilePath;
+    TagBloomFilter *Filter;
+    bool Building;
+    uint32_t BuildId;
+    uint32_t LastUse;
+    uint64_t LastCheckMsec;
+    /* Version of the tags file of the last build */
+    tf_int_t FileSize;
+    uint64_t ModTime;
+    FileWatch *Watch;
+    uint32_t WatchGen;
+  };
+
+  FilterEntry *GetEntry(const char *TagsFilePath);
+  void StartBuild(FilterEntry *Entry, bool Rebuild = false);
+  void DropEntry(FilterEntry *Entry);
+  static void BuildThread(TagFilterRegistry *Reg, char *TagsFilePath,
+    uint32_t BuildId, bool Rebuild);
+  static uint64_t NowMsec();
+
+  std::mutex Lock;
+  FilterEntry Entries[TF_MAX_FILTERS];
+  /* The build thread of each entry, the last one started */
+  std::thread Builds[TF_MAX_FILTERS];
+  uint32_t UseClock;
+  bool Stopping;
+};
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_FILTER_H_ */
@@ -18,15 +18,37 @@
 */
 
 #include "tag_list.h"
-
+#include "tag_cache.h"
+#include "tag_filter.h"
+#include "file_watch.h"
+#include "src_path_cache.h"
+#include "tag_file_index.h"
+#include "ref_index.h"
+
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <malloc.h>
+#include <atomic>
+#include <thread>
 
 using namespace TagLEET;
 
-FileReaderLineIterator::FileReaderLineIterator(FileReader *fr)
+#define LINE_ITR_WINDOW_SIZE (128*1024)
+
+FileReaderLineIterator::FileReaderLineIterator(FileReader *in_fr,
+  const char *in_FileName)
+{
+  fr = in_fr;
+  FileName = in_FileName;
+  Index = NULL;
+  InitErr = rb.InitSequential(fr, 0, LINE_ITR_WINDOW_SIZE);
+}
+
+FileReaderLineIterator::~FileReaderLineIterator()
 {
-  InitErr = rb.Init(fr, 0, 128*1024);
+  if (Index != NULL)
+    LineIndexCache::Global()->Release(Index);
 }
 
 TL_ERR FileReaderLineIterator::HandleNewLine(TL_ERR err)
@@ -45,49 +67,159 @@ TL_ERR FileReaderLineIterator::HandleNewLine(TL_ERR err)
 
 TL_ERR FileReaderLineIterator::MoveToFirstLine()
 {
-  TL_ERR err = InitErr ? InitErr : rb.FindFirstFullLine(true);
-  return HandleNewLine(err);
+  TL_ERR err;
+
+  if (InitErr)
+    return HandleNewLine(InitErr);
+
+  /* A previous search may have moved the buffer away from the start */
+  if (rb.Offset != 0)
+  {
+    err = rb.InitSequential(fr, 0, LINE_ITR_WINDOW_SIZE);
+    if (err)
+      return HandleNewLine(err);
+  }
+  /* Unlike a window in the middle of the file, the first line is full */
+  rb.NextLineOffset = 0;
+  return HandleNewLine(rb.FindNextFullLine(true));
 }
 
 
 TL_ERR FileReaderLineIterator::MoveToNextLine()
 {
-  TL_ERR err = InitErr ? InitErr : rb.FindNextFullLine(true);
+  if (InitErr)
+    return HandleNewLine(InitErr);
+
+  return HandleNewLine(rb.FindNextFullLine(true));
+}
+
+/* Make the line at LineStart the next one of rb. It is usually still in the
+ * buffer, otherwise a window is read from there */
+TL_ERR FileReaderLineIterator::SeekToOffset(tf_int_t LineStart)
+{
+  if (rb.Buff != NULL && LineStart >= rb.Offset &&
+    LineStart < rb.Offset + rb.Size)
+  {
+    rb.NextLineOffset = (uint32_t)(LineStart - rb.Offset);
+    return TL_ERR_OK;
+  }
+  return rb.Init(fr, LineStart, LINE_ITR_WINDOW_SIZE);
+}
+
+/* Lines are found with the line index of the file. It is built on the
+ * first call, unless it is cached */
+TL_ERR FileReaderLineIterator::MoveToLine(uint32_t LineNumber)
+{
+  TL_ERR err;
+  tf_int_t LineStart;
+  uint32_t Size;
+
+  if (InitErr)
+    return HandleNewLine(InitErr);
+
+  if (Index == NULL)
+  {
+    err = LineIndexCache::Global()->Get(FileName, fr, &Index);
+    if (err)
+    {
+      Index = NULL;
+      return TL_ERR_GENERAL;
+    }
+  }
+
+  if (LineNumber == 0)
+    return HandleNewLine(TL_ERR_NOT_EXIST);
+  /* The lines of the index start at 0 */
+  err = Index->GetLineRange(LineNumber - 1, &LineStart, &Size);
+  if (!err)
+    err = SeekToOffset(LineStart);
+  if (!err)
+    err = rb.FindNextFullLine(true);
   return HandleNewLine(err);
 }
 
 TagList::TagList():
-  NodeMem(4*1024, sizeof(void *)),
   StrMem(8*1024, 1)
 {
+  Result = NULL;
   List = NULL;
   Count = 0;
   LineNumFromTag = 0;
   TagForLineNum = NULL;
   TagsFilePath = NULL;
+  LineNumbers = NULL;
 }
 
 TagList::~TagList()
 {
+  SetResult(NULL);
+  ::free(LineNumbers);
 }
 
-TL_ERR TagList::Create(const char *Tag, const char *in_TagsFilePath,
-  TagFile *cache, bool DoPrefixMatch, uint32_t MaxItemCount)
+TL_ERR TagList::Prepare(const char *in_TagsFilePath)
 {
-  TL_ERR err;
-  TagFile tf;
-  TagIterator itr(DoPrefixMatch);
-  TagListItem **NextItem = &List;
-
-  NodeMem.Reset();
+  SetResult(NULL);
+  ::free(LineNumbers);
+  LineNumbers = NULL;
   StrMem.Reset();
-  List = NULL;
-  Count = 0;
   LineNumFromTag = 0;
   TagForLineNum = NULL;
   TagsFilePath = StrMem.StrDup(in_TagsFilePath);
   if (TagsFilePath == NULL)
     return TL_ERR_MEM_ALLOC;
+  return TL_ERR_OK;
+}
+
+TL_ERR TagList::Create(const char *Tag, const char *in_TagsFilePath,
+  TagFile *cache, bool DoPrefixMatch, uint32_t MaxItemCount)
+{
+  TL_ERR err;
+
+  err = Prepare(in_TagsFilePath);
+  if (!err)
+    err = DoCreate(Tag, cache, DoPrefixMatch, MaxItemCount);
+  /* A prefix match is refreshed on every key, its lines are found only for
+   * the item that is opened */
+  if (!err && !DoPrefixMatch)
+    ResolveLineNumbers();
+  return err;
+}
+
+TL_ERR TagList::DoCreate(const char *Tag, TagFile *cache, bool DoPrefixMatch,
+  uint32_t MaxItemCount)
+{
+  TL_ERR err;
+  TagFile tf;
+  TagIterator itr(DoPrefixMatch);
+  TagResultKey Key;
+  FileWatch *Watch;
+  uint32_t WatchGen = 0;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+  FileReader *fr;
+
+  /* Most exact lookups are misses (keywords, locals), the filter answers
+   * them without opening the tags file */
+  if (!DoPrefixMatch &&
+    TagFilterRegistry::Global()->DefinitelyAbsent(TagsFilePath, Tag))
+  {
+    return TL_ERR_OK;
+  }
+
+  /* A watched tags file that did not change since it was last opened is
+   * not opened to find a cached result */
+  Watch = FileWatcher::Global()->Watch(TagsFilePath);
+  if (Watch != NULL)
+  {
+    WatchGen = Watch->GetGeneration();
+    if (Watch->GetFileInfo(WatchGen, &FileSize, &ModTime))
+    {
+      SetKey(&Key, Tag, FileSize, ModTime, WatchGen, DoPrefixMatch,
+        MaxItemCount);
+      if (FromCache(&Key))
+        return TL_ERR_OK;
+    }
+  }
 
   // if (cache == NULL)
   // {
@@ -96,82 +228,303 @@ TL_ERR TagList::Create(const char *Tag, const char *in_TagsFilePath,
       return err;
     cache = &tf;
   // }
+  fr = cache->GetFileReader();
+  if (Watch != NULL)
+    Watch->SetFileInfo(WatchGen, fr->FileSize, fr->ModTime);
+  SetKey(&Key, Tag, fr->FileSize, fr->ModTime, WatchGen, DoPrefixMatch,
+    MaxItemCount);
+  if (FromCache(&Key))
+    return TL_ERR_OK;
+
   err = itr.Init(cache, Tag, 128*1024);
   if (err)
     return err;
 
-  TagsCaseInsensitive = cache->IsCaseInsensitive();
+  return Publish(&Key, &itr, cache->IsCaseInsensitive());
+}
 
-  while (Count < MaxItemCount)
+/* Create a list of the tags that start with 'Prefix' using a query session.
+ * The range of the prefix is narrowed from the previous query of the session
+ * so typing one more character does not repeat the lookup from scratch */
+TL_ERR TagList::Create(const char *Prefix, TagQuerySession *Session,
+  uint32_t MaxItemCount)
+{
+  TL_ERR err;
+  TagIterator itr(true);
+  TagFile *tf = Session->GetTagFile();
+  TagResultKey Key;
+  tf_int_t Start, End;
+
+  /* The key must have the generation of the file as it is now. Unless the
+   * watcher tells it did not change, the file is reopened to get it */
+  err = Prepare(Session->GetTagsFilePath());
+  if (!err && !Session->IsCurrent())
+    err = Session->BeginQuery();
+  if (err)
+    return err;
+
+  SetKey(&Key, Prefix, tf->GetFileReader()->FileSize,
+    tf->GetFileReader()->ModTime, Session->GetWatchGen(), true, MaxItemCount);
+  if (FromCache(&Key))
   {
-   uint32_t ExCmdCopySize, ExtKindCopySize, ExtLineCopySize, ExtFieldsCopySize;
-    // uint32_t ExCmdCopySize, ExtFieldsCopySize;
+    Session->EndQuery();
+    return TL_ERR_OK;
+  }
+
+  err = Session->Narrow(Prefix, &Start, &End);
+  if (!err && Start < End)
+    err = itr.InitAt(tf, Prefix, Start, 128*1024);
+  if (!err)
+    err = Publish(&Key, Start < End ? &itr : NULL, tf->IsCaseInsensitive());
+  Session->EndQuery();
+  return err;
+}
+
+TL_ERR TagList::CreateForSrcFile(const char *SrcFileName,
+  const char *in_TagsFilePath, const TagFileIndex *Index,
+  uint32_t MaxItemCount)
+{
+  TL_ERR err;
+  TagFile tf;
+  TagListResult *NewResult;
+  TagListItem **NextItem;
+  const tf_int_t *Offsets = NULL;
+  uint32_t File, n, i;
+
+  err = Prepare(in_TagsFilePath);
+  if (!err)
+    err = tf.Init(TagsFilePath);
+  if (err)
+    return err;
+  if (!Index->IsValidFor(TagsFilePath, &tf))
+    return TL_ERR_MODIFIED;
+
+  NewResult = new TagListResult();
+  if (NewResult == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  NewResult->TagsCaseInsensitive = tf.IsCaseInsensitive();
+  NextItem = &NewResult->List;
+  n = Index->FindFile(SrcFileName, &File) ?
+    Index->GetFileTags(File, &Offsets) : 0;
+  for (i = 0; !err && i < n && NewResult->Count < MaxItemCount; i++)
+  {
+    TagIterator itr(true);
     TagLineProperties Props;
-    TagListItem *NewItem;
 
-    err = itr.GetNextTagLineProps(&Props);
-    if (err)
-      break;
+    /* An empty prefix matches the line at the offset */
+    err = itr.InitAt(&tf, "", Offsets[i], 1024);
+    if (!err)
+      err = itr.GetNextTagLineProps(&Props);
+    if (!err)
+      err = AddItem(NewResult, &Props, &NextItem);
+  }
 
-    ExCmdCopySize = Props.ExCmdSize;
-    if (Props.ExCmdSize > 1024)
-    {
-      /* Trim ExCmd but don't let it end with the special char '\\' */
-      ExCmdCopySize = 1024;
-      while (ExCmdCopySize > 0 && Props.ExCmd[ExCmdCopySize - 1] == '\\')
-        ExCmdCopySize--;
-    }
+  /* Not published in the result cache, its key is a tag */
+  SetResult(NewResult);
+  NewResult->Release();
+  /* All the items are in the one file, it is read once */
+  if (!err)
+    ResolveLineNumbers();
+  return err;
+}
 
-    ExtKindCopySize = Props.ExtKindSize;
-    if (Props.ExtKindSize > 1024)
-    {
-      /* Trim ExCmd but don't let it end with the special char '\\' */
-     ExtKindCopySize = 1024;
-      while (ExtKindCopySize > 0 && Props.ExtKind[ExtKindCopySize - 1] == '\\')
-        ExtKindCopySize--;
-    }
-    
-    ExtLineCopySize = Props.ExtLineSize;
-    if (Props.ExtLineSize > 1024)
-    {
-      /* Trim ExCmd but don't let it end with the special char '\\' */
-      ExtLineCopySize = 1024;
-      while (ExtLineCopySize > 0 && Props.ExtLine[ExtLineCopySize - 1] == '\\')
-        ExtLineCopySize--;
-    }
+TL_ERR TagList::CreateForRefs(const char *Name, const char *in_TagsFilePath,
+  const ReferenceIndex *Index, uint32_t MaxItemCount)
+{
+  TL_ERR err;
+  TagListResult *NewResult;
+  TagListItem **NextItem;
+  TagLineProperties Props;
+  char LineStr[16];
+  uint32_t First = 0, n = 0, i;
 
-    ExtFieldsCopySize = Props.ExtFieldsSize;
-    if (Props.ExtFieldsSize > 1024)
-    {
-      /* Trim ExCmd but don't let it end with the special char '\\' */
-      ExtFieldsCopySize = 1024;
-      while (ExtFieldsCopySize > 0 && Props.ExtFields[ExtFieldsCopySize - 1] == '\\')
-        ExtFieldsCopySize--;
-    }
+  err = Prepare(in_TagsFilePath);
+  if (err)
+    return err;
 
-    NewItem = (TagListItem *)NodeMem.Alloc(sizeof(*NewItem));
-    if (NewItem == NULL)
-      break;
+  NewResult = new TagListResult();
+  if (NewResult == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  /* A reference has no kind or fields, its ExCmd is its line number */
+  Props.Tag = Name;
+  Props.TagSize = (uint32_t)::strlen(Name);
+  Props.ExtKind = " ";
+  Props.ExtKindSize = 1;
+  Props.ExtFields = "";
+  Props.ExtFieldsSize = 0;
+  Props.Kind = TAG_KIND_UNKNOWN;
+  NextItem = &NewResult->List;
+  if (!Index->Find(Name, &First, &n))
+    n = 0;
+  for (i = 0; !err && i < n && NewResult->Count < MaxItemCount; i++)
+  {
+    Props.FileName = Index->GetFileName(Index->GetRefFile(First + i));
+    Props.FileNameSize = (uint32_t)::strlen(Props.FileName);
+    Props.ExCmdSize = (uint32_t)::sprintf(LineStr, "%u",
+      Index->GetRefLine(First + i));
+    Props.ExCmd = LineStr;
+    Props.ExtLine = LineStr;
+    Props.ExtLineSize = Props.ExCmdSize;
+    err = AddItem(NewResult, &Props, &NextItem);
+  }
+
+  /* Not published in the result cache, its key is a tag */
+  SetResult(NewResult);
+  NewResult->Release();
+  if (!err)
+    ResolveLineNumbers();
+  return err;
+}
+
+void TagList::SetKey(TagResultKey *Key, const char *Tag, tf_int_t FileSize,
+  uint64_t ModTime, uint32_t WatchGen, bool PrefixMatch,
+  uint32_t MaxItemCount) const
+{
+  Key->TagsFilePath = TagsFilePath;
+  Key->FileSize = FileSize;
+  Key->ModTime = ModTime;
+  Key->WatchGen = WatchGen;
+  Key->Tag = Tag;
+  Key->PrefixMatch = PrefixMatch;
+  Key->MaxItemCount = MaxItemCount;
+}
 
-    NewItem->Tag = StrMem.StrDup(Props.Tag, Props.TagSize);
-    NewItem->FileName = StrMem.StrDup(Props.FileName, Props.FileNameSize);
-    NewItem->ExCmd = StrMem.StrDup(Props.ExCmd, ExCmdCopySize);
-    NewItem->ExtKind = StrMem.StrDup(Props.ExtKind, ExtKindCopySize);
-    NewItem->ExtLine = StrMem.StrDup(Props.ExtLine, ExtLineCopySize);
-    NewItem->ExtFields = StrMem.StrDup(Props.ExtFields, ExtFieldsCopySize);
-    if (NewItem->Tag == NULL || NewItem->FileName == NULL || 
-      NewItem->ExCmd == NULL || NewItem->ExtFields == NULL
-     || NewItem->ExtKind == NULL ||
-     NewItem->ExtLine == NULL || NewItem->ExtFields == NULL)
+/* Use the result of an identical query on the same generation of the tags
+ * file, if there is one in the cache */
+bool TagList::FromCache(const TagResultKey *Key)
+{
+  TagListResult *Cached = TagResultCache::Global()->Lookup(Key);
+
+  if (Cached == NULL)
+    return false;
+  SetResult(Cached);
+  Cached->Release();
+  return true;
+}
+
+/* Read the items into a new result and publish it in the cache. A result
+ * that was cut short by lack of memory is used but not published */
+TL_ERR TagList::Publish(const TagResultKey *Key, TagIterator *itr,
+  bool CaseInsensitive)
+{
+  TL_ERR err = TL_ERR_OK;
+  TagListResult *NewResult = new TagListResult();
+
+  if (NewResult == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  NewResult->TagsCaseInsensitive = CaseInsensitive;
+  if (itr != NULL)
+    err = AddItems(NewResult, itr, Key->MaxItemCount);
+  if (!err)
+    TagResultCache::Global()->Insert(Key, NewResult);
+  SetResult(NewResult);
+  NewResult->Release();
+  return TL_ERR_OK;
+}
+
+void TagList::SetResult(TagListResult *NewResult)
+{
+  if (Result != NULL)
+    Result->Release();
+  Result = NewResult;
+  List = NULL;
+  Count = 0;
+  if (Result == NULL)
+    return;
+
+  Result->AddRef();
+  List = Result->List;
+  Count = Result->Count;
+  TagsCaseInsensitive = Result->TagsCaseInsensitive;
+}
+
+TL_ERR TagList::AddItems(TagListResult *Res, TagIterator *itr,
+  uint32_t MaxItemCount)
+{
+  TagListItem **NextItem = &Res->List;
+  TL_ERR err;
+
+  while (Res->Count < MaxItemCount)
+  {
+    TagLineProperties Props;
+
+    if (itr->GetNextTagLineProps(&Props) != TL_ERR_OK)
       break;
+    err = AddItem(Res, &Props, &NextItem);
+    if (err)
+      return err;
+  }
+  return TL_ERR_OK;
+}
+
+/* Add the item of a tag line after *NextItem, the end of the list */
+TL_ERR TagList::AddItem(TagListResult *Res, const TagLineProperties *Props,
+  TagListItem ***NextItem)
+{
+  uint32_t ExCmdCopySize, ExtKindCopySize, ExtLineCopySize, ExtFieldsCopySize;
+  // uint32_t ExCmdCopySize, ExtFieldsCopySize;
+  TagListItem *NewItem;
+
+  ExCmdCopySize = Props->ExCmdSize;
+  if (Props->ExCmdSize > 1024)
+  {
+    /* Trim ExCmd but don't let it end with the special char '\\' */
+    ExCmdCopySize = 1024;
+    while (ExCmdCopySize > 0 && Props->ExCmd[ExCmdCopySize - 1] == '\\')
+      ExCmdCopySize--;
+  }
 
-    NewItem->Kind = Props.Kind;
-    NewItem->Next = NULL;
-    *NextItem = NewItem;
-    NextItem = &NewItem->Next;
-    Count++;
+  ExtKindCopySize = Props->ExtKindSize;
+  if (Props->ExtKindSize > 1024)
+  {
+    /* Trim ExCmd but don't let it end with the special char '\\' */
+   ExtKindCopySize = 1024;
+    while (ExtKindCopySize > 0 && Props->ExtKind[ExtKindCopySize - 1] == '\\')
+      ExtKindCopySize--;
+  }
+  
+  ExtLineCopySize = Props->ExtLineSize;
+  if (Props->ExtLineSize > 1024)
+  {
+    /* Trim ExCmd but don't let it end with the special char '\\' */
+    ExtLineCopySize = 1024;
+    while (ExtLineCopySize > 0 && Props->ExtLine[ExtLineCopySize - 1] == '\\')
+      ExtLineCopySize--;
   }
 
+  ExtFieldsCopySize = Props->ExtFieldsSize;
+  if (Props->ExtFieldsSize > 1024)
+  {
+    /* Trim ExCmd but don't let it end with the special char '\\' */
+    ExtFieldsCopySize = 1024;
+    while (ExtFieldsCopySize > 0 && Props->ExtFields[ExtFieldsCopySize - 1] == '\\')
+      ExtFieldsCopySize--;
+  }
+
+  NewItem = (TagListItem *)Res->Mem.Alloc(sizeof(*NewItem));
+  if (NewItem == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  NewItem->Tag = Res->Mem.StrDup(Props->Tag, Props->TagSize);
+  NewItem->FileName = Res->Mem.StrDup(Props->FileName, Props->FileNameSize);
+  NewItem->ExCmd = Res->Mem.StrDup(Props->ExCmd, ExCmdCopySize);
+  NewItem->ExtKind = Res->Mem.StrDup(Props->ExtKind, ExtKindCopySize);
+  NewItem->ExtLine = Res->Mem.StrDup(Props->ExtLine, ExtLineCopySize);
+  NewItem->ExtFields = Res->Mem.StrDup(Props->ExtFields, ExtFieldsCopySize);
+  if (NewItem->Tag == NULL || NewItem->FileName == NULL || 
+    NewItem->ExCmd == NULL || NewItem->ExtFields == NULL
+   || NewItem->ExtKind == NULL ||
+   NewItem->ExtLine == NULL || NewItem->ExtFields == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  NewItem->Kind = Props->Kind;
+  NewItem->Next = NULL;
+  **NextItem = NewItem;
+  *NextItem = &NewItem->Next;
+  Res->Count++;
   return TL_ERR_OK;
 }
 
@@ -273,12 +626,48 @@ static TL_ERR TryConvertSpecialAbsPath(const char *Path, uint32_t n, char *Buff,
   return TL_ERR_NOT_EXIST;
 }
 
-/* Try to locate a source file of a tag and open it for reading */
+/* Try to locate a source file of a tag and open it for reading.
+ * The path that was found, or the failure, is kept in the path cache so
+ * moving through a list does not repeat failed opens */
 TL_ERR TagList::OpenSrcFile(
   IN  const TagListItem *Item,
   OUT FileReader *fr,
   OUT char *SrcFilePathBuff,
   IN  uint32_t BuffSize)
+{
+  SrcPathCache *Cache = SrcPathCache::Global();
+  TL_ERR err;
+
+  if (TagsFilePath == NULL)
+    return ResolveSrcFile(Item, fr, SrcFilePathBuff, BuffSize);
+
+  if (Cache->Lookup(TagsFilePath, Item->FileName, SrcFilePathBuff, BuffSize,
+    &err))
+  {
+    if (err)
+      return err;
+    err = fr->Open(SrcFilePathBuff);
+    if (!err)
+      return TL_ERR_OK;
+    /* Moved or deleted since it was found */
+    Cache->Forget(TagsFilePath, Item->FileName);
+  }
+
+  err = ResolveSrcFile(Item, fr, SrcFilePathBuff, BuffSize);
+  /* Too long for this buffer says nothing about the file */
+  if (err != TL_ERR_TOO_BIG)
+  {
+    Cache->Insert(TagsFilePath, Item->FileName,
+      err ? NULL : SrcFilePathBuff, err);
+  }
+  return err;
+}
+
+TL_ERR TagList::ResolveSrcFile(
+  IN  const TagListItem *Item,
+  OUT FileReader *fr,
+  OUT char *SrcFilePathBuff,
+  IN  uint32_t BuffSize)
 {
   uint32_t i, n;
   bool IsAbs = IsAbsolutePath(Item->FileName);
@@ -356,15 +745,71 @@ uint32_t TagList::FindTagInExCmd(const char *Tag, const char *ExCmd)
   return 0;
 }
 
-TL_ERR TagList::FindLineNumberInFile(
-  IN  LineIterator *li,
+/* A pattern to search for in the lines of a source file. Str is matched at
+ * the start of the line, at its end, both (whole line) or anywhere */
+struct TagLEET::SrcLinePattern
+{
+  const char *Str;
+  uint32_t Size;
+  bool FromStart;
+  bool ToEnd;
+};
+
+/* Parse a search pattern, "/^" and "$/" anchor it to the start and to the
+ * end of the line */
+static bool ParseLinePattern(SrcLinePattern *Pat, const char *Str,
+  uint32_t Size)
+{
+  Pat->FromStart = false;
+  Pat->ToEnd = false;
+  if (Size >= 2 && Str[0] == '/' && Str[1] == '^')
+  {
+    Str += 2;
+    Size -= 2;
+    Pat->FromStart = true;
+  }
+  if (Size >= 2 && Str[Size-1] == '/' && Str[Size-2] == '$')
+  {
+    Size -= 2;
+    Pat->ToEnd = true;
+  }
+  Pat->Str = Str;
+  Pat->Size = Size;
+  return Size > 0;
+}
+
+static bool LineMatch(const SrcLinePattern *Pat, const char *Line,
+  uint32_t LineSize)
+{
+  if (LineSize < Pat->Size)
+    return false;
+
+  if (Pat->FromStart)
+  {
+    if (Pat->ToEnd && LineSize != Pat->Size)
+      return false;
+    return ::memcmp(Line, Pat->Str, Pat->Size) == 0;
+  }
+  if (Pat->ToEnd)
+    return ::memcmp(Line + LineSize - Pat->Size, Pat->Str, Pat->Size) == 0;
+  return TagLEET::memfind(Line, LineSize, Pat->Str, Pat->Size) != NULL;
+}
+
+/* The line number of an item is known without reading the source when its
+ * ExCmd is a line number or the line came with the tag. Otherwise prepare
+ * the patterns to search for, in priority order, and the line hint */
+bool TagList::PrepareLineSearch(
   IN  const TagListItem *Item,
+  OUT SrcLinePattern *Patterns,
+  OUT uint32_t *out_PatternCount,
+  OUT uint32_t *out_HintLineNumber,
   OUT uint32_t *out_LineNumber)
 {
   TL_ERR err;
   const char *ExCmd;
   uint32_t LineNumber;
   uint32_t PrefixSize;
+  uint32_t PatternCount = 0;
   int (*StrCmp)(const char *s1, const char *s2);
 
   StrCmp = TagsCaseInsensitive ? TagLEET::stricmp : ::strcmp;
@@ -372,126 +817,472 @@ TL_ERR TagList::FindLineNumberInFile(
     TagForLineNum != NULL && StrCmp(TagForLineNum, Item->Tag) == 0)
   {
     *out_LineNumber = LineNumFromTag - 1;
-    return TL_ERR_OK;
+    return true;
   }
 
   err = ::IsLineNumber(Item->ExCmd, &LineNumber);
   if (!err && LineNumber >= 1)
   {
     *out_LineNumber = LineNumber - 1;
-    return TL_ERR_OK;
+    return true;
   }
 
   ExCmd = FixExCmd(Item->ExCmd);
-  err = DoFindLineNumberInFile(li, ExCmd, out_LineNumber);
-  if (!err)
-    return err;
-  /* Perhaps line changed slightly. Find tag in ExCmd and then re-search file
-   * For the prefix of ExCmd up until the tag */
+  if (ParseLinePattern(&Patterns[PatternCount], ExCmd,
+    (uint32_t)::strlen(ExCmd)))
+  {
+    PatternCount++;
+  }
+  /* Perhaps line changed slightly. Find tag in ExCmd and then search the file
+   * also for the prefix of ExCmd up until the tag */
   PrefixSize = FindTagInExCmd(Item->Tag, ExCmd);
-  if (PrefixSize > 0)
+  if (PrefixSize > 0 &&
+    ParseLinePattern(&Patterns[PatternCount], ExCmd, PrefixSize))
+  {
+    PatternCount++;
+  }
+  /* As last resort just search for the tag itself */
+  if (ParseLinePattern(&Patterns[PatternCount], Item->Tag,
+    (uint32_t)::strlen(Item->Tag)))
   {
-    char TmpBuff[256];
-    char *ExCmdPrefix;
+    PatternCount++;
+  }
+  *out_PatternCount = PatternCount;
 
-    ExCmdPrefix = PrefixSize + 1 < sizeof(TmpBuff) ? TmpBuff :
-      (char *)::malloc(PrefixSize + 1);
-    if (ExCmdPrefix != NULL)
+  /* The line where ctags saw the tag. Like the lines of a LineIterator it
+   * starts at 1, 0 is no hint */
+  *out_HintLineNumber = 0;
+  err = ::IsLineNumber(Item->ExtLine, &LineNumber);
+  if (!err)
+    *out_HintLineNumber = LineNumber;
+  return false;
+}
+
+/* The line an item was resolved to when the list was made */
+bool TagList::GetResolvedLine(const TagListItem *Item,
+  uint32_t *LineNumber) const
+{
+  const TagListItem *ListItem;
+  uint32_t i;
+
+  if (LineNumbers == NULL)
+    return false;
+  for (ListItem = List, i = 0; ListItem != NULL && i < Count;
+    ListItem = ListItem->Next, i++)
+  {
+    if (ListItem != Item)
+      continue;
+    *LineNumber = LineNumbers[i];
+    return *LineNumber != TL_NO_LINE_NUMBER;
+  }
+  return false;
+}
+
+/* The line that was resolved for the item in the file on disk is the hint
+ * of the search in li, which may have unsaved changes */
+TL_ERR TagList::FindLineNumberInFile(
+  IN  LineIterator *li,
+  IN  const TagListItem *Item,
+  OUT uint32_t *out_LineNumber)
+{
+  SrcLinePattern Patterns[3];
+  uint32_t PatternCount;
+  uint32_t HintLineNumber;
+  uint32_t ResolvedLine;
+
+  if (PrepareLineSearch(Item, Patterns, &PatternCount, &HintLineNumber,
+    out_LineNumber))
+  {
+    return TL_ERR_OK;
+  }
+  if (GetResolvedLine(Item, &ResolvedLine))
+    HintLineNumber = ResolvedLine + 1;
+  return DoFindLineNumberInFile(li, Patterns, PatternCount, HintLineNumber,
+    out_LineNumber);
+}
+
+/* Test a line against the patterns that would beat the best match so far */
+static void TestLine(const SrcLinePattern *Patterns, const LineIterator *li,
+  uint32_t LineNumber, uint32_t *Best, uint32_t *BestLineNumber)
+{
+  uint32_t i;
+
+  for (i = 0; i < *Best; i++)
+  {
+    if (LineMatch(&Patterns[i], li->Line, li->LineSize))
     {
-      ::memcpy(ExCmdPrefix, ExCmd, PrefixSize);
-      ExCmdPrefix[PrefixSize] = '\0';
-      err = DoFindLineNumberInFile(li, ExCmdPrefix, out_LineNumber);
-      if (ExCmdPrefix != TmpBuff)
-        ::free(ExCmdPrefix);
-      if (!err)
-        return err;
+      *Best = i;
+      *BestLineNumber = LineNumber;
+      return;
     }
   }
-  /* As last resort just search for the tag itself */
-  return DoFindLineNumberInFile(li, Item->Tag, out_LineNumber);
 }
 
+/* Search outward from the hinted line in both directions, up to MaxRadius
+ * lines away, until a line matches the 1st pattern. False if the hinted
+ * line does not exist */
+static bool SearchAroundLine(LineIterator *li, const SrcLinePattern *Patterns,
+  uint32_t PatternCount, uint32_t HintLineNumber, uint32_t MaxRadius,
+  uint32_t *Best, uint32_t *BestLineNumber)
+{
+  TL_ERR err;
+  uint32_t LineNumber;
+  uint32_t Radius;
+  bool AfterEnd = false;
+  bool BeforeStart = false;
+
+  *Best = PatternCount;
+  err = li->MoveToLine(HintLineNumber);
+  if (err && err != TL_ERR_LINE_TOO_BIG)
+    return false;
+
+  TestLine(Patterns, li, HintLineNumber, Best, BestLineNumber);
+  for (Radius = 1; *Best > 0 && !(AfterEnd && BeforeStart) &&
+    Radius <= MaxRadius; Radius++)
+  {
+    /* Lines are more often added above a tag than removed */
+    if (!AfterEnd)
+    {
+      LineNumber = HintLineNumber + Radius;
+      err = li->MoveToLine(LineNumber);
+      if (!err || err == TL_ERR_LINE_TOO_BIG)
+        TestLine(Patterns, li, LineNumber, Best, BestLineNumber);
+      else
+        AfterEnd = true;
+    }
+    if (!BeforeStart && *Best > 0)
+    {
+      if (Radius >= HintLineNumber)
+      {
+        BeforeStart = true;
+      }
+      else
+      {
+        LineNumber = HintLineNumber - Radius;
+        err = li->MoveToLine(LineNumber);
+        if (!err || err == TL_ERR_LINE_TOO_BIG)
+          TestLine(Patterns, li, LineNumber, Best, BestLineNumber);
+        else
+          BeforeStart = true;
+      }
+    }
+  }
+  return true;
+}
+
+/* Search the file once for all the patterns. The 1st line that matches the
+ * 1st pattern is returned, if there is none then the 1st line that matches
+ * the 2nd pattern and so on.
+ * With a hint the search starts at the hinted line and goes outward in both
+ * directions, so the nearest matching line is found. Tags are usually only
+ * a few lines off.
+ * The lines of li and the hint start at 1, the returned line starts at 0
+ * like the lines of Scintilla */
 TL_ERR TagList::DoFindLineNumberInFile(
   IN  LineIterator *li,
-  IN  const char *ExCmd,
+  IN  const SrcLinePattern *Patterns,
+  IN  uint32_t PatternCount,
+  IN  uint32_t HintLineNumber,
   OUT uint32_t *out_LineNumber)
 {
   TL_ERR err;
   uint32_t LineNumber;
+  uint32_t Best = PatternCount;
+  uint32_t BestLineNumber = 0;
+
+  if (PatternCount == 0)
+    return TL_ERR_INVALID;
+
+  if (HintLineNumber > 0 && SearchAroundLine(li, Patterns, PatternCount,
+    HintLineNumber, (uint32_t)-1, &Best, &BestLineNumber))
+  {
+    if (Best == PatternCount)
+      return TL_ERR_NOT_EXIST;
+    *out_LineNumber = BestLineNumber - 1;
+    return TL_ERR_OK;
+  }
 
   err = li->MoveToFirstLine();
   if (err)
     return err;
 
-  bool FromStart = false;
-  bool ToEnd = false;
-  uint32_t ExCmdSize = (uint32_t)::strlen(ExCmd);
-  if (ExCmdSize >= 2 && ExCmd[0] == '/' && ExCmd[1] == '^')
-  {
-    ExCmd += 2;
-    ExCmdSize -= 2;
-    FromStart = true;
-  }
-  if (ExCmdSize >= 2 && ExCmd[ExCmdSize-1] == '/' && ExCmd[ExCmdSize-2] == '$')
+  for (LineNumber = 1;; LineNumber++)
   {
-    ExCmdSize -= 2;
-    ToEnd = true;
+    TestLine(Patterns, li, LineNumber, &Best, &BestLineNumber);
+    if (Best == 0)
+      break;
+
+    err = li->MoveToNextLine();
+    if (err && err != TL_ERR_LINE_TOO_BIG)
+      break;
   }
-  if (ExCmdSize == 0)
-    return TL_ERR_INVALID;
 
-  for (LineNumber = 1;; LineNumber++)
+  if (Best == PatternCount)
+    return err;
+  *out_LineNumber = BestLineNumber - 1;
+  return TL_ERR_OK;
+}
+
+/* Size of the source file path buffer of a batch worker */
+#define LINE_BATCH_PATH_SIZE 1024
+/* Lines around its hint where an item is looked for before the scan */
+#define LINE_BATCH_HINT_RADIUS 64
+
+/* An item of FindAllLineNumbers that is searched in its source file */
+struct LineBatchItem
+{
+  const TagList::TagListItem *Item;
+  SrcLinePattern Patterns[3];
+  uint32_t PatternCount;
+  uint32_t HintLineNumber;
+  /* Index of the best pattern that matched so far, PatternCount if none */
+  uint32_t Best;
+  /* The first line and the line nearest to the hint that match it */
+  uint32_t FirstLineNumber;
+  uint32_t NearLineNumber;
+  uint32_t *out_LineNumber;
+};
+
+/* The items of one source file */
+struct LineBatchGroup
+{
+  LineBatchItem **Items;
+  uint32_t ItemCount;
+};
+
+static int CompareBatchItems(const void *p1, const void *p2)
+{
+  const LineBatchItem *Item1 = *(const LineBatchItem * const *)p1;
+  const LineBatchItem *Item2 = *(const LineBatchItem * const *)p2;
+
+  return ::strcmp(Item1->Item->FileName, Item2->Item->FileName);
+}
+
+static int CompareBatchHints(const void *p1, const void *p2)
+{
+  const LineBatchItem *Item1 = *(const LineBatchItem * const *)p1;
+  const LineBatchItem *Item2 = *(const LineBatchItem * const *)p2;
+
+  if (Item1->HintLineNumber != Item2->HintLineNumber)
+    return Item1->HintLineNumber < Item2->HintLineNumber ? -1 : 1;
+  return 0;
+}
+
+static uint32_t LineDistance(uint32_t Line1, uint32_t Line2)
+{
+  return Line1 > Line2 ? Line1 - Line2 : Line2 - Line1;
+}
+
+/* Test a line of a scan from the start of the file for an item. The result
+ * is the one of DoFindLineNumberInFile: with a hint the nearest line wins
+ * among the lines that match the same pattern, and on a tie the line after
+ * the hint. Return true when later lines can not change the result */
+static bool TestBatchLine(LineBatchItem *Bi, const LineIterator *li,
+  uint32_t LineNumber)
+{
+  uint32_t Limit = Bi->HintLineNumber > 0 ? Bi->Best + 1 : Bi->Best;
+  uint32_t i;
+
+  if (Limit > Bi->PatternCount)
+    Limit = Bi->PatternCount;
+  for (i = 0; i < Limit; i++)
   {
-    const char *Line = (const char *)li->Line;
-    uint32_t LineSize = li->LineSize;
-    if (LineSize < ExCmdSize)
+    if (!LineMatch(&Bi->Patterns[i], li->Line, li->LineSize))
+      continue;
+    if (i < Bi->Best)
     {
-      /* Do nothing */
+      Bi->Best = i;
+      Bi->FirstLineNumber = LineNumber;
+      Bi->NearLineNumber = LineNumber;
     }
-    else if (FromStart)
+    else if (LineDistance(LineNumber, Bi->HintLineNumber) <=
+      LineDistance(Bi->NearLineNumber, Bi->HintLineNumber))
     {
-      if (ToEnd)
-      {
-        if (LineSize == ExCmdSize && ::memcmp(Line, ExCmd, ExCmdSize) == 0)
-          break;
-      }
-      else
+      Bi->NearLineNumber = LineNumber;
+    }
+    break;
+  }
+  /* Later lines are farther from the hint than the nearest match */
+  return Bi->Best == 0 && LineNumber >= Bi->HintLineNumber +
+    LineDistance(Bi->NearLineNumber, Bi->HintLineNumber);
+}
+
+/* Resolve the items of a source file. An item with a hint is first looked
+ * for near it, in hint order so the reads move forward through the file.
+ * The items that are left are searched together in one scan of the file */
+static void ResolveLineBatch(TagList *tl, LineBatchGroup *Group)
+{
+  TL_ERR err;
+  FileReader *fr;
+  char PathBuff[LINE_BATCH_PATH_SIZE];
+  uint32_t LineNumber = 1;
+  uint32_t Pending = Group->ItemCount;
+  uint32_t i;
+
+  fr = FileReader::FileReaderCreate();
+  err = fr == NULL ? TL_ERR_MEM_ALLOC :
+    tl->OpenSrcFile(Group->Items[0]->Item, fr, PathBuff, sizeof(PathBuff));
+  if (!err)
+  {
+    FileReaderLineIterator li(fr, PathBuff);
+
+    ::qsort(Group->Items, Group->ItemCount, sizeof(*Group->Items),
+      CompareBatchHints);
+    Pending = 0;
+    for (i = 0; i < Group->ItemCount; i++)
+    {
+      LineBatchItem *Bi = Group->Items[i];
+      uint32_t Best;
+      uint32_t BestLineNumber;
+
+      if (Bi->HintLineNumber > 0 && SearchAroundLine(&li, Bi->Patterns,
+        Bi->PatternCount, Bi->HintLineNumber, LINE_BATCH_HINT_RADIUS, &Best,
+        &BestLineNumber) && Best == 0)
       {
-        if (LineSize >= ExCmdSize && ::memcmp(Line, ExCmd, ExCmdSize) == 0)
-          break;
+        Bi->Best = 0;
+        Bi->FirstLineNumber = BestLineNumber;
+        Bi->NearLineNumber = BestLineNumber;
+        continue;
       }
+      /* Keep the pending items first */
+      Group->Items[i] = Group->Items[Pending];
+      Group->Items[Pending++] = Bi;
     }
-    else /* not FromStart */
+
+    err = Pending > 0 ? li.MoveToFirstLine() : TL_ERR_NO_MORE;
+    for (; !err || err == TL_ERR_LINE_TOO_BIG; LineNumber++)
     {
-      if (ToEnd)
+      /* Items that are done are moved after the pending ones */
+      for (i = 0; i < Pending;)
       {
-        if (LineSize >= ExCmdSize &&
-          ::memcmp(Line + LineSize - ExCmdSize, ExCmd, ExCmdSize) == 0)
+        if (TestBatchLine(Group->Items[i], &li, LineNumber))
         {
-          break;
+          LineBatchItem *Tmp = Group->Items[i];
+          Group->Items[i] = Group->Items[--Pending];
+          Group->Items[Pending] = Tmp;
         }
-      }
-      else /* Substring match */
-      {
-        uint32_t  i;
-        for (i = 0; i + ExCmdSize <= LineSize; i++)
+        else
         {
-          if (Line[i] != ExCmd[0])
-            continue;
-          if (::memcmp(Line + i, ExCmd, ExCmdSize) == 0)
-            break;
+          i++;
         }
-        if (i + ExCmdSize <= LineSize)
-          break;
       }
+      if (Pending == 0)
+        break;
+      err = li.MoveToNextLine();
     }
+  }
 
-    err = li->MoveToNextLine();
-    if (err && err != TL_ERR_LINE_TOO_BIG)
-      return err;
+  /* LineNumber is now after the last line. Like the outward search, a hint
+   * after the last line is ignored */
+  for (i = 0; i < Group->ItemCount; i++)
+  {
+    LineBatchItem *Bi = Group->Items[i];
+    if (Bi->Best == Bi->PatternCount)
+      continue;
+    if (Bi->HintLineNumber > 0 && Bi->HintLineNumber < LineNumber)
+      *Bi->out_LineNumber = Bi->NearLineNumber - 1;
+    else
+      *Bi->out_LineNumber = Bi->FirstLineNumber - 1;
+  }
+  if (fr != NULL)
+    delete fr;
+}
+
+TL_ERR TagList::FindAllLineNumbers(
+  OUT uint32_t *out_LineNumbers,
+  IN  uint32_t ThreadCount)
+{
+  LineBatchItem *Batch;
+  LineBatchItem **Sorted;
+  LineBatchGroup *Groups;
+  TagListItem *Item;
+  uint32_t BatchCount = 0;
+  uint32_t GroupCount = 0;
+  uint32_t i, j;
+
+  if (Count == 0)
+    return TL_ERR_OK;
+
+  Batch = (LineBatchItem *)::malloc(Count * sizeof(LineBatchItem));
+  Sorted = (LineBatchItem **)::malloc(Count * sizeof(LineBatchItem *));
+  Groups = (LineBatchGroup *)::malloc(Count * sizeof(LineBatchGroup));
+  if (Batch == NULL || Sorted == NULL || Groups == NULL)
+  {
+    ::free(Batch);
+    ::free(Sorted);
+    ::free(Groups);
+    return TL_ERR_MEM_ALLOC;
+  }
+
+  /* The patterns are prepared here, FixExCmd allocates from StrMem */
+  for (Item = List, i = 0; Item != NULL && i < Count; Item = Item->Next, i++)
+  {
+    LineBatchItem *Bi = &Batch[BatchCount];
+
+    out_LineNumbers[i] = TL_NO_LINE_NUMBER;
+    if (PrepareLineSearch(Item, Bi->Patterns, &Bi->PatternCount,
+      &Bi->HintLineNumber, &out_LineNumbers[i]) || Bi->PatternCount == 0)
+    {
+      continue;
+    }
+    Bi->Item = Item;
+    Bi->Best = Bi->PatternCount;
+    Bi->FirstLineNumber = 0;
+    Bi->NearLineNumber = 0;
+    Bi->out_LineNumber = &out_LineNumbers[i];
+    Sorted[BatchCount++] = Bi;
+  }
+
+  ::qsort(Sorted, BatchCount, sizeof(*Sorted), CompareBatchItems);
+  for (i = 0; i < BatchCount; i = j)
+  {
+    for (j = i + 1; j < BatchCount && CompareBatchItems(&Sorted[i],
+      &Sorted[j]) == 0; j++);
+    Groups[GroupCount].Items = &Sorted[i];
+    Groups[GroupCount].ItemCount = j - i;
+    GroupCount++;
+  }
+
+  /* Distinct files are scanned in parallel. The calling thread is one of
+   * the workers */
+  std::atomic<uint32_t> NextGroup(0);
+  auto Worker = [&]()
+  {
+    uint32_t g;
+    while ((g = NextGroup++) < GroupCount)
+      ResolveLineBatch(this, &Groups[g]);
+  };
+  if (ThreadCount > GroupCount)
+    ThreadCount = GroupCount;
+  std::thread *Threads = ThreadCount > 1 ?
+    new std::thread[ThreadCount - 1] : NULL;
+  for (i = 0; Threads != NULL && i < ThreadCount - 1; i++)
+    Threads[i] = std::thread(Worker);
+  Worker();
+  for (i = 0; Threads != NULL && i < ThreadCount - 1; i++)
+    Threads[i].join();
+  delete[] Threads;
+
+  ::free(Batch);
+  ::free(Sorted);
+  ::free(Groups);
+  return TL_ERR_OK;
+}
+
+/* Resolve the line numbers of all the items once the list is made, all the
+ * items of a source file in one pass over that file */
+void TagList::ResolveLineNumbers()
+{
+  if (Count == 0)
+    return;
+  LineNumbers = (uint32_t *)::malloc(Count * sizeof(uint32_t));
+  if (LineNumbers == NULL)
+    return;
+  if (FindAllLineNumbers(LineNumbers) != TL_ERR_OK)
+  {
+    ::free(LineNumbers);
+    LineNumbers = NULL;
   }
-  *out_LineNumber = LineNumber;
-  return TL_ERR_OK;;
 }
 
 void TagList::SetTagAndLine(const char *Tag, int TagSize, int LineNum)
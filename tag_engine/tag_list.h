@@ -21,6 +21,8 @@
 #define _FILE_LIST_H_
 
 #include "tag_file.h"
+#include "tag_query.h"
+#include "line_index.h"
 #include <stddef.h>
 
 namespace TagLEET {
@@ -33,6 +35,12 @@ public:
 
   virtual TL_ERR MoveToFirstLine() = 0;
   virtual TL_ERR MoveToNextLine() = 0;
+  /* Move to a line by its number, the first line is number 1. Iterators
+   * that cannot do it cheaply return TL_ERR_GENERAL */
+  virtual TL_ERR MoveToLine(uint32_t /* LineNumber */)
+  {
+    return TL_ERR_GENERAL;
+  }
 
   const char *Line;
   uint32_t LineSize;
@@ -41,28 +49,58 @@ public:
 class FileReaderLineIterator : public LineIterator
 {
 public:
-  FileReaderLineIterator(FileReader *fr);
-  ~FileReaderLineIterator() {};
+  /* With the file name the line index of the file is cached */
+  FileReaderLineIterator(FileReader *in_fr, const char *in_FileName = NULL);
+  ~FileReaderLineIterator();
 
   TL_ERR MoveToFirstLine();
   TL_ERR MoveToNextLine();
+  TL_ERR MoveToLine(uint32_t LineNumber);
 
 private:
   TL_ERR HandleNewLine(TL_ERR err);
+  TL_ERR SeekToOffset(tf_int_t LineStart);
 
   ReaderBuff rb;
+  FileReader *fr;
+  const char *FileName;
   TL_ERR InitErr;
+  /* Taken on the first MoveToLine */
+  LineIndex *Index;
 };
 
+#define TL_NO_LINE_NUMBER ((uint32_t)-1)
+
+class TagListResult;
+class TagFileIndex;
+class ReferenceIndex;
+struct TagResultKey;
+struct SrcLinePattern;
+
 class TagList
 {
 public:
   TagList();
   ~TagList();
 
+  /* An exact lookup also resolves the line numbers of the items, see
+   * FindAllLineNumbers */
   TL_ERR Create(const char *Tag, const char *in_TagsFilePath,
     TagFile *cache = NULL, bool DoPrefixMatch = false,
     uint32_t MaxItemCount = 200);
+  TL_ERR Create(const char *Prefix, TagQuerySession *Session,
+    uint32_t MaxItemCount = 200);
+  /* Create a list of the tags of one source file, in the order of the tags
+   * file. The lines are found with the file index of the tags file, which
+   * must be of its current version */
+  TL_ERR CreateForSrcFile(const char *SrcFileName,
+    const char *in_TagsFilePath, const TagFileIndex *Index,
+    uint32_t MaxItemCount = 200);
+  /* Create a list of the references to an identifier, as the reference
+   * index of the tags file finds them. The tag of each item is the
+   * identifier, its file and line are of the reference */
+  TL_ERR CreateForRefs(const char *Name, const char *in_TagsFilePath,
+    const ReferenceIndex *Index, uint32_t MaxItemCount = 1000);
 
   struct TagListItem
   {
@@ -81,10 +119,19 @@ public:
     OUT FileReader *fr,
     OUT char *SrcFilePathBuff,
     IN  uint32_t BuffSize);
+  /* out_LineNumber starts at 0, like the lines of Scintilla */
   TL_ERR FindLineNumberInFile(
     IN  LineIterator *li,
     IN  const TagListItem *Item,
     OUT uint32_t *out_LineNumber);
+  /* Find the line numbers of all the items, like FindLineNumberInFile.
+   * Items of the same source file are searched together in one scan of the
+   * file and distinct files are spread over up to ThreadCount threads.
+   * out_LineNumbers gets Count entries in list order, TL_NO_LINE_NUMBER for
+   * items that were not found */
+  TL_ERR FindAllLineNumbers(
+    OUT uint32_t *out_LineNumbers,
+    IN  uint32_t ThreadCount = 4);
   void SetTagAndLine(const char *Tag, int TagSize, int LineNum);
 
 public:
@@ -96,15 +143,49 @@ public:
   bool TagsCaseInsensitive;
 
 private:
+  TL_ERR Prepare(const char *in_TagsFilePath);
+  TL_ERR DoCreate(const char *Tag, TagFile *cache, bool DoPrefixMatch,
+    uint32_t MaxItemCount);
+  void ResolveLineNumbers();
+  bool GetResolvedLine(const TagListItem *Item, uint32_t *LineNumber) const;
+  void SetKey(TagResultKey *Key, const char *Tag, tf_int_t FileSize,
+    uint64_t ModTime, uint32_t WatchGen, bool PrefixMatch,
+    uint32_t MaxItemCount) const;
+  bool FromCache(const TagResultKey *Key);
+  TL_ERR Publish(const TagResultKey *Key, TagIterator *itr,
+    bool CaseInsensitive);
+  void SetResult(TagListResult *NewResult);
+  static TL_ERR AddItems(TagListResult *Res, TagIterator *itr,
+    uint32_t MaxItemCount);
+  static TL_ERR AddItem(TagListResult *Res, const TagLineProperties *Props,
+    TagListItem ***NextItem);
+  TL_ERR ResolveSrcFile(
+    IN  const TagListItem *Item,
+    OUT FileReader *fr,
+    OUT char *SrcFilePathBuff,
+    IN  uint32_t BuffSize);
   TL_ERR DoFindLineNumberInFile(
     IN  LineIterator *li,
-    IN  const char *ExCmd,
+    IN  const SrcLinePattern *Patterns,
+    IN  uint32_t PatternCount,
+    IN  uint32_t HintLineNumber,
+    OUT uint32_t *out_LineNumber);
+  bool PrepareLineSearch(
+    IN  const TagListItem *Item,
+    OUT SrcLinePattern *Patterns,
+    OUT uint32_t *out_PatternCount,
+    OUT uint32_t *out_HintLineNumber,
     OUT uint32_t *out_LineNumber);
   const char *FixExCmd(const char *ExCmd);
   uint32_t FindTagInExCmd(const char *Tag, const char *ExCmd);
 
-  TfAllocator NodeMem;
+  /* The items are shared with the result cache, only the strings that are
+   * specific to this list are allocated from StrMem */
+  TagListResult *Result;
   TfAllocator StrMem;
+  /* Line numbers of the items in list order, as FindAllLineNumbers found
+   * them in the files on disk. NULL if they were not resolved */
+  uint32_t *LineNumbers;
 };
 
 } /* namespace TagLEET */
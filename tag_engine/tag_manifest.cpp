@@ -0,0 +1,529 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_manifest.h"
+#include "file_reader.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace TagLEET;
+
+/* Header of a saved manifest */
+struct TmFileHeader
+{
+  char Magic[4];
+  uint32_t Version;
+  uint64_t TagsFileSize;
+  uint64_t TagsModTime;
+  uint32_t Count;
+  uint32_t PoolSize;
+};
+
+static const char TmMagic[4] = {'T', 'L', 'M', 'F'};
+#define TM_VERSION 1
+
+/* Files are hashed in chunks of this size, a multiple of the 32 byte
+ * stripe of XXH64 */
+#define TM_HASH_CHUNK_SIZE (1024*1024)
+
+TagManifest::TagManifest()
+{
+  Entries = NULL;
+  Count = Capacity = 0;
+  Pool = NULL;
+  PoolSize = PoolCapacity = 0;
+  HashTable = NULL;
+  HashSize = 0;
+}
+
+TagManifest::~TagManifest()
+{
+  Reset();
+}
+
+void TagManifest::Reset()
+{
+  ::free(Entries);
+  ::free(Pool);
+  ::free(HashTable);
+  Entries = NULL;
+  Count = Capacity = 0;
+  Pool = NULL;
+  PoolSize = PoolCapacity = 0;
+  HashTable = NULL;
+  HashSize = 0;
+}
+
+/* FNV-1a */
+uint32_t TagManifest::NameHash(const char *Name)
+{
+  uint32_t Hash = 2166136261U;
+
+  for (; *Name != '\0'; Name++)
+  {
+    Hash ^= (uint8_t)*Name;
+    Hash *= 16777619U;
+  }
+  return Hash;
+}
+
+/* Slot of a name, or the empty slot where it would be */
+uint32_t *TagManifest::FindSlot(const char *Name, uint32_t Hash) const
+{
+  uint32_t Mask = HashSize - 1;
+  uint32_t i;
+
+  for (i = Hash & Mask; HashTable[i] != 0; i = (i + 1) & Mask)
+  {
+    if (::strcmp(Pool + Entries[HashTable[i] - 1].NameOffset, Name) == 0)
+      break;
+  }
+  return HashTable + i;
+}
+
+TL_ERR TagManifest::BuildHash(uint32_t NewHashSize)
+{
+  uint32_t i;
+
+  ::free(HashTable);
+  HashTable = (uint32_t *)::calloc(NewHashSize, sizeof(uint32_t));
+  if (HashTable == NULL)
+  {
+    HashSize = 0;
+    return TL_ERR_MEM_ALLOC;
+  }
+  HashSize = NewHashSize;
+
+  for (i = 0; i < Count; i++)
+  {
+    const char *Name = Pool + Entries[i].NameOffset;
+    *FindSlot(Name, NameHash(Name)) = i + 1;
+  }
+  return TL_ERR_OK;
+}
+
+bool TagManifest::Find(const char *Name, uint32_t *out_Entry) const
+{
+  uint32_t *Slot;
+
+  if (HashSize == 0)
+    return false;
+  Slot = FindSlot(Name, NameHash(Name));
+  if (*Slot == 0)
+    return false;
+  *out_Entry = *Slot - 1;
+  return true;
+}
+
+TL_ERR TagManifest::Set(const char *Name, uint64_t Size, uint64_t ModTime,
+  uint64_t Hash)
+{
+  TL_ERR err;
+  uint32_t NameSize = (uint32_t)::strlen(Name) + 1;
+  uint32_t *Slot;
+  Entry *e;
+
+  /* Keep the table at most half full */
+  if (2 * (Count + 1) > HashSize)
+  {
+    err = BuildHash(HashSize == 0 ? 1024 : HashSize * 2);
+    if (err)
+      return err;
+  }
+
+  Slot = FindSlot(Name, NameHash(Name));
+  if (*Slot != 0)
+  {
+    e = &Entries[*Slot - 1];
+    e->Size = Size;
+    e->ModTime = ModTime;
+    e->Hash = Hash;
+    return TL_ERR_OK;
+  }
+
+  if (Count == Capacity)
+  {
+    uint32_t NewCapacity = Capacity == 0 ? 1024 : Capacity * 2;
+    Entry *NewEntries;
+
+    NewEntries = (Entry *)::realloc(Entries, NewCapacity * sizeof(Entry));
+    if (NewEntries == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Entries = NewEntries;
+    Capacity = NewCapacity;
+  }
+
+  if (PoolSize + NameSize > PoolCapacity)
+  {
+    uint32_t NewCapacity = PoolCapacity == 0 ? 64*1024 : PoolCapacity * 2;
+    char *NewPool;
+
+    while (PoolSize + NameSize > NewCapacity)
+      NewCapacity *= 2;
+    NewPool = (char *)::realloc(Pool, NewCapacity);
+    if (NewPool == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Pool = NewPool;
+    PoolCapacity = NewCapacity;
+  }
+
+  e = &Entries[Count];
+  e->NameOffset = PoolSize;
+  e->Reserved = 0;
+  e->Size = Size;
+  e->ModTime = ModTime;
+  e->Hash = Hash;
+  ::memcpy(Pool + PoolSize, Name, NameSize);
+  PoolSize += NameSize;
+  *Slot = ++Count;
+  return TL_ERR_OK;
+}
+
+TL_ERR TagManifest::Save(const char *FileName, const char *TagsFilePath) const
+{
+  TL_ERR err;
+  FileWriter *fw;
+  std::string TmpPath(FileName);
+  TmFileHeader Hdr;
+  tf_int_t TagsFileSize;
+  uint64_t TagsModTime;
+
+  err = FileReader::GetFileInfo(TagsFilePath, &TagsFileSize, &TagsModTime);
+  if (err)
+    return err;
+
+  ::memset(&Hdr, 0, sizeof(Hdr));
+  ::memcpy(Hdr.Magic, TmMagic, sizeof(Hdr.Magic));
+  Hdr.Version = TM_VERSION;
+  Hdr.TagsFileSize = TagsFileSize;
+  Hdr.TagsModTime = TagsModTime;
+  Hdr.Count = Count;
+  Hdr.PoolSize = PoolSize;
+
+  fw = FileWriter::FileWriterCreate();
+  if (fw == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  TmpPath += FW_TMP_EXT;
+  err = fw->Create(TmpPath.c_str());
+  if (!err)
+    err = fw->Write(&Hdr, sizeof(Hdr));
+  if (!err && Count > 0)
+    err = fw->Write(Entries, Count * sizeof(Entry));
+  if (!err && PoolSize > 0)
+    err = fw->Write(Pool, PoolSize);
+  if (!err)
+    err = fw->Flush();
+  fw->Close();
+  delete fw;
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), FileName);
+  if (err)
+    FileWriter::RemoveFile(TmpPath.c_str());
+  return err;
+}
+
+TL_ERR TagManifest::Load(const char *FileName, const char *TagsFilePath)
+{
+  TL_ERR err;
+  FileReader *fr;
+  TmFileHeader Hdr;
+  tf_int_t TagsFileSize;
+  uint64_t TagsModTime;
+  uint32_t i;
+
+  Reset();
+  err = FileReader::GetFileInfo(TagsFilePath, &TagsFileSize, &TagsModTime);
+  if (err)
+    return err;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(FileName);
+  if (!err && fr->FileSize < sizeof(Hdr))
+    err = TL_ERR_INVALID;
+  if (!err)
+    err = fr->Read(0, &Hdr, sizeof(Hdr));
+  if (!err && (::memcmp(Hdr.Magic, TmMagic, sizeof(Hdr.Magic)) != 0 ||
+    Hdr.Version != TM_VERSION || fr->FileSize != sizeof(Hdr) +
+    (tf_int_t)Hdr.Count * sizeof(Entry) + Hdr.PoolSize))
+  {
+    err = TL_ERR_INVALID;
+  }
+  if (!err && (Hdr.TagsFileSize != TagsFileSize ||
+    Hdr.TagsModTime != TagsModTime))
+  {
+    err = TL_ERR_MODIFIED;
+  }
+
+  if (!err && Hdr.Count > 0)
+  {
+    Entries = (Entry *)::malloc(Hdr.Count * sizeof(Entry));
+    Pool = (char *)::malloc(Hdr.PoolSize);
+    if (Entries == NULL || Pool == NULL)
+      err = TL_ERR_MEM_ALLOC;
+    if (!err)
+      err = fr->Read(sizeof(Hdr), Entries, Hdr.Count * sizeof(Entry));
+    if (!err)
+      err = fr->Read(sizeof(Hdr) + (tf_int_t)Hdr.Count * sizeof(Entry), Pool,
+        Hdr.PoolSize);
+  }
+  delete fr;
+
+  /* Every name must be terminated within the pool */
+  for (i = 0; !err && i < Hdr.Count; i++)
+  {
+    if (Entries[i].NameOffset >= Hdr.PoolSize ||
+      ::memchr(Pool + Entries[i].NameOffset, '\0',
+      Hdr.PoolSize - Entries[i].NameOffset) == NULL)
+    {
+      err = TL_ERR_INVALID;
+    }
+  }
+  if (!err)
+  {
+    uint32_t NewHashSize = 1024;
+
+    Count = Capacity = Hdr.Count;
+    PoolSize = PoolCapacity = Hdr.PoolSize;
+    while (NewHashSize < 2 * Count)
+      NewHashSize *= 2;
+    err = BuildHash(NewHashSize);
+  }
+  if (err)
+    Reset();
+  return err;
+}
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+static uint64_t XxhRotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t XxhRead64(const uint8_t *p)
+{
+  uint64_t v;
+  ::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t XxhRead32(const uint8_t *p)
+{
+  uint32_t v;
+  ::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint64_t XxhRound(uint64_t Acc, uint64_t Input)
+{
+  Acc += Input * XXH_P2;
+  Acc = XxhRotl(Acc, 31);
+  return Acc * XXH_P1;
+}
+
+static uint64_t XxhMerge(uint64_t Acc, uint64_t Val)
+{
+  Acc ^= XxhRound(0, Val);
+  return Acc * XXH_P1 + XXH_P4;
+}
+
+/* XXH64 with seed 0, fed in chunks that are whole 32 byte stripes except
+ * the last one */
+struct XxhState
+{
+  uint64_t v[4];
+  uint64_t TotalSize;
+};
+
+static void XxhInit(XxhState *s)
+{
+  s->v[0] = XXH_P1 + XXH_P2;
+  s->v[1] = XXH_P2;
+  s->v[2] = 0;
+  s->v[3] = 0 - XXH_P1;
+  s->TotalSize = 0;
+}
+
+/* Consume the whole stripes of Data, return how many bytes that was */
+static uint32_t XxhStripes(XxhState *s, const uint8_t *Data, uint32_t Size)
+{
+  uint32_t i;
+
+  for (i = 0; i + 32 <= Size; i += 32)
+  {
+    s->v[0] = XxhRound(s->v[0], XxhRead64(Data + i));
+    s->v[1] = XxhRound(s->v[1], XxhRead64(Data + i + 8));
+    s->v[2] = XxhRound(s->v[2], XxhRead64(Data + i + 16));
+    s->v[3] = XxhRound(s->v[3], XxhRead64(Data + i + 24));
+  }
+  s->TotalSize += i;
+  return i;
+}
+
+static uint64_t XxhFinish(XxhState *s, const uint8_t *Tail, uint32_t Size)
+{
+  uint64_t h;
+
+  if (s->TotalSize >= 32)
+  {
+    h = XxhRotl(s->v[0], 1) + XxhRotl(s->v[1], 7) + XxhRotl(s->v[2], 12) +
+      XxhRotl(s->v[3], 18);
+    h = XxhMerge(h, s->v[0]);
+    h = XxhMerge(h, s->v[1]);
+    h = XxhMerge(h, s->v[2]);
+    h = XxhMerge(h, s->v[3]);
+  }
+  else
+  {
+    h = XXH_P5;
+  }
+  h += s->TotalSize + Size;
+
+  for (; Size >= 8; Tail += 8, Size -= 8)
+  {
+    h ^= XxhRound(0, XxhRead64(Tail));
+    h = XxhRotl(h, 27) * XXH_P1 + XXH_P4;
+  }
+  if (Size >= 4)
+  {
+    h ^= (uint64_t)XxhRead32(Tail) * XXH_P1;
+    h = XxhRotl(h, 23) * XXH_P2 + XXH_P3;
+    Tail += 4;
+    Size -= 4;
+  }
+  for (; Size > 0; Tail++, Size--)
+  {
+    h ^= *Tail * XXH_P5;
+    h = XxhRotl(h, 11) * XXH_P1;
+  }
+
+  h ^= h >> 33;
+  h *= XXH_P2;
+  h ^= h >> 29;
+  h *= XXH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+static TL_ERR HashFileBuff(const char *FileName, uint8_t *Buff,
+  uint64_t *out_Hash)
+{
+  TL_ERR err;
+  FileReader *fr;
+  XxhState State;
+  tf_int_t Offset = 0;
+  uint32_t Size = 0;
+  uint32_t Used = 0;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  XxhInit(&State);
+  err = fr->Open(FileName);
+  if (!err)
+    fr->SetAccess(FR_ACCESS_ONCE);
+  while (!err && Offset < fr->FileSize)
+  {
+    Size = fr->FileSize - Offset < TM_HASH_CHUNK_SIZE ?
+      (uint32_t)(fr->FileSize - Offset) : TM_HASH_CHUNK_SIZE;
+    err = fr->Read(Offset, Buff, Size);
+    Offset += Size;
+    if (!err)
+      Used = XxhStripes(&State, Buff, Size);
+  }
+  delete fr;
+  if (err)
+    return err;
+
+  /* The last chunk is not read over, its tail is still in Buff */
+  *out_Hash = XxhFinish(&State, Buff + Used, Size - Used);
+  return TL_ERR_OK;
+}
+
+TL_ERR TagLEET::HashFile(const char *FileName, uint64_t *out_Hash)
+{
+  TL_ERR err;
+  uint8_t *Buff = (uint8_t *)::malloc(TM_HASH_CHUNK_SIZE);
+
+  if (Buff == NULL)
+    return TL_ERR_MEM_ALLOC;
+  err = HashFileBuff(FileName, Buff, out_Hash);
+  ::free(Buff);
+  return err;
+}
+
+/* Take files to hash until there are none left */
+static void HashWorker(const char *const *FileNames, uint32_t Count,
+  std::atomic<uint32_t> *Next, uint64_t *out_Hashes, bool *out_Ok)
+{
+  uint8_t *Buff = (uint8_t *)::malloc(TM_HASH_CHUNK_SIZE);
+  uint32_t i;
+
+  for (i = Next->fetch_add(1); i < Count; i = Next->fetch_add(1))
+  {
+    out_Ok[i] = Buff != NULL &&
+      HashFileBuff(FileNames[i], Buff, &out_Hashes[i]) == TL_ERR_OK;
+    if (!out_Ok[i])
+      out_Hashes[i] = 0;
+  }
+  ::free(Buff);
+}
+
+void TagLEET::HashFiles(const char *const *FileNames, uint32_t Count,
+  uint32_t ThreadCount, uint64_t *out_Hashes, bool *out_Ok)
+{
+  std::vector<std::thread> Threads;
+  std::atomic<uint32_t> Next(0);
+  uint32_t i;
+
+  if (ThreadCount > Count)
+    ThreadCount = Count;
+  /* The calling thread is one of the workers */
+  for (i = 1; i < ThreadCount; i++)
+  {
+    try
+    {
+      Threads.push_back(std::thread(HashWorker, FileNames, Count, &Next,
+        out_Hashes, out_Ok));
+    }
+    catch (...)
+    {
+      break;
+    }
+  }
+  HashWorker(FileNames, Count, &Next, out_Hashes, out_Ok);
+  for (i = 0; i < Threads.size(); i++)
+    Threads[i].join();
+}
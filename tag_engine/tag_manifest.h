@@ -0,0 +1,95 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TAG_MANIFEST_H_
+#define _TAG_MANIFEST_H_
+
+#include "tl_types.h"
+
+namespace TagLEET {
+
+/* Extension of the manifest, next to the tags file */
+#define TAG_MANIFEST_EXT ".tlm"
+
+/* The source files a tags file was made from, with the size, time and
+ * content hash each had. A re-index parses again only the files whose
+ * content changed since, the tags of the others are kept from the tags
+ * file where the file index finds them. A manifest is valid only for the
+ * version of the tags file it was saved with. */
+class TagManifest
+{
+public:
+  TagManifest();
+  ~TagManifest();
+
+  /* Stamp the manifest with the tags file as it is now */
+  TL_ERR Save(const char *FileName, const char *TagsFilePath) const;
+  /* Fails with TL_ERR_MODIFIED if the tags file changed since it was saved */
+  TL_ERR Load(const char *FileName, const char *TagsFilePath);
+  void Reset();
+
+  /* Add a file or replace what is known about it */
+  TL_ERR Set(const char *Name, uint64_t Size, uint64_t ModTime,
+    uint64_t Hash);
+  bool Find(const char *Name, uint32_t *out_Entry) const;
+
+  uint32_t GetCount() const { return Count; }
+  const char *GetName(uint32_t Entry) const
+    { return Pool + Entries[Entry].NameOffset; }
+  uint64_t GetSize(uint32_t Entry) const { return Entries[Entry].Size; }
+  uint64_t GetModTime(uint32_t Entry) const
+    { return Entries[Entry].ModTime; }
+  uint64_t GetHash(uint32_t Entry) const { return Entries[Entry].Hash; }
+
+private:
+  struct Entry
+  {
+    uint32_t NameOffset;
+    uint32_t Reserved;
+    uint64_t Size;
+    uint64_t ModTime;
+    uint64_t Hash;
+  };
+
+  static uint32_t NameHash(const char *Name);
+  uint32_t *FindSlot(const char *Name, uint32_t Hash) const;
+  TL_ERR BuildHash(uint32_t NewHashSize);
+
+  Entry *Entries;
+  uint32_t Count;
+  uint32_t Capacity;
+  char *Pool;
+  uint32_t PoolSize;
+  uint32_t PoolCapacity;
+  /* Open addressing table of entry index + 1, HashSize is a power of 2 */
+  uint32_t *HashTable;
+  uint32_t HashSize;
+};
+
+/* 64 bit XXH64 hash of the content of a file */
+TL_ERR HashFile(const char *FileName, uint64_t *out_Hash);
+
+/* Hash files on up to ThreadCount threads. A file that could not be read
+ * gets the hash 0 and out_Ok[i] false */
+void HashFiles(const char *const *FileNames, uint32_t Count,
+  uint32_t ThreadCount, uint64_t *out_Hashes, bool *out_Ok);
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_MANIFEST_H_ */
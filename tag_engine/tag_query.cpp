@@ -0,0 +1,218 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_query.h"
+#include "tag_cache.h"
+#include "src_path_cache.h"
+
+#include <malloc.h>
+#include <string.h>
+
+using namespace TagLEET;
+
+TagQuerySession::TagQuerySession()
+{
+  TagsFilePath = NULL;
+  FileOpen = false;
+  FileSize = 0;
+  ModTime = 0;
+  Watch = NULL;
+  WatchGen = 0;
+  CurrPrefix = NULL;
+  CurrPrefixBuffSize = 0;
+  LevelCount = 0;
+}
+
+TagQuerySession::~TagQuerySession()
+{
+  Release();
+}
+
+void TagQuerySession::Release()
+{
+  tf.Init((const char *)NULL);
+  if (TagsFilePath != NULL)
+  {
+    free(const_cast<char *>(TagsFilePath));
+    TagsFilePath = NULL;
+  }
+  if (CurrPrefix != NULL)
+  {
+    free(CurrPrefix);
+    CurrPrefix = NULL;
+  }
+  CurrPrefixBuffSize = 0;
+  FileOpen = false;
+  LevelCount = 0;
+  Watch = NULL;
+  WatchGen = 0;
+}
+
+/* Start a query on a tags file. If the session is already on that file its
+ * page tree and prefix ranges are reused. The file remains open until
+ * EndQuery is called */
+TL_ERR TagQuerySession::Init(const char *in_TagsFilePath)
+{
+  TL_ERR err;
+
+  if (TagsFilePath != NULL && ::strcmp(TagsFilePath, in_TagsFilePath) == 0)
+    return BeginQuery();
+
+  Release();
+  TagsFilePath = ::_strdup(in_TagsFilePath);
+  if (TagsFilePath == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  /* The generation is taken before the file is opened, a change while it is
+   * opened is seen by the next query */
+  Watch = FileWatcher::Global()->Watch(TagsFilePath);
+  WatchGen = Watch != NULL ? Watch->GetGeneration() : 0;
+  err = tf.Init(TagsFilePath);
+  if (err)
+  {
+    Release();
+    return err;
+  }
+
+  FileOpen = true;
+  FileSize = tf.GetFileReader()->FileSize;
+  ModTime = tf.GetFileReader()->ModTime;
+  return TL_ERR_OK;
+}
+
+/* Reopen the file for a query and check whether it was rewritten. Narrow
+ * calls it implicitly */
+TL_ERR TagQuerySession::BeginQuery()
+{
+  TL_ERR err;
+  FileReader *fr;
+  uint32_t Gen;
+  bool Changed;
+
+  if (TagsFilePath == NULL)
+    return TL_ERR_FILE_NOT_OPEN;
+  if (FileOpen)
+    return TL_ERR_OK;
+
+  Gen = Watch != NULL ? Watch->GetGeneration() : 0;
+  Changed = Gen != WatchGen;
+  err = tf.ReopenFile(Changed);
+  if (err)
+    return err;
+
+  FileOpen = true;
+  WatchGen = Gen;
+  fr = tf.GetFileReader();
+  if (Changed || fr->FileSize != FileSize || fr->ModTime != ModTime)
+  {
+    /* The tags file was rewritten, all the ranges are stale */
+    FileSize = fr->FileSize;
+    ModTime = fr->ModTime;
+    LevelCount = 0;
+    TagResultCache::Global()->InvalidateFile(TagsFilePath);
+    SrcPathCache::Global()->Invalidate(TagsFilePath);
+  }
+  return TL_ERR_OK;
+}
+
+/* True if the file is watched and did not change since the last query, its
+ * size and time are then known without opening it */
+bool TagQuerySession::IsCurrent() const
+{
+  return Watch != NULL && Watch->IsActive() &&
+    Watch->GetGeneration() == WatchGen;
+}
+
+void TagQuerySession::EndQuery()
+{
+  if (FileOpen)
+  {
+    tf.CloseFile();
+    FileOpen = false;
+  }
+}
+
+/* Get the range [Start, End) of the lines whose tag starts with 'Prefix'.
+ * Levels of the stack whose prefix is not a prefix of 'Prefix' are popped.
+ * The range is then searched within the range of the deepest remaining level
+ * and pushed as a new level. */
+TL_ERR TagQuerySession::Narrow(const char *Prefix, tf_int_t *Start,
+  tf_int_t *End)
+{
+  TL_ERR err;
+  TqLevel *Top;
+  uint32_t PrefixSize = (uint32_t)strlen(Prefix);
+
+  err = BeginQuery();
+  if (err)
+    return err;
+
+  while (LevelCount > 0)
+  {
+    Top = &Levels[LevelCount - 1];
+    if (Top->PrefixSize <= PrefixSize &&
+      ::memcmp(CurrPrefix, Prefix, Top->PrefixSize) == 0)
+    {
+      break;
+    }
+    LevelCount--;
+  }
+
+  if (LevelCount > 0 && Levels[LevelCount - 1].PrefixSize == PrefixSize)
+  {
+    *Start = Levels[LevelCount - 1].Start;
+    *End = Levels[LevelCount - 1].End;
+    return TL_ERR_OK;
+  }
+
+  if (LevelCount == 0)
+  {
+    err = tf.GetPrefixRange(Prefix, Start, End);
+  }
+  else
+  {
+    Top = &Levels[LevelCount - 1];
+    err = tf.GetPrefixRangeIn(Prefix, Top->Start, Top->End, Start, End);
+  }
+  if (err)
+    return err;
+
+  if (PrefixSize + 1 > CurrPrefixBuffSize)
+  {
+    char *NewPrefix = (char *)realloc(CurrPrefix, PrefixSize + 32);
+    if (NewPrefix == NULL)
+    {
+      /* Still a valid result, just don't remember it */
+      LevelCount = 0;
+      return TL_ERR_OK;
+    }
+    CurrPrefix = NewPrefix;
+    CurrPrefixBuffSize = PrefixSize + 32;
+  }
+  ::memcpy(CurrPrefix, Prefix, PrefixSize + 1);
+
+  if (LevelCount == TQ_MAX_LEVELS)
+    ::memmove(&Levels[0], &Levels[1], sizeof(Levels[0]) * --LevelCount);
+  Levels[LevelCount].PrefixSize = PrefixSize;
+  Levels[LevelCount].Start = *Start;
+  Levels[LevelCount].End = *End;
+  LevelCount++;
+  return TL_ERR_OK;
+}
@@ -0,0 +1,80 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TAG_QUERY_H_
+#define _TAG_QUERY_H_
+
+#include "tag_file.h"
+#include "file_watch.h"
+
+namespace TagLEET {
+
+#define TQ_MAX_LEVELS 64
+
+/* Query session for type-ahead prefix queries over one tags file.
+ * The session keeps the TagFile, with its page tree, between queries and
+ * remembers the range of lines of every prefix typed so far. When the prefix
+ * is extended the new range is searched only within the range of the
+ * previous prefix. When characters are deleted the range of the shorter
+ * prefix is taken from the stack without any I/O.
+ * The file is kept open only during a query, between Narrow and EndQuery.
+ * A new tags file is published by renaming it over the old one, a query
+ * goes on reading the version it opened and the next query opens the new
+ * one. When the file is watched a rewrite is noticed without looking at
+ * the file. */
+class TagQuerySession
+{
+public:
+  TagQuerySession();
+  ~TagQuerySession();
+
+  TL_ERR Init(const char *in_TagsFilePath);
+  void Release();
+  TL_ERR BeginQuery();
+  TL_ERR Narrow(const char *Prefix, tf_int_t *Start, tf_int_t *End);
+  void EndQuery();
+  bool IsCurrent() const;
+  uint32_t GetWatchGen() const { return WatchGen; }
+  TagFile *GetTagFile() { return &tf; }
+  const char *GetTagsFilePath() const { return TagsFilePath; }
+
+private:
+  struct TqLevel {
+    uint32_t PrefixSize;
+    tf_int_t Start;
+    tf_int_t End;
+  };
+
+  TagFile tf;
+  const char *TagsFilePath;
+  bool FileOpen;
+  tf_int_t FileSize;
+  uint64_t ModTime;
+  FileWatch *Watch;
+  uint32_t WatchGen;
+  char *CurrPrefix;
+  uint32_t CurrPrefixBuffSize;
+  uint32_t LevelCount;
+  TqLevel Levels[TQ_MAX_LEVELS];
+};
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_QUERY_H_ */
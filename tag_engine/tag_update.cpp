@@ -0,0 +1,737 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "tag_update.h"
+#include "tag_file.h"
+#include "tag_file_index.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace TagLEET;
+
+#define UPDATE_WINDOW_SIZE (256*1024)
+
+struct NewTagLine
+{
+  const char *Line;
+  /* Without the EOL */
+  uint32_t Size;
+};
+
+static int CompareLines(const char *s1, uint32_t n1, const char *s2,
+  uint32_t n2, bool NoCase)
+{
+  int res;
+
+  res = NoCase ? TagLEET::memicmp(s1, s2, n1 < n2 ? n1 : n2) :
+    ::memcmp(s1, s2, n1 < n2 ? n1 : n2);
+  if (res != 0)
+    return res;
+  return n1 < n2 ? -1 : n1 > n2 ? 1 : 0;
+}
+
+static int CompareNewLines(const void *p1, const void *p2)
+{
+  const NewTagLine *l1 = (const NewTagLine *)p1;
+  const NewTagLine *l2 = (const NewTagLine *)p2;
+  return CompareLines(l1->Line, l1->Size, l2->Line, l2->Size, false);
+}
+
+static int CompareNewLinesNoCase(const void *p1, const void *p2)
+{
+  const NewTagLine *l1 = (const NewTagLine *)p1;
+  const NewTagLine *l2 = (const NewTagLine *)p2;
+  return CompareLines(l1->Line, l1->Size, l2->Line, l2->Size, true);
+}
+
+static bool IsPseudoTag(const char *Line, uint32_t Size)
+{
+  return Size >= 2 && Line[0] == '!' && Line[1] == '_';
+}
+
+/* Test if the file field of a tag line is SrcFileName. '/' and '\\' are the
+ * same, ctags may write either one */
+static bool IsSrcFileLine(const char *Line, uint32_t Size,
+  const char *SrcFileName, uint32_t NameSize)
+{
+  const char *Tab = (const char *)::memchr(Line, '\t', Size);
+  uint32_t i;
+
+  if (Tab == NULL)
+    return false;
+  Size -= (uint32_t)(Tab + 1 - Line);
+  Line = Tab + 1;
+  if (Size < NameSize || (Size > NameSize && Line[NameSize] != '\t'))
+    return false;
+
+  for (i = 0; i < NameSize; i++)
+  {
+    if (Line[i] == SrcFileName[i])
+      continue;
+    if ((Line[i] == '/' || Line[i] == '\\') &&
+      (SrcFileName[i] == '/' || SrcFileName[i] == '\\'))
+    {
+      continue;
+    }
+    return false;
+  }
+  return true;
+}
+
+/* !_TAG_FILE_SORTED, 0 unsorted, 1 sorted, 2 sorted ignoring case */
+static void TestSortedFlag(const char *Line, uint32_t Size, bool *Unsorted,
+  bool *NoCase)
+{
+  static const char TagsSortedFlag[] = "!_TAG_FILE_SORTED\t";
+  uint32_t n = sizeof(TagsSortedFlag) - 1;
+
+  if (Size <= n || ::memcmp(Line, TagsSortedFlag, n) != 0)
+    return;
+  *Unsorted = Line[n] == '0';
+  *NoCase = Line[n] == '2';
+}
+
+/* Split the new tags to lines, its pseudo tags are dropped */
+static TL_ERR SplitNewLines(const char *Data, uint32_t DataSize,
+  NewTagLine **out_Lines, uint32_t *out_Count)
+{
+  NewTagLine *Lines;
+  uint32_t i, Start, Count = 0;
+
+  /* At most one line per 2 bytes, with a last line without EOL */
+  Lines = (NewTagLine *)::malloc((DataSize / 2 + 1) * sizeof(NewTagLine));
+  if (Lines == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  for (i = Start = 0; i <= DataSize; i++)
+  {
+    uint32_t Size;
+
+    if (i < DataSize && Data[i] != '\n')
+      continue;
+    Size = i - Start;
+    if (Size > 0 && Data[Start + Size - 1] == '\r')
+      Size--;
+    if (Size > 0 && !IsPseudoTag(Data + Start, Size))
+    {
+      Lines[Count].Line = Data + Start;
+      Lines[Count].Size = Size;
+      Count++;
+    }
+    Start = i + 1;
+  }
+
+  *out_Lines = Lines;
+  *out_Count = Count;
+  return TL_ERR_OK;
+}
+
+/* Read the new tags file to memory */
+static TL_ERR ReadNewTags(const char *NewTagsPath, char **out_Data,
+  uint32_t *out_Size)
+{
+  TL_ERR err;
+  FileReader *fr;
+  char *Data = NULL;
+  uint32_t DataSize = 0;
+
+  fr = FileReader::FileReaderCreate();
+  if (fr == NULL)
+    return TL_ERR_MEM_ALLOC;
+
+  err = fr->Open(NewTagsPath);
+  if (!err && fr->FileSize > TAG_UPDATE_MAX_NEW_SIZE)
+    err = TL_ERR_FILE_TOO_BIG;
+  if (!err)
+  {
+    DataSize = (uint32_t)fr->FileSize;
+    Data = (char *)::malloc(DataSize + 1);
+    err = Data == NULL ? TL_ERR_MEM_ALLOC : TL_ERR_OK;
+  }
+  if (!err && DataSize > 0)
+    err = fr->Read(0, Data, DataSize);
+  delete fr;
+
+  if (err)
+  {
+    ::free(Data);
+    return err;
+  }
+  *out_Data = Data;
+  *out_Size = DataSize;
+  return TL_ERR_OK;
+}
+
+/* The updated tags file, and its file index when there is one */
+struct MergeOutput
+{
+  FileWriter *fw;
+  tf_int_t Offset;
+  TagFileIndex *Index;
+};
+
+/* Write a line and its EOL, a last line without one gets "\n" as more lines
+ * may follow it */
+static TL_ERR WriteLine(MergeOutput *Out, const char *Line, uint32_t Size,
+  const char *Eol, uint32_t EolSize)
+{
+  TL_ERR err = TL_ERR_OK;
+
+  if (Out->Index != NULL)
+    err = Out->Index->AddLine(Line, Size, Out->Offset);
+  if (!err)
+    err = Out->fw->Write(Line, Size);
+  if (!err)
+    err = EolSize > 0 ? Out->fw->Write(Eol, EolSize) : Out->fw->Write("\n", 1);
+  Out->Offset += Size + (EolSize > 0 ? EolSize : 1);
+  return err;
+}
+
+/* The new index is of the tags file as it was written, once it replaced the
+ * old one */
+static void FinishIndex(const char *TagsFilePath, TagFileIndex *NewIndex,
+  TagFileIndex *Index)
+{
+  tf_int_t FileSize;
+  uint64_t ModTime;
+
+  if (FileReader::GetFileInfo(TagsFilePath, &FileSize, &ModTime) == TL_ERR_OK
+    && NewIndex->Finish(TagsFilePath, FileSize, ModTime) == TL_ERR_OK)
+  {
+    Index->MoveFrom(NewIndex);
+  }
+  else
+  {
+    Index->Reset();
+  }
+}
+
+/* Copy the tags file without the lines of the source file and merge the new
+ * lines, that are sorted the same way, in between. With DropOffsets, the
+ * offsets of the lines of the source file from the file index, the lines
+ * are dropped by offset instead of by their file name */
+static TL_ERR MergeTags(FileReader *fr, MergeOutput *Out,
+  const char *SrcFileName, const tf_int_t *DropOffsets, uint32_t DropCount,
+  NewTagLine *NewLines, uint32_t NewCount)
+{
+  TL_ERR err;
+  ReaderBuff rb;
+  uint32_t NameSize = (uint32_t)::strlen(SrcFileName);
+  uint32_t j = 0;
+  uint32_t d = 0;
+  bool Unsorted = false;
+  bool NoCase = false;
+  bool Sorted = false;
+  char Eol[2] = {'\n', 0};
+  uint32_t EolSize = 1;
+
+  err = rb.InitSequential(fr, 0, UPDATE_WINDOW_SIZE, FR_ACCESS_ONCE);
+  if (!err)
+    err = rb.FindNextFullLine(true);
+  for (; !err; err = rb.FindNextFullLine(true))
+  {
+    const char *Line = (const char *)rb.Buff + rb.LineOffset;
+    uint32_t LineEol = rb.NextLineOffset - rb.LineOffset - rb.LineSize;
+
+    /* New lines use the EOL of the tags file */
+    if (LineEol > 0)
+    {
+      ::memcpy(Eol, Line + rb.LineSize, LineEol);
+      EolSize = LineEol;
+    }
+    if (IsPseudoTag(Line, rb.LineSize))
+    {
+      TestSortedFlag(Line, rb.LineSize, &Unsorted, &NoCase);
+      err = WriteLine(Out, Line, rb.LineSize, Line + rb.LineSize, LineEol);
+      if (err)
+        break;
+      continue;
+    }
+
+    /* The pseudo tags are all before the first tag */
+    if (!Sorted)
+    {
+      if (Unsorted)
+        return TL_ERR_SORT;
+      ::qsort(NewLines, NewCount, sizeof(*NewLines),
+        NoCase ? CompareNewLinesNoCase : CompareNewLines);
+      Sorted = true;
+    }
+
+    if (DropOffsets != NULL)
+    {
+      tf_int_t LineStart = rb.Offset + rb.LineOffset;
+
+      while (d < DropCount && DropOffsets[d] < LineStart)
+        d++;
+      if (d < DropCount && DropOffsets[d] == LineStart)
+        continue;
+    }
+    else if (IsSrcFileLine(Line, rb.LineSize, SrcFileName, NameSize))
+    {
+      continue;
+    }
+    if (rb.LineSize == 0)
+      continue;
+
+    for (; !err && j < NewCount; j++)
+    {
+      if (CompareLines(NewLines[j].Line, NewLines[j].Size, Line, rb.LineSize,
+        NoCase) >= 0)
+      {
+        break;
+      }
+      err = WriteLine(Out, NewLines[j].Line, NewLines[j].Size, Eol, EolSize);
+    }
+    if (!err)
+      err = WriteLine(Out, Line, rb.LineSize, Line + rb.LineSize, LineEol);
+    if (err)
+      break;
+  }
+  if (err != TL_ERR_NO_MORE)
+    return err;
+  if (Unsorted)
+    return TL_ERR_SORT;
+
+  if (!Sorted)
+  {
+    ::qsort(NewLines, NewCount, sizeof(*NewLines),
+      NoCase ? CompareNewLinesNoCase : CompareNewLines);
+  }
+  for (err = TL_ERR_OK; !err && j < NewCount; j++)
+    err = WriteLine(Out, NewLines[j].Line, NewLines[j].Size, Eol, EolSize);
+  return err;
+}
+
+TL_ERR TagLEET::UpdateTagsOfSrcFile(const char *TagsFilePath,
+  const char *SrcFileName, const char *NewTagsPath, TagFileIndex *Index)
+{
+  TL_ERR err;
+  char *NewData;
+  uint32_t NewSize;
+
+  err = ReadNewTags(NewTagsPath, &NewData, &NewSize);
+  if (err)
+    return err;
+  err = UpdateTagsOfSrcFileData(TagsFilePath, SrcFileName, NewData, NewSize,
+    Index);
+  ::free(NewData);
+  return err;
+}
+
+TL_ERR TagLEET::UpdateTagsOfSrcFileData(const char *TagsFilePath,
+  const char *SrcFileName, const char *NewData, uint32_t NewSize,
+  TagFileIndex *Index)
+{
+  TL_ERR err;
+  FileReader *fr;
+  MergeOutput Out;
+  TagFileIndex NewIndex;
+  NewTagLine *NewLines = NULL;
+  uint32_t NewCount = 0;
+  const tf_int_t NoOffset = 0;
+  const tf_int_t *DropOffsets = NULL;
+  uint32_t DropCount = 0;
+  uint32_t File;
+  std::string TmpPath(TagsFilePath);
+
+  TmpPath += TAG_UPDATE_EXT;
+  err = SplitNewLines(NewData, NewSize, &NewLines, &NewCount);
+  if (err)
+    return err;
+
+  fr = FileReader::FileReaderCreate();
+  Out.fw = FileWriter::FileWriterCreate();
+  Out.Offset = 0;
+  Out.Index = Index != NULL ? &NewIndex : NULL;
+  err = fr == NULL || Out.fw == NULL ? TL_ERR_MEM_ALLOC : TL_ERR_OK;
+  if (!err)
+    err = fr->Open(TagsFilePath);
+  /* An index of this version of the tags file has the lines to drop */
+  if (!err && Index != NULL &&
+    Index->IsValidFor(TagsFilePath, fr->FileSize, fr->ModTime))
+  {
+    DropOffsets = &NoOffset;
+    if (Index->FindFile(SrcFileName, &File))
+      DropCount = Index->GetFileTags(File, &DropOffsets);
+  }
+  if (!err)
+    err = Out.fw->Create(TmpPath.c_str());
+  if (!err)
+    err = MergeTags(fr, &Out, SrcFileName, DropOffsets, DropCount, NewLines,
+      NewCount);
+  if (!err)
+    err = Out.fw->Flush();
+  if (Out.fw != NULL)
+  {
+    Out.fw->Close();
+    delete Out.fw;
+  }
+  /* The tags file must be closed before it is replaced */
+  if (fr != NULL)
+    delete fr;
+  ::free(NewLines);
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), TagsFilePath);
+  if (err)
+  {
+    FileWriter::RemoveFile(TmpPath.c_str());
+    return err;
+  }
+
+  if (Index != NULL)
+    FinishIndex(TagsFilePath, &NewIndex, Index);
+  return TL_ERR_OK;
+}
+
+/* A shard tags file of MergeTagsFiles and its current line */
+struct ShardLine
+{
+  FileReader *fr;
+  ReaderBuff rb;
+  /* NULL once the shard has no more lines */
+  const char *Line;
+  uint32_t Size;
+  uint32_t EolSize;
+  /* Sorted offsets of lines to leave out, the rest of them */
+  const tf_int_t *Drop;
+  uint32_t DropCount;
+};
+
+/* Tell if the current line of a shard is one to leave out */
+static bool IsDroppedLine(ShardLine *Shard)
+{
+  tf_int_t LineStart = Shard->rb.Offset + Shard->rb.LineOffset;
+
+  while (Shard->DropCount > 0 && *Shard->Drop < LineStart)
+  {
+    Shard->Drop++;
+    Shard->DropCount--;
+  }
+  return Shard->DropCount > 0 && *Shard->Drop == LineStart;
+}
+
+/* Move to the next line of a shard, empty and dropped lines are skipped */
+static TL_ERR NextShardLine(ShardLine *Shard)
+{
+  TL_ERR err;
+
+  for (err = Shard->rb.FindNextFullLine(true);
+    !err && (Shard->rb.LineSize == 0 || IsDroppedLine(Shard));
+    err = Shard->rb.FindNextFullLine(true));
+
+  if (err)
+  {
+    Shard->Line = NULL;
+    return err;
+  }
+  Shard->Line = (const char *)Shard->rb.Buff + Shard->rb.LineOffset;
+  Shard->Size = Shard->rb.LineSize;
+  Shard->EolSize = Shard->rb.NextLineOffset - Shard->rb.LineOffset -
+    Shard->rb.LineSize;
+  return TL_ERR_OK;
+}
+
+/* Order of the shards in the merge heap. Equal lines are taken by shard
+ * order so the output does not depend on the heap */
+static bool ShardBefore(const ShardLine *Shards, uint32_t s1, uint32_t s2,
+  bool NoCase)
+{
+  int res = CompareLines(Shards[s1].Line, Shards[s1].Size, Shards[s2].Line,
+    Shards[s2].Size, NoCase);
+  return res < 0 || (res == 0 && s1 < s2);
+}
+
+static void SiftDown(const ShardLine *Shards, uint32_t *Heap, uint32_t Count,
+  uint32_t i, bool NoCase)
+{
+  for (;;)
+  {
+    uint32_t Min = i;
+    uint32_t l = 2 * i + 1;
+    uint32_t r = l + 1;
+    uint32_t Tmp;
+
+    if (l < Count && ShardBefore(Shards, Heap[l], Heap[Min], NoCase))
+      Min = l;
+    if (r < Count && ShardBefore(Shards, Heap[r], Heap[Min], NoCase))
+      Min = r;
+    if (Min == i)
+      return;
+    Tmp = Heap[i];
+    Heap[i] = Heap[Min];
+    Heap[Min] = Tmp;
+    i = Min;
+  }
+}
+
+/* Read the pseudo tags at the head of each shard. They are written sorted
+ * and each one once, the shards of one ctags run repeat most of them */
+static TL_ERR MergePseudoTags(ShardLine *Shards, uint32_t ShardCount,
+  MergeOutput *Out, bool *out_NoCase, char *Eol, uint32_t *EolSize)
+{
+  TL_ERR err = TL_ERR_OK;
+  std::string Data;
+  NewTagLine *Lines = NULL;
+  uint32_t Count = 0;
+  uint32_t i, Start;
+
+  for (i = 0; i < ShardCount; i++)
+  {
+    ShardLine *Shard = &Shards[i];
+    bool Unsorted = false;
+    bool NoCase = false;
+
+    err = NextShardLine(Shard);
+    for (; !err && IsPseudoTag(Shard->Line, Shard->Size);
+      err = NextShardLine(Shard))
+    {
+      TestSortedFlag(Shard->Line, Shard->Size, &Unsorted, &NoCase);
+      Data.append(Shard->Line, Shard->Size);
+      Data += '\n';
+      Count++;
+    }
+    if (err != TL_ERR_OK && err != TL_ERR_NO_MORE)
+      return err;
+    if (Unsorted || (i > 0 && NoCase != *out_NoCase))
+      return TL_ERR_SORT;
+    *out_NoCase = NoCase;
+
+    /* New lines use the EOL of the first shard */
+    if (*EolSize == 0 && Shard->Line != NULL && Shard->EolSize > 0)
+    {
+      ::memcpy(Eol, Shard->Line + Shard->Size, Shard->EolSize);
+      *EolSize = Shard->EolSize;
+    }
+  }
+  if (*EolSize == 0)
+  {
+    Eol[0] = '\n';
+    *EolSize = 1;
+  }
+  if (Count == 0)
+    return TL_ERR_OK;
+
+  Lines = (NewTagLine *)::malloc(Count * sizeof(NewTagLine));
+  if (Lines == NULL)
+    return TL_ERR_MEM_ALLOC;
+  for (i = Start = 0; Start < Data.size(); i++)
+  {
+    Lines[i].Line = Data.c_str() + Start;
+    Lines[i].Size = (uint32_t)(Data.find('\n', Start) - Start);
+    Start += Lines[i].Size + 1;
+  }
+  ::qsort(Lines, Count, sizeof(*Lines), CompareNewLines);
+
+  for (i = 0; !err && i < Count; i++)
+  {
+    if (i > 0 && CompareNewLines(&Lines[i - 1], &Lines[i]) == 0)
+      continue;
+    err = WriteLine(Out, Lines[i].Line, Lines[i].Size, Eol, *EolSize);
+  }
+  ::free(Lines);
+  return err;
+}
+
+/* k-way merge of the tag lines of the shards, with a heap of the shards by
+ * their current line */
+static TL_ERR MergeShards(ShardLine *Shards, uint32_t ShardCount,
+  MergeOutput *Out)
+{
+  TL_ERR err;
+  uint32_t *Heap;
+  uint32_t Count = 0;
+  uint32_t i;
+  bool NoCase = false;
+  char Eol[2];
+  uint32_t EolSize = 0;
+
+  for (i = 0; i < ShardCount; i++)
+  {
+    err = Shards[i].rb.InitSequential(Shards[i].fr, 0, UPDATE_WINDOW_SIZE,
+      FR_ACCESS_ONCE);
+    if (err)
+      return err;
+  }
+  err = MergePseudoTags(Shards, ShardCount, Out, &NoCase, Eol, &EolSize);
+  if (err)
+    return err;
+
+  Heap = (uint32_t *)::malloc(ShardCount * sizeof(uint32_t));
+  if (Heap == NULL)
+    return TL_ERR_MEM_ALLOC;
+  for (i = 0; i < ShardCount; i++)
+  {
+    if (Shards[i].Line != NULL)
+      Heap[Count++] = i;
+  }
+  for (i = Count / 2; i-- > 0;)
+    SiftDown(Shards, Heap, Count, i, NoCase);
+
+  while (Count > 0)
+  {
+    ShardLine *Shard = &Shards[Heap[0]];
+
+    err = WriteLine(Out, Shard->Line, Shard->Size, Shard->Line + Shard->Size,
+      Shard->EolSize);
+    if (!err)
+      err = NextShardLine(Shard);
+    if (err == TL_ERR_NO_MORE)
+    {
+      Heap[0] = Heap[--Count];
+      err = TL_ERR_OK;
+    }
+    if (err)
+      break;
+    SiftDown(Shards, Heap, Count, 0, NoCase);
+  }
+  ::free(Heap);
+  return err;
+}
+
+TL_ERR TagLEET::MergeTagsFiles(const char *const *ShardPaths,
+  uint32_t ShardCount, const char *TagsFilePath, TagFileIndex *Index,
+  const tf_int_t *DropOffsets, uint32_t DropCount)
+{
+  TL_ERR err = TL_ERR_OK;
+  ShardLine *Shards;
+  MergeOutput Out;
+  TagFileIndex NewIndex;
+  uint32_t i;
+  std::string TmpPath(TagsFilePath);
+
+  if (ShardCount == 0)
+    return TL_ERR_INVALID;
+
+  TmpPath += TAG_UPDATE_EXT;
+  Shards = new ShardLine[ShardCount];
+  for (i = 0; i < ShardCount; i++)
+  {
+    Shards[i].fr = FileReader::FileReaderCreate();
+    Shards[i].Line = NULL;
+    Shards[i].Drop = i == 0 ? DropOffsets : NULL;
+    Shards[i].DropCount = i == 0 ? DropCount : 0;
+  }
+  for (i = 0; !err && i < ShardCount; i++)
+  {
+    err = Shards[i].fr == NULL ? TL_ERR_MEM_ALLOC :
+      Shards[i].fr->Open(ShardPaths[i]);
+  }
+
+  Out.fw = FileWriter::FileWriterCreate();
+  Out.Offset = 0;
+  Out.Index = Index != NULL ? &NewIndex : NULL;
+  if (!err && Out.fw == NULL)
+    err = TL_ERR_MEM_ALLOC;
+  if (!err)
+    err = Out.fw->Create(TmpPath.c_str());
+  if (!err)
+    err = MergeShards(Shards, ShardCount, &Out);
+  if (!err)
+    err = Out.fw->Flush();
+  if (Out.fw != NULL)
+  {
+    Out.fw->Close();
+    delete Out.fw;
+  }
+  /* The buffers of a shard are freed to its reader */
+  for (i = 0; i < ShardCount; i++)
+  {
+    Shards[i].rb.Release();
+    if (Shards[i].fr != NULL)
+      delete Shards[i].fr;
+  }
+  delete [] Shards;
+
+  if (!err)
+    err = FileWriter::RenameFile(TmpPath.c_str(), TagsFilePath);
+  if (err)
+  {
+    FileWriter::RemoveFile(TmpPath.c_str());
+    return err;
+  }
+
+  if (Index != NULL)
+    FinishIndex(TagsFilePath, &NewIndex, Index);
+  return TL_ERR_OK;
+}
+
+struct SizedFile
+{
+  uint64_t Size;
+  uint32_t File;
+};
+
+/* Largest first, equal sizes by file order */
+static int CompareSizedFiles(const void *p1, const void *p2)
+{
+  const SizedFile *f1 = (const SizedFile *)p1;
+  const SizedFile *f2 = (const SizedFile *)p2;
+
+  if (f1->Size != f2->Size)
+    return f1->Size > f2->Size ? -1 : 1;
+  return f1->File < f2->File ? -1 : f1->File > f2->File ? 1 : 0;
+}
+
+TL_ERR TagLEET::PartitionBySize(const uint64_t *Sizes, uint32_t Count,
+  uint32_t ShardCount, uint32_t *out_Shard)
+{
+  SizedFile *Files;
+  uint64_t *Loads;
+  uint32_t i, j, Min;
+
+  if (ShardCount == 0)
+    return TL_ERR_INVALID;
+
+  Files = (SizedFile *)::malloc((Count + 1) * sizeof(SizedFile));
+  Loads = (uint64_t *)::malloc(ShardCount * sizeof(uint64_t));
+  if (Files == NULL || Loads == NULL)
+  {
+    ::free(Files);
+    ::free(Loads);
+    return TL_ERR_MEM_ALLOC;
+  }
+
+  for (i = 0; i < Count; i++)
+  {
+    Files[i].Size = Sizes[i];
+    Files[i].File = i;
+  }
+  ::qsort(Files, Count, sizeof(*Files), CompareSizedFiles);
+  ::memset(Loads, 0, ShardCount * sizeof(uint64_t));
+
+  for (i = 0; i < Count; i++)
+  {
+    for (j = 1, Min = 0; j < ShardCount; j++)
+    {
+      if (Loads[j] < Loads[Min])
+        Min = j;
+    }
+    out_Shard[Files[i].File] = Min;
+    Loads[Min] += Files[i].Size;
+  }
+  ::free(Files);
+  ::free(Loads);
+  return TL_ERR_OK;
+}
@@ -0,0 +1,76 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TAG_UPDATE_H_
+#define _TAG_UPDATE_H_
+
+#include "tl_types.h"
+#include <stddef.h>
+
+namespace TagLEET {
+
+class TagFileIndex;
+
+/* The updated tags file is written next to it with this extension and then
+ * renamed over it */
+#define TAG_UPDATE_EXT ".tlu"
+/* A tags file made for one source file is read to memory, it is never big */
+#define TAG_UPDATE_MAX_NEW_SIZE (64*1024*1024)
+
+/* Replace the tags of one source file in a sorted tags file.
+ * NewTagsPath is a tags file that ctags made for just that source file.
+ * SrcFileName is the name of the source file as written in the tags file,
+ * its lines are dropped and the lines of NewTagsPath are merged in their
+ * sorted place. The tags file is replaced only once the new one is fully
+ * written. An unsorted tags file fails with TL_ERR_SORT.
+ * Index, if given, is the file index of the tags file. When it is of the
+ * current version of the tags file it tells which lines to drop, and either
+ * way it is replaced with the index of the updated file */
+TL_ERR UpdateTagsOfSrcFile(const char *TagsFilePath, const char *SrcFileName,
+  const char *NewTagsPath, TagFileIndex *Index = NULL);
+
+/* The same with the new tags in memory, as ctags wrote them to its standard
+ * output. They need not be sorted */
+TL_ERR UpdateTagsOfSrcFileData(const char *TagsFilePath,
+  const char *SrcFileName, const char *NewData, uint32_t NewSize,
+  TagFileIndex *Index = NULL);
+
+/* Merge sorted tags files, that ctags made for disjoint parts of a source
+ * tree, into one sorted tags file at TagsFilePath. The pseudo tags of all
+ * the shards are written once each, ahead of the tags. All the shards must
+ * be sorted the same way, otherwise it fails with TL_ERR_SORT. The tags file
+ * is replaced only once the new one is fully written.
+ * Index, if given, is replaced with the file index of the new tags file.
+ * DropOffsets are sorted offsets of lines of the first shard to leave out,
+ * so the first shard may be the current tags file with the tags of changed
+ * source files dropped, and the other shards their new tags */
+TL_ERR MergeTagsFiles(const char *const *ShardPaths, uint32_t ShardCount,
+  const char *TagsFilePath, TagFileIndex *Index = NULL,
+  const tf_int_t *DropOffsets = NULL, uint32_t DropCount = 0);
+
+/* Split Count files to ShardCount shards of about the same total size. The
+ * largest files are placed first, each in the shard that is least loaded.
+ * out_Shard[i] is set to the shard of file i */
+TL_ERR PartitionBySize(const uint64_t *Sizes, uint32_t Count,
+  uint32_t ShardCount, uint32_t *out_Shard);
+
+} /* namespace TagLEET */
+
+#endif /* _TAG_UPDATE_H_ */
@@ -0,0 +1,49 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TL_SIMD_H_
+#define _TL_SIMD_H_
+
+#include <stdint.h>
+
+/* SSE2 is part of every x64 CPU. 32 bit builds use it only if the compiler
+ * was told so */
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TL_USE_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/* Index of the lowest set bit of a movemask result, Mask must not be 0 */
+static inline uint32_t lowest_bit_index(uint32_t Mask)
+{
+#ifdef _MSC_VER
+  unsigned long Index;
+  _BitScanForward(&Index, Mask);
+  return (uint32_t)Index;
+#else
+  return (uint32_t)__builtin_ctz(Mask);
+#endif
+}
+#endif
+
+#endif /* _TL_SIMD_H_ */
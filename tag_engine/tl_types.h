@@ -45,8 +45,13 @@ typedef enum {
   TL_ERR_FILE_NOT_OPEN,
   TL_ERR_LINE_TOO_BIG,
   TL_ERR_BUFF_TOO_SHORT,
+  TL_ERR_CANCELED,
 } TL_ERR;
 
+/* Asked by long operations every so often. Returning true stops them and
+ * they fail with TL_ERR_CANCELED */
+typedef bool (*TL_CANCEL_CB)(void *Ctx);
+
 } /* namespace TagLEET */
 
 #ifndef IN
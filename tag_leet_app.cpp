@@ -25,6 +25,8 @@
 #include <tchar.h>
 #include <stdio.h>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <shlobj.h>
 #include <shellapi.h>
 
@@ -38,6 +40,24 @@
 #define DEFAULT_WAIT_TIME_MSEC 10000
 #define DEFAULT_PRE_LINES 2
 #define DEFAULT_POST_LINES 9
+#define MAX_AUTOCOMPLETE_TAGS 200
+#define COMPLETION_INDEX_EXT ".tlc"
+#define CTAGS_EXTRAS "--extras=+Ffq"
+#define CTAGS_FIELDS "--fields=+Kn"
+#define CTAGS_ARGS " " CTAGS_EXTRAS " " CTAGS_FIELDS " "
+/* ctags writes a whole new tags file here, it is then renamed over the tags
+ * file so a lookup never reads a tags file that is half written */
+#define NEW_TAGS_EXT ".tln"
+/* Full re-index runs ctags on shards of the tree, each with a list of its
+ * files and a tags file that are merged into the tags file */
+#define SHARD_TAGS_EXT ".tls"
+#define SHARD_LIST_EXT ".tll"
+/* Shards of fewer files are not worth another ctags process */
+#define SHARD_MIN_FILES 32
+/* Saves of a project are indexed together once none came for this time */
+#define INDEX_DEBOUNCE_MSEC 500
+/* More saved files than this are indexed by a re-index of the tree */
+#define INDEX_MAX_FILE_UPDATES 8
 
 using namespace TagLEET_NPP;
 
@@ -155,16 +175,8 @@ static int __stdcall BrowseCallbackProc(HWND hwnd, UINT uMsg, LPARAM, LPARAM pDa
   return 0;
 }
 
-DWORD WINAPI ShExecCtags(LPVOID lpParam)
-{
-  LPSHELLEXECUTEINFOA lpShExecInfo;
-  lpShExecInfo = (LPSHELLEXECUTEINFOA)lpParam;
-
-  ShellExecuteExA(lpShExecInfo);
-  return 0;
-}
-
-void CreateTagsDb(HWND NppHndl, NppCallContext *NppC, char *TagsFilePath)
+/* ctags.exe is in the plugin directory */
+static std::string GetCtagsPath(NppCallContext *NppC)
 {
   char moduleFileName[MAX_PATH];
   GetModuleFileNameA((HMODULE)NppC->App->GetInstance(), moduleFileName, MAX_PATH);
@@ -173,57 +185,820 @@ void CreateTagsDb(HWND NppHndl, NppCallContext *NppC, char *TagsFilePath)
   size_t lastindex = strModuleFileName.find_last_of(".");
   strModuleFileName = strModuleFileName.substr(0, lastindex);
   strModuleFileName += "\\ctags.exe";
-  std::string strArgs = " --extras=+Ffq --fields=+Kn ";
-  if (g_RecurseDirs)
-      strArgs += " -R ";
+  return strModuleFileName;
+}
+
+/* Don't let the filter of the old file answer for the new one, source files
+ * that were missing may exist now */
+static void InvalidateTagsFile(const char *TagsFile)
+{
+  TagFilterRegistry::Global()->Invalidate(TagsFile);
+  SrcPathCache::Global()->Invalidate(TagsFile);
+}
+
+/* A LowPriority ctags runs for indexing in the background */
+static HANDLE StartCtags(const std::string &CtagsPath, const char *Dir,
+  const std::string &Args, bool LowPriority = false)
+{
+  SHELLEXECUTEINFOA ShExecInfo;
+
+  ::memset(&ShExecInfo, 0, sizeof(ShExecInfo));
+  ShExecInfo.cbSize = sizeof(ShExecInfo);
+  ShExecInfo.fMask = SEE_MASK_NOCLOSEPROCESS;
+  ShExecInfo.lpFile = CtagsPath.c_str();
+  ShExecInfo.lpParameters = Args.c_str();
+  ShExecInfo.lpDirectory = Dir;
+  ShExecInfo.nShow = SW_HIDE;
+  if (!::ShellExecuteExA(&ShExecInfo))
+    return NULL;
+  if (LowPriority && ShExecInfo.hProcess != NULL)
+    ::SetPriorityClass(ShExecInfo.hProcess, BELOW_NORMAL_PRIORITY_CLASS);
+  return ShExecInfo.hProcess;
+}
+
+/* Wait for ctags processes and close them. A cancelled job stops them */
+static TL_ERR WaitCtags(HANDLE *Procs, uint32_t Count, const IndexJob *Job)
+{
+  TL_ERR err = TL_ERR_OK;
+  DWORD ExitCode;
+  uint32_t i;
+
+  while (Count > 0 &&
+    ::WaitForMultipleObjects(Count, Procs, TRUE, PR_POLL_MSEC) == WAIT_TIMEOUT)
+  {
+    if (err != TL_ERR_CANCELED && Job != NULL && Job->IsCanceled())
+    {
+      for (i = 0; i < Count; i++)
+        ::TerminateProcess(Procs[i], 1);
+      err = TL_ERR_CANCELED;
+    }
+  }
+  for (i = 0; i < Count; i++)
+  {
+    if (!err && (!::GetExitCodeProcess(Procs[i], &ExitCode) || ExitCode != 0))
+      err = TL_ERR_GENERAL;
+    ::CloseHandle(Procs[i]);
+  }
+  return err;
+}
+
+/* Run ctags in a tags directory to make a new tags file and publish it by
+ * renaming it over the tags file */
+static TL_ERR RunCtagsNewTags(const std::string &CtagsPath,
+  const std::string &TagsDir, const std::string &Args, const IndexJob *Job)
+{
+  std::string TagsFile = TagsDir + "\\tags";
+  std::string NewTagsFile = TagsFile + NEW_TAGS_EXT;
+  HANDLE hProcess;
+  TL_ERR err;
+
+  hProcess = StartCtags(CtagsPath, TagsDir.c_str(),
+    CTAGS_ARGS "-f \"tags" NEW_TAGS_EXT "\" " + Args, Job != NULL);
+  err = hProcess != NULL ? WaitCtags(&hProcess, 1, Job) : TL_ERR_GENERAL;
+  if (!err)
+    err = FileWriter::RenameFile(NewTagsFile.c_str(), TagsFile.c_str());
+  if (err)
+    ::remove(NewTagsFile.c_str());
+  InvalidateTagsFile(TagsFile.c_str());
+  return err;
+}
+
+/* List the files under a directory, with their path relative to the tags
+ * directory as ctags -R names them, their size and time. Directories that
+ * start with '.' and the tags file with its side files are skipped */
+static void ListSrcFiles(const std::string &TagsDir, const std::string &RelDir,
+  std::vector<std::string> *Files, std::vector<uint64_t> *Sizes,
+  std::vector<uint64_t> *ModTimes)
+{
+  WIN32_FIND_DATAA FindData;
+  std::string Pattern = TagsDir;
+  HANDLE hFind;
+
+  if (!RelDir.empty())
+    Pattern += "\\" + RelDir;
+  Pattern += "\\*";
+  hFind = ::FindFirstFileA(Pattern.c_str(), &FindData);
+  if (hFind == INVALID_HANDLE_VALUE)
+    return;
+
+  do
+  {
+    const char *Name = FindData.cFileName;
+    std::string RelPath = RelDir.empty() ? Name : RelDir + "\\" + Name;
+
+    if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+      if (Name[0] != '.' &&
+        !(FindData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+      {
+        ListSrcFiles(TagsDir, RelPath, Files, Sizes, ModTimes);
+      }
+      continue;
+    }
+    if (RelDir.empty() && ::_strnicmp(Name, "tags", 4) == 0 &&
+      (Name[4] == '\0' || Name[4] == '.'))
+    {
+      continue;
+    }
+    Files->push_back(RelPath);
+    Sizes->push_back((uint64_t)FindData.nFileSizeHigh << 32 |
+      FindData.nFileSizeLow);
+    ModTimes->push_back(
+      (uint64_t)FindData.ftLastWriteTime.dwHighDateTime << 32 |
+      FindData.ftLastWriteTime.dwLowDateTime);
+  } while (::FindNextFileA(hFind, &FindData));
+  ::FindClose(hFind);
+}
+
+/* Run ctags on shards of Files at once and merge their outputs into the
+ * tags file. With Drops, the tags file is merged too, without the lines at
+ * those sorted offsets, so only the tags of Files are made again */
+static TL_ERR RunCtagsShards(const std::string &CtagsPath,
+  const std::string &TagsDir, const std::string &TagsFile,
+  const std::vector<std::string> &Files, const std::vector<uint64_t> &Sizes,
+  uint32_t ShardCount, const IndexJob *Job,
+  const std::vector<tf_int_t> *Drops = NULL)
+{
+  std::vector<uint32_t> FileShard(Files.size());
+  std::vector<std::string> ShardTags(ShardCount);
+  std::vector<std::string> ShardLists(ShardCount);
+  std::vector<const char *> ShardPaths;
+  HANDLE Procs[MAXIMUM_WAIT_OBJECTS];
+  uint32_t i, Started = 0;
+  TL_ERR err = TL_ERR_OK;
+  TL_ERR WaitErr;
+
+  if (Drops != NULL)
+    ShardPaths.push_back(TagsFile.c_str());
+  if (ShardCount > 0 && !Files.empty())
+  {
+    err = PartitionBySize(&Sizes[0], (uint32_t)Sizes.size(), ShardCount,
+      &FileShard[0]);
+  }
+  for (i = 0; !err && i < ShardCount; i++)
+  {
+    FileWriter *fw = FileWriter::FileWriterCreate();
+    size_t f;
+
+    ShardTags[i] = TagsFile + SHARD_TAGS_EXT + std::to_string(i);
+    ShardLists[i] = TagsFile + SHARD_LIST_EXT + std::to_string(i);
+    ShardPaths.push_back(ShardTags[i].c_str());
+    err = fw == NULL ? TL_ERR_MEM_ALLOC : fw->Create(ShardLists[i].c_str());
+    for (f = 0; !err && f < Files.size(); f++)
+    {
+      if (FileShard[f] != i)
+        continue;
+      err = fw->Write(Files[f].c_str(), (uint32_t)Files[f].size());
+      if (!err)
+        err = fw->Write("\n", 1);
+    }
+    if (!err)
+      err = fw->Flush();
+    if (fw != NULL)
+    {
+      fw->Close();
+      delete fw;
+    }
+  }
+
+  for (i = 0; !err && i < ShardCount; i++)
+  {
+    std::string Args = CTAGS_ARGS;
+    Args += "-f \"" + ShardTags[i] + "\" -L \"" + ShardLists[i] + "\"";
+    Procs[i] = StartCtags(CtagsPath, TagsDir.c_str(), Args, Job != NULL);
+    if (Procs[i] == NULL)
+      err = TL_ERR_GENERAL;
+    else
+      Started++;
+  }
+  WaitErr = WaitCtags(Procs, Started, Job);
+  if (!err)
+    err = WaitErr;
+
+  if (!err)
+  {
+    std::string IndexPath(TagsFile);
+    IndexPath += TAG_FILE_INDEX_EXT;
+    TagFileIndex Index;
+
+    err = MergeTagsFiles(&ShardPaths[0], (uint32_t)ShardPaths.size(),
+      TagsFile.c_str(), &Index,
+      Drops != NULL && !Drops->empty() ? &(*Drops)[0] : NULL,
+      Drops != NULL ? (uint32_t)Drops->size() : 0);
+    if (!err && Index.Save(IndexPath.c_str()) != TL_ERR_OK)
+      ::remove(IndexPath.c_str());
+  }
+  for (i = 0; i < ShardCount; i++)
+  {
+    if (ShardLists[i].empty())
+      break;
+    ::remove(ShardLists[i].c_str());
+    ::remove(ShardTags[i].c_str());
+  }
+  return err;
+}
+
+/* A tags file made on request, as a task of the index queue. Without Args
+ * the whole tree is indexed, otherwise ctags runs with them. The task and
+ * the request that waits for it each hold a reference */
+struct CtagsJob
+{
+  std::string CtagsPath;
+  std::string TagsDir;
+  std::string Args;
+  HANDLE DoneEvent;
+  TL_ERR Err;
+  LONG RefCount;
+};
+
+static void ReleaseCtagsJob(CtagsJob *Job)
+{
+  if (::InterlockedDecrement(&Job->RefCount) != 0)
+    return;
+  ::CloseHandle(Job->DoneEvent);
+  delete Job;
+}
+
+/* Number of ctags shards for Count files, one per core */
+static uint32_t GetShardCount(size_t Count)
+{
+  SYSTEM_INFO SysInfo;
+  uint32_t ShardCount;
+
+  ::GetSystemInfo(&SysInfo);
+  ShardCount = SysInfo.dwNumberOfProcessors;
+  if (ShardCount > MAXIMUM_WAIT_OBJECTS)
+    ShardCount = MAXIMUM_WAIT_OBJECTS;
+  if (ShardCount > Count / SHARD_MIN_FILES)
+    ShardCount = (uint32_t)(Count / SHARD_MIN_FILES);
+  return ShardCount;
+}
+
+/* Make the manifest of the listed files. A file whose size and time are as
+ * in OldManifest keeps its hash, the others are hashed on all cores. The
+ * files whose content is not in OldManifest are added to Changed */
+static TL_ERR HashSrcFiles(const std::string &TagsDir,
+  const std::vector<std::string> &Files, const std::vector<uint64_t> &Sizes,
+  const std::vector<uint64_t> &ModTimes, const TagManifest &OldManifest,
+  TagManifest *Manifest, std::vector<uint32_t> *Changed)
+{
+  std::vector<uint32_t> ToHash;
+  std::vector<std::string> Paths;
+  std::vector<const char *> PathPtrs;
+  uint64_t *Hashes;
+  bool *Ok;
+  SYSTEM_INFO SysInfo;
+  uint32_t i, Entry;
+  TL_ERR err = TL_ERR_OK;
+
+  for (i = 0; i < Files.size(); i++)
+  {
+    if (OldManifest.Find(Files[i].c_str(), &Entry) &&
+      OldManifest.GetSize(Entry) == Sizes[i] &&
+      OldManifest.GetModTime(Entry) == ModTimes[i])
+    {
+      err = Manifest->Set(Files[i].c_str(), Sizes[i], ModTimes[i],
+        OldManifest.GetHash(Entry));
+      if (err)
+        return err;
+      continue;
+    }
+    ToHash.push_back(i);
+    Paths.push_back(TagsDir + "\\" + Files[i]);
+  }
+  if (ToHash.empty())
+    return TL_ERR_OK;
+
+  for (i = 0; i < Paths.size(); i++)
+    PathPtrs.push_back(Paths[i].c_str());
+  Hashes = (uint64_t *)::malloc(ToHash.size() * sizeof(uint64_t));
+  Ok = (bool *)::malloc(ToHash.size() * sizeof(bool));
+  if (Hashes == NULL || Ok == NULL)
+  {
+    ::free(Hashes);
+    ::free(Ok);
+    return TL_ERR_MEM_ALLOC;
+  }
+  ::GetSystemInfo(&SysInfo);
+  HashFiles(&PathPtrs[0], (uint32_t)PathPtrs.size(),
+    SysInfo.dwNumberOfProcessors, Hashes, Ok);
+
+  /* A file that could not be read is always parsed again */
+  for (i = 0; !err && i < ToHash.size(); i++)
+  {
+    uint32_t f = ToHash[i];
+
+    if (!Ok[i] || !OldManifest.Find(Files[f].c_str(), &Entry) ||
+      OldManifest.GetSize(Entry) != Sizes[f] ||
+      OldManifest.GetHash(Entry) != Hashes[i])
+    {
+      Changed->push_back(f);
+    }
+    err = Manifest->Set(Files[f].c_str(), Sizes[f], ModTimes[f], Hashes[i]);
+  }
+  ::free(Hashes);
+  ::free(Ok);
+  return err;
+}
+
+/* Get the file index of a tags file, from its file next to the tags file or
+ * built with a scan of the tags file */
+static TL_ERR LoadFileIndex(const char *TagsFile, TagFileIndex *Index)
+{
+  std::string IndexPath(TagsFile);
+  TagFile tf;
+  TL_ERR err;
+
+  IndexPath += TAG_FILE_INDEX_EXT;
+  if (Index->Load(IndexPath.c_str(), TagsFile) == TL_ERR_OK)
+    return TL_ERR_OK;
+  err = tf.Init(TagsFile);
+  if (!err)
+    err = Index->Build(&tf, TagsFile);
+  if (!err && Index->Save(IndexPath.c_str()) != TL_ERR_OK)
+    ::remove(IndexPath.c_str());
+  return err;
+}
+
+/* Make the tags of only the changed files again. The tags of the files that
+ * changed or are gone are dropped from the tags file, found by the file
+ * index, and the rest of it is merged with the new tags of the changed files
+ * as one more shard */
+static TL_ERR ReindexChanged(const std::string &CtagsPath,
+  const std::string &TagsDir, const std::string &TagsFile,
+  const std::vector<std::string> &Files, const std::vector<uint64_t> &Sizes,
+  const std::vector<uint32_t> &Changed, const TagManifest &OldManifest,
+  const TagManifest &Manifest, const IndexJob *Job)
+{
+  std::vector<std::string> ChangedFiles;
+  std::vector<uint64_t> ChangedSizes;
+  std::vector<tf_int_t> Drops;
+  TagFileIndex Index;
+  const tf_int_t *Offsets;
+  uint32_t i, File, Entry, Count, ShardCount;
+  TL_ERR err;
+
+  err = LoadFileIndex(TagsFile.c_str(), &Index);
+  if (err)
+    return err;
+
+  for (i = 0; i < Changed.size(); i++)
+  {
+    ChangedFiles.push_back(Files[Changed[i]]);
+    ChangedSizes.push_back(Sizes[Changed[i]]);
+    if (!Index.FindFile(Files[Changed[i]].c_str(), &File))
+      continue;
+    Count = Index.GetFileTags(File, &Offsets);
+    Drops.insert(Drops.end(), Offsets, Offsets + Count);
+  }
+  for (i = 0; i < OldManifest.GetCount(); i++)
+  {
+    if (Manifest.Find(OldManifest.GetName(i), &Entry) ||
+      !Index.FindFile(OldManifest.GetName(i), &File))
+    {
+      continue;
+    }
+    Count = Index.GetFileTags(File, &Offsets);
+    Drops.insert(Drops.end(), Offsets, Offsets + Count);
+  }
+  if (ChangedFiles.empty() && Drops.empty())
+    return TL_ERR_OK;
+  std::sort(Drops.begin(), Drops.end());
+
+  ShardCount = GetShardCount(ChangedFiles.size());
+  if (ShardCount == 0 && !ChangedFiles.empty())
+    ShardCount = 1;
+  return RunCtagsShards(CtagsPath, TagsDir, TagsFile, ChangedFiles,
+    ChangedSizes, ShardCount, Job, &Drops);
+}
+
+/* Cancel callback of the engine for the task of an indexing job */
+static bool IsJobCanceled(void *Ctx)
+{
+  return ((const IndexJob *)Ctx)->IsCanceled();
+}
+
+/* Bring the reference index of a re-indexed tree up to date and save it
+ * for the new tags file. If Refs was valid for the old tags file only the
+ * changed files and the files that are gone are tokenized again, otherwise
+ * all the files are. An index that was not saved, also when the Job was
+ * cancelled, is removed */
+static TL_ERR ReindexRefs(const std::string &TagsDir,
+  const std::string &TagsFile, const std::vector<std::string> &Files,
+  const std::vector<uint32_t> &Changed, const TagManifest &Manifest,
+  bool Incremental, ReferenceIndex *Refs, const IndexJob *Job)
+{
+  std::string RefsPath = TagsFile + REF_INDEX_EXT;
+  std::vector<std::string> Names;
+  std::vector<std::string> Paths;
+  std::vector<const char *> NamePtrs;
+  std::vector<const char *> PathPtrs;
+  SYSTEM_INFO SysInfo;
+  uint32_t i, Entry;
+  TL_ERR err = TL_ERR_OK;
+
+  if (Incremental)
+  {
+    for (i = 0; i < Changed.size(); i++)
+      Names.push_back(Files[Changed[i]]);
+    for (i = 0; i < Refs->GetFileCount(); i++)
+    {
+      if (!Manifest.Find(Refs->GetFileName(i), &Entry))
+        Names.push_back(Refs->GetFileName(i));
+    }
+  }
+  else
+  {
+    Refs->Reset();
+    Names = Files;
+  }
+  for (i = 0; i < Names.size(); i++)
+    Paths.push_back(TagsDir + "\\" + Names[i]);
+  for (i = 0; i < Names.size(); i++)
+  {
+    NamePtrs.push_back(Names[i].c_str());
+    PathPtrs.push_back(Paths[i].c_str());
+  }
+
+  ::GetSystemInfo(&SysInfo);
+  if (!Names.empty())
+  {
+    err = Refs->Update(&NamePtrs[0], &PathPtrs[0], (uint32_t)Names.size(),
+      SysInfo.dwNumberOfProcessors, Job != NULL ? IsJobCanceled : NULL,
+      (void *)Job);
+  }
+  if (!err)
+    err = Refs->Save(RefsPath.c_str(), TagsFile.c_str());
+  if (err)
+    ::remove(RefsPath.c_str());
+  return err;
+}
+
+/* Index the tree of a tags directory. The files are split to shards of
+ * about the same size, one per core, ctags runs on all of them at once and
+ * their sorted outputs are merged into the tags file. A small tree is left
+ * to a single ctags -R. With an indexing Job, ctags runs at low priority and
+ * stops when the job is cancelled.
+ * The manifest next to the tags file has the size, time and content hash
+ * of each file. While it is valid only the files whose content changed are
+ * parsed again, touching a file or switching to a branch with the same
+ * content does not re-parse it. The reference index is kept up to date the
+ * same way */
+static TL_ERR ReindexTree(const std::string &CtagsPath,
+  const std::string &TagsDir, const IndexJob *Job)
+{
+  std::string TagsFile = TagsDir + "\\tags";
+  std::string ManifestPath = TagsFile + TAG_MANIFEST_EXT;
+  std::string RefsPath = TagsFile + REF_INDEX_EXT;
+  std::vector<std::string> Files;
+  std::vector<uint64_t> Sizes;
+  std::vector<uint64_t> ModTimes;
+  std::vector<uint32_t> Changed;
+  TagManifest OldManifest;
+  TagManifest Manifest;
+  ReferenceIndex Refs;
+  uint32_t ShardCount;
+  TL_ERR err, HashErr;
+  bool Incremental, HasRefs;
+
+  ListSrcFiles(TagsDir, "", &Files, &Sizes, &ModTimes);
+  Incremental = OldManifest.Load(ManifestPath.c_str(),
+    TagsFile.c_str()) == TL_ERR_OK;
+  HasRefs = Refs.Load(RefsPath.c_str(), TagsFile.c_str()) == TL_ERR_OK;
+  /* The files are hashed as they are before ctags reads them, a file saved
+   * meanwhile is hashed again by the next re-index */
+  HashErr = HashSrcFiles(TagsDir, Files, Sizes, ModTimes, OldManifest,
+    &Manifest, &Changed);
+
+  err = TL_ERR_GENERAL;
+  if (Incremental && !HashErr)
+    err = ReindexChanged(CtagsPath, TagsDir, TagsFile, Files, Sizes, Changed,
+      OldManifest, Manifest, Job);
+
+  if (err != TL_ERR_OK && err != TL_ERR_CANCELED)
+  {
+    ShardCount = GetShardCount(Files.size());
+    if (ShardCount >= 2)
+    {
+      err = RunCtagsShards(CtagsPath, TagsDir, TagsFile, Files, Sizes,
+        ShardCount, Job);
+    }
+    else
+    {
+      err = RunCtagsNewTags(CtagsPath, TagsDir, "-R", Job);
+    }
+  }
+
+  /* The manifest is stamped with the new tags file, a failed run leaves the
+   * old one that is valid only while the old tags file is there */
+  if (!err && !HashErr &&
+    Manifest.Save(ManifestPath.c_str(), TagsFile.c_str()) != TL_ERR_OK)
+  {
+    ::remove(ManifestPath.c_str());
+  }
+  if (!err && !HashErr)
+  {
+    ReindexRefs(TagsDir, TagsFile, Files, Changed, Manifest, HasRefs, &Refs,
+      Job);
+  }
+  InvalidateTagsFile(TagsFile.c_str());
+  return err;
+}
+
+/* Task of the index queue that makes the tags file of a CtagsJob. Like the
+ * updates on save it runs on the indexing thread, so they never write the
+ * tags file together, and it stops when the queue is shut down */
+static TL_ERR BuildTagsDb(void *Ctx, IndexJob *IqJob)
+{
+  CtagsJob *Job = (CtagsJob *)Ctx;
+  TL_ERR err;
+
+  if (Job->Args.empty())
+    err = ReindexTree(Job->CtagsPath, Job->TagsDir, IqJob);
   else
+    err = RunCtagsNewTags(Job->CtagsPath, Job->TagsDir, Job->Args, IqJob);
+  Job->Err = err;
+  ::SetEvent(Job->DoneEvent);
+  ReleaseCtagsJob(Job);
+  return err;
+}
+
+/* The tags file is made in the background, either of the whole tree or of
+ * the current file. If it takes longer than the wait time it goes on after
+ * this returns. The tags file is replaced only once the new one is done */
+void CreateTagsDb(HWND NppHndl, NppCallContext *NppC, char *TagsFilePath)
+{
+  CtagsJob *Job = new CtagsJob;
+  TL_ERR err = TL_ERR_OK;
+
+  Job->CtagsPath = GetCtagsPath(NppC);
+  Job->TagsDir = TagsFilePath;
+  if (!g_RecurseDirs)
   {
     TCHAR path[MAX_PATH];
     ::SendMessage(NppHndl, NPPM_GETFULLCURRENTPATH, MAX_PATH, (LPARAM)path);
-    strArgs += ws2s(path);
+    Job->Args = "\"" + ws2s(path) + "\"";
+  }
+  std::string errMsg = Job->CtagsPath + " " +
+    (Job->Args.empty() ? std::string("-R") : Job->Args);
+
+  Job->Err = TL_ERR_GENERAL;
+  Job->RefCount = 2;
+  Job->DoneEvent = ::CreateEvent(NULL, TRUE, FALSE, NULL);
+  if (Job->DoneEvent == NULL)
+  {
+    delete Job;
+    err = TL_ERR_GENERAL;
+  }
+  else if (!IndexQueue::Global()->Post((Job->TagsDir + "\\tags").c_str(),
+    BuildTagsDb, Job))
+  {
+    /* The tags file is already being made */
+    ::CloseHandle(Job->DoneEvent);
+    delete Job;
+  }
+  else
+  {
+    if (::WaitForSingleObject(Job->DoneEvent, g_WaitTimeMsec) == WAIT_OBJECT_0)
+      err = Job->Err;
+    ReleaseCtagsJob(Job);
+  }
+  if (err && err != TL_ERR_CANCELED)
+  {
+    errMsg += "\n\n in directory\n\n";
+    errMsg += TagsFilePath;
+    MessageBoxA(NULL, errMsg.c_str(), "Cannot generate ctags database", MB_OK | MB_ICONEXCLAMATION);
+  }
+}
+
+/* Set the entry of a source file in the manifest of a tags file that was
+ * just updated with its tags, and save it for the new tags file. A manifest
+ * that cannot be kept right is removed */
+static void UpdateManifestOfFile(TagManifest *Manifest,
+  const char *ManifestPath, const char *TagsFile, const char *SrcFile,
+  const char *RelName)
+{
+  tf_int_t Size;
+  uint64_t ModTime, Hash;
+  TL_ERR err;
+
+  err = FileReader::GetFileInfo(SrcFile, &Size, &ModTime);
+  if (!err)
+    err = HashFile(SrcFile, &Hash);
+  if (!err)
+    err = Manifest->Set(RelName, Size, ModTime, Hash);
+  if (!err)
+    err = Manifest->Save(ManifestPath, TagsFile);
+  if (err)
+    ::remove(ManifestPath);
+}
+
+/* Tokenize again a source file in the reference index of a tags file that
+ * was just updated with its tags, and save it for the new tags file. An
+ * index that cannot be kept right is removed */
+static void UpdateRefsOfFile(ReferenceIndex *Refs, const char *RefsPath,
+  const char *TagsFile, const char *SrcFile, const char *RelName)
+{
+  TL_ERR err;
+
+  err = Refs->Update(&RelName, &SrcFile, 1, 1);
+  if (!err)
+    err = Refs->Save(RefsPath, TagsFile);
+  if (err)
+    ::remove(RefsPath);
+}
+
+struct CtagsRun
+{
+  ULONGLONG Deadline;
+  const IndexJob *Job;
+};
+
+/* Progress of a ctags run, it is stopped once the wait time passed or its
+ * job is cancelled */
+static bool CtagsInTime(void *Ctx, uint32_t)
+{
+  const CtagsRun *Run = (const CtagsRun *)Ctx;
+  return !Run->Job->IsCanceled() && ::GetTickCount64() < Run->Deadline;
+}
+
+/* The name of SrcFile as written in the tags file of TagsDir, that is its
+ * path relative to TagsDir. NULL if the file is not under TagsDir */
+static const char *GetSrcFileName(const char *SrcFile, const char *TagsDir)
+{
+  size_t n = ::strlen(TagsDir);
+
+  if (::_strnicmp(SrcFile, TagsDir, n) != 0 ||
+    (SrcFile[n] != '\\' && SrcFile[n] != '/') || SrcFile[n + 1] == '\0')
+  {
+    return NULL;
   }
+  return SrcFile + n + 1;
+}
 
-  DWORD err, errw = 0;
-  LPSHELLEXECUTEINFOA lpShExecInfo;
-  lpShExecInfo = (LPSHELLEXECUTEINFOA) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(SHELLEXECUTEINFOA));
+/* Update the tags of one saved source file instead of running ctags on the
+ * whole tree. Tags, if given, are the tags that the built-in extractor
+ * found in the file. Otherwise ctags runs on just that file, with its path
+ * relative to the tags directory so it is named as in the tags file. Its
+ * output is read from a pipe. The tags are merged into the tags file,
+ * without a tags file of their own. The file index of the tags file is
+ * updated with it. Fails if the file is not under the tags directory or
+ * ctags did not finish in time */
+static TL_ERR UpdateTagsOfFile(const std::string &CtagsPath,
+  const char *SrcFile, const char *TagsDir, const char *TagsFile,
+  const std::string *Tags, const IndexJob *Job)
+{
+  const char *SrcFileName = GetSrcFileName(SrcFile, TagsDir);
+  ProcessRunner *Ctags;
+  CtagsRun Run;
+  char *NewData = NULL;
+  uint32_t NewSize = 0;
+  TL_ERR err = TL_ERR_OK;
 
-  lpShExecInfo->cbSize = sizeof(SHELLEXECUTEINFO);
-  lpShExecInfo->fMask = SEE_MASK_NOCLOSEPROCESS;
-  lpShExecInfo->hwnd = NULL;
-  lpShExecInfo->lpVerb = NULL;
-  lpShExecInfo->lpFile = strModuleFileName.c_str();
-  lpShExecInfo->lpParameters = strArgs.c_str();
-  lpShExecInfo->lpDirectory = TagsFilePath;
-  lpShExecInfo->nShow = SW_HIDE;
-  lpShExecInfo->hInstApp = NULL;
+  if (SrcFileName == NULL)
+    return TL_ERR_INVALID;
 
-  // std::string errMsg = " ";
-  // errMsg += lpShExecInfo.lpFile;
-  // errMsg += " ";
-  // errMsg += lpShExecInfo.lpParameters;
-  // errMsg += "\n\n in directory\n\n";
-  // errMsg += lpShExecInfo.lpDirectory;
-  // MessageBoxA(NULL, errMsg.c_str(), "Ready to generate ctags database", MB_OK | MB_ICONEXCLAMATION);
+  if (Tags == NULL)
+  {
+    /* The tags are sorted while they are merged */
+    const char *Args[] = {CtagsPath.c_str(), CTAGS_EXTRAS, CTAGS_FIELDS,
+      "--sort=no", "-f", "-", SrcFileName, NULL};
+
+    Ctags = ProcessRunner::ProcessRunnerCreate();
+    if (Ctags == NULL)
+      return TL_ERR_MEM_ALLOC;
+    Run.Deadline = ::GetTickCount64() + g_WaitTimeMsec;
+    Run.Job = Job;
+    err = Ctags->Start(Args, TagsDir, true);
+    if (!err)
+      err = Ctags->ReadAll(TAG_UPDATE_MAX_NEW_SIZE, CtagsInTime, &Run,
+        &NewData, &NewSize);
+    delete Ctags;
+    /* Out of time is a failure, only a newer change cancels the job */
+    if (err == TL_ERR_CANCELED && !Job->IsCanceled())
+      err = TL_ERR_GENERAL;
+  }
 
-  HANDLE hThread = CreateThread(NULL, 0, ShExecCtags, lpShExecInfo, 0, NULL);
-  errw = WaitForSingleObject(hThread, g_WaitTimeMsec);
-  CloseHandle(hThread);
+  /* The file index tells which lines to drop, the update writes the index
+   * of the new tags file */
+  std::string IndexPath(TagsFile);
+  IndexPath += TAG_FILE_INDEX_EXT;
+  TagFileIndex Index;
+  Index.Load(IndexPath.c_str(), TagsFile);
+  /* The manifest of the old tags file, if valid, goes on with the new one */
+  std::string ManifestPath(TagsFile);
+  ManifestPath += TAG_MANIFEST_EXT;
+  TagManifest Manifest;
+  bool HasManifest = Manifest.Load(ManifestPath.c_str(), TagsFile) ==
+    TL_ERR_OK;
+  /* And so does the reference index */
+  std::string RefsPath(TagsFile);
+  RefsPath += REF_INDEX_EXT;
+  ReferenceIndex Refs;
+  bool HasRefs = Refs.Load(RefsPath.c_str(), TagsFile) == TL_ERR_OK;
+
+  if (!err && Tags != NULL)
+    err = UpdateTagsOfSrcFileData(TagsFile, SrcFileName, Tags->data(),
+      (uint32_t)Tags->size(), &Index);
+  else if (!err)
+    err = UpdateTagsOfSrcFileData(TagsFile, SrcFileName, NewData, NewSize,
+      &Index);
+  ::free(NewData);
+  if (!err)
+  {
+    InvalidateTagsFile(TagsFile);
+    if (Index.Save(IndexPath.c_str()) != TL_ERR_OK)
+      ::remove(IndexPath.c_str());
+    if (HasManifest)
+      UpdateManifestOfFile(&Manifest, ManifestPath.c_str(), TagsFile, SrcFile,
+        SrcFileName);
+    if (HasRefs)
+      UpdateRefsOfFile(&Refs, RefsPath.c_str(), TagsFile, SrcFile,
+        SrcFileName);
+  }
+  return err;
+}
 
-  HeapFree(GetProcessHeap(), 0, lpShExecInfo);
+/* Extract the tags of the saved C and C++ files of Job with the built-in
+ * extractor, on all cores. out_Tags[i] is set to the tags of file i and
+ * out_Ok[i] tells if it has them, the other files are left to ctags */
+static void ExtractSavedFiles(const IndexJob *Job, const char *TagsDir,
+  std::vector<std::string> *out_Tags, std::vector<bool> *out_Ok)
+{
+  uint32_t i, Count = Job->GetFileCount();
+  std::vector<uint32_t> ToExtract;
+  std::vector<const char *> Paths, SrcFileNames;
+  const char *SrcFileName;
+  SYSTEM_INFO SysInfo;
+
+  out_Tags->assign(Count, std::string());
+  out_Ok->assign(Count, false);
+  for (i = 0; i < Count; i++)
+  {
+    SrcFileName = GetSrcFileName(Job->GetFileName(i), TagsDir);
+    if (SrcFileName == NULL || !IsExtractSupported(SrcFileName))
+      continue;
+    ToExtract.push_back(i);
+    Paths.push_back(Job->GetFileName(i));
+    SrcFileNames.push_back(SrcFileName);
+  }
+  if (ToExtract.empty())
+    return;
 
-  GetExitCodeProcess(lpShExecInfo->hProcess, &err);
-  if ( err != 0 && err != STILL_ACTIVE )
+  std::vector<std::string> Tags(ToExtract.size());
+  std::vector<TL_ERR> Errs(ToExtract.size());
+  ::GetSystemInfo(&SysInfo);
+  ExtractTagsOfFiles(&Paths[0], &SrcFileNames[0], (uint32_t)ToExtract.size(),
+    SysInfo.dwNumberOfProcessors, &Tags[0], &Errs[0]);
+  for (i = 0; i < ToExtract.size(); i++)
   {
-      std::string errMsg = "[" + std::to_string(errw) + "] ";
-      errMsg += lpShExecInfo->lpFile;
-      errMsg += " ";
-      errMsg += lpShExecInfo->lpParameters;
-      errMsg += "\n\n in directory\n\n";
-      errMsg += lpShExecInfo->lpDirectory;
-      MessageBoxA(NULL, errMsg.c_str(), "Cannot generate ctags database", MB_OK | MB_ICONEXCLAMATION);
+    if (Errs[i] != TL_ERR_OK)
+      continue;
+    (*out_Tags)[ToExtract[i]].swap(Tags[i]);
+    (*out_Ok)[ToExtract[i]] = true;
   }
 }
 
+/* Index the files of a project that were saved, on the indexing thread.
+ * Ctx is the path of ctags. The tags of each file are updated in place,
+ * C and C++ files with the built-in extractor and other files with ctags.
+ * If that fails or many files were saved the tags file is made again: from
+ * the whole tree, or like before from just the saved files */
+static TL_ERR IndexSavedFiles(void *Ctx, IndexJob *Job)
+{
+  const std::string *CtagsPath = (const std::string *)Ctx;
+  const char *TagsFile = Job->GetTagsFilePath();
+  std::string TagsDir(TagsFile, ::strlen(TagsFile) - 5);
+  uint32_t i, Count = Job->GetFileCount();
+  TL_ERR err = TL_ERR_GENERAL;
+
+  ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+  if (Count <= INDEX_MAX_FILE_UPDATES)
+  {
+    std::vector<std::string> Tags;
+    std::vector<bool> HasTags;
+
+    ExtractSavedFiles(Job, TagsDir.c_str(), &Tags, &HasTags);
+    for (i = 0, err = TL_ERR_OK; !err && i < Count; i++)
+    {
+      err = UpdateTagsOfFile(*CtagsPath, Job->GetFileName(i), TagsDir.c_str(),
+        TagsFile, HasTags[i] ? &Tags[i] : NULL, Job);
+      if (!err)
+        Job->SetDone(i + 1);
+    }
+  }
+  if (err == TL_ERR_OK || err == TL_ERR_CANCELED)
+    return err;
+
+  if (g_RecurseDirs)
+    return ReindexTree(*CtagsPath, TagsDir, Job);
+
+  std::string Args;
+  for (i = 0; i < Count; i++)
+    Args += std::string(" \"") + Job->GetFileName(i) + "\"";
+  return RunCtagsNewTags(*CtagsPath, TagsDir, Args, Job);
+}
+
 void SetTagsFilePath(HWND NppHndl, NppCallContext *NppC, char *TagsFilePath)
 {
   TCHAR Msg[2048];
@@ -285,6 +1060,7 @@ TagLeetApp::TagLeetApp(const struct NppData *NppDataObj)
   Form = NULL;
   DestroyOnDetachForm = false;
   LastTagFile[0] = _T('\0');
+  CompIndexNext = 0;
 
   wndclass.style          = CS_HREDRAW|CS_VREDRAW;
   wndclass.lpfnWndProc    = TagLeetForm::InitialWndProc;
@@ -409,6 +1185,16 @@ void TagLeetApp::Shutdown()
   delete this;
 }
 
+/* Stop the background threads of the engine and wait for them to exit, so
+ * none runs once the plugin is unloaded. Called when Notepad++ shuts down,
+ * a thread can't be joined from DllMain */
+void TagLeetApp::StopWorkers()
+{
+  IndexQueue::Global()->Shutdown();
+  TagFilterRegistry::Global()->Shutdown();
+  FileReader::StopReadAhead();
+}
+
 void TagLeetApp::GetFormSize(unsigned int *Width, unsigned int *Height)
 {
   if (HeightWidthValid) {
@@ -702,6 +1488,8 @@ void TagLeetApp::LookupTag()
 
   if (Form != NULL)
   {
+    Form->setDoFindRefs(false);
+    Form->setDoListFileTags(false);
     Form->RefreshList(&TLCtx);
     return;
   }
@@ -841,6 +1629,8 @@ TL_ERR TagLeetApp::PopulateTagList(TagLookupContext *TLCtx)
   return TL_ERR_OK;
 }
 
+/* The saved file is queued for indexing, saves in a row are indexed
+ * together in the background. Nothing waits for the indexing */
 void TagLeetApp::UpdateTagDb()
 {
   if (!g_UpdateOnSave)
@@ -850,36 +1640,82 @@ void TagLeetApp::UpdateTagDb()
   TlAppSync Sync(this);
   NppCallContext NppC(this);
   char TagsFilePath[TL_MAX_PATH];
+  char SrcFile[TL_MAX_PATH];
+  static std::string *CtagsPath = new std::string(GetCtagsPath(&NppC));
 
   err = GetTagsFilePath(&NppC, TagsFilePath, sizeof(TagsFilePath));
+  Sync.Unlock();
   if (err)
     return;
 
-  char Path[TL_MAX_PATH + 16];
   int n = (int)::strlen(TagsFilePath);
-  ::memcpy(Path, TagsFilePath, n * sizeof(char));
 
-  if (Path[n-1] == 's' &&
-      Path[n-2] == 'g' &&
-      Path[n-3] == 'a' &&
-      Path[n-4] == 't' &&
-      Path[n-5] == '\\')
+  if (TagsFilePath[n-1] == 's' &&
+      TagsFilePath[n-2] == 'g' &&
+      TagsFilePath[n-3] == 'a' &&
+      TagsFilePath[n-4] == 't' &&
+      TagsFilePath[n-5] == '\\')
   {
-    Path[n-5] = '\0';
-    CreateTagsDb(NppHndl, &NppC, Path);
+    TSTR_to_str(NppC.Path, -1, SrcFile, sizeof(SrcFile));
+    IndexQueue::Global()->Submit(TagsFilePath, SrcFile, INDEX_DEBOUNCE_MSEC,
+      IndexSavedFiles, CtagsPath);
   }
 }
 
+/* List the references to the word at the cursor from the reference index
+ * of the tags file. Without one, as before a recursive index of the tree or
+ * while the index is being made, the Find in Files dialog is opened on the
+ * tags directory */
 void TagLeetApp::FindRefs()
 {
   TL_ERR err;
+  TlAppSync Sync(this);
   NppCallContext NppC(this);
   char TagsFilePath[TL_MAX_PATH];
+  TCHAR Msg[2048];
+  bool ValidWord;
+  int i;
 
   err = GetTagsFilePath(&NppC, TagsFilePath, sizeof(TagsFilePath));
   if (err)
     return;
 
+  TagLookupContext TLCtx(&NppC, TagsFilePath, g_GlobalTagsFile);
+
+  /* Test that word is valid */
+  ValidWord = TLCtx.TagLength > 0;
+  for (i = 0; ValidWord && i < TLCtx.TagLength; i++)
+  {
+    char ch = TLCtx.TextBuff[TLCtx.TagOffset + i];
+    if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
+      ValidWord = false;
+  }
+
+  if (ValidWord && GetReferenceIndex(TagsFilePath) != NULL)
+  {
+    if (Form != NULL)
+    {
+      Form->setDoFindRefs(true);
+      Form->setDoListFileTags(false);
+      Form->RefreshList(&TLCtx);
+      return;
+    }
+
+    Form = new TagLeetForm(&NppC);
+    if (Form == NULL)
+      return;
+
+    Form->setDoFindRefs(true);
+    err = Form->CreateWnd(&TLCtx);
+    if (!err)
+      return;
+
+    ::_sntprintf(Msg, ARRAY_SIZE(Msg), TEXT("unexpected error(%u)"),
+      (unsigned)err);
+    ::MessageBox(NppHndl, Msg, TEXT("TagLEET"), MB_ICONEXCLAMATION);
+    return;
+  }
+
   char Path[TL_MAX_PATH + 16];
   int n = (int)::strlen(TagsFilePath);
   ::memcpy(Path, TagsFilePath, n * sizeof(char));
@@ -900,20 +1736,307 @@ void TagLeetApp::FindRefs()
   }
 }
 
-void TagLeetApp::SciAutoComplete()
+/* List the tags of the current file from the file index of its tags file,
+ * in the order of the tags file */
+void TagLeetApp::ListFileTags()
 {
   TL_ERR err;
   TlAppSync Sync(this);
   NppCallContext NppC(this);
   char TagsFilePath[TL_MAX_PATH];
   TCHAR Msg[2048];
+
+  err = GetTagsFilePath(&NppC, TagsFilePath, sizeof(TagsFilePath));
+  if (err)
+    return;
+
+  TagLookupContext TLCtx(&NppC, TagsFilePath, g_GlobalTagsFile);
+
+  if (Form != NULL)
+  {
+    Form->setDoFindRefs(false);
+    Form->setDoListFileTags(true);
+    Form->RefreshList(&TLCtx);
+    return;
+  }
+
+  Form = new TagLeetForm(&NppC);
+  if (Form == NULL)
+    return;
+
+  Form->setDoListFileTags(true);
+  err = Form->CreateWnd(&TLCtx);
+  if (!err)
+    return;
+
+  ::_sntprintf(Msg, ARRAY_SIZE(Msg), TEXT("unexpected error(%u)"),
+    (unsigned)err);
+  ::MessageBox(NppHndl, Msg, TEXT("TagLEET"), MB_ICONEXCLAMATION);
+}
+
+/* Build the completion index of a tags file on the indexing thread and save
+ * it next to the tags file, where GetCompletionIndex loads it from */
+static TL_ERR BuildCompletionIndex(void * /* Ctx */, IndexJob *Job)
+{
+  TL_ERR err;
+  TagFile tf;
+  TagCompletionIndex Index;
+  std::string IndexPath(Job->GetTagsFilePath());
+
+  ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+  err = tf.Init(Job->GetTagsFilePath());
+  if (err)
+    return err;
+
+  IndexPath += COMPLETION_INDEX_EXT;
+  err = Index.Load(IndexPath.c_str(), &tf, Job->GetTagsFilePath());
+  if (!err)
+    return TL_ERR_OK;
+
+  err = Index.Build(&tf, Job->GetTagsFilePath(), IsJobCanceled, Job);
+  if (!err)
+    err = Index.Save(IndexPath.c_str());
+  if (err)
+    ::remove(IndexPath.c_str());
+  return err;
+}
+
+/* Get the completion index of a tags file. On first use the index is loaded
+ * from its file next to the tags file. If there is none it is built on the
+ * indexing thread and NULL is returned until it is ready */
+TagCompletionIndex *TagLeetApp::GetCompletionIndex(const char *TagsFilePath,
+  TagFile *tf)
+{
+  TL_ERR err;
+  TagCompletionIndex *Index;
+  std::string IndexPath(TagsFilePath);
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(CompIndex); i++)
+  {
+    const char *Path = CompIndex[i].GetTagsFilePath();
+    if (Path == NULL || ::strcmp(Path, TagsFilePath) != 0)
+      continue;
+    if (CompIndex[i].IsValidFor(TagsFilePath, tf))
+      return &CompIndex[i];
+    break;
+  }
+  if (i == ARRAY_SIZE(CompIndex))
+  {
+    i = CompIndexNext;
+    CompIndexNext = (CompIndexNext + 1) % ARRAY_SIZE(CompIndex);
+  }
+
+  Index = &CompIndex[i];
+  IndexPath += COMPLETION_INDEX_EXT;
+  err = Index->Load(IndexPath.c_str(), tf, TagsFilePath);
+  if (!err)
+    return Index;
+
+  IndexQueue::Global()->Post(TagsFilePath, BuildCompletionIndex, NULL);
+  return NULL;
+}
+
+/* Make the reference index of a tags file on the indexing thread from the
+ * source files in its manifest and save it next to the tags file, where
+ * GetReferenceIndex loads it from */
+static TL_ERR BuildReferenceIndex(void * /* Ctx */, IndexJob *Job)
+{
+  std::string TagsFile(Job->GetTagsFilePath());
+  std::string ManifestPath = TagsFile + TAG_MANIFEST_EXT;
+  std::string RefsPath = TagsFile + REF_INDEX_EXT;
+  std::string TagsDir;
+  std::vector<std::string> Files;
+  std::vector<uint32_t> Changed;
+  TagManifest Manifest;
+  ReferenceIndex Refs;
+  uint32_t i;
+
+  ::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+  if (Refs.Load(RefsPath.c_str(), TagsFile.c_str()) == TL_ERR_OK)
+    return TL_ERR_OK;
+  if (Manifest.Load(ManifestPath.c_str(), TagsFile.c_str()) != TL_ERR_OK ||
+    Manifest.GetCount() == 0)
+  {
+    return TL_ERR_NOT_EXIST;
+  }
+
+  /* Only the tags file of a tree has a manifest, it is named tags */
+  TagsDir.assign(TagsFile, 0, TagsFile.size() - 5);
+  for (i = 0; i < Manifest.GetCount(); i++)
+    Files.push_back(Manifest.GetName(i));
+  return ReindexRefs(TagsDir, TagsFile, Files, Changed, Manifest, false,
+    &Refs, Job);
+}
+
+/* Get the reference index of a tags file. On first use the index is loaded
+ * from its file next to the tags file. If there is none but the tags file
+ * has a manifest, the index is made on the indexing thread and NULL is
+ * returned until it is ready */
+ReferenceIndex *TagLeetApp::GetReferenceIndex(const char *TagsFilePath)
+{
+  std::string RefsPath(TagsFilePath);
+  std::string ManifestPath(TagsFilePath);
+
+  if (RefIndex.IsValidFor(TagsFilePath))
+    return &RefIndex;
+  RefsPath += REF_INDEX_EXT;
+  if (RefIndex.Load(RefsPath.c_str(), TagsFilePath) == TL_ERR_OK)
+    return &RefIndex;
+
+  ManifestPath += TAG_MANIFEST_EXT;
+  if (::GetFileAttributesA(ManifestPath.c_str()) != INVALID_FILE_ATTRIBUTES)
+    IndexQueue::Global()->Post(TagsFilePath, BuildReferenceIndex, NULL);
+  return NULL;
+}
+
+/* Get the file index of a tags file, kept while the tags file does not
+ * change. It is loaded from its file next to the tags file or built with a
+ * scan of the tags file */
+TagFileIndex *TagLeetApp::GetFileIndex(const char *TagsFilePath)
+{
+  TagFile tf;
+
+  if (tf.Init(TagsFilePath) == TL_ERR_OK &&
+    FileIndex.IsValidFor(TagsFilePath, &tf))
+  {
+    return &FileIndex;
+  }
+  return LoadFileIndex(TagsFilePath, &FileIndex) == TL_ERR_OK ?
+    &FileIndex : NULL;
+}
+
+/* Add to List, in Scintilla's autocomplete format, the distinct tags that
+ * start with Prefix. Return the number of tags that were added */
+int TagLeetApp::AppendDistinctTags(TagQuerySession *Session,
+  const char *TagsFilePath, const char *Prefix, const char *ImageId,
+  std::string *List)
+{
+  TL_ERR err;
+  TagFile *tf;
+  TagCompletionIndex *Index;
+  char TagBuff[TL_MAX_PATH];
+  tf_int_t Start, End;
+  int Count = 0;
+  int i;
+
+  err = Session->Init(TagsFilePath);
+  if (err)
+    return 0;
+
+  tf = Session->GetTagFile();
+  Index = GetCompletionIndex(TagsFilePath, tf);
+  if (Index != NULL)
+  {
+    const char *Names[MAX_AUTOCOMPLETE_TAGS];
+
+    Count = (int)Index->GetTopCompletions(Prefix, ARRAY_SIZE(Names), Names);
+    for (i = 0; i < Count; i++)
+    {
+      if (!List->empty())
+        *List += " ";
+      *List += Names[i];
+      *List += "?";
+      *List += ImageId;
+    }
+    Session->EndQuery();
+    return Count;
+  }
+
+  /* No index, enumerate the tags file itself. The session narrows the range
+   * of the prefix from the previous keystroke so a prefix without tags is
+   * found without a lookup of the whole file */
+  err = Session->Narrow(Prefix, &Start, &End);
+  if (!err)
+    err = Start < End ? TL_ERR_OK : TL_ERR_NO_MORE;
+  if (!err)
+    err = tf->NextDistinctTag(Prefix, TagBuff, sizeof(TagBuff), true);
+  while (!err && Count < MAX_AUTOCOMPLETE_TAGS && tf->HasPrefix(TagBuff, Prefix))
+  {
+    if (!List->empty())
+      *List += " ";
+    *List += TagBuff;
+    *List += "?";
+    *List += ImageId;
+    Count++;
+    err = tf->NextDistinctTag(TagBuff, TagBuff, sizeof(TagBuff));
+  }
+  Session->EndQuery();
+  return Count;
+}
+
+static bool IsDocWordChar(char ch)
+{
+  return ch >= 'A' && ch <= 'Z' || ch >= 'a' && ch <= 'z' ||
+    ch >= '0' && ch <= '9' || ch == '_';
+}
+
+/* Add to List, in Scintilla's autocomplete format, the distinct words of
+ * the current document that start with Prefix, ignoring case. The word at
+ * WordStart, that is being typed, is left out. Return the number of words
+ * that were added */
+static int AppendDocumentWords(NppCallContext *NppC, const char *Prefix,
+  int WordStart, std::string *List)
+{
+  std::vector<std::string> Words;
+  const char *Text;
+  size_t PrefixSize = ::strlen(Prefix);
+  int Length, Start, Pos;
+  int Count = 0;
+  size_t i;
+
+  Length = (int)NppC->SciMsg(SCI_GETLENGTH);
+  /* The text of the document, valid until it is modified */
+  Text = (const char *)NppC->SciMsg(SCI_GETCHARACTERPOINTER);
+  if (Text == NULL)
+    return 0;
+
+  for (Pos = 0; Pos < Length;)
+  {
+    if (!IsDocWordChar(Text[Pos]))
+    {
+      Pos++;
+      continue;
+    }
+    for (Start = Pos; Pos < Length && IsDocWordChar(Text[Pos]); Pos++);
+    if (Start == WordStart || (size_t)(Pos - Start) < PrefixSize ||
+      (Text[Start] >= '0' && Text[Start] <= '9') ||
+      ::_strnicmp(Text + Start, Prefix, PrefixSize) != 0)
+    {
+      continue;
+    }
+    Words.push_back(std::string(Text + Start, Pos - Start));
+  }
+
+  std::sort(Words.begin(), Words.end());
+  Words.erase(std::unique(Words.begin(), Words.end()), Words.end());
+  for (i = 0; i < Words.size() && Count < MAX_AUTOCOMPLETE_TAGS; i++)
+  {
+    if (!List->empty())
+      *List += " ";
+    *List += Words[i];
+    Count++;
+  }
+  return Count;
+}
+
+/* Complete the word at the cursor with the tags of the tags file, or of the
+ * global tags file if it has none. A file that no tags file covers, or a
+ * word that no tag starts with, is completed from the words of the
+ * document */
+void TagLeetApp::SciAutoComplete()
+{
+  TL_ERR err;
+  TlAppSync Sync(this);
+  NppCallContext NppC(this);
+  char TagsFilePath[TL_MAX_PATH];
   int i;
 
   FromLocalFile = true;
 
   err = GetTagsFilePath(&NppC, TagsFilePath, sizeof(TagsFilePath));
   if (err)
-    return;
+    TagsFilePath[0] = '\0';
 
   // if at start of word, just return
   int currpos = ( int )::SendMessage( NppC.SciHndl, SCI_GETCURRENTPOS, 0, 0 );
@@ -939,35 +2062,30 @@ void TagLeetApp::SciAutoComplete()
   }
 
   // Above same as LookupTag()
-  // Below implements the Form() part of LookupTag()
-  err = PopulateTagList(&TLCtx);
-  if (err)
-    return;
-
-  int Idx;
-  TagList::TagListItem *Item;
+  // Below lists the distinct tags with the word as prefix. The tags are taken
+  // directly from the tags file without building a TagList
+  char *Tag = TLCtx.TextBuff + TLCtx.TagOffset;
+  char SavedChar = Tag[TLCtx.TagLength];
   std::string wList;
-  std::string prevWord;
-  prevWord = "";
+  int Idx;
 
-  // We want prefix match, after all, this is autocomplete
-  DoPrefixMatch = true;
-  TLCtx.GetLineNumFromTag(DoPrefixMatch, &TList);
-  // Loop from SetListFromTag()
-  for (Item = TList.List, Idx=0; Item != NULL; Item = Item->Next, Idx++)
+  /* Ensure Tag is NULL terminated */
+  Tag[TLCtx.TagLength] = '\0';
+  Idx = 0;
+  if (TLCtx.TagsFilePath[0] != '\0')
   {
-    if ( prevWord.compare(Item->Tag) == 0 )
-        continue;
-    prevWord = Item->Tag;
-    wList += Item->Tag;
-    wList += "?";
-    if (FromLocalFile)
-        wList += STR(REGIMGIDL);
-    else
-        wList += STR(REGIMGIDG);
-    if (Item->Next != NULL)
-        wList += " ";
+    Idx = AppendDistinctTags(&AutoCSession[0], TLCtx.TagsFilePath, Tag,
+      STR(REGIMGIDL), &wList);
   }
+  if (Idx == 0 && TLCtx.GlobalTagsFilePath[0] != '\0')
+  {
+    FromLocalFile = false;
+    Idx = AppendDistinctTags(&AutoCSession[1], TLCtx.GlobalTagsFilePath, Tag,
+      STR(REGIMGIDG), &wList);
+  }
+  if (Idx == 0)
+    Idx = AppendDocumentWords(&NppC, Tag, wordStart, &wList);
+  Tag[TLCtx.TagLength] = SavedChar;
 
   // Must clear the selection that TagLookupContext did for us
   SendMessage( NppC.SciHndl, SCI_SETEMPTYSELECTION, currpos, 0 );
@@ -977,24 +2095,11 @@ void TagLeetApp::SciAutoComplete()
   SendMessage(NppC.SciHndl, SCI_AUTOCSETSEPARATOR, WPARAM(' '), 0 );
   SendMessage(NppC.SciHndl, SCI_AUTOCSETTYPESEPARATOR, WPARAM('?'), 0 );
   SendMessage(NppC.SciHndl, SCI_AUTOCSETIGNORECASE, true, 0 );
+  // Completions from the index are ordered by weight
+  SendMessage(NppC.SciHndl, SCI_AUTOCSETORDER, SC_ORDER_PERFORMSORT, 0 );
   SendMessage(NppC.SciHndl, SCI_REGISTERIMAGE, REGIMGIDL, (LPARAM)xpmTlL);
   SendMessage(NppC.SciHndl, SCI_REGISTERIMAGE, REGIMGIDG, (LPARAM)xpmTlG);
   SendMessage(NppC.SciHndl, SCI_AUTOCSHOW, TLCtx.TagLength, (LPARAM) wList.c_str());
-
-  if (!err)
-    return;
-
-  switch (err)
-  {
-    case TL_ERR_SORT:
-      ::_sntprintf(Msg, ARRAY_SIZE(Msg), TEXT("Unsorted tags file: %hs"), TagsFilePath);
-      break;
-    default:
-      ::_sntprintf(Msg, ARRAY_SIZE(Msg), TEXT("unexpected error(%u)"),
-        (unsigned)err);
-      break;
-  }
-  ::MessageBox(NppHndl, Msg, TEXT("TagLEET"), MB_ICONEXCLAMATION);
 }
 
 void TagLeetApp::AutoComplete()
@@ -1027,6 +2132,8 @@ void TagLeetApp::AutoComplete()
 
   if (Form != NULL)
   {
+    Form->setDoFindRefs(false);
+    Form->setDoListFileTags(false);
     Form->RefreshList(&TLCtx);
     return;
   }
@@ -1082,6 +2189,27 @@ void TagLeetApp::DeleteTags()
         LastTagFile[0] = _T('\0');
   }
   remove(TagsFilePath);
+
+  std::string IndexPath(TagsFilePath);
+  IndexPath += COMPLETION_INDEX_EXT;
+  remove(IndexPath.c_str());
+
+  std::string FilterPath(TagsFilePath);
+  FilterPath += TAG_FILTER_EXT;
+  remove(FilterPath.c_str());
+
+  std::string FileIndexPath(TagsFilePath);
+  FileIndexPath += TAG_FILE_INDEX_EXT;
+  remove(FileIndexPath.c_str());
+
+  std::string ManifestPath(TagsFilePath);
+  ManifestPath += TAG_MANIFEST_EXT;
+  remove(ManifestPath.c_str());
+
+  std::string RefsPath(TagsFilePath);
+  RefsPath += REF_INDEX_EXT;
+  remove(RefsPath.c_str());
+  TagFilterRegistry::Global()->Invalidate(TagsFilePath);
 }
 
 void TagLeetApp::ShowAbout() const
@@ -22,8 +22,19 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <string>
 #include "tag_engine/tl_types.h"
 #include "tag_engine/tag_list.h"
+#include "tag_engine/tag_complete.h"
+#include "tag_engine/tag_filter.h"
+#include "tag_engine/src_path_cache.h"
+#include "tag_engine/tag_update.h"
+#include "tag_engine/tag_file_index.h"
+#include "tag_engine/tag_manifest.h"
+#include "tag_engine/tag_extract.h"
+#include "tag_engine/ref_index.h"
+#include "tag_engine/process_runner.h"
+#include "tag_engine/index_queue.h"
 
 struct NppData;
 
@@ -113,6 +124,7 @@ public:
   void AutoComplete();
   void DeleteTags();
   void FindRefs();
+  void ListFileTags();
   void UpdateTagDb();
   void ShowSettings();
   void Lock();
@@ -127,7 +139,10 @@ public:
   int GetEditViewFontHeight() const { return EditViewFontHeight; }
   int GetStatusHeight() const { return StatusHeight; }
   void Shutdown();
+  void StopWorkers();
   TL_ERR GetTagsFilePath(NppCallContext *NppC, char *TagFileBuff, int BuffSize);
+  ReferenceIndex *GetReferenceIndex(const char *TagsFilePath);
+  TagFileIndex *GetFileIndex(const char *TagsFilePath);
 
   void SetFormSize(unsigned int Width, unsigned int Height, bool reset);
   void GetFormSize(unsigned int *Width, unsigned int *Height);
@@ -148,6 +163,10 @@ private:
   TL_ERR PopulateTagListHelperGlobal(TagLookupContext *TLCtx, TagFile *tf);
   TL_ERR PopulateTagListHelper(TagLookupContext *TLCtx, TagFile *tf);
   TL_ERR PopulateTagList(TagLookupContext *TLCtx);
+  TagCompletionIndex *GetCompletionIndex(const char *TagsFilePath,
+    TagFile *tf);
+  int AppendDistinctTags(TagQuerySession *Session, const char *TagsFilePath,
+    const char *Prefix, const char *ImageId, std::string *List);
 
   HFONT CreateSpecificFont(const TCHAR **FontList, int FontListSize,
     int Height);
@@ -157,6 +176,16 @@ private:
   TagList TList;
   bool DoPrefixMatch;
   bool FromLocalFile;
+  /* Completion indexes of the recently used tags files */
+  TagCompletionIndex CompIndex[2];
+  int CompIndexNext;
+  /* Query sessions of the local and global tags files for type-ahead */
+  TagQuerySession AutoCSession[2];
+  /* Reference index of the last tags file that references were found in */
+  ReferenceIndex RefIndex;
+  /* File index of the last tags file that the tags of a file were listed
+   * from */
+  TagFileIndex FileIndex;
 
   static HINSTANCE InstanceHndl;
   CRITICAL_SECTION CritSec;
@@ -215,10 +244,9 @@ public:
 
   TL_ERR MoveToFirstLine();
   TL_ERR MoveToNextLine();
+  TL_ERR MoveToLine(uint32_t LineNumber);
 
 private:
-  TL_ERR MoveToLine(int LineNum);
-
   NppCallContext NppC;
   TL_ERR InitErr;
   char LocalBuff[1024];
@@ -27,7 +27,6 @@
 #include <tchar.h>
 #include <commctrl.h>
 #include <malloc.h>
-#include <fstream>
 #include <richedit.h>
 
 #include "resource.h"
@@ -57,6 +56,8 @@ TagLeetForm::TagLeetForm(NppCallContext *NppC)
   EditHWnd = NULL;
   DoPrefixMatch = false;
   DoAutoComplete = false;
+  DoFindRefs = false;
+  DoListFileTags = false;
   UseGlobalTagsFile = false;
   ::memset(&BackLoc, 0, sizeof(BackLoc));
   BackLocBank = NppC->LocBank;
@@ -147,6 +148,8 @@ TL_ERR TagLeetForm::CreateWnd(TagLookupContext *TLCtx)
   std::wstring title = TEXT("TagLEET for Notepad++");
   if ( DoAutoComplete )
       title += TEXT(": Autocomplete");
+  else if ( DoListFileTags )
+      title += TEXT(": Tags of File");
   else
       title += TEXT(": Lookup Tag");
 
@@ -747,52 +750,59 @@ void TagLeetForm::UpdateEditView()
     // otherwise assume full file path/name
     strFileToOpen += Item->FileName;
 
-    // open the file for reading
-    std::ifstream file(strFileToOpen.c_str());
+    // open the file for reading, its line index is cached so the lines
+    // around the tag are read without scanning the file from the start
     std::string strFileContent;
-    std::string strTemp;
-    if (!file.is_open())
+    FileReader *fr = FileReader::FileReaderCreate();
+    LineIndex *Index = NULL;
+    TL_ERR err = fr == NULL ? TL_ERR_MEM_ALLOC : fr->Open(strFileToOpen.c_str());
+    if (!err)
+        err = LineIndexCache::Global()->Get(strFileToOpen.c_str(), fr, &Index);
+    if (err)
     {
+        delete fr;
         strFileContent += strFileToOpen.c_str();
         strFileContent += " NOT FOUND!";
         SetWindowTextA(EditHWnd, (LPCSTR)strFileContent.c_str());
         return;
     }
 
+    // PeekPre lines, THE LINE and PeekPost lines
     int discard = max( 0, (iLine - g_PeekPre) );
-    // throw away top lines
-    int i;
-    for (i = 1; i < discard; i++)
-    {
-        std::getline(file, strTemp);
-    }
-
-    // read PeekPre lines
-    i = 0;
-    while (i < g_PeekPre && std::getline(file, strTemp))
-    {
-        strFileContent += strTemp;
-        strFileContent += "\r\n";
-        i++;
-    }
-
-    // read THE LINE
-    i = 0;
-    while (i < 1 && std::getline(file, strTemp))
+    uint32_t First = discard > 0 ? discard - 1 : 0;
+    uint32_t Last = First + g_PeekPre + 1 + g_PeekPost;
+    if (Last > Index->GetLineCount())
+        Last = Index->GetLineCount();
+
+    tf_int_t RangeStart, LineStart;
+    uint32_t RangeSize, LineSize;
+    char *Buff = NULL;
+    if (First < Last &&
+        !Index->GetLineRange(First, &RangeStart, &RangeSize) &&
+        !Index->GetLineRange(Last - 1, &LineStart, &LineSize))
     {
-        strFileContent += strTemp;
-        strFileContent += "\r\n";
-        i++;
+        RangeSize = (uint32_t)(LineStart + LineSize - RangeStart);
+        Buff = (char *)::malloc(RangeSize);
+        if (Buff != NULL && fr->Read(RangeStart, Buff, RangeSize))
+        {
+            ::free(Buff);
+            Buff = NULL;
+        }
     }
 
-    // read PeekPost lines
-    i = 0;
-    while (i < g_PeekPost && std::getline(file, strTemp))
+    for (uint32_t i = First; Buff != NULL && i < Last; i++)
     {
-        strFileContent += strTemp;
+        Index->GetLineRange(i, &LineStart, &LineSize);
+        const char *Line = Buff + (LineStart - RangeStart);
+        while (LineSize > 0 && IS_EOL_CHAR(Line[LineSize - 1]))
+            LineSize--;
+        strFileContent.append(Line, LineSize);
         strFileContent += "\r\n";
-        i++;
     }
+    if (Buff != NULL)
+        ::free(Buff);
+    LineIndexCache::Global()->Release(Index);
+    delete fr;
 
     SetWindowTextA(EditHWnd, (LPCSTR)strFileContent.c_str());
 
@@ -1239,6 +1249,16 @@ void TagLeetForm::setDoAutoComplete()
   DoAutoComplete = true;
 }
 
+void TagLeetForm::setDoFindRefs(bool in_DoFindRefs)
+{
+  DoFindRefs = in_DoFindRefs;
+}
+
+void TagLeetForm::setDoListFileTags(bool in_DoListFileTags)
+{
+  DoListFileTags = in_DoListFileTags;
+}
+
 void TagLeetForm::RefreshList(TagLookupContext *TLCtx)
 {
   DoPrefixMatch = TList.TagsFilePath == NULL ||
@@ -1275,17 +1295,73 @@ TL_ERR TagLeetForm::PopulateTagListHelper(TagLookupContext *TLCtx, TagFile *tf)
   SavedChar = Tag[TLCtx->TagLength];
   /* Ensure Tag is NULL terminated */
   Tag[TLCtx->TagLength] = '\0';
-  err = TList.Create(Tag, TLCtx->TagsFilePath, tf, DoPrefixMatch);
+  if (DoPrefixMatch)
+  {
+    err = QuerySession.Init(TLCtx->TagsFilePath);
+    if (!err)
+      err = TList.Create(Tag, &QuerySession);
+  }
+  else
+  {
+    err = TList.Create(Tag, TLCtx->TagsFilePath, tf, DoPrefixMatch);
+  }
   Tag[TLCtx->TagLength] = SavedChar;
   return err;
 }
 
+/* List the references to the word, from the reference index of the tags
+ * file */
+TL_ERR TagLeetForm::PopulateRefList(TagLookupContext *TLCtx)
+{
+  TL_ERR err;
+  ReferenceIndex *Index;
+  char SavedChar;
+  char *Tag = TLCtx->TextBuff + TLCtx->TagOffset;
+
+  Index = App->GetReferenceIndex(TLCtx->TagsFilePath);
+  if (Index == NULL)
+    return TL_ERR_NOT_EXIST;
+
+  SavedChar = Tag[TLCtx->TagLength];
+  /* Ensure Tag is NULL terminated */
+  Tag[TLCtx->TagLength] = '\0';
+  err = TList.CreateForRefs(Tag, TLCtx->TagsFilePath, Index);
+  Tag[TLCtx->TagLength] = SavedChar;
+  return err;
+}
+
+/* List the tags of the current file, from the file index of the tags file.
+ * The file is named in the tags file by its path from the tags directory */
+TL_ERR TagLeetForm::PopulateFileTagList(TagLookupContext *TLCtx)
+{
+  TagFileIndex *Index;
+  char SrcFile[TL_MAX_PATH];
+  const char *Sep;
+  size_t n;
+
+  Index = App->GetFileIndex(TLCtx->TagsFilePath);
+  if (Index == NULL)
+    return TL_ERR_NOT_EXIST;
+
+  TSTR_to_str(TLCtx->NppC->Path, -1, SrcFile, sizeof(SrcFile));
+  Sep = ::strrchr(TLCtx->TagsFilePath, '\\');
+  n = Sep == NULL ? 0 : Sep - TLCtx->TagsFilePath + 1;
+  if (n == 0 || ::_strnicmp(SrcFile, TLCtx->TagsFilePath, n) != 0)
+    return TL_ERR_NOT_EXIST;
+  return TList.CreateForSrcFile(SrcFile + n, TLCtx->TagsFilePath, Index);
+}
+
 TL_ERR TagLeetForm::PopulateTagList(TagLookupContext *TLCtx)
 {
   TL_ERR err;
   TagFile tf;
   char *Tag;
 
+  if (DoFindRefs)
+    return PopulateRefList(TLCtx);
+  if (DoListFileTags)
+    return PopulateFileTagList(TLCtx);
+
   err = tf.Init(TLCtx->TagsFilePath);
   if (err)
     return err;
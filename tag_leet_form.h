@@ -45,6 +45,8 @@ public :
   void PostCloseMsg() const;
   void setDoPrefixMatch();
   void setDoAutoComplete();
+  void setDoFindRefs(bool in_DoFindRefs);
+  void setDoListFileTags(bool in_DoListFileTags);
 
 private:
   TL_ERR CreateListView(HWND hwnd);
@@ -58,6 +60,8 @@ private:
   TL_ERR PopulateTagListHelperGlobal(TagLookupContext *TLCtx, TagFile *tf);
   TL_ERR PopulateTagListHelper(TagLookupContext *TLCtx, TagFile *tf);
   TL_ERR PopulateTagList(TagLookupContext *TLCtx);
+  TL_ERR PopulateRefList(TagLookupContext *TLCtx);
+  TL_ERR PopulateFileTagList(TagLookupContext *TLCtx);
   void GoToSelectedTag();
   void DoSelectedAutoComplete();
   LRESULT WndProc( HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
@@ -91,9 +95,15 @@ private:
 
   TagLeetApp *App;
   TagList TList;
+  /* Keeps the prefix ranges between keystrokes in AutoComplete mode */
+  TagQuerySession QuerySession;
   UINT KindToIndex[TAG_KIND_LAST];
   bool DoPrefixMatch;
   bool DoAutoComplete;
+  /* The list has the references to the word instead of its tags */
+  bool DoFindRefs;
+  /* The list has the tags of the current file instead of those of the word */
+  bool DoListFileTags;
   bool UseGlobalTagsFile;
   uint8_t SortOrder[6];
   int LastMaxTagWidth;
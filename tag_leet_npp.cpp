@@ -35,6 +35,7 @@ HINSTANCE TagLeetApp::InstanceHndl = NULL;
 
 static void NppLookupTag();
 static void NppFindRefs();
+static void NppListFileTags();
 static void NppGoBack();
 static void NppGoForward();
 static void NppAutoComplete();
@@ -94,6 +95,7 @@ extern "C" __declspec(dllexport) FuncItem * getFuncsArray(int *nbF)
   static struct FuncItem TagLeetFuncs[] = {
     {_T("&Lookup Tag"),      NppLookupTag,    0, false, TagLeetShortcuts},
     {_T("Find &References"), NppFindRefs,     0, false, NULL},
+    {_T("Tags of &File"),    NppListFileTags, 0, false, NULL},
     {_T("&Back"),            NppGoBack,       0, false, TagLeetShortcuts + 1},
     {_T("&Forward"),         NppGoForward,    0, false, TagLeetShortcuts + 2},
     {_T("&Autocomplete"),    NppAutoComplete, 0, false, NULL},
@@ -114,6 +116,11 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notifyCode)
       if (TheApp != NULL)
         TheApp->UpdateTagDb();
       break;
+
+    case NPPN_SHUTDOWN:
+      if (TheApp != NULL)
+        TheApp->StopWorkers();
+      break;
  
     case SCN_CHARADDED:
       if (g_useSciAutoC)
@@ -145,6 +152,12 @@ static void NppFindRefs()
     TheApp->FindRefs();
 }
 
+static void NppListFileTags()
+{
+  if (TheApp != NULL)
+    TheApp->ListFileTags();
+}
+
 static void NppGoForward()
 {
   if (TheApp != NULL)
@@ -473,8 +486,11 @@ NppFileLineIterator::~NppFileLineIterator()
     ::free(LineBuff);
 }
 
-TL_ERR NppFileLineIterator::MoveToLine(int LineNum)
+/* Scintilla keeps the line index so any line is reached in constant time.
+ * Its lines start at 0, the lines of a LineIterator at 1 */
+TL_ERR NppFileLineIterator::MoveToLine(uint32_t LineNumber)
 {
+  int LineNum = (int)LineNumber - 1;
   int LineCount;
   int SciLineSize;
 
@@ -482,7 +498,7 @@ TL_ERR NppFileLineIterator::MoveToLine(int LineNum)
     return InitErr;
 
   LineCount = (int)NppC.SciMsg(SCI_GETLINECOUNT);
-  if (LineNum > LineCount)
+  if (LineNum < 0 || LineNum >= LineCount)
     return TL_ERR_NOT_EXIST;
 
   SciLineSize = (int)NppC.SciMsg(SCI_GETLINE, LineNum);
@@ -511,7 +527,7 @@ TL_ERR NppFileLineIterator::MoveToLine(int LineNum)
     Line = NULL;
     LineSize = 0;
   }
-  CurrLineNum = LineNum;
+  CurrLineNum = (int)LineNumber;
   return TL_ERR_OK;
 }
 
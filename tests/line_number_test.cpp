@@ -0,0 +1,131 @@
+/*  Copyright 2013-2014, Gur Stavi, gur.stavi@gmail.com  */
+
+/*
+    This file is part of TagLEET.
+
+    TagLEET is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    TagLEET is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with TagLEET.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/* The line of a tag must not depend on how it was found. For a tag on the
+ * first line of its source file and for a tag further down, the search
+ * around the ctags line: hint, the scan of the whole file and the batch
+ * resolver of the list must all give the same line.
+ * Built as a console program from this file and the sources of tag_engine,
+ * leaving out the *_lin.cpp or *_win.cpp files of the other OS. Run it in a
+ * writable directory, it exits with 0 when all the checks pass */
+
+#include "../tag_engine/tag_list.h"
+#include "../tag_engine/file_reader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace TagLEET;
+
+static const char SrcText[] =
+  "int first(void) { return 1; }\n"
+  "\n"
+  "int second(void)\n"
+  "{\n"
+  "  return 2;\n"
+  "}\n";
+
+/* Tags files with and without the line: hint, only the hint makes the
+ * search start at the line */
+static const char HintTags[] =
+  "first\tlnt_src.c\t/^int first(void) { return 1; }$/;\"\tf\tline:1\n"
+  "second\tlnt_src.c\t/^int second(void)$/;\"\tf\tline:3\n";
+static const char ScanTags[] =
+  "first\tlnt_src.c\t/^int first(void) { return 1; }$/;\"\tf\n"
+  "second\tlnt_src.c\t/^int second(void)$/;\"\tf\n";
+
+static int Failures = 0;
+
+static bool WriteFile(const char *FileName, const char *Text)
+{
+  FILE *f = ::fopen(FileName, "wb");
+  bool Ok;
+
+  if (f == NULL)
+    return false;
+  Ok = ::fwrite(Text, 1, ::strlen(Text), f) == ::strlen(Text);
+  return ::fclose(f) == 0 && Ok;
+}
+
+static void Check(const char *What, const char *Tag, TL_ERR err,
+  uint32_t LineNumber, uint32_t Expected)
+{
+  if (err == TL_ERR_OK && LineNumber == Expected)
+    return;
+  ::printf("FAIL %s %s: err %d line %u, expected line %u\n", What, Tag,
+    (int)err, LineNumber, Expected);
+  Failures++;
+}
+
+/* Lines are reported from 0, like the lines of Scintilla */
+static void CheckTag(const char *TagsFile, const char *Tag, uint32_t Expected)
+{
+  TL_ERR err;
+  TagList tl;
+  FileReader *fr;
+  char SrcPath[1024];
+  uint32_t LineNumber = 0;
+  uint32_t Batch[1];
+
+  err = tl.Create(Tag, TagsFile);
+  if (!err && tl.Count != 1)
+    err = TL_ERR_NOT_EXIST;
+  if (err)
+  {
+    Check("create", Tag, err, 0, Expected);
+    return;
+  }
+
+  err = tl.FindAllLineNumbers(Batch, 1);
+  Check(TagsFile, Tag, err, Batch[0], Expected);
+
+  fr = FileReader::FileReaderCreate();
+  err = tl.OpenSrcFile(tl.List, fr, SrcPath, sizeof(SrcPath));
+  if (!err)
+  {
+    FileReaderLineIterator li(fr, SrcPath);
+    err = tl.FindLineNumberInFile(&li, tl.List, &LineNumber);
+  }
+  Check(TagsFile, Tag, err, LineNumber, Expected);
+  delete fr;
+}
+
+int main()
+{
+  if (!WriteFile("lnt_src.c", SrcText) ||
+    !WriteFile("lnt_hint_tags", HintTags) ||
+    !WriteFile("lnt_scan_tags", ScanTags))
+  {
+    ::printf("FAIL can't write the test files\n");
+    return 1;
+  }
+
+  CheckTag("./lnt_hint_tags", "first", 0);
+  CheckTag("./lnt_scan_tags", "first", 0);
+  CheckTag("./lnt_hint_tags", "second", 2);
+  CheckTag("./lnt_scan_tags", "second", 2);
+
+  ::remove("lnt_src.c");
+  ::remove("lnt_hint_tags");
+  ::remove("lnt_scan_tags");
+  if (Failures == 0)
+    ::printf("OK\n");
+  return Failures == 0 ? 0 : 1;
+}